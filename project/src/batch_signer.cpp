@@ -0,0 +1,162 @@
+// batch_signer.cpp
+#include "batch_signer.h"
+#include "logger.h"
+#include <algorithm>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+
+namespace {
+
+constexpr size_t digestSize = 32;
+
+uint64_t micros(std::chrono::steady_clock::duration duration) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+}
+
+void checkDigest(const std::vector<uint8_t>& digest) {
+    if (digest.size() != digestSize) {
+        throw std::invalid_argument("Digest must be a 32-byte SHA-256 hash");
+    }
+}
+
+std::vector<uint8_t> signRoot(TPMBackend& backend, const std::vector<uint8_t>& root) {
+    return backend.sign(std::string(root.begin(), root.end())).get();
+}
+
+} // namespace
+
+BatchSigner::BatchSigner(TPMBackend& backend, const BatchSignerConfig& config)
+    : backend(backend), config(config) {
+    if (this->config.maxBatchSize == 0) {
+        this->config.maxBatchSize = 1;
+    }
+    driver = std::thread(&BatchSigner::run, this);
+    logMessage("Batch signer started (window " + std::to_string(this->config.window.count()) + " us, up to " +
+               std::to_string(this->config.maxBatchSize) + " signatures per batch)", serverLogFile);
+}
+
+BatchSigner::~BatchSigner() {
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        stopping = true;
+    }
+    queueChanged.notify_all();
+    if (driver.joinable()) {
+        driver.join();
+    }
+}
+
+std::future<BatchSignature> BatchSigner::sign(const std::vector<uint8_t>& digest) {
+    checkDigest(digest);
+    Request request;
+    request.digest = digest;
+    request.queuedAt = std::chrono::steady_clock::now();
+    std::future<BatchSignature> result = request.result.get_future();
+    bool wake;
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        if (stopping) {
+            throw std::runtime_error("Batch signer is shutting down");
+        }
+        queue.push_back(std::move(request));
+        // The driver only waits for the first request of a batch or for it to fill up.
+        wake = queue.size() == 1 || queue.size() >= config.maxBatchSize;
+    }
+    ++requestCount;
+    if (wake) {
+        queueChanged.notify_one();
+    }
+    return result;
+}
+
+BatchSignature BatchSigner::signUnbatched(const std::vector<uint8_t>& digest) {
+    checkDigest(digest);
+    ++requestCount;
+    ++unbatchedCount;
+    BatchSignature result;
+    result.root = merkleLeafHash(digest);
+    result.treeSize = 1;
+    try {
+        result.signature = signRoot(backend, result.root);
+    } catch (...) {
+        ++failureCount;
+        throw;
+    }
+    return result;
+}
+
+void BatchSigner::run() {
+    std::unique_lock<std::mutex> lock(queueMutex);
+    for (;;) {
+        queueChanged.wait(lock, [&] { return stopping || !queue.empty(); });
+        if (queue.empty()) {
+            return;
+        }
+        // The window opens with the oldest waiting request, so a backlog that
+        // built up while the last batch was being signed goes out at once.
+        auto closesAt = queue.front().queuedAt + config.window;
+        queueChanged.wait_until(lock, closesAt, [&] { return stopping || queue.size() >= config.maxBatchSize; });
+
+        size_t take = std::min(queue.size(), config.maxBatchSize);
+        std::vector<Request> batch(std::make_move_iterator(queue.begin()), std::make_move_iterator(queue.begin() + take));
+        queue.erase(queue.begin(), queue.begin() + take);
+        lock.unlock();
+        signBatch(batch);
+        lock.lock();
+    }
+}
+
+void BatchSigner::signBatch(std::vector<Request>& batch) {
+    auto closedAt = std::chrono::steady_clock::now();
+    std::vector<std::vector<uint8_t>> digests;
+    digests.reserve(batch.size());
+    for (const auto& request : batch) {
+        batchWaitUs += micros(closedAt - request.queuedAt);
+        digests.push_back(request.digest);
+    }
+
+    std::vector<BatchSignature> results(batch.size());
+    try {
+        MerkleTree tree(digests);
+        std::vector<uint8_t> signature = signRoot(backend, tree.root());
+        for (size_t i = 0; i < batch.size(); ++i) {
+            results[i].signature = signature;
+            results[i].root = tree.root();
+            results[i].leafIndex = i;
+            results[i].treeSize = tree.size();
+            results[i].proof = tree.proof(i);
+        }
+    } catch (const std::exception &e) {
+        failureCount += batch.size();
+        logErrorMessage("Error signing batch of " + std::to_string(batch.size()) + ": " + e.what(), serverErrorLogFile);
+        for (auto& request : batch) {
+            request.result.set_exception(std::current_exception());
+        }
+        return;
+    }
+    signTimeUs += micros(std::chrono::steady_clock::now() - closedAt);
+    ++batchCount;
+    if (batch.size() > largestBatch.load()) {
+        largestBatch = batch.size();
+    }
+    for (size_t i = 0; i < batch.size(); ++i) {
+        batch[i].result.set_value(std::move(results[i]));
+    }
+}
+
+BatchSignerStats BatchSigner::stats() const {
+    BatchSignerStats stats;
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        stats.queueDepth = queue.size();
+    }
+    stats.requests = requestCount;
+    stats.batches = batchCount;
+    stats.unbatched = unbatchedCount;
+    stats.failures = failureCount;
+    stats.largestBatch = largestBatch;
+    stats.batchWaitUs = batchWaitUs;
+    stats.signTimeUs = signTimeUs;
+    return stats;
+}
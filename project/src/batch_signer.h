@@ -0,0 +1,82 @@
+// batch_signer.h
+#ifndef BATCH_SIGNER_H
+#define BATCH_SIGNER_H
+
+#include "merkle_tree.h"
+#include "tpm_backend.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct BatchSignerConfig {
+    std::chrono::microseconds window{2000};   // how long a batch stays open after its first request
+    size_t maxBatchSize = 256;                // a full batch is signed without waiting out the window
+};
+
+struct BatchSignerStats {
+    size_t queueDepth = 0;
+    uint64_t requests = 0;
+    uint64_t batches = 0;         // TPM signatures over a batch root
+    uint64_t unbatched = 0;       // requests signed on their own
+    uint64_t failures = 0;        // requests that got an error
+    size_t largestBatch = 0;
+    uint64_t batchWaitUs = 0;     // total time requests waited for their batch to close
+    uint64_t signTimeUs = 0;      // total time batch roots spent being signed
+};
+
+// Amortizes TPM signatures over many callers. Digests that arrive within one
+// window become the leaves of a Merkle tree and the TPM signs only its root;
+// each caller gets the root signature and the inclusion proof for its digest.
+// One batch is signed at a time, so requests that arrive while the TPM is busy
+// simply make the next batch larger.
+class BatchSigner {
+public:
+    BatchSigner(TPMBackend& backend, const BatchSignerConfig& config = BatchSignerConfig());
+    ~BatchSigner();
+
+    BatchSigner(const BatchSigner&) = delete;
+    BatchSigner& operator=(const BatchSigner&) = delete;
+
+    // digest must be a 32-byte SHA-256 hash; throws std::invalid_argument otherwise.
+    std::future<BatchSignature> sign(const std::vector<uint8_t>& digest);
+    // Signs digest as a tree of one straight away, bypassing the batch.
+    BatchSignature signUnbatched(const std::vector<uint8_t>& digest);
+
+    BatchSignerStats stats() const;
+
+private:
+    struct Request {
+        std::vector<uint8_t> digest;
+        std::promise<BatchSignature> result;
+        std::chrono::steady_clock::time_point queuedAt;
+    };
+
+    void run();
+    void signBatch(std::vector<Request>& batch);
+
+    TPMBackend& backend;
+    BatchSignerConfig config;
+
+    mutable std::mutex queueMutex;
+    std::condition_variable queueChanged;
+    std::deque<Request> queue;
+    bool stopping = false;
+
+    std::atomic<uint64_t> requestCount{0};
+    std::atomic<uint64_t> batchCount{0};
+    std::atomic<uint64_t> unbatchedCount{0};
+    std::atomic<uint64_t> failureCount{0};
+    std::atomic<size_t> largestBatch{0};
+    std::atomic<uint64_t> batchWaitUs{0};
+    std::atomic<uint64_t> signTimeUs{0};
+
+    std::thread driver;
+};
+
+#endif // BATCH_SIGNER_H
@@ -0,0 +1,198 @@
+// bench_main.cpp
+#include "key_manager.h"
+#include "key_store.h"
+#include "micro_bench.h"
+#include "logger.h"
+#include "config.h"
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <regex>
+#include <sstream>
+#include <stdexcept>
+#include <nlohmann/json.hpp>
+
+namespace {
+
+std::vector<size_t> parseSizes(const std::string& list) {
+    std::vector<size_t> sizes;
+    std::stringstream stream(list);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        if (!item.empty()) {
+            sizes.push_back(static_cast<size_t>(std::stoul(item)));
+        }
+    }
+    if (sizes.empty()) {
+        throw std::invalid_argument("Empty list: " + list);
+    }
+    return sizes;
+}
+
+struct BenchCase {
+    std::string name;
+    size_t bytesPerOp;
+    MicroBenchOperation op;
+};
+
+// Times the in-process TPM and key store paths that the server is built on,
+// without HTTP or TLS in the way. Point KMS_TPM_TCTI at a local swtpm, or set
+// KMS_TPM_BACKEND=software to time everything but the TPM; the report goes to
+// KMS_BENCH_OUT, or to stdout with progress on stderr.
+int runBench() {
+    LoggerConfig logConfig;
+    logConfig.level = LogLevel::Warning;
+    logConfig.files = false;
+    configureLogger(logConfig);
+
+    MicroBenchConfig benchConfig;
+    benchConfig.duration = std::chrono::seconds(getEnvLong("KMS_BENCH_SECONDS", 2));
+    benchConfig.warmup = std::chrono::milliseconds(getEnvLong("KMS_BENCH_WARMUP_MS", 200));
+    std::regex filter(getEnvString("KMS_BENCH_FILTER", ".*"));
+    std::string outputPath = getEnvString("KMS_BENCH_OUT", "");
+    std::vector<size_t> threadCounts;
+    std::vector<size_t> hashSizes;
+    try {
+        threadCounts = parseSizes(getEnvString("KMS_BENCH_THREADS", "1,2,4,8"));
+        hashSizes = parseSizes(getEnvString("KMS_BENCH_HASH_SIZES", "64,1024,65536,1048576"));
+    } catch (const std::exception& e) {
+        std::cerr << "Bad benchmark configuration: " << e.what() << std::endl;
+        return 1;
+    }
+
+    KeyManagerConfig kmConfig;
+    if (!parseTPMBackendType(getEnvString("KMS_TPM_BACKEND", "tpm"), kmConfig.backend)) {
+        std::cerr << "KMS_TPM_BACKEND must be tpm or software" << std::endl;
+        return 1;
+    }
+    kmConfig.device.contextPool.size = static_cast<size_t>(getEnvLong("KMS_TPM_CONTEXT_POOL_SIZE", 4));
+    kmConfig.shards.tctis = getEnvList("KMS_TPM_TCTI", ';');
+    if (kmConfig.shards.tctis.empty()) {
+        kmConfig.shards.tctis.push_back("swtpm:host=localhost,port=2321");
+    }
+    kmConfig.device.contextPool.tcti = kmConfig.shards.tctis.front();
+    kmConfig.device.objectCache.primaryHandle = static_cast<TPM2_HANDLE>(getEnvLong("KMS_TPM_PRIMARY_HANDLE", 0x81000001));
+    kmConfig.device.objectCache.signingKeyHandle = static_cast<TPM2_HANDLE>(getEnvLong("KMS_TPM_SIGNING_KEY_HANDLE", 0x81000002));
+    kmConfig.device.scheduler.maxInFlight = static_cast<size_t>(getEnvLong("KMS_TPM_MAX_IN_FLIGHT", 0));
+    kmConfig.entropyPoolEnabled = getEnvBool("KMS_ENTROPY_POOL", true);
+    // In memory unless asked otherwise, so store timings do not include fdatasync.
+    kmConfig.keyLog.directory = getEnvString("KMS_BENCH_DATA_DIR", "");
+    kmConfig.rotation.interval = std::chrono::seconds(0);
+
+    std::unique_ptr<KeyManager> km;
+    try {
+        km = std::make_unique<KeyManager>(kmConfig);
+    } catch (const std::exception& e) {
+        std::cerr << "Unable to start the key manager: " << e.what() << std::endl;
+        return 1;
+    }
+    TPMBackend& tpm = km->tpmBackend();
+
+    // Fixed inputs, prepared once so every case times only its own operation.
+    const size_t inputCount = 64;
+    KeyBuffer key(32);
+    std::fill(key.data(), key.data() + key.size(), 0x5a);
+    std::vector<std::vector<uint8_t>> sealedBlobs;
+    std::vector<std::string> storedIds;
+    std::vector<std::vector<uint8_t>> digests;
+    for (size_t i = 0; i < inputCount; ++i) {
+        sealedBlobs.push_back(tpm.seal("bench-sealed-" + std::to_string(i), key.clone()).get());
+        storedIds.push_back(km->newKeyId());
+        km->addKey(storedIds.back(), key.clone());
+        digests.emplace_back(32, static_cast<uint8_t>(i));
+    }
+    KeyStore store;
+    std::vector<std::string> storeIds;
+    for (size_t i = 0; i < 4096; ++i) {
+        storeIds.push_back("bench-" + std::to_string(i));
+        store.put(storeIds.back(), sealedBlobs[i % inputCount], 0, 0);
+    }
+    std::map<size_t, std::string> hashInputs;
+    for (size_t size : hashSizes) {
+        hashInputs[size] = std::string(size, 'h');
+    }
+
+    auto pick = [](size_t thread, uint64_t iteration, size_t count) {
+        return static_cast<size_t>((thread * 7919 + iteration) % count);
+    };
+
+    std::vector<BenchCase> cases;
+    cases.push_back({"generateTPMSymmetricKey", 32, [&](size_t, uint64_t) { km->generateTPMSymmetricKey(); }});
+    cases.push_back({"sealKey", 32, [&](size_t thread, uint64_t iteration) {
+        tpm.seal("bench-seal-" + std::to_string(thread) + "-" + std::to_string(iteration), key.clone()).get();
+    }});
+    cases.push_back({"unsealKey", 32, [&](size_t thread, uint64_t iteration) {
+        size_t i = pick(thread, iteration, inputCount);
+        // Ids are distinct per blob so the object cache sees the same working set as the server.
+        tpm.unseal("bench-sealed-" + std::to_string(i), i + 1, sealedBlobs[i]).get();
+    }});
+    for (size_t size : hashSizes) {
+        const std::string& data = hashInputs[size];
+        cases.push_back({"tpm_hash/" + std::to_string(size), size, [&](size_t, uint64_t) { tpm.hash(data).get(); }});
+    }
+    cases.push_back({"tpm_sign", 0, [&](size_t thread, uint64_t iteration) {
+        const auto& digest = digests[pick(thread, iteration, inputCount)];
+        tpm.sign(std::string(digest.begin(), digest.end())).get();
+    }});
+    cases.push_back({"batch_sign", 0, [&](size_t thread, uint64_t iteration) {
+        km->batchSigner().sign(digests[pick(thread, iteration, inputCount)]).get();
+    }});
+    cases.push_back({"addKey", 32, [&](size_t, uint64_t) { km->addKey(km->newKeyId(), key.clone()); }});
+    cases.push_back({"getKey", 32, [&](size_t thread, uint64_t iteration) {
+        km->getKey(storedIds[pick(thread, iteration, inputCount)]);
+    }});
+    // deleteKey needs a key to delete and does no TPM work, so it is timed with the addKey that feeds it.
+    cases.push_back({"addKey+deleteKey", 32, [&](size_t, uint64_t) {
+        std::string id = km->newKeyId();
+        km->addKey(id, key.clone());
+        km->deleteKey(id);
+    }});
+    cases.push_back({"KeyStore::find", 0, [&](size_t thread, uint64_t iteration) {
+        store.find(storeIds[pick(thread, iteration, storeIds.size())]);
+    }});
+    cases.push_back({"KeyStore::put", 0, [&](size_t thread, uint64_t iteration) {
+        size_t i = pick(thread, iteration, storeIds.size());
+        store.put(storeIds[i], sealedBlobs[i % inputCount], 0, 0);
+    }});
+
+    std::vector<MicroBenchResult> results;
+    for (const auto& benchCase : cases) {
+        if (!std::regex_search(benchCase.name, filter)) {
+            continue;
+        }
+        for (size_t threads : threadCounts) {
+            std::string name = benchCase.name + "/threads:" + std::to_string(threads);
+            results.push_back(runMicroBenchmark(name, threads, benchCase.bytesPerOp, benchCase.op, benchConfig));
+            const auto& result = results.back();
+            std::cerr << name << ": " << static_cast<uint64_t>(result.seconds > 0 ? result.iterations / result.seconds : 0)
+                      << " ops/s, p50 " << result.latency.percentile(50) / 1000 << " us, p99 "
+                      << result.latency.percentile(99) / 1000 << " us, " << result.errors << " errors" << std::endl;
+        }
+    }
+
+    nlohmann::json report = microBenchReport(results);
+    if (outputPath.empty()) {
+        std::cout << report.dump(2) << std::endl;
+    } else {
+        std::ofstream out(outputPath);
+        out << report.dump(2) << std::endl;
+        if (!out) {
+            std::cerr << "Unable to write " << outputPath << std::endl;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+} // namespace
+
+int main() {
+    try {
+        return runBench();
+    } catch (const std::invalid_argument& e) {
+        std::cerr << "Invalid configuration: " << e.what() << std::endl;
+        return 1;
+    }
+}
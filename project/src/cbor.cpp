@@ -0,0 +1,206 @@
+// cbor.cpp
+#include "cbor.h"
+#include <stdexcept>
+
+const char* const cborContentType = "application/cbor";
+
+namespace {
+
+constexpr uint8_t majorUnsigned = 0;
+constexpr uint8_t majorBytes = 2;
+constexpr uint8_t majorText = 3;
+constexpr uint8_t majorArray = 4;
+constexpr uint8_t majorMap = 5;
+constexpr uint8_t majorSimple = 7;
+
+constexpr uint8_t simpleFalse = 20;
+constexpr uint8_t simpleTrue = 21;
+
+// Bounds nesting so a hostile body cannot recurse the server's stack away.
+constexpr int maxDepth = 16;
+
+} // namespace
+
+void CborWriter::header(uint8_t major, uint64_t value) {
+    uint8_t initial = static_cast<uint8_t>(major << 5);
+    if (value < 24) {
+        out.push_back(static_cast<char>(initial | value));
+        return;
+    }
+    int width;
+    if (value <= 0xff) {
+        out.push_back(static_cast<char>(initial | 24));
+        width = 1;
+    } else if (value <= 0xffff) {
+        out.push_back(static_cast<char>(initial | 25));
+        width = 2;
+    } else if (value <= 0xffffffffULL) {
+        out.push_back(static_cast<char>(initial | 26));
+        width = 4;
+    } else {
+        out.push_back(static_cast<char>(initial | 27));
+        width = 8;
+    }
+    for (int shift = (width - 1) * 8; shift >= 0; shift -= 8) {
+        out.push_back(static_cast<char>((value >> shift) & 0xff));
+    }
+}
+
+void CborWriter::map(size_t entries) {
+    header(majorMap, entries);
+}
+
+void CborWriter::array(size_t items) {
+    header(majorArray, items);
+}
+
+void CborWriter::text(const std::string& value) {
+    header(majorText, value.size());
+    out.append(value);
+}
+
+void CborWriter::bytes(const uint8_t* data, size_t size) {
+    header(majorBytes, size);
+    out.append(reinterpret_cast<const char*>(data), size);
+}
+
+void CborWriter::unsignedInt(uint64_t value) {
+    header(majorUnsigned, value);
+}
+
+void CborWriter::boolean(bool value) {
+    out.push_back(static_cast<char>((majorSimple << 5) | (value ? simpleTrue : simpleFalse)));
+}
+
+CborReader::CborReader(const char* data, size_t size)
+    : data(reinterpret_cast<const uint8_t*>(data)), size(size) {}
+
+void CborReader::need(size_t count) const {
+    if (count > size - pos) {
+        throw std::invalid_argument("Truncated CBOR body");
+    }
+}
+
+uint8_t CborReader::peekMajor() const {
+    need(1);
+    return data[pos] >> 5;
+}
+
+uint64_t CborReader::header(uint8_t expectedMajor) {
+    need(1);
+    uint8_t initial = data[pos];
+    if ((initial >> 5) != expectedMajor) {
+        throw std::invalid_argument("Unexpected CBOR type");
+    }
+    ++pos;
+    uint8_t info = initial & 0x1f;
+    if (info < 24) {
+        return info;
+    }
+    if (info > 27) {
+        // Indefinite lengths and reserved values are not part of the wire format.
+        throw std::invalid_argument("Unsupported CBOR length encoding");
+    }
+    size_t width = size_t(1) << (info - 24);
+    need(width);
+    uint64_t value = 0;
+    for (size_t i = 0; i < width; ++i) {
+        value = (value << 8) | data[pos++];
+    }
+    return value;
+}
+
+size_t CborReader::map() {
+    uint64_t entries = header(majorMap);
+    // Every entry takes at least two bytes; reject counts the body cannot hold.
+    if (entries > (size - pos) / 2) {
+        throw std::invalid_argument("Truncated CBOR body");
+    }
+    return static_cast<size_t>(entries);
+}
+
+size_t CborReader::array() {
+    uint64_t items = header(majorArray);
+    if (items > size - pos) {
+        throw std::invalid_argument("Truncated CBOR body");
+    }
+    return static_cast<size_t>(items);
+}
+
+std::string CborReader::text() {
+    uint64_t length = header(majorText);
+    need(length);
+    std::string value(reinterpret_cast<const char*>(data + pos), length);
+    pos += length;
+    return value;
+}
+
+std::vector<uint8_t> CborReader::bytes() {
+    auto view = bytesView();
+    return std::vector<uint8_t>(view.first, view.first + view.second);
+}
+
+std::pair<const uint8_t*, size_t> CborReader::bytesView() {
+    uint64_t length = header(majorBytes);
+    need(length);
+    std::pair<const uint8_t*, size_t> view(data + pos, static_cast<size_t>(length));
+    pos += length;
+    return view;
+}
+
+uint64_t CborReader::unsignedInt() {
+    return header(majorUnsigned);
+}
+
+bool CborReader::boolean() {
+    need(1);
+    uint8_t initial = data[pos];
+    if (initial != ((majorSimple << 5) | simpleFalse) && initial != ((majorSimple << 5) | simpleTrue)) {
+        throw std::invalid_argument("Expected a CBOR boolean");
+    }
+    ++pos;
+    return (initial & 0x1f) == simpleTrue;
+}
+
+void CborReader::skip() {
+    skip(0);
+}
+
+void CborReader::skip(int depth) {
+    if (depth > maxDepth) {
+        throw std::invalid_argument("CBOR nesting too deep");
+    }
+    switch (peekMajor()) {
+    case majorUnsigned:
+        header(majorUnsigned);
+        break;
+    case majorBytes: {
+        uint64_t length = header(majorBytes);
+        need(length);
+        pos += length;
+        break;
+    }
+    case majorText: {
+        uint64_t length = header(majorText);
+        need(length);
+        pos += length;
+        break;
+    }
+    case majorArray:
+        for (size_t items = array(); items > 0; --items) {
+            skip(depth + 1);
+        }
+        break;
+    case majorMap:
+        for (size_t entries = map(); entries > 0; --entries) {
+            skip(depth + 1);
+            skip(depth + 1);
+        }
+        break;
+    case majorSimple:
+        boolean();
+        break;
+    default:
+        throw std::invalid_argument("Unsupported CBOR type");
+    }
+}
@@ -0,0 +1,105 @@
+// cbor.h
+#ifndef CBOR_H
+#define CBOR_H
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Media type for request and response bodies encoded with CborWriter.
+extern const char* const cborContentType;
+
+// Streaming CBOR (RFC 8949) encoder for the subset the KMS wire format uses:
+// unsigned integers, booleans, byte and text strings, and definite-length
+// arrays and maps. Values are appended straight to the output buffer.
+class CborWriter {
+public:
+    void map(size_t entries);
+    void array(size_t items);
+    void text(const std::string& value);
+    void bytes(const uint8_t* data, size_t size);
+    void bytes(const std::vector<uint8_t>& value) { bytes(value.data(), value.size()); }
+    void unsignedInt(uint64_t value);
+    void boolean(bool value);
+
+    // Convenience for map entries with a text key.
+    template <typename Value>
+    void field(const std::string& name, const Value& value);
+
+    std::string& data() { return out; }
+    // Leaves the writer empty.
+    std::string release() { return std::move(out); }
+
+private:
+    void header(uint8_t major, uint64_t value);
+
+    std::string out;
+};
+
+// Decoder for the same subset. Reads in document order without building a
+// tree; any malformed, truncated or unexpected input throws std::invalid_argument.
+class CborReader {
+public:
+    CborReader(const char* data, size_t size);
+    explicit CborReader(const std::string& data) : CborReader(data.data(), data.size()) {}
+
+    size_t map();
+    size_t array();
+    std::string text();
+    std::vector<uint8_t> bytes();
+    // Like bytes(), but points into the body instead of copying, so key
+    // material can go straight into a KeyBuffer.
+    std::pair<const uint8_t*, size_t> bytesView();
+    uint64_t unsignedInt();
+    bool boolean();
+    // Skips one value of any supported type, e.g. an unknown map entry.
+    void skip();
+    bool atEnd() const { return pos == size; }
+
+private:
+    uint64_t header(uint8_t expectedMajor);
+    uint8_t peekMajor() const;
+    void need(size_t count) const;
+    void skip(int depth);
+
+    const uint8_t* data;
+    size_t size;
+    size_t pos = 0;
+};
+
+// Calls onField(name, reader) for every entry of a top-level CBOR map in body.
+// onField either consumes the value and returns true, or returns false to have
+// it skipped. Throws std::invalid_argument on malformed or trailing data.
+template <typename OnField>
+void readCborMap(const std::string& body, OnField&& onField) {
+    CborReader reader(body);
+    for (size_t entries = reader.map(); entries > 0; --entries) {
+        std::string name = reader.text();
+        if (!onField(name, reader)) {
+            reader.skip();
+        }
+    }
+    if (!reader.atEnd()) {
+        throw std::invalid_argument("Trailing data after CBOR body");
+    }
+}
+
+template <typename Value>
+void CborWriter::field(const std::string& name, const Value& value) {
+    text(name);
+    if constexpr (std::is_same<Value, std::vector<uint8_t>>::value) {
+        bytes(value);
+    } else if constexpr (std::is_same<Value, bool>::value) {
+        boolean(value);
+    } else if constexpr (std::is_integral<Value>::value) {
+        unsignedInt(static_cast<uint64_t>(value));
+    } else {
+        text(value);
+    }
+}
+
+#endif // CBOR_H
@@ -0,0 +1,247 @@
+// change_feed.cpp
+#include "change_feed.h"
+#include "cbor.h"
+#include <openssl/rand.h>
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+
+namespace {
+
+void writeChange(CborWriter& writer, const ReplicationChange& change) {
+    bool hasKey = change.type != KeyLogRecordType::Erase;
+    bool hasTimes = change.type == KeyLogRecordType::Put;
+    writer.map(3 + (hasKey ? 1 : 0) + (hasTimes ? 2 : 0));
+    writer.field("seq", change.seq);
+    writer.field("type", static_cast<uint64_t>(change.type));
+    writer.field("key_id", change.keyId);
+    if (hasKey) {
+        writer.field("key", change.wrappedKey);
+    }
+    if (hasTimes) {
+        writer.field("created_at", static_cast<uint64_t>(change.createdAt));
+        writer.field("expires_at", static_cast<uint64_t>(change.expiresAt));
+    }
+}
+
+ReplicationChange readChange(CborReader& reader) {
+    ReplicationChange change;
+    bool haveType = false, haveId = false;
+    for (size_t entries = reader.map(); entries > 0; --entries) {
+        std::string name = reader.text();
+        if (name == "seq") {
+            change.seq = reader.unsignedInt();
+        } else if (name == "type") {
+            uint64_t type = reader.unsignedInt();
+            if (type < static_cast<uint64_t>(KeyLogRecordType::Put) || type > static_cast<uint64_t>(KeyLogRecordType::Kek)) {
+                throw std::invalid_argument("Unknown replication change type " + std::to_string(type));
+            }
+            change.type = static_cast<KeyLogRecordType>(type);
+            haveType = true;
+        } else if (name == "key_id") {
+            change.keyId = reader.text();
+            haveId = true;
+        } else if (name == "key") {
+            change.wrappedKey = reader.bytes();
+        } else if (name == "created_at") {
+            change.createdAt = static_cast<int64_t>(reader.unsignedInt());
+        } else if (name == "expires_at") {
+            change.expiresAt = static_cast<int64_t>(reader.unsignedInt());
+        } else {
+            reader.skip();
+        }
+    }
+    if (!haveType || !haveId || (change.type != KeyLogRecordType::Erase && change.wrappedKey.empty())) {
+        throw std::invalid_argument("Incomplete replication change");
+    }
+    return change;
+}
+
+void writeChanges(CborWriter& writer, const std::vector<ReplicationChange>& changes) {
+    writer.text("changes");
+    writer.array(changes.size());
+    for (const auto& change : changes) {
+        writeChange(writer, change);
+    }
+}
+
+std::vector<ReplicationChange> readChanges(CborReader& reader) {
+    std::vector<ReplicationChange> changes;
+    for (size_t count = reader.array(); count > 0; --count) {
+        changes.push_back(readChange(reader));
+    }
+    return changes;
+}
+
+} // namespace
+
+const char* const replicationAuthHeader = "X-KMS-Replication-Auth";
+
+bool parseReplicationRole(const std::string& name, ReplicationRole& role) {
+    if (name == "standalone") {
+        role = ReplicationRole::Standalone;
+    } else if (name == "primary") {
+        role = ReplicationRole::Primary;
+    } else if (name == "replica") {
+        role = ReplicationRole::Replica;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+const char* replicationRoleName(ReplicationRole role) {
+    switch (role) {
+    case ReplicationRole::Primary:
+        return "primary";
+    case ReplicationRole::Replica:
+        return "replica";
+    default:
+        return "standalone";
+    }
+}
+
+std::string formatReplicationToken(const ReplicationToken& token) {
+    char text[48];
+    std::snprintf(text, sizeof(text), "%016" PRIx64 "-%" PRIu64, token.epoch, token.seq);
+    return text;
+}
+
+bool parseReplicationToken(const std::string& text, ReplicationToken& token) {
+    size_t dash = text.find('-');
+    if (dash == 0 || dash == std::string::npos || dash + 1 == text.size()) {
+        return false;
+    }
+    char* end = nullptr;
+    std::string epoch = text.substr(0, dash);
+    unsigned long long parsedEpoch = std::strtoull(epoch.c_str(), &end, 16);
+    if (*end != '\0') {
+        return false;
+    }
+    const char* seq = text.c_str() + dash + 1;
+    if (*seq < '0' || *seq > '9') {
+        return false;
+    }
+    unsigned long long parsedSeq = std::strtoull(seq, &end, 10);
+    if (*end != '\0') {
+        return false;
+    }
+    token.epoch = parsedEpoch;
+    token.seq = parsedSeq;
+    return true;
+}
+
+ChangeFeed::ChangeFeed(size_t capacity) : capacity(std::max<size_t>(capacity, 1)) {
+    while (feedEpoch == 0) {
+        if (RAND_bytes(reinterpret_cast<unsigned char*>(&feedEpoch), sizeof(feedEpoch)) != 1) {
+            throw std::runtime_error("Error generating replication epoch");
+        }
+    }
+}
+
+void ChangeFeed::append(std::vector<ReplicationChange> batch) {
+    if (batch.empty()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto& change : batch) {
+            change.seq = ++last;
+            changes.push_back(std::move(change));
+        }
+        while (changes.size() > capacity) {
+            changes.pop_front();
+        }
+    }
+    appended.notify_all();
+}
+
+uint64_t ChangeFeed::lastSeq() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return last;
+}
+
+uint64_t ChangeFeed::oldestSeq() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return changes.empty() ? last + 1 : changes.front().seq;
+}
+
+bool ChangeFeed::read(uint64_t after, size_t limit, std::chrono::milliseconds wait, ReplicationBatch& batch) {
+    std::unique_lock<std::mutex> lock(mutex);
+    batch.epoch = feedEpoch;
+    batch.changes.clear();
+    uint64_t oldest = changes.empty() ? last + 1 : changes.front().seq;
+    if (after > last || after + 1 < oldest) {
+        batch.lastSeq = last;
+        return false;
+    }
+    appended.wait_for(lock, wait, [&] { return last > after; });
+    // Appends only ever drop changes older than the ones just added, so after may have fallen out while waiting.
+    oldest = changes.empty() ? last + 1 : changes.front().seq;
+    batch.lastSeq = last;
+    if (after + 1 < oldest) {
+        return false;
+    }
+    size_t first = static_cast<size_t>(after + 1 - oldest);
+    for (size_t i = first; i < changes.size() && batch.changes.size() < limit; ++i) {
+        batch.changes.push_back(changes[i]);
+    }
+    return true;
+}
+
+std::string encodeReplicationBatch(const ReplicationBatch& batch) {
+    CborWriter writer;
+    writer.map(3);
+    writer.field("epoch", batch.epoch);
+    writer.field("last_seq", batch.lastSeq);
+    writeChanges(writer, batch.changes);
+    return writer.release();
+}
+
+ReplicationBatch decodeReplicationBatch(const std::string& body) {
+    ReplicationBatch batch;
+    readCborMap(body, [&](const std::string& name, CborReader& reader) {
+        if (name == "epoch") {
+            batch.epoch = reader.unsignedInt();
+        } else if (name == "last_seq") {
+            batch.lastSeq = reader.unsignedInt();
+        } else if (name == "changes") {
+            batch.changes = readChanges(reader);
+        } else {
+            return false;
+        }
+        return true;
+    });
+    return batch;
+}
+
+std::string encodeReplicationSnapshot(const ReplicationSnapshotPage& page) {
+    CborWriter writer;
+    writer.map(4);
+    writer.field("epoch", page.epoch);
+    writer.field("seq", page.seq);
+    writeChanges(writer, page.changes);
+    writer.field("next", page.next);
+    return writer.release();
+}
+
+ReplicationSnapshotPage decodeReplicationSnapshot(const std::string& body) {
+    ReplicationSnapshotPage page;
+    readCborMap(body, [&](const std::string& name, CborReader& reader) {
+        if (name == "epoch") {
+            page.epoch = reader.unsignedInt();
+        } else if (name == "seq") {
+            page.seq = reader.unsignedInt();
+        } else if (name == "changes") {
+            page.changes = readChanges(reader);
+        } else if (name == "next") {
+            page.next = reader.text();
+        } else {
+            return false;
+        }
+        return true;
+    });
+    return page;
+}
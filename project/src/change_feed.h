@@ -0,0 +1,124 @@
+// change_feed.h
+#ifndef CHANGE_FEED_H
+#define CHANGE_FEED_H
+
+#include "key_log.h"
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+enum class ReplicationRole { Standalone, Primary, Replica };
+
+// Accepts "standalone", "primary" and "replica"; returns false for anything else.
+bool parseReplicationRole(const std::string& name, ReplicationRole& role);
+const char* replicationRoleName(ReplicationRole role);
+
+struct ReplicationConfig {
+    ReplicationRole role = ReplicationRole::Standalone;
+    // 32 raw bytes shared by a primary and its replicas. Keys travel wrapped
+    // under it and each replica seals them again under its own TPM.
+    std::string keyFile;
+    size_t feedRecords = 65536;   // changes a primary keeps for replicas that fall behind
+    // How far a signed replication request's time may be from the primary's clock.
+    std::chrono::seconds authWindow{60};
+};
+
+// Position in a primary's change feed, and the read-your-writes token a
+// client carries from a write on the primary to a read on a replica.
+struct ReplicationToken {
+    uint64_t epoch = 0;   // random per primary process
+    uint64_t seq = 0;     // last change included
+};
+
+// "<epoch as 16 hex digits>-<seq>".
+std::string formatReplicationToken(const ReplicationToken& token);
+bool parseReplicationToken(const std::string& text, ReplicationToken& token);
+
+// One key store mutation as shipped to replicas. Key material travels wrapped
+// under the replication key with EnvelopeCipher, bound to keyId, never as the
+// primary's TPM blob, which no other TPM could unseal.
+struct ReplicationChange {
+    uint64_t seq = 0;
+    KeyLogRecordType type = KeyLogRecordType::Put;
+    std::string keyId;                 // the KEK version for Kek
+    std::vector<uint8_t> wrappedKey;   // Put and Kek
+    int64_t createdAt = 0;             // Put only
+    int64_t expiresAt = 0;
+};
+
+// Body of GET /replication/changes.
+struct ReplicationBatch {
+    uint64_t epoch = 0;
+    uint64_t lastSeq = 0;   // the primary's newest change when the batch was cut
+    std::vector<ReplicationChange> changes;
+};
+
+// Body of GET /replication/snapshot: one page of the primary's live keys, in
+// key id order. Every change up to seq is reflected in the page; later ones
+// are replayed from the feed. The first page also carries every KEK.
+struct ReplicationSnapshotPage {
+    uint64_t epoch = 0;
+    uint64_t seq = 0;
+    std::vector<ReplicationChange> changes;   // Kek, then Put; seq is 0
+    std::string next;                         // cursor for the next page, empty after the last
+};
+
+struct ReplicationStats {
+    ReplicationRole role = ReplicationRole::Standalone;
+    uint64_t epoch = 0;            // the primary's, as seen by this node
+    uint64_t lastSeq = 0;          // primary: newest change; replica: newest change applied
+    uint64_t oldestSeq = 0;        // primary: oldest change still in the feed
+    uint64_t primarySeq = 0;       // replica: the primary's newest change at the last poll
+    uint64_t lagChanges = 0;       // replica: of those, how many it has not applied
+    uint64_t appliedChanges = 0;   // replica
+    uint64_t snapshots = 0;        // replica: full copies taken because the feed had moved on
+    uint64_t failures = 0;         // replica: polls and applies that failed
+    uint64_t lagMs = 0;            // replica: time since it last held everything the primary had
+    uint64_t tokenWaits = 0;       // replica: reads that waited for a token
+    uint64_t tokenTimeouts = 0;    // replica: reads refused because the token was not reached in time
+};
+
+// Bounded, in-memory log of a primary's committed changes. Sequence numbers
+// start at 1 in every process and the epoch is new each start, so a replica
+// following an older epoch, or one that fell further behind than the feed
+// reaches, takes a snapshot instead.
+class ChangeFeed {
+public:
+    explicit ChangeFeed(size_t capacity);
+
+    uint64_t epoch() const { return feedEpoch; }
+    // Numbers the changes in order and appends them, dropping the oldest past capacity.
+    void append(std::vector<ReplicationChange> changes);
+    uint64_t lastSeq() const;
+    uint64_t oldestSeq() const;
+    // Copies up to limit changes after `after` into batch, waiting up to wait
+    // for one when there are none yet. Returns false when the feed no longer
+    // holds the change right after `after`.
+    bool read(uint64_t after, size_t limit, std::chrono::milliseconds wait, ReplicationBatch& batch);
+
+private:
+    uint64_t feedEpoch = 0;
+    size_t capacity;
+    mutable std::mutex mutex;
+    std::condition_variable appended;
+    std::deque<ReplicationChange> changes;
+    uint64_t last = 0;
+};
+
+// Request header carrying KeyManager::replicationRequestAuth; the primary
+// answers 401 to a replication request without a valid one.
+extern const char* const replicationAuthHeader;
+
+// CBOR wire format of the replication endpoints. Decoding throws
+// std::invalid_argument on malformed bodies.
+std::string encodeReplicationBatch(const ReplicationBatch& batch);
+ReplicationBatch decodeReplicationBatch(const std::string& body);
+std::string encodeReplicationSnapshot(const ReplicationSnapshotPage& page);
+ReplicationSnapshotPage decodeReplicationSnapshot(const std::string& body);
+
+#endif // CHANGE_FEED_H
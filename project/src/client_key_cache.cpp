@@ -0,0 +1,101 @@
+// client_key_cache.cpp
+#include "client_key_cache.h"
+#include <algorithm>
+
+ClientKeyCache::ClientKeyCache(const ClientKeyCacheConfig& config) : config(config) {
+    this->config.maxEntries = std::max<size_t>(config.maxEntries, 1);
+    this->config.maxKeyBytes = std::max<size_t>(config.maxKeyBytes, 1);
+    entries.reserve(this->config.maxEntries);
+}
+
+ClientKeyCache::Lookup ClientKeyCache::find(const std::string& key_id, KeyBuffer& key) {
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    auto it = entries.find(key_id);
+    if (it == entries.end()) {
+        ++missCount;
+        return Lookup::Miss;
+    }
+    if (std::chrono::steady_clock::now() >= it->second.expiresAt) {
+        erase(it);
+        ++missCount;
+        return Lookup::Miss;
+    }
+
+    lru.splice(lru.begin(), lru, it->second.lru);
+    if (it->second.notFound) {
+        ++notFoundHitCount;
+        return Lookup::NotFound;
+    }
+    key = it->second.key.clone();
+    ++hitCount;
+    return Lookup::Hit;
+}
+
+void ClientKeyCache::put(const std::string& key_id, const KeyBuffer& key) {
+    if (key.size() > config.maxKeyBytes) {
+        return;
+    }
+    Entry entry;
+    entry.key = key.clone();
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    makeRoom(key_id);
+    entry.expiresAt = std::chrono::steady_clock::now() + config.ttl;
+    insert(key_id, std::move(entry));
+}
+
+void ClientKeyCache::putNotFound(const std::string& key_id) {
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    makeRoom(key_id);
+    Entry entry;
+    entry.notFound = true;
+    entry.expiresAt = std::chrono::steady_clock::now() + config.notFoundTtl;
+    insert(key_id, std::move(entry));
+}
+
+void ClientKeyCache::invalidate(const std::string& key_id) {
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    auto it = entries.find(key_id);
+    if (it != entries.end()) {
+        erase(it);
+    }
+}
+
+void ClientKeyCache::clear() {
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    entries.clear();
+    lru.clear();
+}
+
+ClientKeyCacheStats ClientKeyCache::stats() const {
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    ClientKeyCacheStats result;
+    result.hits = hitCount;
+    result.notFoundHits = notFoundHitCount;
+    result.misses = missCount;
+    result.evictions = evictionCount;
+    result.entries = entries.size();
+    return result;
+}
+
+void ClientKeyCache::makeRoom(const std::string& key_id) {
+    auto existing = entries.find(key_id);
+    if (existing != entries.end()) {
+        erase(existing);
+    }
+    if (entries.size() >= config.maxEntries) {
+        erase(entries.find(lru.back()));
+        ++evictionCount;
+    }
+}
+
+void ClientKeyCache::insert(const std::string& key_id, Entry entry) {
+    lru.push_front(key_id);
+    entry.lru = lru.begin();
+    entries.emplace(key_id, std::move(entry));
+}
+
+void ClientKeyCache::erase(EntryMap::iterator it) {
+    // Destroying the entry's KeyBuffer wipes the key and frees its slot.
+    lru.erase(it->second.lru);
+    entries.erase(it);
+}
@@ -0,0 +1,80 @@
+// client_key_cache.h
+#ifndef CLIENT_KEY_CACHE_H
+#define CLIENT_KEY_CACHE_H
+
+#include "key_buffer.h"
+#include <chrono>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+struct ClientKeyCacheConfig {
+    bool enabled = false;
+    size_t maxEntries = 1024;
+    size_t maxKeyBytes = 64;                    // longer keys are never cached
+    std::chrono::milliseconds ttl{30000};
+    std::chrono::milliseconds notFoundTtl{1000};  // how long a "Key not found" answer is reused
+};
+
+struct ClientKeyCacheStats {
+    uint64_t hits = 0;
+    uint64_t notFoundHits = 0;
+    uint64_t misses = 0;          // includes lookups that found an expired entry
+    uint64_t evictions = 0;       // dropped to make room, not by TTL or invalidation
+    size_t entries = 0;
+
+    double hitRate() const {
+        uint64_t lookups = hits + notFoundHits + misses;
+        return lookups == 0 ? 0.0 : static_cast<double>(hits + notFoundHits) / lookups;
+    }
+};
+
+// Fetched keys kept as KeyBuffers in the key arena, so cached key material is
+// never swapped or dumped and is wiped when an entry expires, is evicted (least
+// recently used first) or is invalidated.
+class ClientKeyCache {
+public:
+    enum class Lookup { Miss, Hit, NotFound };
+
+    explicit ClientKeyCache(const ClientKeyCacheConfig& config);
+
+    ClientKeyCache(const ClientKeyCache&) = delete;
+    ClientKeyCache& operator=(const ClientKeyCache&) = delete;
+
+    // Clones the cached key into `key` on a Hit.
+    Lookup find(const std::string& key_id, KeyBuffer& key);
+    void put(const std::string& key_id, const KeyBuffer& key);
+    void putNotFound(const std::string& key_id);
+    void invalidate(const std::string& key_id);
+    void clear();
+
+    ClientKeyCacheStats stats() const;
+
+private:
+    struct Entry {
+        std::list<std::string>::iterator lru;
+        bool notFound = false;
+        KeyBuffer key;
+        std::chrono::steady_clock::time_point expiresAt;
+    };
+    using EntryMap = std::unordered_map<std::string, Entry>;
+
+    // Drops key_id if present, then the least recently used entry if full.
+    void makeRoom(const std::string& key_id);
+    void insert(const std::string& key_id, Entry entry);
+    void erase(EntryMap::iterator it);
+
+    ClientKeyCacheConfig config;
+    EntryMap entries;
+    std::list<std::string> lru;   // most recently used first
+    mutable std::mutex cacheMutex;
+
+    uint64_t hitCount = 0;
+    uint64_t notFoundHitCount = 0;
+    uint64_t missCount = 0;
+    uint64_t evictionCount = 0;
+};
+
+#endif // CLIENT_KEY_CACHE_H
@@ -1,8 +1,20 @@
 //client_main.cpp
 #include "kms_client.h"
 #include "logger.h"
+#include "config.h"
+#include "handshake_bench.h"
+#include "load_bench.h"
+#include "merkle_tree.h"
+#include <openssl/evp.h>
+#include <atomic>
+#include <chrono>
 #include <iostream>
 #include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
 #include <vector>
 
 void logMessage(const std::string& message) {
@@ -23,11 +35,122 @@ std::vector<uint8_t> stringToVector(const std::string& str) {
     return std::vector<uint8_t>(str.begin(), str.end());
 }
 
-std::string vectorToString(const std::vector<uint8_t>& vec) {
-    return std::string(vec.begin(), vec.end());
+std::string vectorToHex(const std::vector<uint8_t>& vec) {
+    static const char digits[] = "0123456789abcdef";
+    std::string hex;
+    hex.reserve(vec.size() * 2);
+    for (uint8_t byte : vec) {
+        hex.push_back(digits[byte >> 4]);
+        hex.push_back(digits[byte & 0x0f]);
+    }
+    return hex;
 }
 
-int main(int argc, char* argv[]) {
+std::vector<uint8_t> hexToVector(const std::string& hex) {
+    if (hex.size() % 2 != 0) {
+        throw std::runtime_error("Hex string must have an even length");
+    }
+    std::vector<uint8_t> vec;
+    vec.reserve(hex.size() / 2);
+    for (size_t i = 0; i < hex.size(); i += 2) {
+        vec.push_back(static_cast<uint8_t>(std::stoi(hex.substr(i, 2), nullptr, 16)));
+    }
+    return vec;
+}
+
+// Logs each batch item and returns the number of failed items.
+size_t logBatchResults(const std::vector<BatchKeyResult>& results, bool showKeys) {
+    size_t failures = 0;
+    for (const auto& result : results) {
+        if (result.error.empty()) {
+            logMessage(result.keyId + ": ok" + (showKeys ? " " + std::string(result.key.begin(), result.key.end()) : ""));
+        } else {
+            ++failures;
+            logErrorMessage(result.keyId + ": " + result.error);
+        }
+    }
+    logMessage(std::to_string(results.size() - failures) + "/" + std::to_string(results.size()) + " succeeded.");
+    return failures;
+}
+
+// Hashes inputs from 1 KiB up to maxBytes, each for about perSize, in software
+// and through the TPM, and logs the server-side throughput of both.
+void benchHash(KMSClient& client, size_t maxBytes, std::chrono::seconds perSize) {
+    for (size_t size = 1024; size <= maxBytes; size *= 4) {
+        std::string data(size, 'x');
+        for (bool attest : {false, true}) {
+            uint64_t requests = 0;
+            auto start = std::chrono::steady_clock::now();
+            auto deadline = start + perSize;
+            do {
+                client.hash(data, attest);
+                ++requests;
+            } while (std::chrono::steady_clock::now() < deadline);
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            std::ostringstream line;
+            line.precision(3);
+            line << std::fixed << size << " bytes, " << (attest ? "TPM" : "software") << ": "
+                 << requests / seconds << " req/s, " << requests * size / seconds / (1024 * 1024) << " MiB/s";
+            logMessage(line.str());
+        }
+    }
+}
+
+std::vector<uint8_t> sha256(const std::string& data) {
+    std::vector<uint8_t> digest(EVP_MAX_MD_SIZE);
+    unsigned int size = 0;
+    if (EVP_Digest(data.data(), data.size(), digest.data(), &size, EVP_sha256(), nullptr) != 1) {
+        throw std::runtime_error("Error computing SHA-256");
+    }
+    digest.resize(size);
+    return digest;
+}
+
+// Signs distinct digests from `threads` concurrent callers for `duration`,
+// one at a time and then batched, and logs the signature rate of each. One
+// batched signature is checked against the server's public key.
+void benchSign(KMSClient& client, std::chrono::seconds duration, size_t threads) {
+    for (bool batch : {false, true}) {
+        std::atomic<uint64_t> signatures{0};
+        std::atomic<uint64_t> failures{0};
+        std::atomic<uint64_t> largestTree{0};
+        auto start = std::chrono::steady_clock::now();
+        auto deadline = start + duration;
+        std::vector<std::thread> workers;
+        for (size_t t = 0; t < threads; ++t) {
+            workers.emplace_back([&, t] {
+                for (uint64_t n = 0; std::chrono::steady_clock::now() < deadline; ++n) {
+                    try {
+                        BatchSignature signature = client.sign(sha256(std::to_string(t) + ":" + std::to_string(n)), batch);
+                        ++signatures;
+                        uint64_t seen = largestTree.load();
+                        while (signature.treeSize > seen && !largestTree.compare_exchange_weak(seen, signature.treeSize)) {
+                        }
+                    } catch (const std::exception&) {
+                        ++failures;
+                    }
+                }
+            });
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::ostringstream line;
+        line.precision(1);
+        line << std::fixed << (batch ? "Batched" : "Unbatched") << " signing, " << threads << " threads: "
+             << signatures / seconds << " signatures/s, largest tree " << largestTree << ", " << failures << " failed";
+        logMessage(line.str());
+    }
+
+    std::vector<uint8_t> digest = sha256("benchSign check");
+    bool valid = verifyBatchSignature(digest, client.sign(digest), client.signingPublicKey());
+    logMessage(std::string("Batched signature verification: ") + (valid ? "ok" : "FAILED"));
+}
+
+namespace {
+
+int runClient(int argc, char* argv[]) {
     initializeLogFiles();
 
     if (argc < 2) {
@@ -36,12 +159,26 @@ int main(int argc, char* argv[]) {
     }
 
     std::string command = argv[1];
-    KMSClient client;
+    KMSClientConfig clientConfig;
+    HTTPSConnectionPoolConfig& connectionConfig = clientConfig.connections;
+    connectionConfig.host = getEnvString("KMS_SERVER_HOST", connectionConfig.host);
+    connectionConfig.port = static_cast<int>(getEnvLong("KMS_SERVER_PORT", connectionConfig.port));
+    connectionConfig.size = static_cast<size_t>(getEnvLong("KMS_CLIENT_CONNECTIONS", 4));
+    connectionConfig.caCertPath = getEnvString("KMS_CA_CERT", connectionConfig.caCertPath);
+    connectionConfig.verifyServer = getEnvBool("KMS_TLS_VERIFY", true);
+    connectionConfig.verifyHostname = getEnvBool("KMS_TLS_VERIFY_HOSTNAME", false);
+    connectionConfig.connectTimeout = std::chrono::milliseconds(getEnvLong("KMS_CLIENT_CONNECT_TIMEOUT_MS", 5000));
+    connectionConfig.readTimeout = std::chrono::milliseconds(getEnvLong("KMS_CLIENT_READ_TIMEOUT_MS", 30000));
+    clientConfig.keyCache.enabled = getEnvBool("KMS_CLIENT_KEY_CACHE", false);
+    clientConfig.keyCache.maxEntries = static_cast<size_t>(getEnvLong("KMS_CLIENT_KEY_CACHE_ENTRIES", 1024));
+    clientConfig.keyCache.ttl = std::chrono::milliseconds(getEnvLong("KMS_CLIENT_KEY_CACHE_TTL_MS", 30000));
+    clientConfig.keyCache.notFoundTtl = std::chrono::milliseconds(getEnvLong("KMS_CLIENT_KEY_CACHE_NOT_FOUND_TTL_MS", 1000));
+    clientConfig.binaryWire = getEnvString("KMS_CLIENT_WIRE_FORMAT", "cbor") != "json";
+    KMSClient client(clientConfig);
 
     try {
         if (command == "generateKey") {
-            client.generateKey();
-            logMessage("Key generated successfully.");
+            logMessage("Key generated: " + client.generateKey());
         } else if (command == "storeKey") {
             if (argc != 4) {
                 logMessage("Usage: " + std::string(argv[0]) + " storeKey <key_id> <key_value>");
@@ -55,9 +192,8 @@ int main(int argc, char* argv[]) {
                 logMessage("Usage: " + std::string(argv[0]) + " fetchKey <key_id>");
                 return 1;
             }
-            std::vector<uint8_t> keyVector = client.fetchKey(argv[2]);
-            std::string key = vectorToString(keyVector);
-            logMessage("Fetched key: " + key);
+            KeyBuffer key = client.fetchKey(argv[2]);
+            logMessage("Fetched key: " + std::string(key.begin(), key.end()));
         } else if (command == "rotateKey") {
             client.rotateKey();
             logMessage("Key rotated successfully.");
@@ -72,6 +208,158 @@ int main(int argc, char* argv[]) {
             logMessage("Requesting server to generate certificate...");
             client.generateCert();
             logMessage("Certificate generated successfully.");
+        } else if (command == "generateDataKey") {
+            std::string context = argc >= 3 ? argv[2] : "";
+            DataKeyResult dataKey = client.generateDataKey(context);
+            logMessage("Data key (plaintext): " + vectorToHex(dataKey.plaintext));
+            logMessage("Data key (ciphertext blob): " + vectorToHex(dataKey.ciphertextBlob));
+        } else if (command == "decryptDataKey") {
+            if (argc < 3 || argc > 4) {
+                logMessage("Usage: " + std::string(argv[0]) + " decryptDataKey <ciphertext_blob_hex> [<context>]");
+                return 1;
+            }
+            std::string context = argc == 4 ? argv[3] : "";
+            std::vector<uint8_t> plaintext = client.decryptDataKey(hexToVector(argv[2]), context);
+            logMessage("Data key (plaintext): " + vectorToHex(plaintext));
+        } else if (command == "rotateKek") {
+            client.rotateKeyEncryptionKey();
+            logMessage("Key-encryption key rotated successfully.");
+        } else if (command == "generateKeys") {
+            if (argc != 3) {
+                logMessage("Usage: " + std::string(argv[0]) + " generateKeys <count>");
+                return 1;
+            }
+            auto results = client.generateKeys(std::stoul(argv[2]));
+            return logBatchResults(results, false) == 0 ? 0 : 1;
+        } else if (command == "storeKeys") {
+            if (argc < 3) {
+                logMessage("Usage: " + std::string(argv[0]) + " storeKeys <key_id>=<key_value> [...]");
+                return 1;
+            }
+            std::vector<std::pair<std::string, std::vector<uint8_t>>> keys;
+            for (int i = 2; i < argc; ++i) {
+                std::string arg = argv[i];
+                size_t separator = arg.find('=');
+                if (separator == std::string::npos) {
+                    logMessage("Expected <key_id>=<key_value>, got: " + arg);
+                    return 1;
+                }
+                keys.emplace_back(arg.substr(0, separator), stringToVector(arg.substr(separator + 1)));
+            }
+            auto results = client.storeKeys(keys);
+            return logBatchResults(results, false) == 0 ? 0 : 1;
+        } else if (command == "fetchKeys" || command == "deleteKeys") {
+            if (argc < 3) {
+                logMessage("Usage: " + std::string(argv[0]) + " " + command + " <key_id> [...]");
+                return 1;
+            }
+            std::vector<std::string> keyIds(argv + 2, argv + argc);
+            bool fetch = command == "fetchKeys";
+            auto results = fetch ? client.fetchKeys(keyIds) : client.deleteKeys(keyIds);
+            return logBatchResults(results, fetch) == 0 ? 0 : 1;
+        } else if (command == "hash") {
+            if (argc < 3 || argc > 4) {
+                logMessage("Usage: " + std::string(argv[0]) + " hash <file> [attest]");
+                return 1;
+            }
+            std::ifstream file(argv[2], std::ios::binary);
+            if (!file) {
+                logErrorMessage("Unable to open " + std::string(argv[2]));
+                return 1;
+            }
+            std::string data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+            DigestResult result = client.hash(data, argc == 4 && std::string(argv[3]) == "attest");
+            logMessage("SHA-256: " + vectorToHex(result.digest));
+            if (!result.ticket.empty()) {
+                logMessage("Hash-check ticket: " + vectorToHex(result.ticket));
+            }
+        } else if (command == "benchHash") {
+            size_t maxBytes = argc >= 3 ? std::stoul(argv[2]) : 16 * 1024 * 1024;
+            benchHash(client, maxBytes, std::chrono::seconds(argc >= 4 ? std::stol(argv[3]) : 2));
+        } else if (command == "encryptFile" || command == "decryptFile") {
+            if (argc < 4 || argc > 5) {
+                logMessage("Usage: " + std::string(argv[0]) + " " + command + " <input> <output> [<context>]");
+                return 1;
+            }
+            std::ifstream input(argv[2], std::ios::binary);
+            if (!input) {
+                logErrorMessage("Unable to open " + std::string(argv[2]));
+                return 1;
+            }
+            std::ofstream output(argv[3], std::ios::binary | std::ios::trunc);
+            if (!output) {
+                logErrorMessage("Unable to create " + std::string(argv[3]));
+                return 1;
+            }
+            std::string context = argc == 5 ? argv[4] : "";
+            uint64_t written = command == "encryptFile" ? client.encryptStream(input, output, context)
+                                                        : client.decryptStream(input, output, context);
+            logMessage("Wrote " + std::to_string(written) + " bytes to " + std::string(argv[3]));
+        } else if (command == "sign") {
+            if (argc < 3 || argc > 4) {
+                logMessage("Usage: " + std::string(argv[0]) + " sign <file> [unbatched]");
+                return 1;
+            }
+            std::ifstream file(argv[2], std::ios::binary);
+            if (!file) {
+                logErrorMessage("Unable to open " + std::string(argv[2]));
+                return 1;
+            }
+            std::string data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+            std::vector<uint8_t> digest = sha256(data);
+            BatchSignature signature = client.sign(digest, !(argc == 4 && std::string(argv[3]) == "unbatched"));
+            logMessage("SHA-256: " + vectorToHex(digest));
+            logMessage("Signature: " + vectorToHex(signature.signature));
+            logMessage("Root: " + vectorToHex(signature.root) + " (leaf " + std::to_string(signature.leafIndex) +
+                       " of " + std::to_string(signature.treeSize) + ")");
+            for (const auto& node : signature.proof) {
+                logMessage("Proof: " + vectorToHex(node));
+            }
+            if (!verifyBatchSignature(digest, signature, client.signingPublicKey())) {
+                logErrorMessage("Signature does not verify");
+                return 1;
+            }
+            logMessage("Signature verified.");
+        } else if (command == "benchSign") {
+            benchSign(client, std::chrono::seconds(argc >= 3 ? std::stol(argv[2]) : 5), argc >= 4 ? std::stoul(argv[3]) : 32);
+        } else if (command == "bench") {
+            LoadBenchConfig benchConfig;
+            benchConfig.duration = std::chrono::seconds(argc >= 3 ? std::stol(argv[2]) : 10);
+            benchConfig.rate = argc >= 4 ? std::stod(argv[3]) : 100;
+            benchConfig.threads = argc >= 5 ? std::stoul(argv[4]) : connectionConfig.size * 4;
+            benchConfig.mix = parseLoadMix(getEnvString("KMS_BENCH_MIX", "generate=1,fetch=6,store=2,delete=1"));
+            benchConfig.seedKeys = static_cast<size_t>(getEnvLong("KMS_BENCH_SEED_KEYS", 64));
+            nlohmann::json report = loadBenchReport(benchConfig, runLoadBenchmark(client, benchConfig));
+            report["connections"] = connectionConfig.size;
+            report["wire_format"] = clientConfig.binaryWire ? "cbor" : "json";
+            std::string outputPath = getEnvString("KMS_BENCH_OUT", "");
+            if (outputPath.empty()) {
+                std::cout << report.dump(2) << std::endl;
+            } else {
+                std::ofstream out(outputPath);
+                out << report.dump(2) << std::endl;
+                if (!out) {
+                    logErrorMessage("Unable to write " + outputPath);
+                    return 1;
+                }
+            }
+        } else if (command == "benchHandshakes") {
+            HandshakeBenchConfig benchConfig;
+            benchConfig.host = connectionConfig.host;
+            benchConfig.port = connectionConfig.port;
+            benchConfig.caCertPath = connectionConfig.caCertPath;
+            benchConfig.verifyServer = connectionConfig.verifyServer;
+            benchConfig.duration = std::chrono::seconds(argc >= 3 ? std::stol(argv[2]) : 10);
+            benchConfig.threads = argc >= 4 ? std::stoul(argv[3]) : 4;
+            for (bool resume : {false, true}) {
+                benchConfig.resume = resume;
+                HandshakeBenchResult result = runHandshakeBenchmark(benchConfig);
+                logMessage(std::string(resume ? "Resumed" : "Full") + " handshakes: " +
+                           std::to_string(static_cast<uint64_t>(result.rate())) + "/s, " +
+                           std::to_string(result.resumed) + "/" + std::to_string(result.handshakes) + " resumed, " +
+                           std::to_string(result.failures) + " failed, p50 " + std::to_string(result.p50Us) +
+                           " us, p99 " + std::to_string(result.p99Us) + " us");
+            }
         } else {
             logMessage("Unknown command: " + command);
             return 1;
@@ -84,3 +372,13 @@ int main(int argc, char* argv[]) {
     return 0;
 }
 
+} // namespace
+
+int main(int argc, char* argv[]) {
+    try {
+        return runClient(argc, argv);
+    } catch (const std::invalid_argument& e) {
+        std::cerr << "Invalid configuration: " << e.what() << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,57 @@
+// config.cpp
+#include "config.h"
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+
+std::string getEnvString(const char* name, const std::string& defaultValue) {
+    const char* value = std::getenv(name);
+    if (value == nullptr || *value == '\0') {
+        return defaultValue;
+    }
+    return value;
+}
+
+long getEnvLong(const char* name, long defaultValue) {
+    const char* value = std::getenv(name);
+    if (value == nullptr || *value == '\0') {
+        return defaultValue;
+    }
+    // strtoul would quietly wrap "-1", and every numeric setting is a count, size, duration or handle.
+    const char* digits = value;
+    while (std::isspace(static_cast<unsigned char>(*digits))) {
+        ++digits;
+    }
+    char* end = nullptr;
+    errno = 0;
+    unsigned long parsed = std::strtoul(digits, &end, 0);
+    if (*digits == '-' || *digits == '+' || end == digits || *end != '\0' || errno == ERANGE ||
+        parsed > static_cast<unsigned long>(std::numeric_limits<long>::max())) {
+        throw std::invalid_argument(std::string(name) + " must be a non-negative decimal or 0x-prefixed integer, not \"" +
+                                    value + "\"");
+    }
+    return static_cast<long>(parsed);
+}
+
+bool getEnvBool(const char* name, bool defaultValue) {
+    std::string value = getEnvString(name, "");
+    if (value.empty()) {
+        return defaultValue;
+    }
+    return value == "1" || value == "true" || value == "yes" || value == "on";
+}
+
+std::vector<std::string> getEnvList(const char* name, char separator) {
+    std::vector<std::string> items;
+    std::stringstream stream(getEnvString(name, ""));
+    std::string item;
+    while (std::getline(stream, item, separator)) {
+        if (!item.empty()) {
+            items.push_back(item);
+        }
+    }
+    return items;
+}
@@ -0,0 +1,18 @@
+// config.h
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <string>
+#include <vector>
+
+// Environment-based configuration helpers. Each subsystem keeps its own
+// config struct with defaults; server_main fills them in from KMS_* variables.
+std::string getEnvString(const char* name, const std::string& defaultValue);
+// Accepts decimal, 0x hex and 0-prefixed octal. Throws std::invalid_argument
+// naming the variable on anything else, including negative numbers.
+long getEnvLong(const char* name, long defaultValue);
+bool getEnvBool(const char* name, bool defaultValue);
+// Splits the value on separator, dropping empty items; empty when unset.
+std::vector<std::string> getEnvList(const char* name, char separator);
+
+#endif // CONFIG_H
@@ -0,0 +1,205 @@
+// entropy_pool.cpp
+#include "entropy_pool.h"
+#include "logger.h"
+#include <openssl/core_names.h>
+#include <openssl/crypto.h>
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+
+constexpr unsigned int drbgStrength = 256;
+constexpr size_t drbgMaxRequest = 1 << 16;
+
+} // namespace
+
+EntropyPool::EntropyPool(Source source, const EntropyPoolConfig& config)
+    : source(std::move(source)), config(config), ring(std::max(config.capacity, seedSize)) {
+    this->config.capacity = ring.size();
+    this->config.lowWaterMark = std::min(this->config.lowWaterMark, this->config.capacity);
+    if (this->config.batchSize == 0) {
+        this->config.batchSize = 32;
+    }
+
+    // The first seed comes straight from the TPM so the DRBG never starts without it.
+    {
+        std::lock_guard<std::mutex> lock(ringMutex);
+        while (depth < seedSize) {
+            std::vector<uint8_t> bytes = this->source(this->config.batchSize);
+            if (bytes.empty()) {
+                throw std::runtime_error("TPM entropy source returned no data");
+            }
+            put(bytes.data(), bytes.size());
+            OPENSSL_cleanse(bytes.data(), bytes.size());
+        }
+    }
+
+    EVP_RAND* rand = EVP_RAND_fetch(nullptr, "CTR-DRBG", nullptr);
+    if (rand == nullptr) {
+        throw std::runtime_error("CTR-DRBG is not available");
+    }
+    drbg = EVP_RAND_CTX_new(rand, nullptr);
+    EVP_RAND_free(rand);
+    if (drbg == nullptr) {
+        throw std::runtime_error("Unable to create DRBG");
+    }
+
+    char cipher[] = "AES-256-CTR";
+    OSSL_PARAM params[] = {
+        OSSL_PARAM_construct_utf8_string(OSSL_DRBG_PARAM_CIPHER, cipher, 0),
+        OSSL_PARAM_construct_end()
+    };
+    uint8_t seed[seedSize];
+    {
+        std::lock_guard<std::mutex> lock(ringMutex);
+        take(seed, seedSize);
+    }
+    // The TPM seed is mixed in as personalization on top of OpenSSL's own seed source.
+    int ok = EVP_RAND_instantiate(drbg, drbgStrength, 0, seed, seedSize, params);
+    OPENSSL_cleanse(seed, seedSize);
+    if (ok != 1) {
+        EVP_RAND_CTX_free(drbg);
+        throw std::runtime_error("Unable to instantiate DRBG");
+    }
+    lastReseed = std::chrono::steady_clock::now();
+
+    refillThread = std::thread(&EntropyPool::refillLoop, this);
+    logMessage("TPM entropy pool started (capacity " + std::to_string(this->config.capacity) + " bytes)", serverLogFile);
+}
+
+EntropyPool::~EntropyPool() {
+    {
+        std::lock_guard<std::mutex> lock(ringMutex);
+        stopping = true;
+    }
+    refillWanted.notify_all();
+    if (refillThread.joinable()) {
+        refillThread.join();
+    }
+    EVP_RAND_CTX_free(drbg);
+}
+
+// Both ring helpers expect ringMutex to be held.
+size_t EntropyPool::take(uint8_t* out, size_t length) {
+    size_t count = std::min(length, depth);
+    size_t first = std::min(count, ring.size() - head);
+    std::memcpy(out, ring.data() + head, first);
+    OPENSSL_cleanse(ring.data() + head, first);
+    std::memcpy(out + first, ring.data(), count - first);
+    OPENSSL_cleanse(ring.data(), count - first);
+    head = (head + count) % ring.size();
+    depth -= count;
+    return count;
+}
+
+void EntropyPool::put(const uint8_t* data, size_t length) {
+    size_t count = std::min(length, ring.size() - depth);
+    size_t tail = (head + depth) % ring.size();
+    size_t first = std::min(count, ring.size() - tail);
+    std::memcpy(ring.data() + tail, data, first);
+    std::memcpy(ring.data(), data + first, count - first);
+    depth += count;
+}
+
+void EntropyPool::refillLoop() {
+    std::unique_lock<std::mutex> lock(ringMutex);
+    while (!stopping) {
+        refillWanted.wait(lock, [this] { return stopping || depth < config.lowWaterMark; });
+
+        while (!stopping && depth < config.capacity) {
+            size_t want = std::min(config.batchSize, config.capacity - depth);
+            lock.unlock();
+            std::vector<uint8_t> bytes;
+            bool failed = false;
+            try {
+                bytes = source(want);
+            } catch (const std::exception &e) {
+                failed = true;
+                ++sourceErrorCount;
+                logErrorMessage("TPM entropy refill failed: " + std::string(e.what()), serverErrorLogFile);
+            }
+            lock.lock();
+            if (failed || bytes.empty()) {
+                // Back off instead of hammering a TPM that is in trouble.
+                refillWanted.wait_for(lock, std::chrono::seconds(1), [this] { return stopping; });
+                break;
+            }
+            put(bytes.data(), bytes.size());
+            OPENSSL_cleanse(bytes.data(), bytes.size());
+            ++refillCount;
+            bytesRefilled += bytes.size();
+        }
+    }
+}
+
+// Expects drbgMutex to be held.
+void EntropyPool::reseedIfDue() {
+    bool due = requestsSinceReseed >= config.reseedRequests ||
+               std::chrono::steady_clock::now() - lastReseed >= config.reseedInterval;
+    if (!due) {
+        return;
+    }
+
+    uint8_t seed[seedSize];
+    size_t taken;
+    bool wantRefill;
+    {
+        std::lock_guard<std::mutex> lock(ringMutex);
+        taken = depth >= seedSize ? take(seed, seedSize) : 0;
+        wantRefill = depth < config.lowWaterMark;
+    }
+    if (wantRefill) {
+        refillWanted.notify_one();
+    }
+    if (taken < seedSize) {
+        // Keep serving from the current DRBG state; the next call tries again.
+        ++deferredReseedCount;
+        return;
+    }
+
+    int ok = EVP_RAND_reseed(drbg, 0, seed, seedSize, nullptr, 0);
+    OPENSSL_cleanse(seed, seedSize);
+    if (ok != 1) {
+        logErrorMessage("DRBG reseed failed", serverErrorLogFile);
+        return;
+    }
+    ++reseedCount;
+    requestsSinceReseed = 0;
+    lastReseed = std::chrono::steady_clock::now();
+}
+
+void EntropyPool::generate(uint8_t* out, size_t length) {
+    std::lock_guard<std::mutex> lock(drbgMutex);
+    reseedIfDue();
+    while (length > 0) {
+        size_t chunk = std::min(length, drbgMaxRequest);
+        if (EVP_RAND_generate(drbg, out, chunk, drbgStrength, 0, nullptr, 0) != 1) {
+            throw std::runtime_error("DRBG generate failed");
+        }
+        out += chunk;
+        length -= chunk;
+    }
+    ++requestsSinceReseed;
+}
+
+std::vector<uint8_t> EntropyPool::generate(size_t length) {
+    std::vector<uint8_t> bytes(length);
+    generate(bytes.data(), bytes.size());
+    return bytes;
+}
+
+EntropyPoolStats EntropyPool::stats() const {
+    EntropyPoolStats result;
+    {
+        std::lock_guard<std::mutex> lock(ringMutex);
+        result.depth = depth;
+    }
+    result.capacity = config.capacity;
+    result.refills = refillCount;
+    result.bytesRefilled = bytesRefilled;
+    result.reseeds = reseedCount;
+    result.deferredReseeds = deferredReseedCount;
+    result.sourceErrors = sourceErrorCount;
+    return result;
+}
@@ -0,0 +1,84 @@
+// entropy_pool.h
+#ifndef ENTROPY_POOL_H
+#define ENTROPY_POOL_H
+
+#include "locked_buffer.h"
+#include <openssl/evp.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct EntropyPoolConfig {
+    size_t capacity = 4096;                    // bytes of TPM output kept in the ring
+    size_t lowWaterMark = 1024;                // refill thread wakes below this depth
+    size_t batchSize = 64;                     // bytes per GetRandom, clamped to the TPM's max digest
+    std::chrono::seconds reseedInterval{60};   // DRBG reseeds at least this often
+    uint64_t reseedRequests = 4096;            // ...or after this many generate calls
+};
+
+struct EntropyPoolStats {
+    size_t depth = 0;
+    size_t capacity = 0;
+    uint64_t refills = 0;          // GetRandom batches pulled by the refill thread
+    uint64_t bytesRefilled = 0;
+    uint64_t reseeds = 0;
+    uint64_t deferredReseeds = 0;  // reseed due but the ring was empty
+    uint64_t sourceErrors = 0;
+};
+
+// TPM entropy collected in the background into an mlock'd ring buffer, used to
+// seed and reseed an OpenSSL CTR-DRBG. Callers never wait on the TPM.
+class EntropyPool {
+public:
+    // Returns up to `bytes` of fresh entropy; may throw.
+    using Source = std::function<std::vector<uint8_t>(size_t bytes)>;
+
+    EntropyPool(Source source, const EntropyPoolConfig& config = EntropyPoolConfig());
+    ~EntropyPool();
+
+    EntropyPool(const EntropyPool&) = delete;
+    EntropyPool& operator=(const EntropyPool&) = delete;
+
+    void generate(uint8_t* out, size_t length);
+    std::vector<uint8_t> generate(size_t length);
+
+    EntropyPoolStats stats() const;
+
+private:
+    static constexpr size_t seedSize = 48;   // AES-256 CTR-DRBG seed length
+
+    size_t take(uint8_t* out, size_t length);
+    void put(const uint8_t* data, size_t length);
+    void refillLoop();
+    void reseedIfDue();
+
+    Source source;
+    EntropyPoolConfig config;
+
+    mutable std::mutex ringMutex;
+    std::condition_variable refillWanted;
+    LockedBuffer ring;
+    size_t head = 0;    // next byte to read
+    size_t depth = 0;
+    bool stopping = false;
+
+    std::mutex drbgMutex;
+    EVP_RAND_CTX* drbg = nullptr;
+    std::chrono::steady_clock::time_point lastReseed;
+    uint64_t requestsSinceReseed = 0;
+
+    std::atomic<uint64_t> refillCount{0};
+    std::atomic<uint64_t> bytesRefilled{0};
+    std::atomic<uint64_t> reseedCount{0};
+    std::atomic<uint64_t> deferredReseedCount{0};
+    std::atomic<uint64_t> sourceErrorCount{0};
+
+    std::thread refillThread;
+};
+
+#endif // ENTROPY_POOL_H
@@ -0,0 +1,137 @@
+// envelope_cipher.cpp
+#include "envelope_cipher.h"
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+
+namespace {
+
+constexpr uint8_t wrapFormat = 1;
+constexpr size_t ivSize = 12;
+constexpr size_t tagSize = 16;
+constexpr size_t headerSize = 1 + 4 + ivSize;
+
+using CipherCtx = std::unique_ptr<EVP_CIPHER_CTX, decltype(&EVP_CIPHER_CTX_free)>;
+
+CipherCtx newCipherCtx() {
+    CipherCtx ctx(EVP_CIPHER_CTX_new(), EVP_CIPHER_CTX_free);
+    if (!ctx) {
+        throw std::runtime_error("Unable to allocate cipher context");
+    }
+    return ctx;
+}
+
+} // namespace
+
+void EnvelopeCipher::installKek(uint32_t version, const uint8_t* kek, size_t size) {
+    if (size != kekSize) {
+        throw std::runtime_error("Key-encryption key must be 32 bytes");
+    }
+    LockedBuffer buffer(kekSize);
+    std::memcpy(buffer.data(), kek, kekSize);
+
+    std::unique_lock<std::shared_mutex> lock(kekMutex);
+    keks.erase(version);
+    keks.emplace(version, std::move(buffer));
+    if (version >= activeVersion) {
+        activeVersion = version;
+    }
+}
+
+bool EnvelopeCipher::hasKek() const {
+    std::shared_lock<std::shared_mutex> lock(kekMutex);
+    return !keks.empty();
+}
+
+uint32_t EnvelopeCipher::currentVersion() const {
+    std::shared_lock<std::shared_mutex> lock(kekMutex);
+    return activeVersion;
+}
+
+std::vector<uint8_t> EnvelopeCipher::wrap(const KeyBuffer& plaintext, const std::string& context) const {
+    std::vector<uint8_t> out(headerSize + plaintext.size() + tagSize);
+    uint8_t* iv = out.data() + 5;
+    if (RAND_bytes(iv, ivSize) != 1) {
+        throw std::runtime_error("Unable to generate IV");
+    }
+
+    auto ctx = newCipherCtx();
+    int len = 0;
+    uint32_t version;
+    {
+        std::shared_lock<std::shared_mutex> lock(kekMutex);
+        auto it = keks.find(activeVersion);
+        if (it == keks.end()) {
+            throw std::runtime_error("No key-encryption key installed");
+        }
+        version = activeVersion;
+        if (EVP_EncryptInit_ex(ctx.get(), EVP_aes_256_gcm(), nullptr, it->second.data(), iv) != 1) {
+            throw std::runtime_error("Error initializing data key wrap");
+        }
+    }
+
+    out[0] = wrapFormat;
+    out[1] = static_cast<uint8_t>(version >> 24);
+    out[2] = static_cast<uint8_t>(version >> 16);
+    out[3] = static_cast<uint8_t>(version >> 8);
+    out[4] = static_cast<uint8_t>(version);
+
+    // The header is authenticated too, so the KEK version cannot be swapped.
+    if (EVP_EncryptUpdate(ctx.get(), nullptr, &len, out.data(), headerSize) != 1 ||
+        (!context.empty() &&
+         EVP_EncryptUpdate(ctx.get(), nullptr, &len, reinterpret_cast<const uint8_t*>(context.data()), context.size()) != 1)) {
+        throw std::runtime_error("Error wrapping data key");
+    }
+
+    uint8_t* ciphertext = out.data() + headerSize;
+    if (EVP_EncryptUpdate(ctx.get(), ciphertext, &len, plaintext.data(), plaintext.size()) != 1 ||
+        EVP_EncryptFinal_ex(ctx.get(), ciphertext + len, &len) != 1 ||
+        EVP_CIPHER_CTX_ctrl(ctx.get(), EVP_CTRL_GCM_GET_TAG, tagSize, ciphertext + plaintext.size()) != 1) {
+        throw std::runtime_error("Error wrapping data key");
+    }
+    return out;
+}
+
+uint32_t EnvelopeCipher::kekVersionOf(const std::vector<uint8_t>& wrapped) {
+    if (wrapped.size() < headerSize + tagSize || wrapped[0] != wrapFormat) {
+        throw std::runtime_error("Malformed wrapped data key");
+    }
+    return (static_cast<uint32_t>(wrapped[1]) << 24) | (static_cast<uint32_t>(wrapped[2]) << 16) |
+           (static_cast<uint32_t>(wrapped[3]) << 8) | static_cast<uint32_t>(wrapped[4]);
+}
+
+KeyBuffer EnvelopeCipher::unwrap(const std::vector<uint8_t>& wrapped, const std::string& context) const {
+    uint32_t version = kekVersionOf(wrapped);
+    const uint8_t* iv = wrapped.data() + 5;
+    const uint8_t* ciphertext = wrapped.data() + headerSize;
+    size_t ciphertextSize = wrapped.size() - headerSize - tagSize;
+
+    auto ctx = newCipherCtx();
+    {
+        std::shared_lock<std::shared_mutex> lock(kekMutex);
+        auto it = keks.find(version);
+        if (it == keks.end()) {
+            throw std::runtime_error("Unknown key-encryption key version");
+        }
+        if (EVP_DecryptInit_ex(ctx.get(), EVP_aes_256_gcm(), nullptr, it->second.data(), iv) != 1) {
+            throw std::runtime_error("Error initializing data key unwrap");
+        }
+    }
+
+    int len = 0;
+    // Decrypted straight into locked memory; the buffer wipes itself if authentication fails.
+    KeyBuffer plaintext(ciphertextSize);
+    std::vector<uint8_t> tag(wrapped.end() - tagSize, wrapped.end());
+    if (EVP_DecryptUpdate(ctx.get(), nullptr, &len, wrapped.data(), headerSize) != 1 ||
+        (!context.empty() &&
+         EVP_DecryptUpdate(ctx.get(), nullptr, &len, reinterpret_cast<const uint8_t*>(context.data()), context.size()) != 1) ||
+        EVP_DecryptUpdate(ctx.get(), plaintext.data(), &len, ciphertext, ciphertextSize) != 1 ||
+        EVP_CIPHER_CTX_ctrl(ctx.get(), EVP_CTRL_GCM_SET_TAG, tagSize, tag.data()) != 1 ||
+        EVP_DecryptFinal_ex(ctx.get(), plaintext.data() + len, &len) != 1) {
+        throw std::runtime_error("Data key authentication failed");
+    }
+    return plaintext;
+}
@@ -0,0 +1,35 @@
+// envelope_cipher.h
+#ifndef ENVELOPE_CIPHER_H
+#define ENVELOPE_CIPHER_H
+
+#include "key_buffer.h"
+#include "locked_buffer.h"
+#include <cstdint>
+#include <map>
+#include <shared_mutex>
+#include <string>
+#include <vector>
+
+// Software AES-256-GCM wrapping of data keys under an in-memory KEK.
+// Wrapped blobs are: format byte | KEK version (u32, big endian) | 12-byte IV |
+// ciphertext | 16-byte tag. The optional context string is bound as AAD.
+// Older KEK versions stay installed so blobs wrapped before a rotation still open.
+class EnvelopeCipher {
+public:
+    static constexpr size_t kekSize = 32;
+
+    void installKek(uint32_t version, const uint8_t* kek, size_t size);
+    bool hasKek() const;
+    uint32_t currentVersion() const;
+
+    std::vector<uint8_t> wrap(const KeyBuffer& plaintext, const std::string& context) const;
+    KeyBuffer unwrap(const std::vector<uint8_t>& wrapped, const std::string& context) const;
+    static uint32_t kekVersionOf(const std::vector<uint8_t>& wrapped);
+
+private:
+    mutable std::shared_mutex kekMutex;
+    std::map<uint32_t, LockedBuffer> keks;
+    uint32_t activeVersion = 0;
+};
+
+#endif // ENVELOPE_CIPHER_H
@@ -4,15 +4,27 @@
 #include <nlohmann/json.hpp>
 #include <iostream>
 #include <fstream>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cerrno>
+#include <cstdio>
 #include <cstdlib>
+#include <exception>
+#include <map>
 #include <string>
+#include <thread>
 #include "logger.h"
+#include "metrics.h"
+#include "cbor.h"
+#include "key_wire.h"
+#include "tpm_hash_stream.h"
+#include "stream_cipher.h"
+#include "spill_buffer.h"
+#include "key_arena.h"
 
-#define SSL_CERT_FILE "/home/alexey/Documents/mit/app2/project/certs/myapp-localhost.crt"
-#define SSL_KEY_FILE "/home/alexey/Documents/mit/app2/project/certs/myapp-localhost.key"
-
-void generateSelfSignedCertificate() {
-    std::string command = "openssl req -x509 -nodes -days 365 -newkey rsa:2048 -keyout " SSL_KEY_FILE " -out " SSL_CERT_FILE " -subj \"/C=US/ST=Denial/L=Springfield/O=Dis/CN=www.example.com\"";
+void generateSelfSignedCertificate(const std::string& certPath, const std::string& keyPath) {
+    std::string command = "openssl req -x509 -nodes -days 365 -newkey rsa:2048 -keyout " + keyPath + " -out " + certPath + " -subj \"/C=US/ST=Denial/L=Springfield/O=Dis/CN=www.example.com\"";
     int result = std::system(command.c_str());
     if (result != 0) {
         throw std::runtime_error("Failed to generate self-signed certificate");
@@ -20,71 +32,542 @@ void generateSelfSignedCertificate() {
     logMessage("Self-signed certificate generated successfully.", serverLogFile);
 }
 
-void startKMSServer(KeyManager &keyManager) {
-    httplib::SSLServer svr(SSL_CERT_FILE, SSL_KEY_FILE);
+// Upper bound on items per batch request, so one request cannot hold the TPM indefinitely.
+static const size_t maxBatchSize = 10000;
+
+// The same bounds for replication requests: changes or keys per reply, and
+// how long a poll may hold a worker thread.
+static const size_t maxReplicationItems = 4096;
+static const uint64_t maxReplicationWaitMs = 30000;
+
+// Sent with every response of a primary or replica; a client passes the one
+// from a write to a replica read to see that write.
+static const char* const replicationTokenHeader = "X-KMS-Replication-Token";
+
+// Replication requests must be signed with the replication key. Checked
+// before anything else, so an unauthenticated caller cannot read the feed or
+// make the primary unseal a snapshot page.
+bool authorizeReplication(const KeyManager &keyManager, const httplib::Request &req, httplib::Response &res) {
+    if (keyManager.checkReplicationRequestAuth(req.path, req.params, req.get_header_value(replicationAuthHeader))) {
+        return true;
+    }
+    res.status = 401;
+    res.set_content("Replication request not authenticated", "application/json");
+    logErrorMessage("Rejected unauthenticated request to " + req.path, serverErrorLogFile);
+    return false;
+}
+
+// Routes that change the key store or KEKs, which a replica refuses.
+bool isWriteRoute(const std::string& path) {
+    static const char* const writes[] = {"/generate-key", "/store-key", "/rotate-key", "/generate-keys",
+                                         "/store-keys", "/delete-keys", "/rotate-kek"};
+    for (const char* route : writes) {
+        if (path == route) {
+            return true;
+        }
+    }
+    return path.rfind("/delete-key/", 0) == 0;
+}
+
+uint64_t unsignedParam(const httplib::Request &req, const std::string& name, int base, uint64_t defaultValue) {
+    if (!req.has_param(name)) {
+        return defaultValue;
+    }
+    std::string value = req.get_param_value(name);
+    char* end = nullptr;
+    errno = 0;
+    unsigned long long parsed = std::strtoull(value.c_str(), &end, base);
+    if (value.empty() || *end != '\0' || errno == ERANGE || value[0] == '-') {
+        throw std::invalid_argument(name + " must be an unsigned integer");
+    }
+    return parsed;
+}
+
+nlohmann::json batchResultsToJson(const std::vector<KeyResult>& results, bool includeKeys) {
+    nlohmann::json items = nlohmann::json::array();
+    for (const auto& result : results) {
+        nlohmann::json item = {{"key_id", result.keyId}};
+        if (result.error.empty()) {
+            item["status"] = "ok";
+            if (includeKeys) {
+                item["key"] = keyToJson(result.key);
+            }
+        } else {
+            item["status"] = "error";
+            item["error"] = result.error;
+        }
+        items.push_back(std::move(item));
+    }
+    return nlohmann::json{{"results", std::move(items)}};
+}
+
+void checkBatchSize(size_t size) {
+    if (size > maxBatchSize) {
+        throw std::invalid_argument("Batch too large (max " + std::to_string(maxBatchSize) + " keys)");
+    }
+}
+
+// Bodies are JSON unless the request says otherwise; replies are CBOR when the
+// client lists application/cbor in Accept. CBOR bodies are decoded field by
+// field and key bytes are written straight into the reply, with no json tree.
+bool isCborRequest(const httplib::Request &req) {
+    return req.get_header_value("Content-Type").rfind(cborContentType, 0) == 0;
+}
+
+bool wantsCbor(const httplib::Request &req) {
+    return req.get_header_value("Accept").find(cborContentType) != std::string::npos;
+}
+
+std::vector<std::string> parseKeyIds(const httplib::Request &req) {
+    std::vector<std::string> key_ids;
+    if (isCborRequest(req)) {
+        readCborMap(req.body, [&](const std::string& name, CborReader& reader) {
+            if (name != "key_ids") {
+                return false;
+            }
+            size_t count = reader.array();
+            checkBatchSize(count);
+            key_ids.reserve(count);
+            for (size_t i = 0; i < count; ++i) {
+                key_ids.push_back(reader.text());
+            }
+            return true;
+        });
+    } else {
+        key_ids = nlohmann::json::parse(req.body).at("key_ids").get<std::vector<std::string>>();
+    }
+    checkBatchSize(key_ids.size());
+    return key_ids;
+}
+
+std::pair<std::string, KeyBuffer> parseStoreKey(const httplib::Request &req) {
+    if (!isCborRequest(req)) {
+        auto json = nlohmann::json::parse(req.body);
+        return {json.at("key_id").get<std::string>(), keyFromJson(json.at("key"))};
+    }
+    std::pair<std::string, KeyBuffer> entry;
+    bool haveId = false, haveKey = false;
+    readCborMap(req.body, [&](const std::string& name, CborReader& reader) {
+        if (name == "key_id") {
+            entry.first = reader.text();
+            haveId = true;
+        } else if (name == "key") {
+            entry.second = keyFromCbor(reader);
+            haveKey = true;
+        } else {
+            return false;
+        }
+        return true;
+    });
+    if (!haveId || !haveKey) {
+        throw std::invalid_argument("key_id and key are required");
+    }
+    return entry;
+}
+
+std::vector<std::pair<std::string, KeyBuffer>> parseStoreKeys(const httplib::Request &req) {
+    std::vector<std::pair<std::string, KeyBuffer>> entries;
+    if (!isCborRequest(req)) {
+        auto json = nlohmann::json::parse(req.body);
+        const auto& items = json.at("keys");
+        checkBatchSize(items.size());
+        entries.reserve(items.size());
+        for (const auto& item : items) {
+            entries.emplace_back(item.at("key_id").get<std::string>(), keyFromJson(item.at("key")));
+        }
+        return entries;
+    }
+    readCborMap(req.body, [&](const std::string& name, CborReader& reader) {
+        if (name != "keys") {
+            return false;
+        }
+        size_t count = reader.array();
+        checkBatchSize(count);
+        entries.resize(count);
+        for (auto& entry : entries) {
+            for (size_t fields = reader.map(); fields > 0; --fields) {
+                std::string field = reader.text();
+                if (field == "key_id") {
+                    entry.first = reader.text();
+                } else if (field == "key") {
+                    entry.second = keyFromCbor(reader);
+                } else {
+                    reader.skip();
+                }
+            }
+        }
+        return true;
+    });
+    return entries;
+}
+
+size_t parseCount(const httplib::Request &req) {
+    size_t count = 0;
+    if (isCborRequest(req)) {
+        readCborMap(req.body, [&](const std::string& name, CborReader& reader) {
+            if (name != "count") {
+                return false;
+            }
+            count = static_cast<size_t>(std::min<uint64_t>(reader.unsignedInt(), maxBatchSize + 1));
+            return true;
+        });
+    } else {
+        count = nlohmann::json::parse(req.body).at("count").get<size_t>();
+    }
+    if (count == 0 || count > maxBatchSize) {
+        throw std::invalid_argument("count must be between 1 and " + std::to_string(maxBatchSize));
+    }
+    return count;
+}
+
+void replyKey(const httplib::Request &req, httplib::Response &res, const std::string& keyId, const KeyBuffer& key) {
+    bool cbor = wantsCbor(req);
+    res.set_content(encodeKeyReply(keyId, key, cbor), cbor ? cborContentType : "application/json");
+}
+
+void replyBatch(const httplib::Request &req, httplib::Response &res, const std::vector<KeyResult>& results, bool includeKeys) {
+    if (!wantsCbor(req)) {
+        res.set_content(batchResultsToJson(results, includeKeys).dump(), "application/json");
+        return;
+    }
+    CborWriter writer;
+    writer.map(1);
+    writer.text("results");
+    writer.array(results.size());
+    for (const auto& result : results) {
+        bool ok = result.error.empty();
+        writer.map(!ok || includeKeys ? 3 : 2);
+        writer.field("key_id", result.keyId);
+        writer.field("status", ok ? "ok" : "error");
+        if (!ok) {
+            writer.field("error", result.error);
+        } else if (includeKeys) {
+            writeKeyField(writer, "key", result.key);
+        }
+    }
+    res.set_content(writer.release(), cborContentType);
+}
+
+void countRequest(const std::string& route, int status) {
+    thread_local std::map<std::pair<std::string, int>, MetricId> requestIds;
+    auto key = std::make_pair(route, status);
+    auto it = requestIds.find(key);
+    if (it == requestIds.end()) {
+        MetricId id = registerCounter("kms_http_requests_total",
+                                      metricLabel("route", route) + "," + metricLabel("status", std::to_string(status)),
+                                      "HTTP requests handled, by route and status code");
+        it = requestIds.emplace(key, id).first;
+    }
+    incrementCounter(it->second);
+}
 
-    svr.Post("/generate-key", [&](const httplib::Request &req, httplib::Response &res) {
+MetricId routeLatency(const std::string& route) {
+    return registerHistogram("kms_http_request_duration_seconds", metricLabel("route", route),
+                             "Time spent handling HTTP requests, by route");
+}
+
+// Records latency per route pattern (not per path, so key ids do not become
+// series) and a request count by status code.
+httplib::Server::Handler instrumented(const std::string& route, httplib::Server::Handler handler) {
+    MetricId latency = routeLatency(route);
+    return [=](const httplib::Request &req, httplib::Response &res) {
+        auto start = std::chrono::steady_clock::now();
+        handler(req, res);
+        observeDuration(latency, std::chrono::steady_clock::now() - start);
+        countRequest(route, res.status);
+    };
+}
+
+// The same for handlers that consume the request body as it arrives.
+httplib::Server::HandlerWithContentReader instrumented(const std::string& route, httplib::Server::HandlerWithContentReader handler) {
+    MetricId latency = routeLatency(route);
+    return [=](const httplib::Request &req, httplib::Response &res, const httplib::ContentReader &content) {
+        auto start = std::chrono::steady_clock::now();
+        handler(req, res, content);
+        observeDuration(latency, std::chrono::steady_clock::now() - start);
+        countRequest(route, res.status);
+    };
+}
+
+// Feeds the raw request body to consume as it arrives. An exception thrown by
+// consume stops the upload and is rethrown here rather than inside httplib.
+template <typename Consume>
+void readBody(const httplib::Request &req, const httplib::ContentReader &content, Consume&& consume) {
+    if (req.is_multipart_form_data()) {
+        throw std::invalid_argument("Send the data as the raw request body");
+    }
+    std::exception_ptr failure;
+    bool complete = content([&](const char *data, size_t size) {
+        try {
+            consume(reinterpret_cast<const uint8_t*>(data), size);
+            return true;
+        } catch (...) {
+            failure = std::current_exception();
+            return false;
+        }
+    });
+    if (failure) {
+        std::rethrow_exception(failure);
+    }
+    if (!complete) {
+        throw std::runtime_error("Error reading request body");
+    }
+}
+
+constexpr size_t responseBlockSize = 64 * 1024;
+
+// Sends a finished spill buffer as the response body, one block at a time.
+void replyFromSpill(httplib::Response &res, std::shared_ptr<SpillBuffer> spill) {
+    std::vector<uint8_t> block(responseBlockSize);
+    res.set_content_provider(spill->size(), "application/octet-stream",
+        [spill, block](size_t offset, size_t length, httplib::DataSink &sink) mutable {
+            size_t n = spill->read(offset, block.data(), std::min(length, block.size()));
+            return n > 0 && sink.write(reinterpret_cast<const char*>(block.data()), n);
+        });
+}
+
+// Decrypts a stream that has already been authenticated while it was uploaded,
+// writing each frame's plaintext straight to the response.
+void replyDecrypted(httplib::Response &res, std::shared_ptr<SpillBuffer> ciphertext, uint64_t plaintextSize,
+                    StreamDecryptor::KeyUnwrapper unwrap) {
+    struct State {
+        std::shared_ptr<SpillBuffer> ciphertext;
+        uint64_t offset = 0;
+        std::vector<uint8_t> block;
+        httplib::DataSink *sink = nullptr;
+        std::unique_ptr<StreamDecryptor> decryptor;
+    };
+    auto state = std::make_shared<State>();
+    state->ciphertext = std::move(ciphertext);
+    state->block.resize(responseBlockSize);
+    State *raw = state.get();
+    state->decryptor = std::make_unique<StreamDecryptor>(std::move(unwrap), [raw](const uint8_t* data, size_t size) {
+        if (!raw->sink->write(reinterpret_cast<const char*>(data), size)) {
+            throw std::runtime_error("Client stopped reading");
+        }
+    });
+    res.set_content_provider(plaintextSize, "application/octet-stream",
+        [state](size_t, size_t, httplib::DataSink &sink) {
+            state->sink = &sink;
+            try {
+                size_t n = state->ciphertext->read(state->offset, state->block.data(), state->block.size());
+                if (n == 0) {
+                    return false;
+                }
+                state->offset += n;
+                state->decryptor->update(state->block.data(), n);
+                return true;
+            } catch (const std::exception &e) {
+                logErrorMessage("Error sending decrypted stream: " + std::string(e.what()), serverErrorLogFile);
+                return false;
+            }
+        });
+}
+
+// Point-in-time values owned by other components, rendered next to the histograms.
+std::string componentMetrics(KeyManager &keyManager) {
+    auto pool = keyManager.contextPoolStats();
+    auto scheduler = keyManager.schedulerStats();
+    auto objects = keyManager.objectCacheStats();
+    auto entropy = keyManager.entropyPoolStats();
+    auto rotation = keyManager.keyRotationStats();
+    auto signer = keyManager.batchSignerStats();
+    auto arena = KeyArena::instance().stats();
+    auto logging = loggerStats();
+    std::string out;
+    appendMetric(out, "kms_tpm_contexts_available", "gauge", "Idle contexts in the TPM context pool", pool.available);
+    appendMetric(out, "kms_tpm_context_reconnects_total", "counter", "TPM contexts re-initialized after a TCTI failure", pool.reconnects);
+    appendMetric(out, "kms_tpm_scheduler_queue_depth", "gauge", "Requests waiting for the TPM scheduler", scheduler.queueDepth);
+    appendMetric(out, "kms_tpm_scheduler_in_flight", "gauge", "TPM commands currently in flight", scheduler.inFlight);
+    size_t healthyDevices = 0;
+    auto devices = keyManager.tpmDeviceStats();
+    for (const auto& device : devices) {
+        healthyDevices += device.healthy ? 1 : 0;
+    }
+    if (!devices.empty()) {
+        appendMetric(out, "kms_tpm_devices_healthy", "gauge", "Sharded TPMs currently taking new work", healthyDevices);
+    }
+    appendMetric(out, "kms_tpm_object_cache_hits_total", "counter", "Sealed objects found already loaded", objects.hits);
+    appendMetric(out, "kms_tpm_object_cache_misses_total", "counter", "Sealed objects loaded with Esys_Load", objects.misses);
+    appendMetric(out, "kms_entropy_pool_bytes", "gauge", "Random bytes buffered in the entropy pool", entropy.depth);
+    appendMetric(out, "kms_keys", "gauge", "Sealed keys in the key store", keyManager.keyCount());
+    appendMetric(out, "kms_keys_retired_total", "counter", "Expired keys erased by rotation", rotation.retired);
+    appendMetric(out, "kms_sign_requests_total", "counter", "Digests signed", signer.requests);
+    appendMetric(out, "kms_sign_batches_total", "counter", "TPM signatures over a batch root", signer.batches);
+    appendMetric(out, "kms_key_arena_locked_bytes", "gauge", "Locked memory reserved for plaintext keys", arena.lockedBytes);
+    appendMetric(out, "kms_key_arena_slots_in_use", "gauge", "Plaintext keys currently held in the key arena", arena.slotsInUse);
+    auto replication = keyManager.replicationStats();
+    if (replication.role == ReplicationRole::Replica) {
+        appendMetric(out, "kms_replication_lag_changes", "gauge", "Primary changes this replica has not applied yet", replication.lagChanges);
+        appendMetric(out, "kms_replication_lag_seconds", "gauge", "Time since this replica last held everything the primary had", replication.lagMs / 1000.0);
+        appendMetric(out, "kms_replication_failures_total", "counter", "Replication polls and applies that failed", replication.failures);
+    } else if (replication.role == ReplicationRole::Primary) {
+        appendMetric(out, "kms_replication_last_seq", "gauge", "Newest change in the replication feed", replication.lastSeq);
+    }
+    appendMetric(out, "kms_log_records_dropped_total", "counter", "Log records dropped because the ring was full", logging.dropped);
+    return out;
+}
+
+void startKMSServer(KeyManager &keyManager, const KMSServerConfig &config) {
+    httplib::SSLServer svr(config.certPath.c_str(), config.keyPath.c_str());
+    if (!svr.is_valid()) {
+        logErrorMessage("Unable to load server certificate " + config.certPath + " or key " + config.keyPath, serverErrorLogFile);
+        throw std::runtime_error("Unable to set up TLS server");
+    }
+    configureSessionResumption(svr.ssl_context(), config.tls);
+
+    size_t workers = config.workerThreads;
+    if (workers == 0) {
+        workers = std::max<size_t>(std::thread::hardware_concurrency(), 8);
+    }
+    size_t maxQueued = config.maxQueuedRequests;
+    svr.new_task_queue = [workers, maxQueued] { return new httplib::ThreadPool(workers, maxQueued); };
+    svr.set_keep_alive_max_count(config.keepAliveMaxCount);
+    svr.set_keep_alive_timeout(config.keepAliveTimeout.count());
+    svr.set_read_timeout(config.readTimeout.count(), 0);
+    svr.set_write_timeout(config.writeTimeout.count(), 0);
+
+    // A replica refuses writes, and holds a read that carries a replication
+    // token until it has applied that token or replicationWait passes.
+    ReplicationRole role = keyManager.replicationRole();
+    if (role == ReplicationRole::Replica) {
+        svr.set_pre_routing_handler([&](const httplib::Request &req, httplib::Response &res) {
+            if (isWriteRoute(req.path)) {
+                res.status = 403;
+                res.set_content("This server is a read-only replica; send writes to the primary", "application/json");
+                return httplib::HandlerResponse::Handled;
+            }
+            if (!req.has_header(replicationTokenHeader)) {
+                return httplib::HandlerResponse::Unhandled;
+            }
+            ReplicationToken token;
+            if (!parseReplicationToken(req.get_header_value(replicationTokenHeader), token)) {
+                res.status = 400;
+                res.set_content("Malformed replication token", "application/json");
+                return httplib::HandlerResponse::Handled;
+            }
+            if (!keyManager.waitForReplication(token, config.replicationWait)) {
+                res.status = 503;
+                res.set_header("Retry-After", "1");
+                res.set_content("Replica has not caught up with the replication token", "application/json");
+                return httplib::HandlerResponse::Handled;
+            }
+            return httplib::HandlerResponse::Unhandled;
+        });
+    }
+    if (role != ReplicationRole::Standalone) {
+        svr.set_post_routing_handler([&](const httplib::Request &, httplib::Response &res) {
+            res.set_header(replicationTokenHeader, formatReplicationToken(keyManager.replicationToken()));
+        });
+    }
+
+    // Primary side of log shipping; see replica_sync.h for the other end.
+    // Both answer in CBOR. 410 tells the replica to take a snapshot.
+    svr.Get("/replication/changes", instrumented("/replication/changes", [&](const httplib::Request &req, httplib::Response &res) {
+        if (!authorizeReplication(keyManager, req, res)) {
+            return;
+        }
+        try {
+            uint64_t epoch = unsignedParam(req, "epoch", 16, 0);
+            uint64_t after = unsignedParam(req, "after", 10, 0);
+            size_t limit = static_cast<size_t>(std::min<uint64_t>(unsignedParam(req, "limit", 10, 1024), maxReplicationItems));
+            auto wait = std::chrono::milliseconds(std::min(unsignedParam(req, "wait_ms", 10, 0), maxReplicationWaitMs));
+            ReplicationBatch batch;
+            if (!keyManager.replicationChanges(epoch, after, std::max<size_t>(limit, 1), wait, batch)) {
+                res.status = 410;
+            }
+            res.set_content(encodeReplicationBatch(batch), cborContentType);
+        } catch (const std::invalid_argument &e) {
+            res.status = 400;
+            res.set_content(e.what(), "application/json");
+            logErrorMessage("Invalid replication request: " + std::string(e.what()), serverErrorLogFile);
+        } catch (const std::exception &e) {
+            res.status = 500;
+            res.set_content(e.what(), "application/json");
+            logErrorMessage("Error reading replication changes: " + std::string(e.what()), serverErrorLogFile);
+        }
+    }));
+
+    svr.Get("/replication/snapshot", instrumented("/replication/snapshot", [&](const httplib::Request &req, httplib::Response &res) {
+        logMessage("Received request to /replication/snapshot", serverLogFile);
+        if (!authorizeReplication(keyManager, req, res)) {
+            return;
+        }
+        try {
+            size_t limit = static_cast<size_t>(std::min<uint64_t>(unsignedParam(req, "limit", 10, 256), maxReplicationItems));
+            auto page = keyManager.replicationSnapshot(req.get_param_value("after"), std::max<size_t>(limit, 1));
+            res.set_content(encodeReplicationSnapshot(page), cborContentType);
+        } catch (const std::invalid_argument &e) {
+            res.status = 400;
+            res.set_content(e.what(), "application/json");
+            logErrorMessage("Invalid replication request: " + std::string(e.what()), serverErrorLogFile);
+        } catch (const std::exception &e) {
+            res.status = 500;
+            res.set_content(e.what(), "application/json");
+            logErrorMessage("Error reading replication snapshot: " + std::string(e.what()), serverErrorLogFile);
+        }
+    }));
+
+    svr.Post("/generate-key", instrumented("/generate-key", [&](const httplib::Request &req, httplib::Response &res) {
         logMessage("Received request to /generate-key", serverLogFile);
         try {
-            auto key = keyManager.generateTPMSymmetricKey();
-            std::vector<uint8_t> keyVector = key;
-            std::string keyId = std::to_string(std::time(nullptr)); // Generate key ID based on the current time
-            keyManager.addKey(keyId, keyVector);
-            nlohmann::json json = {{"key_id", keyId}, {"key", nlohmann::json::binary_t(keyVector)}};
-            res.set_content(json.dump(), "application/json");
+            auto generated = keyManager.generateKey();
+            replyKey(req, res, generated.keyId, generated.key);
         } catch (const std::exception &e) {
             res.status = 500;
             res.set_content(e.what(), "application/json");
             logErrorMessage("Error generating key: " + std::string(e.what()), serverErrorLogFile);
         }
-    });
+    }));
 
-    svr.Post("/store-key", [&](const httplib::Request &req, httplib::Response &res) {
+    svr.Post("/store-key", instrumented("/store-key", [&](const httplib::Request &req, httplib::Response &res) {
         logMessage("Received request to /store-key", serverLogFile);
         try {
-            auto json = nlohmann::json::parse(req.body);
-            std::string key_id = json.at("key_id").get<std::string>();
-            std::vector<uint8_t> keyVector = json.at("key").get<std::vector<uint8_t>>();
-            keyManager.addKey(key_id, keyVector);
+            auto entry = parseStoreKey(req);
+            keyManager.addKey(entry.first, std::move(entry.second));
             res.set_content("{\"message\": \"Key stored successfully\"}", "application/json");
         } catch (const nlohmann::json::exception &e) {
             res.status = 400; // Bad Request
             res.set_content(e.what(), "application/json");
             logErrorMessage("JSON error storing key: " + std::string(e.what()), serverErrorLogFile);
+        } catch (const std::invalid_argument &e) {
+            res.status = 400;
+            res.set_content(e.what(), "application/json");
+            logErrorMessage("Invalid store request: " + std::string(e.what()), serverErrorLogFile);
         } catch (const std::exception &e) {
             res.status = 500;
             res.set_content(e.what(), "application/json");
             logErrorMessage("Error storing key: " + std::string(e.what()), serverErrorLogFile);
         }
-    });
+    }));
 
-    svr.Post("/rotate-key", [&](const httplib::Request &req, httplib::Response &res) {
+    svr.Post("/rotate-key", instrumented("/rotate-key", [&](const httplib::Request &, httplib::Response &res) {
         logMessage("Received request to /rotate-key", serverLogFile);
         try {
-            keyManager.rotateKeys();
-            res.set_content("{\"message\": \"Key rotated successfully\"}", "application/json");
+            std::string keyId = keyManager.rotateKeys();
+            nlohmann::json json = {{"message", "Key rotated successfully"}, {"key_id", keyId}};
+            res.set_content(json.dump(), "application/json");
         } catch (const std::exception &e) {
             res.status = 500;
             res.set_content(e.what(), "application/json");
             logErrorMessage("Error rotating key: " + std::string(e.what()), serverErrorLogFile);
         }
-    });
+    }));
 
-    svr.Get("/fetch-key/(.*)", [&](const httplib::Request &req, httplib::Response &res) {
+    svr.Get("/fetch-key/(.*)", instrumented("/fetch-key/(.*)", [&](const httplib::Request &req, httplib::Response &res) {
         logMessage("Received request to /fetch-key", serverLogFile);
         try {
             std::string key_id = req.matches[1];
             auto key = keyManager.getKey(key_id);
-            nlohmann::json json = {{"key_id", key_id}, {"key", nlohmann::json::binary_t(key)}};
-            res.set_content(json.dump(), "application/json");
+            replyKey(req, res, key_id, key);
         } catch (const std::exception &e) {
             res.status = 404;
             res.set_content(e.what(), "application/json");
             logErrorMessage("Error fetching key with ID: " + std::string(req.matches[1]) + " - " + std::string(e.what()), serverErrorLogFile);
         }
-    });
+    }));
 
-    svr.Post("/delete-key/(.*)", [&](const httplib::Request &req, httplib::Response &res) {
+    svr.Post("/delete-key/(.*)", instrumented("/delete-key/(.*)", [&](const httplib::Request &req, httplib::Response &res) {
         logMessage("Received request to /delete-key", serverLogFile);
         try {
             std::string key_id = req.matches[1];
@@ -95,20 +578,536 @@ void startKMSServer(KeyManager &keyManager) {
             res.set_content(e.what(), "application/json");
             logErrorMessage("Error deleting key with ID: " + std::string(req.matches[1]) + " - " + std::string(e.what()), serverErrorLogFile);
         }
+    }));
+
+    // The body is raw bytes of any length; it is hashed as it is received
+    // rather than buffered. ?attest=true routes it through the TPM for a
+    // hash-check ticket, otherwise SHA-256 runs in software. Attestation is
+    // refused with a 400 under the software TPM backend.
+    svr.Post("/hash", instrumented("/hash", [&](const httplib::Request &req, httplib::Response &res, const httplib::ContentReader &content) {
+        logMessage("Received request to /hash", serverLogFile);
+        try {
+            std::string attest = req.get_param_value("attest");
+            StreamingHash hasher(keyManager.contextPool(), attest == "true" || attest == "1");
+            readBody(req, content, [&](const uint8_t *data, size_t size) { hasher.update(data, size); });
+            HashResult result = hasher.finish();
+            if (wantsCbor(req)) {
+                CborWriter writer;
+                writer.map(3);
+                writer.field("digest", result.digest);
+                writer.field("ticket", result.ticket);
+                writer.field("bytes", result.bytes);
+                res.set_content(writer.release(), cborContentType);
+                return;
+            }
+            nlohmann::json json = {{"digest", result.digest}, {"ticket", result.ticket}, {"bytes", result.bytes}};
+            res.set_content(json.dump(), "application/json");
+        } catch (const std::invalid_argument &e) {
+            res.status = 400;
+            res.set_content(e.what(), "application/json");
+            logErrorMessage("Invalid hash request: " + std::string(e.what()), serverErrorLogFile);
+        } catch (const std::exception &e) {
+            res.status = 500;
+            res.set_content(e.what(), "application/json");
+            logErrorMessage("Error hashing data: " + std::string(e.what()), serverErrorLogFile);
+        }
+    }));
+
+    svr.Post("/generate-keys", instrumented("/generate-keys", [&](const httplib::Request &req, httplib::Response &res) {
+        logMessage("Received request to /generate-keys", serverLogFile);
+        try {
+            auto results = keyManager.generateKeys(parseCount(req));
+            replyBatch(req, res, results, true);
+        } catch (const nlohmann::json::exception &e) {
+            res.status = 400;
+            res.set_content(e.what(), "application/json");
+            logErrorMessage("JSON error generating keys: " + std::string(e.what()), serverErrorLogFile);
+        } catch (const std::invalid_argument &e) {
+            res.status = 400;
+            res.set_content(e.what(), "application/json");
+            logErrorMessage("Invalid batch request: " + std::string(e.what()), serverErrorLogFile);
+        } catch (const std::exception &e) {
+            res.status = 500;
+            res.set_content(e.what(), "application/json");
+            logErrorMessage("Error generating keys: " + std::string(e.what()), serverErrorLogFile);
+        }
+    }));
+
+    svr.Post("/store-keys", instrumented("/store-keys", [&](const httplib::Request &req, httplib::Response &res) {
+        logMessage("Received request to /store-keys", serverLogFile);
+        try {
+            auto results = keyManager.addKeys(parseStoreKeys(req));
+            replyBatch(req, res, results, false);
+        } catch (const nlohmann::json::exception &e) {
+            res.status = 400;
+            res.set_content(e.what(), "application/json");
+            logErrorMessage("JSON error storing keys: " + std::string(e.what()), serverErrorLogFile);
+        } catch (const std::invalid_argument &e) {
+            res.status = 400;
+            res.set_content(e.what(), "application/json");
+            logErrorMessage("Invalid batch request: " + std::string(e.what()), serverErrorLogFile);
+        } catch (const std::exception &e) {
+            res.status = 500;
+            res.set_content(e.what(), "application/json");
+            logErrorMessage("Error storing keys: " + std::string(e.what()), serverErrorLogFile);
+        }
+    }));
+
+    svr.Post("/fetch-keys", instrumented("/fetch-keys", [&](const httplib::Request &req, httplib::Response &res) {
+        logMessage("Received request to /fetch-keys", serverLogFile);
+        try {
+            auto results = keyManager.getKeys(parseKeyIds(req));
+            replyBatch(req, res, results, true);
+        } catch (const nlohmann::json::exception &e) {
+            res.status = 400;
+            res.set_content(e.what(), "application/json");
+            logErrorMessage("JSON error fetching keys: " + std::string(e.what()), serverErrorLogFile);
+        } catch (const std::invalid_argument &e) {
+            res.status = 400;
+            res.set_content(e.what(), "application/json");
+            logErrorMessage("Invalid batch request: " + std::string(e.what()), serverErrorLogFile);
+        } catch (const std::exception &e) {
+            res.status = 500;
+            res.set_content(e.what(), "application/json");
+            logErrorMessage("Error fetching keys: " + std::string(e.what()), serverErrorLogFile);
+        }
+    }));
+
+    svr.Post("/delete-keys", instrumented("/delete-keys", [&](const httplib::Request &req, httplib::Response &res) {
+        logMessage("Received request to /delete-keys", serverLogFile);
+        try {
+            auto results = keyManager.deleteKeys(parseKeyIds(req));
+            replyBatch(req, res, results, false);
+        } catch (const nlohmann::json::exception &e) {
+            res.status = 400;
+            res.set_content(e.what(), "application/json");
+            logErrorMessage("JSON error deleting keys: " + std::string(e.what()), serverErrorLogFile);
+        } catch (const std::invalid_argument &e) {
+            res.status = 400;
+            res.set_content(e.what(), "application/json");
+            logErrorMessage("Invalid batch request: " + std::string(e.what()), serverErrorLogFile);
+        } catch (const std::exception &e) {
+            res.status = 500;
+            res.set_content(e.what(), "application/json");
+            logErrorMessage("Error deleting keys: " + std::string(e.what()), serverErrorLogFile);
+        }
+    }));
+
+    svr.Post("/generate-data-key", instrumented("/generate-data-key", [&](const httplib::Request &req, httplib::Response &res) {
+        logMessage("Received request to /generate-data-key", serverLogFile);
+        try {
+            size_t keyLength = 32;
+            std::string context;
+            if (!req.body.empty() && isCborRequest(req)) {
+                readCborMap(req.body, [&](const std::string& name, CborReader& reader) {
+                    if (name == "key_length") {
+                        keyLength = static_cast<size_t>(std::min<uint64_t>(reader.unsignedInt(), SIZE_MAX));
+                    } else if (name == "context") {
+                        context = reader.text();
+                    } else {
+                        return false;
+                    }
+                    return true;
+                });
+            } else if (!req.body.empty()) {
+                auto json = nlohmann::json::parse(req.body);
+                keyLength = json.value("key_length", keyLength);
+                context = json.value("context", context);
+            }
+            auto dataKey = keyManager.generateDataKey(keyLength, context);
+            if (wantsCbor(req)) {
+                CborWriter writer;
+                writer.map(3);
+                writeKeyField(writer, "plaintext", dataKey.plaintext);
+                writer.field("ciphertext_blob", dataKey.ciphertextBlob);
+                writer.field("kek_version", dataKey.kekVersion);
+                res.set_content(writer.release(), cborContentType);
+                return;
+            }
+            nlohmann::json json = {
+                {"plaintext", keyToJson(dataKey.plaintext)},
+                {"ciphertext_blob", dataKey.ciphertextBlob},
+                {"kek_version", dataKey.kekVersion}
+            };
+            res.set_content(json.dump(), "application/json");
+        } catch (const nlohmann::json::exception &e) {
+            res.status = 400;
+            res.set_content(e.what(), "application/json");
+            logErrorMessage("JSON error generating data key: " + std::string(e.what()), serverErrorLogFile);
+        } catch (const std::invalid_argument &e) {
+            res.status = 400;
+            res.set_content(e.what(), "application/json");
+            logErrorMessage("Invalid data key request: " + std::string(e.what()), serverErrorLogFile);
+        } catch (const std::exception &e) {
+            res.status = 500;
+            res.set_content(e.what(), "application/json");
+            logErrorMessage("Error generating data key: " + std::string(e.what()), serverErrorLogFile);
+        }
+    }));
+
+    svr.Post("/decrypt-data-key", instrumented("/decrypt-data-key", [&](const httplib::Request &req, httplib::Response &res) {
+        logMessage("Received request to /decrypt-data-key", serverLogFile);
+        try {
+            std::vector<uint8_t> blob;
+            std::string context;
+            if (isCborRequest(req)) {
+                readCborMap(req.body, [&](const std::string& name, CborReader& reader) {
+                    if (name == "ciphertext_blob") {
+                        blob = reader.bytes();
+                    } else if (name == "context") {
+                        context = reader.text();
+                    } else {
+                        return false;
+                    }
+                    return true;
+                });
+            } else {
+                auto json = nlohmann::json::parse(req.body);
+                blob = json.at("ciphertext_blob").get<std::vector<uint8_t>>();
+                context = json.value("context", std::string());
+            }
+            auto plaintext = keyManager.decryptDataKey(blob, context);
+            if (wantsCbor(req)) {
+                CborWriter writer;
+                writer.map(1);
+                writeKeyField(writer, "plaintext", plaintext);
+                res.set_content(writer.release(), cborContentType);
+                return;
+            }
+            nlohmann::json result = {{"plaintext", keyToJson(plaintext)}};
+            res.set_content(result.dump(), "application/json");
+        } catch (const nlohmann::json::exception &e) {
+            res.status = 400;
+            res.set_content(e.what(), "application/json");
+            logErrorMessage("JSON error decrypting data key: " + std::string(e.what()), serverErrorLogFile);
+        } catch (const std::exception &e) {
+            res.status = 400;
+            res.set_content(e.what(), "application/json");
+            logErrorMessage("Error decrypting data key: " + std::string(e.what()), serverErrorLogFile);
+        }
+    }));
+
+    // Bodies of any size are encrypted and decrypted frame by frame as they
+    // arrive; see stream_cipher.h for the format. The optional ?context= is
+    // bound to the stream's wrapped data key and must match on decryption.
+    svr.Post("/encrypt", instrumented("/encrypt", [&](const httplib::Request &req, httplib::Response &res, const httplib::ContentReader &content) {
+        logMessage("Received request to /encrypt", serverLogFile);
+        try {
+            auto dataKey = keyManager.generateDataKey(32, req.get_param_value("context"));
+            auto spill = std::make_shared<SpillBuffer>(config.streamMemoryLimit, config.streamSpillDirectory);
+            auto encryptor = std::make_unique<StreamEncryptor>(std::move(dataKey.plaintext), dataKey.ciphertextBlob, config.streamChunkSize,
+                                                               [&](const uint8_t *data, size_t size) { spill->append(data, size); });
+            readBody(req, content, [&](const uint8_t *data, size_t size) { encryptor->update(data, size); });
+            encryptor->finish();
+            replyFromSpill(res, spill);
+        } catch (const std::invalid_argument &e) {
+            res.status = 400;
+            res.set_content(e.what(), "application/json");
+            logErrorMessage("Invalid encrypt request: " + std::string(e.what()), serverErrorLogFile);
+        } catch (const std::exception &e) {
+            res.status = 500;
+            res.set_content(e.what(), "application/json");
+            logErrorMessage("Error encrypting stream: " + std::string(e.what()), serverErrorLogFile);
+        }
+    }));
+
+    // Every frame is authenticated while the ciphertext is uploaded, so a
+    // tampered or truncated stream is refused before any plaintext is sent.
+    svr.Post("/decrypt", instrumented("/decrypt", [&](const httplib::Request &req, httplib::Response &res, const httplib::ContentReader &content) {
+        logMessage("Received request to /decrypt", serverLogFile);
+        try {
+            std::string context = req.get_param_value("context");
+            StreamDecryptor::KeyUnwrapper unwrap = [&keyManager, context](const std::vector<uint8_t>& wrapped) {
+                return keyManager.decryptDataKey(wrapped, context);
+            };
+            auto spill = std::make_shared<SpillBuffer>(config.streamMemoryLimit, config.streamSpillDirectory);
+            StreamDecryptor verifier(unwrap);
+            readBody(req, content, [&](const uint8_t *data, size_t size) {
+                verifier.update(data, size);
+                spill->append(data, size);
+            });
+            verifier.finish();
+            replyDecrypted(res, spill, verifier.plaintextSize(), unwrap);
+        } catch (const std::invalid_argument &e) {
+            res.status = 400;
+            res.set_content(e.what(), "application/json");
+            logErrorMessage("Invalid decrypt request: " + std::string(e.what()), serverErrorLogFile);
+        } catch (const std::exception &e) {
+            res.status = 500;
+            res.set_content(e.what(), "application/json");
+            logErrorMessage("Error decrypting stream: " + std::string(e.what()), serverErrorLogFile);
+        }
+    }));
+
+    // Concurrent requests are signed together: the TPM signs the root of a
+    // Merkle tree over their digests and each reply carries the caller's proof.
+    // "batch": false signs the digest on its own, for comparison.
+    svr.Post("/sign", instrumented("/sign", [&](const httplib::Request &req, httplib::Response &res) {
+        logMessage("Received request to /sign", serverLogFile);
+        try {
+            std::vector<uint8_t> digest;
+            bool batch = true;
+            if (isCborRequest(req)) {
+                readCborMap(req.body, [&](const std::string& name, CborReader& reader) {
+                    if (name == "digest") {
+                        digest = reader.bytes();
+                    } else if (name == "batch") {
+                        batch = reader.boolean();
+                    } else {
+                        return false;
+                    }
+                    return true;
+                });
+            } else {
+                auto json = nlohmann::json::parse(req.body);
+                digest = json.at("digest").get<std::vector<uint8_t>>();
+                batch = json.value("batch", true);
+            }
+            BatchSignature signature = batch ? keyManager.batchSigner().sign(digest).get()
+                                             : keyManager.batchSigner().signUnbatched(digest);
+            if (wantsCbor(req)) {
+                CborWriter writer;
+                writer.map(5);
+                writer.field("signature", signature.signature);
+                writer.field("root", signature.root);
+                writer.field("leaf_index", signature.leafIndex);
+                writer.field("tree_size", signature.treeSize);
+                writer.text("proof");
+                writer.array(signature.proof.size());
+                for (const auto& node : signature.proof) {
+                    writer.bytes(node);
+                }
+                res.set_content(writer.release(), cborContentType);
+                return;
+            }
+            nlohmann::json result = {
+                {"signature", signature.signature},
+                {"root", signature.root},
+                {"leaf_index", signature.leafIndex},
+                {"tree_size", signature.treeSize},
+                {"proof", signature.proof}
+            };
+            res.set_content(result.dump(), "application/json");
+        } catch (const nlohmann::json::exception &e) {
+            res.status = 400;
+            res.set_content(e.what(), "application/json");
+            logErrorMessage("JSON error signing digest: " + std::string(e.what()), serverErrorLogFile);
+        } catch (const std::invalid_argument &e) {
+            res.status = 400;
+            res.set_content(e.what(), "application/json");
+            logErrorMessage("Invalid sign request: " + std::string(e.what()), serverErrorLogFile);
+        } catch (const std::exception &e) {
+            res.status = 500;
+            res.set_content(e.what(), "application/json");
+            logErrorMessage("Error signing digest: " + std::string(e.what()), serverErrorLogFile);
+        }
+    }));
+
+    svr.Get("/signing-key", instrumented("/signing-key", [&](const httplib::Request &, httplib::Response &res) {
+        res.set_content(keyManager.signingPublicKeyPem(), "application/x-pem-file");
+    }));
+
+    svr.Post("/rotate-kek", instrumented("/rotate-kek", [&](const httplib::Request &, httplib::Response &res) {
+        logMessage("Received request to /rotate-kek", serverLogFile);
+        try {
+            uint32_t version = keyManager.rotateKeyEncryptionKey();
+            nlohmann::json json = {{"message", "Key-encryption key rotated successfully"}, {"kek_version", version}};
+            res.set_content(json.dump(), "application/json");
+        } catch (const std::exception &e) {
+            res.status = 500;
+            res.set_content(e.what(), "application/json");
+            logErrorMessage("Error rotating key-encryption key: " + std::string(e.what()), serverErrorLogFile);
+        }
+    }));
+
+    svr.Post("/log-config", instrumented("/log-config", [&](const httplib::Request &req, httplib::Response &res) {
+        logMessage("Received request to /log-config", serverLogFile);
+        try {
+            auto json = nlohmann::json::parse(req.body);
+            LoggerConfig config = loggerConfig();
+            if (json.contains("level")) {
+                if (!parseLogLevel(json["level"].get<std::string>(), config.level)) {
+                    throw std::invalid_argument("level must be one of debug, info, warning, error");
+                }
+            }
+            config.console = json.value("console", config.console);
+            config.files = json.value("files", config.files);
+            configureLogger(config);
+            nlohmann::json reply = {{"level", logLevelName(config.level)}, {"console", config.console}, {"files", config.files}};
+            res.set_content(reply.dump(), "application/json");
+        } catch (const std::exception &e) {
+            res.status = 400;
+            res.set_content(e.what(), "application/json");
+            logErrorMessage("Error updating log configuration: " + std::string(e.what()), serverErrorLogFile);
+        }
+    }));
+
+    svr.Get("/stats", instrumented("/stats", [&](const httplib::Request &, httplib::Response &res) {
+        auto pool = keyManager.contextPoolStats();
+        auto scheduler = keyManager.schedulerStats();
+        auto objects = keyManager.objectCacheStats();
+        auto entropy = keyManager.entropyPoolStats();
+        auto keyLog = keyManager.keyLogStats();
+        auto rotation = keyManager.keyRotationStats();
+        auto signer = keyManager.batchSignerStats();
+        auto arena = KeyArena::instance().stats();
+        auto logging = loggerStats();
+        auto tls = serverTLSStats(svr.ssl_context());
+        auto replication = keyManager.replicationStats();
+        nlohmann::json startup = {{"total_us", keyManager.startupMicros()}};
+        for (const auto& phase : keyManager.startupReport()) {
+            startup["phases"][phase.first] = phase.second;
+        }
+        nlohmann::json json = {
+            {"startup", startup},
+            {"tpm_backend", tpmBackendTypeName(keyManager.tpmBackend().type())},
+            {"tpm_context_pool", {
+                {"size", pool.size},
+                {"available", pool.available},
+                {"leases", pool.leases},
+                {"waits", pool.waits},
+                {"wait_time_us", pool.waitTimeUs},
+                {"hold_time_us", pool.holdTimeUs},
+                {"reconnects", pool.reconnects}
+            }},
+            {"tpm_scheduler", {
+                {"queue_depth", scheduler.queueDepth},
+                {"in_flight", scheduler.inFlight},
+                {"peak_queue_depth", scheduler.peakQueueDepth},
+                {"submitted", scheduler.submitted},
+                {"completed", scheduler.completed},
+                {"failed", scheduler.failed},
+                {"random_commands", scheduler.randomCommands},
+                {"random_merged", scheduler.randomMerged},
+                {"queue_wait_us", scheduler.queueWaitUs},
+                {"service_time_us", scheduler.serviceTimeUs}
+            }},
+            {"batch_signer", {
+                {"queue_depth", signer.queueDepth},
+                {"requests", signer.requests},
+                {"batches", signer.batches},
+                {"unbatched", signer.unbatched},
+                {"failures", signer.failures},
+                {"largest_batch", signer.largestBatch},
+                {"batch_wait_us", signer.batchWaitUs},
+                {"sign_time_us", signer.signTimeUs}
+            }},
+            {"tpm_object_cache", {
+                {"hits", objects.hits},
+                {"context_loads", objects.contextLoads},
+                {"misses", objects.misses},
+                {"evictions", objects.evictions},
+                {"saved_contexts", objects.savedContexts}
+            }},
+            {"entropy_pool", {
+                {"depth", entropy.depth},
+                {"capacity", entropy.capacity},
+                {"refills", entropy.refills},
+                {"bytes_refilled", entropy.bytesRefilled},
+                {"reseeds", entropy.reseeds},
+                {"deferred_reseeds", entropy.deferredReseeds},
+                {"source_errors", entropy.sourceErrors}
+            }},
+            {"key_store", {
+                {"keys", keyManager.keyCount()},
+                {"log_bytes", keyLog.logBytes},
+                {"snapshot_bytes", keyLog.snapshotBytes},
+                {"records", keyLog.records},
+                {"commits", keyLog.commits},
+                {"commit_failures", keyLog.commitFailures},
+                {"compactions", keyLog.compactions},
+                {"recovered_records", keyLog.recoveredRecords},
+                {"truncated_bytes", keyLog.truncatedBytes},
+                {"recovery_time_us", keyLog.recoveryTimeUs}
+            }},
+            {"key_rotation", {
+                {"passes", rotation.passes},
+                {"retired", rotation.retired},
+                {"issued", rotation.issued},
+                {"failures", rotation.failures},
+                {"last_pass_us", rotation.lastPassUs},
+                {"next_expiry", rotation.nextExpiry}
+            }},
+            {"tls", {
+                {"handshakes", tls.handshakes},
+                {"resumed", tls.resumed},
+                {"misses", tls.misses},
+                {"timeouts", tls.timeouts},
+                {"cached_sessions", tls.cached}
+            }},
+            {"key_arena", {
+                {"slot_bytes", arena.slotSize},
+                {"slabs", arena.slabs},
+                {"locked_bytes", arena.lockedBytes},
+                {"slots_in_use", arena.slotsInUse},
+                {"peak_slots_in_use", arena.peakSlotsInUse},
+                {"allocations", arena.allocations}
+            }},
+            {"replication", {
+                {"role", replicationRoleName(replication.role)},
+                {"token", formatReplicationToken(ReplicationToken{replication.epoch, replication.lastSeq})},
+                {"last_seq", replication.lastSeq},
+                {"oldest_seq", replication.oldestSeq},
+                {"primary_seq", replication.primarySeq},
+                {"lag_changes", replication.lagChanges},
+                {"lag_ms", replication.lagMs},
+                {"applied_changes", replication.appliedChanges},
+                {"snapshots", replication.snapshots},
+                {"failures", replication.failures},
+                {"token_waits", replication.tokenWaits},
+                {"token_timeouts", replication.tokenTimeouts}
+            }},
+            {"logger", {
+                {"level", logLevelName(loggerConfig().level)},
+                {"written", logging.written},
+                {"dropped", logging.dropped},
+                {"batches", logging.batches},
+                {"capacity", logging.capacity}
+            }}
+        };
+        for (const auto& device : keyManager.tpmDeviceStats()) {
+            char id[17];
+            std::snprintf(id, sizeof(id), "%016llx", static_cast<unsigned long long>(device.id));
+            json["tpm_devices"].push_back({
+                {"tcti", device.tcti},
+                {"id", id},
+                {"healthy", device.healthy},
+                {"seals", device.seals},
+                {"unseals", device.unseals},
+                {"failures", device.failures},
+                {"consecutive_failures", device.consecutiveFailures},
+                {"queue_depth", device.queueDepth},
+                {"in_flight", device.inFlight}
+            });
+        }
+        res.set_content(json.dump(), "application/json");
+    }));
+
+    svr.Get("/metrics", [&](const httplib::Request &, httplib::Response &res) {
+        auto tls = serverTLSStats(svr.ssl_context());
+        std::string out = renderMetrics() + componentMetrics(keyManager);
+        appendMetric(out, "kms_tls_handshakes_total", "counter", "Completed TLS handshakes", tls.handshakes);
+        appendMetric(out, "kms_tls_resumed_handshakes_total", "counter", "TLS handshakes that resumed a session", tls.resumed);
+        res.set_content(out, "text/plain; version=0.0.4");
     });
 
-    svr.Post("/generate-cert", [&](const httplib::Request &req, httplib::Response &res) {
+    svr.Post("/generate-cert", instrumented("/generate-cert", [&](const httplib::Request &, httplib::Response &res) {
         logMessage("Received request to /generate-cert", serverLogFile);
         try {
-            generateSelfSignedCertificate();
+            generateSelfSignedCertificate(config.certPath, config.keyPath);
             res.set_content("{\"message\": \"Certificate generated successfully\"}", "application/json");
         } catch (const std::exception &e) {
             res.status = 500;
             res.set_content(e.what(), "application/json");
             logErrorMessage("Error generating certificate: " + std::string(e.what()), serverErrorLogFile);
         }
-    });
+    }));
 
-    svr.listen("0.0.0.0", 8080);
+    std::string address = config.host + ":" + std::to_string(config.port);
+    logMessage("Server listening on " + address + " with " + std::to_string(workers) + " workers", serverLogFile);
+    if (!svr.listen(config.host, config.port)) {
+        logErrorMessage("Unable to listen on " + address, serverErrorLogFile);
+        throw std::runtime_error("Unable to listen on " + address);
+    }
 }
 
@@ -3,8 +3,30 @@
 #define HANDLERS_H
 
 #include "key_manager.h"
+#include "server_tls.h"
+#include <chrono>
+#include <string>
 
-void startKMSServer(KeyManager& keyManager);
+struct KMSServerConfig {
+    std::string host = "0.0.0.0";
+    int port = 8080;
+    std::string certPath = "certs/myapp-localhost.crt";
+    std::string keyPath = "certs/myapp-localhost.key";
+    size_t workerThreads = 0;          // 0 = one per hardware thread, at least 8
+    size_t maxQueuedRequests = 0;      // accepted connections waiting for a worker, 0 = unbounded
+    size_t keepAliveMaxCount = 100;    // requests served on one connection before it is closed
+    std::chrono::seconds keepAliveTimeout{5};
+    std::chrono::seconds readTimeout{5};
+    std::chrono::seconds writeTimeout{5};
+    ServerTLSConfig tls;
+    size_t streamChunkSize = 64 * 1024;        // plaintext bytes per /encrypt frame
+    size_t streamMemoryLimit = 1024 * 1024;    // /encrypt and /decrypt output held in memory before spilling to disk
+    std::string streamSpillDirectory;          // empty = the system temporary directory
+    std::chrono::milliseconds replicationWait{2000};   // longest a replica holds a read for its replication token
+};
+
+// Registers every route on one SSLServer and blocks serving requests.
+void startKMSServer(KeyManager& keyManager, const KMSServerConfig& config = KMSServerConfig());
 
 #endif // HANDLERS_H
 
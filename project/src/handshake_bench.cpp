@@ -0,0 +1,136 @@
+// handshake_bench.cpp
+#include "handshake_bench.h"
+#include <openssl/ssl.h>
+#include <netdb.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+using SSLCtxPtr = std::unique_ptr<SSL_CTX, decltype(&SSL_CTX_free)>;
+
+int connectTo(const addrinfo* address) {
+    int fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+    if (fd < 0) {
+        return -1;
+    }
+    if (connect(fd, address->ai_addr, address->ai_addrlen) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+struct ThreadResult {
+    uint64_t resumed = 0;
+    uint64_t failures = 0;
+    std::vector<uint32_t> latenciesUs;
+};
+
+void runThread(const HandshakeBenchConfig& config, const addrinfo* address, Clock::time_point deadline, ThreadResult& result) {
+    SSLCtxPtr ctx(SSL_CTX_new(TLS_client_method()), SSL_CTX_free);
+    if (!ctx) {
+        ++result.failures;
+        return;
+    }
+    if (config.verifyServer) {
+        SSL_CTX_load_verify_locations(ctx.get(), config.caCertPath.c_str(), nullptr);
+        SSL_CTX_set_verify(ctx.get(), SSL_VERIFY_PEER, nullptr);
+    }
+
+    SSL_SESSION* session = nullptr;
+    while (Clock::now() < deadline) {
+        int fd = connectTo(address);
+        if (fd < 0) {
+            ++result.failures;
+            continue;
+        }
+        SSL* ssl = SSL_new(ctx.get());
+        SSL_set_fd(ssl, fd);
+        SSL_set_tlsext_host_name(ssl, config.host.c_str());
+        if (config.resume && session != nullptr) {
+            SSL_set_session(ssl, session);
+        }
+
+        auto start = Clock::now();
+        int connected = SSL_connect(ssl);
+        auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count();
+        if (connected == 1) {
+            result.latenciesUs.push_back(static_cast<uint32_t>(elapsed));
+            result.resumed += SSL_session_reused(ssl) == 1 ? 1 : 0;
+            // A bidirectional shutdown reads the server's post-handshake
+            // NewSessionTicket messages, so the next connection can resume.
+            if (SSL_shutdown(ssl) == 0) {
+                SSL_shutdown(ssl);
+            }
+            if (config.resume) {
+                SSL_SESSION* latest = SSL_get1_session(ssl);
+                if (latest != nullptr) {
+                    if (session != nullptr) {
+                        SSL_SESSION_free(session);
+                    }
+                    session = latest;
+                }
+            }
+        } else {
+            ++result.failures;
+        }
+        SSL_free(ssl);
+        close(fd);
+    }
+    if (session != nullptr) {
+        SSL_SESSION_free(session);
+    }
+}
+
+} // namespace
+
+HandshakeBenchResult runHandshakeBenchmark(const HandshakeBenchConfig& config) {
+    // A write racing the server's close must fail with EPIPE, not end the process.
+    signal(SIGPIPE, SIG_IGN);
+
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* address = nullptr;
+    if (getaddrinfo(config.host.c_str(), std::to_string(config.port).c_str(), &hints, &address) != 0 || address == nullptr) {
+        throw std::runtime_error("Unable to resolve " + config.host);
+    }
+
+    size_t threadCount = std::max<size_t>(config.threads, 1);
+    std::vector<ThreadResult> perThread(threadCount);
+    std::vector<std::thread> threads;
+    auto start = Clock::now();
+    auto deadline = start + config.duration;
+    for (size_t i = 0; i < threadCount; ++i) {
+        threads.emplace_back(runThread, std::cref(config), address, deadline, std::ref(perThread[i]));
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    freeaddrinfo(address);
+
+    HandshakeBenchResult result;
+    result.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    std::vector<uint32_t> latencies;
+    for (const auto& thread : perThread) {
+        result.resumed += thread.resumed;
+        result.failures += thread.failures;
+        latencies.insert(latencies.end(), thread.latenciesUs.begin(), thread.latenciesUs.end());
+    }
+    result.handshakes = latencies.size();
+    if (!latencies.empty()) {
+        std::sort(latencies.begin(), latencies.end());
+        result.p50Us = latencies[latencies.size() / 2];
+        result.p99Us = latencies[std::min(latencies.size() - 1, latencies.size() * 99 / 100)];
+    }
+    return result;
+}
@@ -0,0 +1,35 @@
+// handshake_bench.h
+#ifndef HANDSHAKE_BENCH_H
+#define HANDSHAKE_BENCH_H
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+struct HandshakeBenchConfig {
+    std::string host = "localhost";
+    int port = 8080;
+    size_t threads = 4;
+    std::chrono::seconds duration{10};
+    bool resume = true;     // offer the previous session on every new connection
+    std::string caCertPath = "certs/myapp-localhost.crt";
+    bool verifyServer = true;
+};
+
+struct HandshakeBenchResult {
+    uint64_t handshakes = 0;
+    uint64_t resumed = 0;
+    uint64_t failures = 0;
+    double seconds = 0;
+    uint64_t p50Us = 0;
+    uint64_t p99Us = 0;
+
+    double rate() const { return seconds > 0 ? handshakes / seconds : 0; }
+};
+
+// Opens and closes TLS connections to the server as fast as each thread can,
+// timing only the handshake. Used to check the worker pool and session cache
+// settings: with resumption working, `resumed` should be close to `handshakes`.
+HandshakeBenchResult runHandshakeBenchmark(const HandshakeBenchConfig& config);
+
+#endif // HANDSHAKE_BENCH_H
@@ -0,0 +1,229 @@
+// https_connection_pool.cpp
+#include "https_connection_pool.h"
+#include <cctype>
+#include <utility>
+
+namespace {
+
+uint64_t micros(std::chrono::steady_clock::duration duration) {
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+    return us < 0 ? 0 : static_cast<uint64_t>(us);
+}
+
+// Where each SSLClient's SSL_CTX keeps a pointer back to its Connection.
+int connectionIndex() {
+    static const int index = SSL_CTX_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+    return index;
+}
+
+} // namespace
+
+std::string percentEncode(const std::string& value) {
+    static const char hex[] = "0123456789ABCDEF";
+    std::string encoded;
+    for (unsigned char c : value) {
+        if (std::isalnum(c) || c == '-' || c == '_' || c == '.' || c == '~') {
+            encoded += static_cast<char>(c);
+        } else {
+            encoded += '%';
+            encoded += hex[c >> 4];
+            encoded += hex[c & 0x0F];
+        }
+    }
+    return encoded;
+}
+
+struct HTTPSConnectionPool::Connection {
+    Connection(HTTPSConnectionPool* pool, const HTTPSConnectionPoolConfig& config)
+        : pool(pool), client(config.host, config.port) {}
+
+    HTTPSConnectionPool* pool;
+    httplib::SSLClient client;
+
+    // Set by the socket and handshake callbacks while a request opens a new connection.
+    bool opened = false;
+    bool handshakeDone = false;
+    bool resumed = false;
+    std::chrono::steady_clock::time_point connectStartedAt;
+    std::chrono::steady_clock::time_point handshakeStartedAt;
+    std::chrono::steady_clock::time_point handshakeDoneAt;
+};
+
+HTTPSConnectionPool::HTTPSConnectionPool(const HTTPSConnectionPoolConfig& config)
+    : config(config) {
+    if (this->config.size == 0) {
+        this->config.size = 1;
+    }
+    connections.reserve(this->config.size);
+}
+
+HTTPSConnectionPool::~HTTPSConnectionPool() {
+    connections.clear();
+    if (lastSession != nullptr) {
+        SSL_SESSION_free(lastSession);
+    }
+}
+
+std::unique_ptr<HTTPSConnectionPool::Connection> HTTPSConnectionPool::open() {
+    auto connection = std::make_unique<Connection>(this, config);
+    Connection* raw = connection.get();
+    httplib::SSLClient& client = connection->client;
+
+    client.set_keep_alive(true);
+    client.set_connection_timeout(config.connectTimeout);
+    client.set_read_timeout(config.readTimeout);
+    if (config.verifyServer) {
+        client.set_ca_cert_path(config.caCertPath.c_str());
+    }
+    client.enable_server_certificate_verification(config.verifyServer);
+    client.enable_server_hostname_verification(config.verifyHostname);
+    client.set_socket_options([raw](socket_t) {
+        raw->opened = true;
+        raw->connectStartedAt = std::chrono::steady_clock::now();
+    });
+
+    SSL_CTX* context = client.ssl_context();
+    SSL_CTX_set_ex_data(context, connectionIndex(), raw);
+    // Sessions are kept by the pool, not OpenSSL's internal cache, so every
+    // connection can offer the one most recently issued by the server.
+    SSL_CTX_set_session_cache_mode(context, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(context, &HTTPSConnectionPool::onNewSession);
+    SSL_CTX_set_info_callback(context, &HTTPSConnectionPool::onHandshakeEvent);
+    return connection;
+}
+
+void HTTPSConnectionPool::onHandshakeEvent(const SSL* ssl, int where, int) {
+    auto* connection = static_cast<Connection*>(SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl), connectionIndex()));
+    if (connection == nullptr) {
+        return;
+    }
+    if (where & SSL_CB_HANDSHAKE_START) {
+        connection->handshakeStartedAt = std::chrono::steady_clock::now();
+        // Runs before the ClientHello is built, so the session offered here is the one resumed.
+        HTTPSConnectionPool* pool = connection->pool;
+        std::lock_guard<std::mutex> lock(pool->sessionMutex);
+        if (pool->lastSession != nullptr && SSL_get_session(ssl) == nullptr) {
+            SSL_set_session(const_cast<SSL*>(ssl), pool->lastSession);
+        }
+    } else if (where & SSL_CB_HANDSHAKE_DONE) {
+        connection->handshakeDone = true;
+        connection->handshakeDoneAt = std::chrono::steady_clock::now();
+        connection->resumed = SSL_session_reused(const_cast<SSL*>(ssl)) == 1;
+    }
+}
+
+int HTTPSConnectionPool::onNewSession(SSL* ssl, SSL_SESSION* session) {
+    auto* connection = static_cast<Connection*>(SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl), connectionIndex()));
+    if (connection == nullptr) {
+        return 0;
+    }
+    HTTPSConnectionPool* pool = connection->pool;
+    std::lock_guard<std::mutex> lock(pool->sessionMutex);
+    if (pool->lastSession != nullptr) {
+        SSL_SESSION_free(pool->lastSession);
+    }
+    pool->lastSession = session;
+    return 1;   // the pool now owns this reference
+}
+
+HTTPSConnectionPool::Connection* HTTPSConnectionPool::acquire() {
+    std::unique_lock<std::mutex> lock(poolMutex);
+    if (idle.empty() && connections.size() < config.size) {
+        connections.push_back(open());
+        return connections.back().get();
+    }
+    connectionAvailable.wait(lock, [this] { return !idle.empty(); });
+    Connection* connection = idle.back();
+    idle.pop_back();
+    return connection;
+}
+
+void HTTPSConnectionPool::release(Connection* connection) {
+    {
+        std::lock_guard<std::mutex> lock(poolMutex);
+        idle.push_back(connection);
+    }
+    connectionAvailable.notify_one();
+}
+
+template <typename Send>
+httplib::Result HTTPSConnectionPool::send(Send&& send) {
+    Connection* connection = acquire();
+    connection->opened = false;
+    connection->handshakeDone = false;
+    connection->resumed = false;
+
+    auto start = std::chrono::steady_clock::now();
+    httplib::Result result = send(connection->client);
+    auto end = std::chrono::steady_clock::now();
+
+    {
+        std::lock_guard<std::mutex> lock(poolMutex);
+        ++totals.requests;
+        if (!result) {
+            ++totals.failures;
+        }
+        if (connection->opened) {
+            ++totals.connections;
+            if (connection->handshakeDone) {
+                totals.connectTimeUs += micros(connection->handshakeStartedAt - connection->connectStartedAt);
+                totals.handshakeTimeUs += micros(connection->handshakeDoneAt - connection->handshakeStartedAt);
+                totals.requestTimeUs += micros(end - connection->handshakeDoneAt);
+                totals.resumedSessions += connection->resumed ? 1 : 0;
+            } else {
+                totals.connectTimeUs += micros(end - connection->connectStartedAt);
+            }
+        } else {
+            totals.requestTimeUs += micros(end - start);
+        }
+    }
+    release(connection);
+    return result;
+}
+
+httplib::Result HTTPSConnectionPool::get(const std::string& path, const httplib::Headers& headers) {
+    return send([&](httplib::SSLClient& client) { return client.Get(path, headers); });
+}
+
+httplib::Result HTTPSConnectionPool::post(const std::string& path, const std::string& body, const std::string& contentType,
+                                          const httplib::Headers& headers) {
+    return send([&](httplib::SSLClient& client) { return client.Post(path, headers, body, contentType); });
+}
+
+httplib::Result HTTPSConnectionPool::postStream(const std::string& path, httplib::ContentProviderWithoutLength body,
+                                                httplib::ContentReceiver receiver, const std::string& contentType,
+                                                const httplib::Headers& headers) {
+    int status = 0;
+    std::string errorBody;
+    auto result = send([&](httplib::SSLClient& client) {
+        httplib::Request req;
+        req.method = "POST";
+        req.path = path;
+        req.headers = headers;
+        req.set_header("Content-Type", contentType);
+        req.set_header("Transfer-Encoding", "chunked");
+        req.content_provider_ = [&](size_t offset, size_t, httplib::DataSink& sink) { return body(offset, sink); };
+        req.is_chunked_content_provider_ = true;
+        req.response_handler = [&](const httplib::Response& res) {
+            status = res.status;
+            return true;
+        };
+        req.content_receiver = [&](const char* data, size_t size, uint64_t, uint64_t) {
+            if (status != 200) {
+                errorBody.append(data, size);
+                return true;
+            }
+            return receiver(data, size);
+        };
+        return client.send(req);
+    });
+    if (result && status != 200) {
+        result->body = std::move(errorBody);
+    }
+    return result;
+}
+
+HTTPSConnectionPoolStats HTTPSConnectionPool::stats() const {
+    std::lock_guard<std::mutex> lock(poolMutex);
+    return totals;
+}
@@ -0,0 +1,87 @@
+// https_connection_pool.h
+#ifndef HTTPS_CONNECTION_POOL_H
+#define HTTPS_CONNECTION_POOL_H
+
+#include <httplib.h>
+#include <openssl/ssl.h>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct HTTPSConnectionPoolConfig {
+    std::string host = "localhost";
+    int port = 8080;
+    size_t size = 4;                   // keep-alive connections opened on demand
+    std::string caCertPath = "certs/myapp-localhost.crt";
+    bool verifyServer = true;          // chain check against caCertPath, once per full handshake
+    bool verifyHostname = false;       // the bundled self-signed certificate is not issued for localhost
+    std::chrono::milliseconds connectTimeout{5000};
+    std::chrono::milliseconds readTimeout{30000};
+};
+
+struct HTTPSConnectionPoolStats {
+    uint64_t requests = 0;
+    uint64_t failures = 0;           // no response at all (connect, TLS or socket error)
+    uint64_t connections = 0;        // TCP connections opened
+    uint64_t resumedSessions = 0;    // handshakes that reused a cached TLS session
+    uint64_t connectTimeUs = 0;      // socket creation to TCP connected
+    uint64_t handshakeTimeUs = 0;    // TLS handshake
+    uint64_t requestTimeUs = 0;      // request and response on an established connection
+};
+
+// Escapes everything but RFC 3986 unreserved characters, for query parameters.
+std::string percentEncode(const std::string& value);
+
+// Fixed set of keep-alive SSLClients shared by every thread of one KMSClient.
+// A connection is used by one request at a time. When the server closes an idle
+// connection, the reconnect offers the most recent TLS session so the
+// handshake is abbreviated and the certificate is not verified again.
+class HTTPSConnectionPool {
+public:
+    explicit HTTPSConnectionPool(const HTTPSConnectionPoolConfig& config = HTTPSConnectionPoolConfig());
+    ~HTTPSConnectionPool();
+
+    HTTPSConnectionPool(const HTTPSConnectionPool&) = delete;
+    HTTPSConnectionPool& operator=(const HTTPSConnectionPool&) = delete;
+
+    httplib::Result get(const std::string& path, const httplib::Headers& headers = {});
+    httplib::Result post(const std::string& path, const std::string& body = "",
+                         const std::string& contentType = "application/json", const httplib::Headers& headers = {});
+    // Uploads a body of unknown length with chunked transfer encoding and hands
+    // a 200 response's body to receiver as it arrives rather than buffering it.
+    // Any other response's body is returned in the result as usual.
+    httplib::Result postStream(const std::string& path, httplib::ContentProviderWithoutLength body,
+                               httplib::ContentReceiver receiver, const std::string& contentType,
+                               const httplib::Headers& headers = {});
+
+    HTTPSConnectionPoolStats stats() const;
+
+private:
+    struct Connection;
+
+    template <typename Send>
+    httplib::Result send(Send&& send);
+    Connection* acquire();
+    void release(Connection* connection);
+    std::unique_ptr<Connection> open();
+
+    static void onHandshakeEvent(const SSL* ssl, int where, int ret);
+    static int onNewSession(SSL* ssl, SSL_SESSION* session);
+
+    HTTPSConnectionPoolConfig config;
+    std::vector<std::unique_ptr<Connection>> connections;
+    std::vector<Connection*> idle;
+    mutable std::mutex poolMutex;
+    std::condition_variable connectionAvailable;
+
+    std::mutex sessionMutex;
+    SSL_SESSION* lastSession = nullptr;
+
+    HTTPSConnectionPoolStats totals;
+};
+
+#endif // HTTPS_CONNECTION_POOL_H
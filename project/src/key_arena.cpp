@@ -0,0 +1,77 @@
+// key_arena.cpp
+#include "key_arena.h"
+#include <openssl/crypto.h>
+#include <algorithm>
+#include <atomic>
+#include <stdexcept>
+
+namespace {
+
+KeyArenaConfig instanceConfig;
+std::atomic<bool> instanceCreated{false};
+
+} // namespace
+
+KeyArena::KeyArena(const KeyArenaConfig& config) : config(config) {
+    this->config.slotSize = std::max<size_t>(config.slotSize, 1);
+    this->config.slotsPerSlab = std::max<size_t>(config.slotsPerSlab, 1);
+}
+
+void KeyArena::grow() {
+    LockedBuffer slab(config.slotSize * config.slotsPerSlab);
+    freeSlots.reserve(freeSlots.size() + config.slotsPerSlab);
+    // Pushed high to low so slots are handed out in address order.
+    for (size_t slot = config.slotsPerSlab; slot > 0; --slot) {
+        freeSlots.push_back(slab.data() + (slot - 1) * config.slotSize);
+    }
+    slabs.push_back(std::move(slab));
+}
+
+uint8_t* KeyArena::allocate() {
+    std::lock_guard<std::mutex> lock(arenaMutex);
+    if (freeSlots.empty()) {
+        grow();
+    }
+    uint8_t* slot = freeSlots.back();
+    freeSlots.pop_back();
+    ++allocationCount;
+    peakInUse = std::max(peakInUse, slabs.size() * config.slotsPerSlab - freeSlots.size());
+    return slot;
+}
+
+void KeyArena::release(uint8_t* slot) {
+    if (slot == nullptr) {
+        return;
+    }
+    // Wiped before it is shared again, and outside the lock.
+    OPENSSL_cleanse(slot, config.slotSize);
+    std::lock_guard<std::mutex> lock(arenaMutex);
+    freeSlots.push_back(slot);
+}
+
+KeyArenaStats KeyArena::stats() const {
+    std::lock_guard<std::mutex> lock(arenaMutex);
+    KeyArenaStats result;
+    result.slotSize = config.slotSize;
+    result.slabs = slabs.size();
+    result.lockedBytes = slabs.size() * config.slotSize * config.slotsPerSlab;
+    result.slotsInUse = slabs.size() * config.slotsPerSlab - freeSlots.size();
+    result.peakSlotsInUse = peakInUse;
+    result.allocations = allocationCount;
+    return result;
+}
+
+KeyArena& KeyArena::instance() {
+    static KeyArena* arena = [] {
+        instanceCreated = true;
+        return new KeyArena(instanceConfig);
+    }();
+    return *arena;
+}
+
+void KeyArena::configure(const KeyArenaConfig& config) {
+    if (instanceCreated) {
+        throw std::logic_error("Key arena is already in use");
+    }
+    instanceConfig = config;
+}
@@ -0,0 +1,61 @@
+// key_arena.h
+#ifndef KEY_ARENA_H
+#define KEY_ARENA_H
+
+#include "locked_buffer.h"
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+struct KeyArenaConfig {
+    size_t slotSize = 64;        // bytes per key slot; longer keys get locked pages of their own
+    size_t slotsPerSlab = 512;   // slots added each time the arena runs out
+};
+
+struct KeyArenaStats {
+    size_t slotSize = 0;
+    size_t slabs = 0;
+    size_t lockedBytes = 0;
+    size_t slotsInUse = 0;
+    size_t peakSlotsInUse = 0;
+    uint64_t allocations = 0;
+};
+
+// Slab allocator for plaintext key material. Slabs are LockedBuffers, so every
+// slot is mlock'd and left out of core dumps, and a slot is wiped as soon as it
+// is released. Slabs are kept for the life of the process: allocation is a pop
+// from a free list, and freed keys never go back to the general heap.
+class KeyArena {
+public:
+    explicit KeyArena(const KeyArenaConfig& config = KeyArenaConfig());
+
+    KeyArena(const KeyArena&) = delete;
+    KeyArena& operator=(const KeyArena&) = delete;
+
+    // A zeroed slot of slotSize() bytes; grows by one slab when none is free.
+    uint8_t* allocate();
+    // Wipes the slot and returns it to the free list.
+    void release(uint8_t* slot);
+
+    size_t slotSize() const { return config.slotSize; }
+    KeyArenaStats stats() const;
+
+    // The arena KeyBuffer draws from. It is never destroyed, so buffers held
+    // by other static objects stay valid during shutdown.
+    static KeyArena& instance();
+    // Shapes instance(); throws std::logic_error once instance() has been used.
+    static void configure(const KeyArenaConfig& config);
+
+private:
+    void grow();
+
+    KeyArenaConfig config;
+    mutable std::mutex arenaMutex;
+    std::vector<LockedBuffer> slabs;
+    std::vector<uint8_t*> freeSlots;
+    size_t peakInUse = 0;
+    uint64_t allocationCount = 0;
+};
+
+#endif // KEY_ARENA_H
@@ -0,0 +1,60 @@
+// key_buffer.cpp
+#include "key_buffer.h"
+#include "key_arena.h"
+#include <openssl/crypto.h>
+#include <cstring>
+#include <utility>
+
+KeyBuffer::KeyBuffer(size_t size) : length(size) {
+    if (size == 0) {
+        return;
+    }
+    KeyArena& arena = KeyArena::instance();
+    if (size <= arena.slotSize()) {
+        bytes = arena.allocate();
+    } else {
+        // LockedBuffer pages come from mmap and are already zero.
+        large = std::make_unique<LockedBuffer>(size);
+        bytes = large->data();
+    }
+}
+
+KeyBuffer::KeyBuffer(const uint8_t* data, size_t size) : KeyBuffer(size) {
+    if (size > 0) {
+        std::memcpy(bytes, data, size);
+    }
+}
+
+KeyBuffer::~KeyBuffer() {
+    release();
+}
+
+KeyBuffer::KeyBuffer(KeyBuffer&& other) noexcept
+    : bytes(std::exchange(other.bytes, nullptr)),
+      length(std::exchange(other.length, 0)),
+      large(std::move(other.large)) {}
+
+KeyBuffer& KeyBuffer::operator=(KeyBuffer&& other) noexcept {
+    if (this != &other) {
+        release();
+        bytes = std::exchange(other.bytes, nullptr);
+        length = std::exchange(other.length, 0);
+        large = std::move(other.large);
+    }
+    return *this;
+}
+
+KeyBuffer KeyBuffer::clone() const {
+    return KeyBuffer(bytes, length);
+}
+
+void KeyBuffer::release() {
+    if (large) {
+        // LockedBuffer wipes its pages when it is unmapped.
+        large.reset();
+    } else if (bytes != nullptr) {
+        KeyArena::instance().release(bytes);
+    }
+    bytes = nullptr;
+    length = 0;
+}
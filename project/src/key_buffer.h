@@ -0,0 +1,45 @@
+// key_buffer.h
+#ifndef KEY_BUFFER_H
+#define KEY_BUFFER_H
+
+#include "locked_buffer.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+// Owns one plaintext key in locked memory: a KeyArena slot, or locked pages of
+// its own when the key is longer than a slot. It can be moved but not copied,
+// and the bytes are wiped when it is destroyed, so a key passed from the TPM to
+// the HTTP reply leaves no stray copies behind. clone() is the only way to
+// duplicate one, for the few places that really need two owners.
+class KeyBuffer {
+public:
+    KeyBuffer() = default;
+    // size bytes, all zero.
+    explicit KeyBuffer(size_t size);
+    KeyBuffer(const uint8_t* data, size_t size);
+    ~KeyBuffer();
+
+    KeyBuffer(KeyBuffer&& other) noexcept;
+    KeyBuffer& operator=(KeyBuffer&& other) noexcept;
+    KeyBuffer(const KeyBuffer&) = delete;
+    KeyBuffer& operator=(const KeyBuffer&) = delete;
+
+    KeyBuffer clone() const;
+
+    uint8_t* data() { return bytes; }
+    const uint8_t* data() const { return bytes; }
+    size_t size() const { return length; }
+    bool empty() const { return length == 0; }
+    const uint8_t* begin() const { return bytes; }
+    const uint8_t* end() const { return bytes + length; }
+
+private:
+    void release();
+
+    uint8_t* bytes = nullptr;
+    size_t length = 0;
+    std::unique_ptr<LockedBuffer> large;   // set instead of an arena slot for long keys
+};
+
+#endif // KEY_BUFFER_H
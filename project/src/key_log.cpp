@@ -0,0 +1,481 @@
+// key_log.cpp
+#include "key_log.h"
+#include "logger.h"
+#include <array>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+constexpr char logMagic[8] = {'K', 'M', 'S', 'L', 'O', 'G', '0', '1'};
+constexpr char snapshotMagic[8] = {'K', 'M', 'S', 'S', 'N', 'P', '0', '1'};
+constexpr size_t magicSize = sizeof(logMagic);
+constexpr size_t recordHeaderSize = 8;            // payload length, CRC32 of payload
+constexpr size_t putMetadataSize = 16;            // createdAt, expiresAt
+constexpr uint32_t maxPayloadSize = 1 << 20;
+constexpr size_t snapshotWriteChunk = 1 << 20;
+
+uint64_t elapsedMicros(std::chrono::steady_clock::time_point since) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - since).count();
+}
+
+uint32_t crc32(const uint8_t* data, size_t size) {
+    static const std::array<uint32_t, 256> table = [] {
+        std::array<uint32_t, 256> t{};
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k) {
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            t[i] = c;
+        }
+        return t;
+    }();
+    uint32_t crc = 0xFFFFFFFFu;
+    for (size_t i = 0; i < size; ++i) {
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFFu;
+}
+
+void putU16(std::vector<uint8_t>& out, uint16_t value) {
+    out.push_back(static_cast<uint8_t>(value >> 8));
+    out.push_back(static_cast<uint8_t>(value));
+}
+
+void putU32(std::vector<uint8_t>& out, uint32_t value) {
+    out.push_back(static_cast<uint8_t>(value >> 24));
+    out.push_back(static_cast<uint8_t>(value >> 16));
+    out.push_back(static_cast<uint8_t>(value >> 8));
+    out.push_back(static_cast<uint8_t>(value));
+}
+
+void putU64(std::vector<uint8_t>& out, uint64_t value) {
+    putU32(out, static_cast<uint32_t>(value >> 32));
+    putU32(out, static_cast<uint32_t>(value));
+}
+
+uint32_t getU32(const uint8_t* p) {
+    return (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16) |
+           (static_cast<uint32_t>(p[2]) << 8) | static_cast<uint32_t>(p[3]);
+}
+
+uint64_t getU64(const uint8_t* p) {
+    return (static_cast<uint64_t>(getU32(p)) << 32) | getU32(p + 4);
+}
+
+uint16_t getU16(const uint8_t* p) {
+    return static_cast<uint16_t>((p[0] << 8) | p[1]);
+}
+
+// Record: u32 payload length | u32 CRC32(payload) | payload, where payload is
+// u8 type | u16 id length | id | u32 blob length | blob, followed for Put
+// records by i64 createdAt | i64 expiresAt. All big-endian. Put records
+// without the trailing times are still read, with both left at 0.
+void appendRecord(std::vector<uint8_t>& out, const KeyLogRecord& record) {
+    if (record.keyId.size() > 0xFFFF) {
+        throw std::runtime_error("Key id too long to persist");
+    }
+    size_t start = out.size();
+    out.resize(start + recordHeaderSize);
+    out.push_back(static_cast<uint8_t>(record.type));
+    putU16(out, static_cast<uint16_t>(record.keyId.size()));
+    out.insert(out.end(), record.keyId.begin(), record.keyId.end());
+    putU32(out, static_cast<uint32_t>(record.sealedBlob.size()));
+    out.insert(out.end(), record.sealedBlob.begin(), record.sealedBlob.end());
+    if (record.type == KeyLogRecordType::Put) {
+        putU64(out, static_cast<uint64_t>(record.createdAt));
+        putU64(out, static_cast<uint64_t>(record.expiresAt));
+    }
+
+    size_t payloadSize = out.size() - start - recordHeaderSize;
+    if (payloadSize > maxPayloadSize) {
+        out.resize(start);
+        throw std::runtime_error("Key record too large to persist");
+    }
+    uint32_t crc = crc32(out.data() + start + recordHeaderSize, payloadSize);
+    for (int i = 0; i < 4; ++i) {
+        out[start + i] = static_cast<uint8_t>(payloadSize >> (24 - 8 * i));
+        out[start + 4 + i] = static_cast<uint8_t>(crc >> (24 - 8 * i));
+    }
+}
+
+// Returns the offset just past the last intact record.
+size_t replayRecords(const uint8_t* data, size_t size, size_t offset, const KeyLog::Visitor& apply, uint64_t& count) {
+    while (size - offset >= recordHeaderSize) {
+        uint32_t payloadSize = getU32(data + offset);
+        uint32_t crc = getU32(data + offset + 4);
+        if (payloadSize < 7 || payloadSize > maxPayloadSize || size - offset - recordHeaderSize < payloadSize) {
+            break;
+        }
+        const uint8_t* payload = data + offset + recordHeaderSize;
+        if (crc32(payload, payloadSize) != crc) {
+            break;
+        }
+
+        KeyLogRecord record;
+        record.type = static_cast<KeyLogRecordType>(payload[0]);
+        uint16_t idSize = getU16(payload + 1);
+        if (3u + idSize + 4u > payloadSize) {
+            break;
+        }
+        record.keyId.assign(reinterpret_cast<const char*>(payload + 3), idSize);
+        uint32_t blobSize = getU32(payload + 3 + idSize);
+        uint64_t baseSize = 3u + idSize + 4u + static_cast<uint64_t>(blobSize);
+        bool hasMetadata = record.type == KeyLogRecordType::Put && baseSize + putMetadataSize == payloadSize;
+        if (baseSize != payloadSize && !hasMetadata) {
+            break;
+        }
+        const uint8_t* blob = payload + 3 + idSize + 4;
+        record.sealedBlob.assign(blob, blob + blobSize);
+        if (hasMetadata) {
+            record.createdAt = static_cast<int64_t>(getU64(blob + blobSize));
+            record.expiresAt = static_cast<int64_t>(getU64(blob + blobSize + 8));
+        }
+
+        apply(record);
+        ++count;
+        offset += recordHeaderSize + payloadSize;
+    }
+    return offset;
+}
+
+bool writeAll(int fd, const uint8_t* data, size_t size) {
+    while (size > 0) {
+        ssize_t n = ::write(fd, data, size);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+void syncDirectory(const std::string& directory) {
+    int fd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd >= 0) {
+        ::fsync(fd);
+        ::close(fd);
+    }
+}
+
+// Maps a whole file read-only; returns nullptr for an empty file.
+class MappedFile {
+public:
+    MappedFile(int fd, size_t size) : size(size) {
+        if (size == 0) {
+            return;
+        }
+        void* mapped = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped == MAP_FAILED) {
+            throw std::runtime_error("Unable to map key store file");
+        }
+        ::madvise(mapped, size, MADV_SEQUENTIAL);
+        data = static_cast<const uint8_t*>(mapped);
+    }
+    ~MappedFile() {
+        if (data != nullptr) {
+            ::munmap(const_cast<uint8_t*>(data), size);
+        }
+    }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const uint8_t* data = nullptr;
+    size_t size;
+};
+
+} // namespace
+
+KeyLog::KeyLog(const KeyLogConfig& config) : config(config) {
+    std::filesystem::create_directories(config.directory);
+    std::filesystem::permissions(config.directory, std::filesystem::perms::owner_all, std::filesystem::perm_options::replace);
+    openLog();
+    compactionThread = std::thread(&KeyLog::compactionLoop, this);
+}
+
+KeyLog::~KeyLog() {
+    {
+        std::lock_guard<std::mutex> lock(compactionWakeMutex);
+        stopping = true;
+    }
+    compactionWanted.notify_all();
+    if (compactionThread.joinable()) {
+        compactionThread.join();
+    }
+    if (logFd >= 0) {
+        ::close(logFd);
+    }
+}
+
+std::string KeyLog::path(const char* name) const {
+    return (std::filesystem::path(config.directory) / name).string();
+}
+
+void KeyLog::openLog() {
+    std::string logPath = path("keys.log");
+    logFd = ::open(logPath.c_str(), O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    if (logFd < 0) {
+        logErrorMessage("Unable to open key log " + logPath + ": " + std::strerror(errno), serverErrorLogFile);
+        throw std::runtime_error("Unable to open key log");
+    }
+    struct stat st;
+    if (::fstat(logFd, &st) != 0) {
+        throw std::runtime_error("Unable to stat key log");
+    }
+    if (st.st_size == 0) {
+        if (!writeAll(logFd, reinterpret_cast<const uint8_t*>(logMagic), magicSize) || ::fdatasync(logFd) != 0) {
+            throw std::runtime_error("Unable to initialize key log");
+        }
+        syncDirectory(config.directory);
+        st.st_size = magicSize;
+    }
+    logBytes = static_cast<uint64_t>(st.st_size);
+}
+
+void KeyLog::recover(const Visitor& apply) {
+    auto start = std::chrono::steady_clock::now();
+    uint64_t count = 0;
+
+    std::string snapshotPath = path("keys.snapshot");
+    int snapshotFd = ::open(snapshotPath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (snapshotFd >= 0) {
+        struct stat st;
+        ::fstat(snapshotFd, &st);
+        try {
+            MappedFile snapshot(snapshotFd, static_cast<size_t>(st.st_size));
+            if (snapshot.size < magicSize || std::memcmp(snapshot.data, snapshotMagic, magicSize) != 0) {
+                throw std::runtime_error("Key snapshot has an unknown format");
+            }
+            // Snapshots are renamed into place only once complete, so damage here is not a torn write.
+            if (replayRecords(snapshot.data, snapshot.size, magicSize, apply, count) != snapshot.size) {
+                throw std::runtime_error("Key snapshot is corrupt");
+            }
+        } catch (...) {
+            ::close(snapshotFd);
+            throw;
+        }
+        snapshotBytes = static_cast<uint64_t>(st.st_size);
+        ::close(snapshotFd);
+    }
+
+    size_t size = static_cast<size_t>(logBytes.load());
+    size_t end;
+    {
+        MappedFile log(logFd, size);
+        if (size < magicSize || std::memcmp(log.data, logMagic, magicSize) != 0) {
+            throw std::runtime_error("Key log has an unknown format");
+        }
+        end = replayRecords(log.data, size, magicSize, apply, count);
+    }
+    if (end != size) {
+        // A crash mid-append leaves a partial record; everything before it was acknowledged.
+        if (::ftruncate(logFd, static_cast<off_t>(end)) != 0 || ::fdatasync(logFd) != 0) {
+            throw std::runtime_error("Unable to truncate torn key log tail");
+        }
+        truncatedBytes = size - end;
+        logBytes = end;
+        logErrorMessage("Key log: dropped " + std::to_string(truncatedBytes) + " bytes of torn tail", serverErrorLogFile);
+    }
+
+    recoveredRecords = count;
+    recoveryTimeUs = elapsedMicros(start);
+    logMessage("Key store recovered " + std::to_string(count) + " records in " +
+               std::to_string(recoveryTimeUs) + " us", serverLogFile);
+}
+
+void KeyLog::setSnapshotSource(SnapshotSource source) {
+    std::unique_lock<std::shared_mutex> lock(compactionMutex);
+    snapshotSource = std::move(source);
+}
+
+void KeyLog::write(const std::vector<KeyLogRecord>& records, const std::function<void()>& apply) {
+    if (records.empty()) {
+        apply();
+        return;
+    }
+    std::vector<uint8_t> bytes;
+    for (const auto& record : records) {
+        appendRecord(bytes, record);
+    }
+
+    {
+        std::shared_lock<std::shared_mutex> lock(compactionMutex);
+        commit(bytes, records.size(), apply);
+    }
+
+    if (logBytes >= config.compactAfterBytes) {
+        {
+            std::lock_guard<std::mutex> lock(compactionWakeMutex);
+            compactionRequested = true;
+        }
+        compactionWanted.notify_one();
+    }
+}
+
+// Group commit: the first waiter becomes the leader and writes everything that
+// queued up behind the previous fdatasync in one write and one fdatasync. The
+// leader then runs every writer's apply in log order and only then lets the
+// next batch start, so two writes to one key land in memory (and in the
+// replication feed) in the same order recovery would replay them.
+void KeyLog::commit(const std::vector<uint8_t>& bytes, size_t records, const std::function<void()>& apply) {
+    std::unique_lock<std::mutex> lock(commitMutex);
+    if (!pending) {
+        pending = std::make_shared<CommitBatch>();
+    }
+    auto batch = pending;
+    batch->bytes.insert(batch->bytes.end(), bytes.begin(), bytes.end());
+    batch->records += records;
+    size_t slot = batch->applies.size();
+    batch->applies.push_back(&apply);
+    batch->errors.emplace_back();
+
+    while (!batch->done) {
+        if (flushing) {
+            committed.wait(lock);
+            continue;
+        }
+        flushing = true;
+        if (config.groupCommitDelay.count() > 0) {
+            lock.unlock();
+            std::this_thread::sleep_for(config.groupCommitDelay);
+            lock.lock();
+        }
+        auto current = std::move(pending);
+        pending.reset();
+        lock.unlock();
+
+        uint64_t before = logBytes;
+        bool ok = writeAll(logFd, current->bytes.data(), current->bytes.size()) && ::fdatasync(logFd) == 0;
+        if (ok) {
+            logBytes = before + current->bytes.size();
+            recordCount += current->records;
+            ++commitCount;
+        } else {
+            logErrorMessage("Key log commit failed: " + std::string(std::strerror(errno)), serverErrorLogFile);
+            // Drop any partial write so later records are not stranded behind it.
+            if (::ftruncate(logFd, static_cast<off_t>(before)) != 0) {
+                logErrorMessage("Unable to roll back partial key log write", serverErrorLogFile);
+            }
+            ++commitFailureCount;
+        }
+        if (ok) {
+            // The writers are all blocked below until done, so their callbacks are still alive.
+            for (size_t i = 0; i < current->applies.size(); ++i) {
+                try {
+                    (*current->applies[i])();
+                } catch (...) {
+                    current->errors[i] = std::current_exception();
+                }
+            }
+        }
+
+        lock.lock();
+        current->done = true;
+        current->ok = ok;
+        flushing = false;
+        committed.notify_all();
+    }
+
+    if (!batch->ok) {
+        throw std::runtime_error("Error persisting key store record");
+    }
+    if (batch->errors[slot]) {
+        std::rethrow_exception(batch->errors[slot]);
+    }
+}
+
+void KeyLog::compactionLoop() {
+    std::unique_lock<std::mutex> lock(compactionWakeMutex);
+    while (true) {
+        compactionWanted.wait(lock, [this] { return stopping || compactionRequested; });
+        if (stopping) {
+            return;
+        }
+        compactionRequested = false;
+        lock.unlock();
+        try {
+            compact();
+        } catch (const std::exception &e) {
+            logErrorMessage("Key log compaction failed: " + std::string(e.what()), serverErrorLogFile);
+        }
+        lock.lock();
+    }
+}
+
+void KeyLog::compact() {
+    // Exclusive: every acknowledged record is both in the log and applied to the source.
+    std::unique_lock<std::shared_mutex> lock(compactionMutex);
+    if (!snapshotSource || logBytes < config.compactAfterBytes) {
+        return;
+    }
+    auto start = std::chrono::steady_clock::now();
+
+    std::string snapshotPath = path("keys.snapshot");
+    std::string tmpPath = path("keys.snapshot.tmp");
+    int fd = ::open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        throw std::runtime_error("Unable to create key snapshot");
+    }
+
+    uint64_t written = 0;
+    bool ok = true;
+    try {
+        std::vector<uint8_t> buffer(snapshotMagic, snapshotMagic + magicSize);
+        snapshotSource([&](const KeyLogRecord& record) {
+            appendRecord(buffer, record);
+            if (buffer.size() >= snapshotWriteChunk) {
+                ok = ok && writeAll(fd, buffer.data(), buffer.size());
+                written += buffer.size();
+                buffer.clear();
+            }
+        });
+        ok = ok && writeAll(fd, buffer.data(), buffer.size()) && ::fsync(fd) == 0;
+        written += buffer.size();
+    } catch (...) {
+        ::close(fd);
+        ::unlink(tmpPath.c_str());
+        throw;
+    }
+    ::close(fd);
+    if (!ok || ::rename(tmpPath.c_str(), snapshotPath.c_str()) != 0) {
+        ::unlink(tmpPath.c_str());
+        throw std::runtime_error("Unable to write key snapshot");
+    }
+    syncDirectory(config.directory);
+
+    // A crash before this point replays the old log over the new snapshot, which is idempotent.
+    if (::ftruncate(logFd, static_cast<off_t>(magicSize)) != 0 || ::fdatasync(logFd) != 0) {
+        throw std::runtime_error("Unable to truncate key log after snapshot");
+    }
+    logBytes = magicSize;
+    snapshotBytes = written;
+    ++compactionCount;
+    logMessage("Key log compacted into a " + std::to_string(written) + " byte snapshot in " +
+               std::to_string(elapsedMicros(start)) + " us", serverLogFile);
+}
+
+KeyLogStats KeyLog::stats() const {
+    KeyLogStats result;
+    result.logBytes = logBytes;
+    result.snapshotBytes = snapshotBytes;
+    result.records = recordCount;
+    result.commits = commitCount;
+    result.commitFailures = commitFailureCount;
+    result.compactions = compactionCount;
+    result.recoveredRecords = recoveredRecords;
+    result.truncatedBytes = truncatedBytes;
+    result.recoveryTimeUs = recoveryTimeUs;
+    return result;
+}
@@ -0,0 +1,125 @@
+// key_log.h
+#ifndef KEY_LOG_H
+#define KEY_LOG_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct KeyLogConfig {
+    std::string directory = "data";              // empty disables persistence
+    size_t compactAfterBytes = 64 * 1024 * 1024; // log size that triggers a snapshot
+    std::chrono::microseconds groupCommitDelay{0}; // extra time a commit leader waits for followers
+};
+
+struct KeyLogStats {
+    uint64_t logBytes = 0;
+    uint64_t snapshotBytes = 0;
+    uint64_t records = 0;           // records appended since startup
+    uint64_t commits = 0;           // fdatasync calls; records / commits is the group size
+    uint64_t commitFailures = 0;
+    uint64_t compactions = 0;
+    uint64_t recoveredRecords = 0;
+    uint64_t truncatedBytes = 0;    // torn tail dropped during recovery
+    uint64_t recoveryTimeUs = 0;
+};
+
+enum class KeyLogRecordType : uint8_t {
+    Put = 1,     // keyId -> sealed blob, with creation and expiry times
+    Erase = 2,
+    Kek = 3,     // keyId is the KEK version, sealedBlob the sealed KEK
+    ReplicaPosition = 4,   // keyId is the replication token a replica has applied up to
+};
+
+struct KeyLogRecord {
+    KeyLogRecordType type;
+    std::string keyId;
+    std::vector<uint8_t> sealedBlob;
+    int64_t createdAt = 0;   // Put only, Unix seconds; 0 in records written before key metadata existed
+    int64_t expiresAt = 0;   // Put only; 0 never expires
+};
+
+// Write-ahead log of sealed key blobs. Records are length-prefixed and CRC32
+// checked; concurrent writers share fdatasync calls (group commit). A
+// background thread compacts the log into a snapshot of live records in the
+// same format, which recovery maps with mmap, so startup cost tracks the
+// snapshot size plus the log written since the last compaction.
+class KeyLog {
+public:
+    using Visitor = std::function<void(const KeyLogRecord&)>;
+    // Emits every live record; called while writers are held off.
+    using SnapshotSource = std::function<void(const Visitor&)>;
+
+    explicit KeyLog(const KeyLogConfig& config);
+    ~KeyLog();
+
+    KeyLog(const KeyLog&) = delete;
+    KeyLog& operator=(const KeyLog&) = delete;
+
+    // Replays the snapshot and then the log; a torn tail is truncated.
+    void recover(const Visitor& apply);
+    void setSnapshotSource(SnapshotSource source);
+
+    // Makes the records durable, then runs apply before compaction can start,
+    // so the snapshot never misses a record that was dropped from the log.
+    // Applies run in the order their records reached the log, possibly on
+    // another writer's thread, so memory always ends where replay would.
+    void write(const std::vector<KeyLogRecord>& records, const std::function<void()>& apply);
+
+    KeyLogStats stats() const;
+
+private:
+    struct CommitBatch {
+        std::vector<uint8_t> bytes;
+        size_t records = 0;
+        // One per writer, in the order their bytes were appended.
+        std::vector<const std::function<void()>*> applies;
+        std::vector<std::exception_ptr> errors;
+        bool done = false;
+        bool ok = false;
+    };
+
+    std::string path(const char* name) const;
+    void openLog();
+    void commit(const std::vector<uint8_t>& bytes, size_t records, const std::function<void()>& apply);
+    void compactionLoop();
+    void compact();
+
+    KeyLogConfig config;
+    int logFd = -1;
+
+    std::shared_mutex compactionMutex;   // shared by writers, exclusive for compaction
+    SnapshotSource snapshotSource;
+
+    std::mutex commitMutex;
+    std::condition_variable committed;
+    std::shared_ptr<CommitBatch> pending;
+    bool flushing = false;
+
+    std::mutex compactionWakeMutex;
+    std::condition_variable compactionWanted;
+    bool compactionRequested = false;
+    bool stopping = false;
+    std::thread compactionThread;
+
+    std::atomic<uint64_t> logBytes{0};
+    std::atomic<uint64_t> snapshotBytes{0};
+    std::atomic<uint64_t> recordCount{0};
+    std::atomic<uint64_t> commitCount{0};
+    std::atomic<uint64_t> commitFailureCount{0};
+    std::atomic<uint64_t> compactionCount{0};
+    uint64_t recoveredRecords = 0;
+    uint64_t truncatedBytes = 0;
+    uint64_t recoveryTimeUs = 0;
+};
+
+#endif // KEY_LOG_H
@@ -1,261 +1,856 @@
 #include "key_manager.h"
 #include "utils.h"
 #include "logger.h"
-#include <tss2/tss2_esys.h>
+#include "tpm_startup.h"
 #include <iostream>
 #include <ctime>
 #include <thread>
 #include <chrono>
 #include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
+#include <filesystem>
+#include <future>
 #include <nlohmann/json.hpp>
-#include <sys/stat.h>
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
+#include <openssl/sha.h>
 
-// Helper function to execute a system command and return its output
-std::string execCommand(const char* cmd) {
-    std::array<char, 128> buffer;
-    std::string result;
-    std::unique_ptr<FILE, decltype(&pclose)> pipe(popen(cmd, "r"), pclose);
-    if (!pipe) {
-        throw std::runtime_error("popen() failed!");
-    }
-    while (fgets(buffer.data(), buffer.size(), pipe.get()) != nullptr) {
-        result += buffer.data();
-    }
-    return result;
+namespace {
+
+int64_t unixNow() {
+    return static_cast<int64_t>(std::time(nullptr));
+}
+
+// Keys stored before metadata was persisted carry their creation time only as
+// a leading timestamp in the id; ids that have none are dated at recovery.
+int64_t legacyCreationTime(const std::string& key_id, int64_t now) {
+    char* end = nullptr;
+    long long parsed = std::strtoll(key_id.c_str(), &end, 10);
+    bool timestamp = end != key_id.c_str() && (*end == '\0' || *end == '-') && parsed > 0 && parsed <= now;
+    return timestamp ? static_cast<int64_t>(parsed) : now;
 }
 
-// Helper function to check and set TPM permissions
-void checkAndSetTPMPermissions() {
-    struct stat statbuf;
-    if (stat("/dev/tpm0", &statbuf) == 0 && (statbuf.st_mode & S_IRUSR) == 0) {
-        system("sudo chmod 666 /dev/tpm0");
+// The file holds exactly the raw key bytes, e.g. from `openssl rand -out <file> 32`.
+KeyBuffer readReplicationKey(const std::string& path) {
+    if (path.empty()) {
+        throw std::invalid_argument("Replication needs a shared replication key file");
     }
-    if (stat("/dev/tpmrm0", &statbuf) == 0 && (statbuf.st_mode & S_IRUSR) == 0) {
-        system("sudo chmod 666 /dev/tpmrm0");
+    std::unique_ptr<FILE, decltype(&std::fclose)> in(std::fopen(path.c_str(), "rb"), std::fclose);
+    if (!in) {
+        throw std::runtime_error("Unable to read replication key " + path);
     }
+    KeyBuffer key(EnvelopeCipher::kekSize);
+    if (std::fread(key.data(), 1, key.size(), in.get()) != key.size() || std::fgetc(in.get()) != EOF) {
+        throw std::invalid_argument("Replication key " + path + " must hold exactly " +
+                                    std::to_string(EnvelopeCipher::kekSize) + " bytes");
+    }
+    return key;
 }
 
-// Helper function to clear TPM
-void clearTPM() {
-    std::string result = execCommand("tpm2_clear");
-    logMessage("TPM cleared: " + result, serverLogFile);
+// A separate key for request signing, so the wrapping key is used for nothing else.
+KeyBuffer deriveReplicationAuthKey(const KeyBuffer& replicationKey) {
+    static const char label[] = "kms replication request auth";
+    KeyBuffer authKey(SHA256_DIGEST_LENGTH);
+    unsigned int length = 0;
+    if (HMAC(EVP_sha256(), replicationKey.data(), static_cast<int>(replicationKey.size()),
+             reinterpret_cast<const unsigned char*>(label), sizeof(label) - 1, authKey.data(), &length) == nullptr ||
+        length != authKey.size()) {
+        throw std::runtime_error("Unable to derive the replication auth key");
+    }
+    return authKey;
 }
 
-// Helper function to clear DA lockout state
-void clearDALockout() {
-    std::string result = execCommand("tpm2_clearlockout");
-    logMessage("TPM DA Lockout cleared: " + result, serverLogFile);
+// "<time>:<hex HMAC>" over the time, the path and every parameter. Lengths
+// prefix each part, so no choice of values can make two requests collide.
+std::string signReplicationRequest(const KeyBuffer& authKey, int64_t time, const std::string& path,
+                                   const std::multimap<std::string, std::string>& params) {
+    std::string message = std::to_string(time) + "\n" + std::to_string(path.size()) + ":" + path;
+    for (const auto& param : params) {
+        message += std::to_string(param.first.size()) + ":" + param.first +
+                   std::to_string(param.second.size()) + ":" + param.second;
+    }
+    unsigned char mac[SHA256_DIGEST_LENGTH];
+    unsigned int length = 0;
+    if (HMAC(EVP_sha256(), authKey.data(), static_cast<int>(authKey.size()),
+             reinterpret_cast<const unsigned char*>(message.data()), message.size(), mac, &length) == nullptr) {
+        throw std::runtime_error("Unable to sign the replication request");
+    }
+    static const char digits[] = "0123456789abcdef";
+    std::string auth = std::to_string(time) + ":";
+    for (unsigned int i = 0; i < length; ++i) {
+        auth += digits[mac[i] >> 4];
+        auth += digits[mac[i] & 0x0f];
+    }
+    return auth;
 }
 
-// Helper function to check TPM capabilities
-void checkTPMCapabilities() {
-    std::string fixedProps = execCommand("tpm2_getcap properties-fixed");
-    std::string variableProps = execCommand("tpm2_getcap properties-variable");
-    logMessage("TPM Fixed Properties: " + fixedProps, serverLogFile);
-    logMessage("TPM Variable Properties: " + variableProps, serverLogFile);
-}
+const char* kekContext = "kek-";
+
+} // namespace
 
-KeyManager::KeyManager() {
+KeyManager::KeyManager(const KeyManagerConfig& config) : config(config), keys(config.keyStoreShards) {
     try {
-        checkAndSetTPMPermissions();
-        clearDALockout();
-        clearTPM();
-        checkTPMCapabilities();
+        StartupTimer timer;
+        uint64_t nonce = 0;
+        if (RAND_bytes(reinterpret_cast<unsigned char*>(&nonce), sizeof(nonce)) != 1) {
+            throw std::runtime_error("Error generating key id nonce");
+        }
+        char nonceHex[17];
+        std::snprintf(nonceHex, sizeof(nonceHex), "%016llx", static_cast<unsigned long long>(nonce));
+        keyIdNonce = nonceHex;
+
+        if (config.replication.role != ReplicationRole::Standalone) {
+            KeyBuffer replicationKey = readReplicationKey(config.replication.keyFile);
+            replicationCipher.installKek(1, replicationKey.data(), replicationKey.size());
+            replicationAuthKey = deriveReplicationAuthKey(replicationKey);
+        }
+        if (config.replication.role == ReplicationRole::Primary) {
+            changeFeed = std::make_unique<ChangeFeed>(config.replication.feedRecords);
+        }
+        replicaCaughtUpAt = std::chrono::steady_clock::now();
+
+        if (config.backend == TPMBackendType::Software) {
+            SoftwareTPMConfig softwareConfig = config.software;
+            // A new key on every start could not unseal anything in the key log.
+            if (softwareConfig.stateFile.empty() && !config.keyLog.directory.empty()) {
+                softwareConfig.stateFile = (std::filesystem::path(config.keyLog.directory) / "software_tpm.pem").string();
+            }
+            backend = std::make_unique<SoftwareTPMBackend>(softwareConfig);
+            timer.phase("software backend");
+        } else if (config.shards.tctis.size() > 1) {
+            backend = std::make_unique<ShardedTPMBackend>(config.device, config.shards, timer);
+        } else {
+            backend = std::make_unique<TPMDeviceBackend>(config.device, timer);
+        }
+
+        signer = std::make_unique<BatchSigner>(*backend, config.signer);
+        if (config.entropyPoolEnabled) {
+            EntropyPoolConfig entropyConfig = config.entropyPool;
+            entropyConfig.batchSize = std::min<size_t>(entropyConfig.batchSize, backend->maxRandomBytes());
+            entropyPool = std::make_unique<EntropyPool>([this](size_t bytes) { return tpmGetRandom(bytes); }, entropyConfig);
+        }
+        timer.phase("signer and entropy pool");
+
+        if (!config.keyLog.directory.empty()) {
+            keyLog = std::make_unique<KeyLog>(config.keyLog);
+            recoverKeys();
+        }
+        timer.phase("key recovery");
+
+        // A replica takes its KEKs from the primary.
+        if (!envelope.hasKek() && config.replication.role != ReplicationRole::Replica) {
+            rotateKeyEncryptionKey();
+        }
+        timer.phase("key-encryption key");
+
+        startupTimeUs = timer.totalMicros();
+        startupPhases = timer.phases();
+        logMessage(timer.report(), serverLogFile);
+
+        if (config.rotation.interval.count() > 0 && config.replication.role != ReplicationRole::Replica) {
+            rotationThread = std::thread(&KeyManager::rotationLoop, this);
+        }
     } catch (const std::exception &e) {
         logErrorMessage("Initialization error: " + std::string(e.what()), serverErrorLogFile);
         throw;
     }
 }
 
-std::vector<uint8_t> KeyManager::generateTPMSymmetricKey() {
-    ESYS_CONTEXT* esys_context;
-    TSS2_RC rc = Esys_Initialize(&esys_context, NULL, NULL);
-    if (rc != TSS2_RC_SUCCESS) {
-        logErrorMessage("Error initializing TPM", serverErrorLogFile);
-        throw std::runtime_error("Error initializing TPM");
+KeyManager::~KeyManager() {
+    {
+        std::lock_guard<std::mutex> lock(rotationWakeMutex);
+        rotationStopping = true;
+    }
+    rotationWake.notify_all();
+    if (rotationThread.joinable()) {
+        rotationThread.join();
     }
+}
+
+void KeyManager::recoverKeys() {
+    std::map<uint32_t, std::vector<uint8_t>> recoveredKeks;
+    int64_t now = unixNow();
+    keyLog->recover([&](const KeyLogRecord& record) {
+        switch (record.type) {
+        case KeyLogRecordType::Put:
+            if (record.createdAt == 0) {
+                int64_t createdAt = legacyCreationTime(record.keyId, now);
+                keys.put(record.keyId, record.sealedBlob, createdAt, expiryFor(createdAt));
+            } else {
+                keys.put(record.keyId, record.sealedBlob, record.createdAt, record.expiresAt);
+            }
+            break;
+        case KeyLogRecordType::Erase:
+            keys.erase(record.keyId);
+            break;
+        case KeyLogRecordType::Kek:
+            recoveredKeks[static_cast<uint32_t>(std::stoul(record.keyId))] = record.sealedBlob;
+            break;
+        case KeyLogRecordType::ReplicaPosition:
+            parseReplicationToken(record.keyId, replicaPosition);
+            break;
+        }
+    });
 
-    TPM2B_DIGEST* randomBytes = NULL;
-    rc = Esys_GetRandom(esys_context, ESYS_TR_NONE, ESYS_TR_NONE, ESYS_TR_NONE, 32, &randomBytes);
-    if (rc != TSS2_RC_SUCCESS) {
-        Esys_Finalize(&esys_context);
-        logErrorMessage("Error generating random bytes using TPM", serverErrorLogFile);
-        throw std::runtime_error("Error generating random bytes using TPM");
+    for (const auto& kek : recoveredKeks) {
+        {
+            // Kept even if it cannot be unsealed, so the version is never reused.
+            std::lock_guard<std::mutex> lock(kekMutex);
+            sealedKeks[kek.first] = kek.second;
+        }
+        try {
+            auto plaintext = unsealKey(kekContext + std::to_string(kek.first), StoredKey{kek.second, 0});
+            envelope.installKek(kek.first, plaintext.data(), plaintext.size());
+        } catch (const std::exception &e) {
+            logErrorMessage("Unable to restore key-encryption key version " + std::to_string(kek.first) + ": " + e.what(), serverErrorLogFile);
+        }
     }
 
-    std::vector<uint8_t> key(randomBytes->buffer, randomBytes->buffer + randomBytes->size);
+    keyLog->setSnapshotSource([this](const KeyLog::Visitor& emit) {
+        keys.forEach([&](const std::string& key_id, const StoredKey& stored) {
+            emit(KeyLogRecord{KeyLogRecordType::Put, key_id, stored.sealedBlob, stored.createdAt, stored.expiresAt});
+        });
+        {
+            std::lock_guard<std::mutex> lock(kekMutex);
+            for (const auto& kek : sealedKeks) {
+                emit(KeyLogRecord{KeyLogRecordType::Kek, std::to_string(kek.first), kek.second});
+            }
+        }
+        ReplicationToken position = replicationToken();
+        if (config.replication.role == ReplicationRole::Replica && position.epoch != 0) {
+            emit(KeyLogRecord{KeyLogRecordType::ReplicaPosition, formatReplicationToken(position), {}});
+        }
+    });
+}
 
-    Esys_Free(randomBytes);
-    Esys_Finalize(&esys_context);
+void KeyManager::persist(const std::vector<KeyLogRecord>& records, const std::function<void()>& apply,
+                         std::vector<std::vector<uint8_t>> wrapped) {
+    auto publish = [&] {
+        if (!changeFeed) {
+            apply();
+            return;
+        }
+        std::vector<ReplicationChange> changes(records.size());
+        for (size_t i = 0; i < records.size(); ++i) {
+            changes[i].type = records[i].type;
+            changes[i].keyId = records[i].keyId;
+            changes[i].createdAt = records[i].createdAt;
+            changes[i].expiresAt = records[i].expiresAt;
+            if (i < wrapped.size()) {
+                changes[i].wrappedKey = std::move(wrapped[i]);
+            }
+        }
+        std::lock_guard<std::mutex> lock(publishMutex);
+        apply();
+        changeFeed->append(std::move(changes));
+    };
+    if (keyLog) {
+        keyLog->write(records, publish);
+    } else {
+        publish();
+    }
+}
+
+std::vector<uint8_t> KeyManager::wrapForReplicas(const std::string& context, const KeyBuffer& key) const {
+    return changeFeed ? replicationCipher.wrap(key, context) : std::vector<uint8_t>();
+}
+
+std::vector<uint8_t> KeyManager::tpmGetRandom(size_t bytes) {
+    return backend->getRandom(bytes).get();
+}
+
+KeyBuffer KeyManager::generateTPMSymmetricKey() {
+    // The entropy pool is seeded from the TPM in the background, so this no longer waits on it.
+    KeyBuffer key(32);
+    if (entropyPool) {
+        entropyPool->generate(key.data(), key.size());
+    } else {
+        auto random = tpmGetRandom(key.size());
+        std::copy(random.begin(), random.end(), key.data());
+        secure_erase(random);
+    }
 
     logMessage("TPM symmetric key generated successfully", serverLogFile);
 
     return key;
 }
 
-void KeyManager::rotateKeys() {
-    std::lock_guard<std::mutex> lock(keysMutex);
-    auto now = std::time(nullptr);
+int64_t KeyManager::expiryFor(int64_t createdAt) const {
+    auto lifetime = config.rotation.keyLifetime.count();
+    return lifetime > 0 ? createdAt + lifetime : 0;
+}
 
-    for (auto it = keys.begin(); it != keys.end(); ) {
-        if (difftime(now, std::stol(it->first)) > rotationPeriodDays * 24 * 3600) {
-            it = keys.erase(it);
-        } else {
-            ++it;
+std::string KeyManager::newKeyId() {
+    // The nonce keeps ids from different processes, or from before a restart, apart
+    // within the same second; the sequence does so within this process.
+    return std::to_string(unixNow()) + "-" + keyIdNonce + "-" + std::to_string(nextKeySequence++);
+}
+
+KeyResult KeyManager::generateKey() {
+    KeyResult result;
+    result.key = generateTPMSymmetricKey();
+    result.keyId = newKeyId();
+    // One copy goes to the TPM and the other back to the caller.
+    addKey(result.keyId, result.key.clone());
+    return result;
+}
+
+size_t KeyManager::retireExpiredKeys() {
+    std::lock_guard<std::mutex> rotationLock(rotationMutex);
+    auto start = std::chrono::steady_clock::now();
+    size_t limit = std::max<size_t>(config.rotation.maxKeysPerPass, 1);
+    size_t retired = 0;
+    for (;;) {
+        auto due = keys.dueBy(unixNow(), limit);
+        if (due.empty()) {
+            break;
+        }
+        std::vector<KeyLogRecord> records;
+        records.reserve(due.size());
+        for (const auto& key_id : due) {
+            records.push_back(KeyLogRecord{KeyLogRecordType::Erase, key_id, {}});
+        }
+        std::vector<bool> erased;
+        persist(records, [&] { erased = keys.eraseMany(due); });
+        for (size_t i = 0; i < due.size(); ++i) {
+            if (erased[i]) {
+                backend->forget(due[i]);
+                ++retired;
+            }
         }
+        if (due.size() < limit) {
+            break;
+        }
+    }
+    ++rotationPasses;
+    retiredKeys += retired;
+    lastRotationUs = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    if (retired > 0) {
+        logMessage("Retired " + std::to_string(retired) + " expired keys", serverLogFile);
     }
+    return retired;
+}
+
+std::string KeyManager::rotateKeys() {
+    retireExpiredKeys();
+    auto generated = generateKey();
+    ++issuedKeys;
+    return generated.keyId;
+}
 
-    auto newKey = generateTPMSymmetricKey();
-    auto sealedKey = sealKey(newKey);
-    addKey(std::to_string(std::time(nullptr)), sealedKey);
+void KeyManager::rotationLoop() {
+    std::unique_lock<std::mutex> lock(rotationWakeMutex);
+    while (!rotationWake.wait_for(lock, config.rotation.interval, [this] { return rotationStopping; })) {
+        lock.unlock();
+        try {
+            // Only keys that actually expired get a replacement.
+            if (retireExpiredKeys() > 0) {
+                generateKey();
+                ++issuedKeys;
+            }
+        } catch (const std::exception &e) {
+            ++rotationFailures;
+            logErrorMessage("Scheduled key rotation failed: " + std::string(e.what()), serverErrorLogFile);
+        }
+        lock.lock();
+    }
 }
 
-void KeyManager::addKey(const std::string& key_id, const std::vector<uint8_t>& key) {
-    std::lock_guard<std::mutex> lock(keysMutex);
-    keys[key_id] = key;
+KeyRotationStats KeyManager::keyRotationStats() const {
+    KeyRotationStats stats;
+    stats.passes = rotationPasses.load();
+    stats.retired = retiredKeys.load();
+    stats.issued = issuedKeys.load();
+    stats.failures = rotationFailures.load();
+    stats.lastPassUs = lastRotationUs.load();
+    stats.nextExpiry = keys.nextExpiry();
+    return stats;
 }
 
-std::vector<uint8_t> KeyManager::getKey(const std::string& key_id) {
-    std::lock_guard<std::mutex> lock(keysMutex);
-    if (keys.find(key_id) != keys.end()) {
-        return unsealKey(keys[key_id]);
+void KeyManager::addKey(const std::string& key_id, KeyBuffer key) {
+    auto wrapped = wrapForReplicas(key_id, key);
+    auto sealedKey = sealKey(key_id, std::move(key));
+    int64_t createdAt = unixNow();
+    int64_t expiresAt = expiryFor(createdAt);
+    persist({KeyLogRecord{KeyLogRecordType::Put, key_id, sealedKey, createdAt, expiresAt}}, [&] {
+        keys.put(key_id, std::move(sealedKey), createdAt, expiresAt);
+    }, {std::move(wrapped)});
+    backend->forget(key_id);
+}
+
+KeyBuffer KeyManager::getKey(const std::string& key_id) {
+    // The record is immutable, so the unseal runs without holding any store lock.
+    auto stored = keys.find(key_id);
+    if (!stored) {
+        throw std::runtime_error("Key not found");
     }
-    throw std::runtime_error("Key not found");
+    return unsealKey(key_id, *stored);
 }
 
 void KeyManager::deleteKey(const std::string& key_id) {
-    std::lock_guard<std::mutex> lock(keysMutex);
-    if (keys.erase(key_id) == 0) {
+    bool erased = false;
+    if (keys.find(key_id)) {
+        persist({KeyLogRecord{KeyLogRecordType::Erase, key_id, {}}}, [&] { erased = keys.erase(key_id); });
+    }
+    if (!erased) {
         throw std::runtime_error("Key not found for deletion");
     }
+    backend->forget(key_id);
 }
 
-std::vector<uint8_t> KeyManager::sealKey(const std::vector<uint8_t>& key) {
-    ESYS_CONTEXT* esys_context;
-    TSS2_RC rc = Esys_Initialize(&esys_context, NULL, NULL);
-    if (rc != TSS2_RC_SUCCESS) {
-        logErrorMessage("Error initializing TPM: " + std::to_string(rc), serverErrorLogFile);
-        throw std::runtime_error("Error initializing TPM");
-    }
-
-    TPM2B_SENSITIVE_CREATE inSensitive = {};
-    inSensitive.size = sizeof(TPM2B_SENSITIVE_CREATE);
-    inSensitive.sensitive.userAuth.size = 0;
-    inSensitive.sensitive.data.size = static_cast<UINT16>(key.size());
-    memcpy(inSensitive.sensitive.data.buffer, key.data(), key.size());
-
-    TPM2B_PUBLIC inPublic = {};
-    inPublic.size = sizeof(TPM2B_PUBLIC);
-    inPublic.publicArea.type = TPM2_ALG_SYMCIPHER;
-    inPublic.publicArea.nameAlg = TPM2_ALG_SHA256;
-    inPublic.publicArea.objectAttributes = (TPMA_OBJECT_USERWITHAUTH | TPMA_OBJECT_RESTRICTED |
-                                             TPMA_OBJECT_DECRYPT | TPMA_OBJECT_FIXEDTPM |
-                                             TPMA_OBJECT_FIXEDPARENT | TPMA_OBJECT_SENSITIVEDATAORIGIN);
-    inPublic.publicArea.parameters.symDetail.sym.algorithm = TPM2_ALG_AES;
-    inPublic.publicArea.parameters.symDetail.sym.keyBits.aes = 128;
-    inPublic.publicArea.parameters.symDetail.sym.mode.aes = TPM2_ALG_CFB;
-    inPublic.publicArea.unique.sym.size = 0;
-
-    TPM2B_DATA outsideInfo = {};
-    TPML_PCR_SELECTION creationPCR = {};
-    TPM2B_PRIVATE* outPrivate = NULL;
-    TPM2B_PUBLIC* outPublic = NULL;
-    TPM2B_CREATION_DATA* creationData = NULL;
-    TPM2B_DIGEST* creationHash = NULL;
-    TPMT_TK_CREATION* creationTicket = NULL;
-
-    rc = Esys_Create(
-        esys_context,
-        ESYS_TR_RH_OWNER,
-        ESYS_TR_PASSWORD,
-        ESYS_TR_NONE,
-        ESYS_TR_NONE,
-        &inSensitive,
-        &inPublic,
-        &outsideInfo,
-        &creationPCR,
-        &outPrivate,
-        &outPublic,
-        &creationData,
-        &creationHash,
-        &creationTicket
-    );
-
-    if (rc != TSS2_RC_SUCCESS) {
-        Esys_Finalize(&esys_context);
-        logErrorMessage("Error sealing key using TPM: " + std::to_string(rc), serverErrorLogFile);
-        throw std::runtime_error("Error sealing key using TPM");
-    }
-
-    std::vector<uint8_t> sealedKey(outPrivate->buffer, outPrivate->buffer + outPrivate->size);
-
-    Esys_Free(outPrivate);
-    Esys_Free(outPublic);
-    Esys_Free(creationData);
-    Esys_Free(creationHash);
-    Esys_Free(creationTicket);
-    Esys_Finalize(&esys_context);
+void KeyManager::storeSealed(std::vector<std::pair<std::string, std::vector<uint8_t>>>& sealed,
+                             std::vector<std::vector<uint8_t>> wrapped) {
+    int64_t createdAt = unixNow();
+    int64_t expiresAt = expiryFor(createdAt);
+    std::vector<KeyLogRecord> records;
+    records.reserve(sealed.size());
+    for (const auto& entry : sealed) {
+        records.push_back(KeyLogRecord{KeyLogRecordType::Put, entry.first, entry.second, createdAt, expiresAt});
+    }
+    // One log write for the whole batch, so it shares a single fdatasync.
+    persist(records, [&] { keys.putMany(sealed, createdAt, expiresAt); }, std::move(wrapped));
+}
 
-    logMessage("TPM key sealed successfully", serverLogFile);
+std::vector<KeyResult> KeyManager::generateKeys(size_t count) {
+    std::vector<KeyResult> results(count);
+    std::vector<std::future<std::vector<uint8_t>>> pending(count);
+    for (size_t i = 0; i < count; ++i) {
+        try {
+            results[i].key = KeyBuffer(32);
+            if (entropyPool) {
+                entropyPool->generate(results[i].key.data(), 32);
+            } else {
+                auto random = tpmGetRandom(32);
+                std::copy(random.begin(), random.end(), results[i].key.data());
+                secure_erase(random);
+            }
+            // The id is chosen before sealing so a sharded backend can place the key by it.
+            results[i].keyId = newKeyId();
+            pending[i] = backend->seal(results[i].keyId, results[i].key.clone());
+        } catch (const std::exception &e) {
+            results[i].error = e.what();
+        }
+    }
 
-    return sealedKey;
+    std::vector<std::pair<std::string, std::vector<uint8_t>>> sealed;
+    std::vector<std::vector<uint8_t>> wrapped;
+    sealed.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        if (!pending[i].valid()) {
+            results[i].keyId.clear();
+            continue;
+        }
+        try {
+            auto blob = pending[i].get();
+            if (changeFeed) {
+                wrapped.push_back(wrapForReplicas(results[i].keyId, results[i].key));
+            }
+            sealed.emplace_back(results[i].keyId, std::move(blob));
+        } catch (const std::exception &e) {
+            results[i].keyId.clear();
+            results[i].error = e.what();
+        }
+    }
+
+    storeSealed(sealed, std::move(wrapped));
+    logMessage("Generated " + std::to_string(count) + " keys in batch", serverLogFile);
+    return results;
 }
 
-std::vector<uint8_t> KeyManager::unsealKey(const std::vector<uint8_t>& sealedKey) {
-    ESYS_CONTEXT* esys_context;
-    TSS2_RC rc = Esys_Initialize(&esys_context, NULL, NULL);
-    if (rc != TSS2_RC_SUCCESS) {
-        logErrorMessage("Error initializing TPM: " + std::to_string(rc), serverErrorLogFile);
-        throw std::runtime_error("Error initializing TPM");
+std::vector<KeyResult> KeyManager::addKeys(std::vector<std::pair<std::string, KeyBuffer>> entries) {
+    std::vector<KeyResult> results(entries.size());
+    std::vector<std::future<std::vector<uint8_t>>> pending(entries.size());
+    std::vector<std::vector<uint8_t>> wrappedEntries(entries.size());
+    for (size_t i = 0; i < entries.size(); ++i) {
+        results[i].keyId = entries[i].first;
+        try {
+            wrappedEntries[i] = wrapForReplicas(entries[i].first, entries[i].second);
+            pending[i] = backend->seal(entries[i].first, std::move(entries[i].second));
+        } catch (const std::exception &e) {
+            results[i].error = e.what();
+        }
+    }
+
+    std::vector<std::pair<std::string, std::vector<uint8_t>>> sealed;
+    std::vector<std::vector<uint8_t>> wrapped;
+    sealed.reserve(entries.size());
+    for (size_t i = 0; i < entries.size(); ++i) {
+        if (!pending[i].valid()) {
+            continue;
+        }
+        try {
+            sealed.emplace_back(entries[i].first, pending[i].get());
+            wrapped.push_back(std::move(wrappedEntries[i]));
+        } catch (const std::exception &e) {
+            results[i].error = e.what();
+        }
     }
 
-    TPM2B_PRIVATE inPrivate = {};
-    inPrivate.size = static_cast<UINT16>(sealedKey.size());
-    memcpy(inPrivate.buffer, sealedKey.data(), sealedKey.size());
+    storeSealed(sealed, std::move(wrapped));
+    for (const auto& entry : sealed) {
+        backend->forget(entry.first);
+    }
+    return results;
+}
 
-    TPM2B_PUBLIC* inPublic = NULL;
-    ESYS_TR objectHandle;
-    rc = Esys_Load(
-        esys_context,
-        ESYS_TR_RH_OWNER,
-        ESYS_TR_PASSWORD,
-        ESYS_TR_NONE,
-        ESYS_TR_NONE,
-        &inPrivate,
-        inPublic,
-        &objectHandle
-    );
+std::vector<KeyResult> KeyManager::getKeys(const std::vector<std::string>& key_ids) {
+    std::vector<KeyResult> results(key_ids.size());
+    auto found = keys.findMany(key_ids);
 
-    if (rc != TSS2_RC_SUCCESS) {
-        Esys_Finalize(&esys_context);
-        logErrorMessage("Error loading key using TPM: " + std::to_string(rc), serverErrorLogFile);
-        throw std::runtime_error("Error loading key using TPM");
+    std::vector<std::future<KeyBuffer>> pending(key_ids.size());
+    for (size_t i = 0; i < key_ids.size(); ++i) {
+        results[i].keyId = key_ids[i];
+        if (!found[i]) {
+            results[i].error = "Key not found";
+            continue;
+        }
+        try {
+            pending[i] = backend->unseal(key_ids[i], found[i]->version, found[i]->sealedBlob);
+        } catch (const std::exception &e) {
+            results[i].error = e.what();
+        }
     }
 
-    TPM2B_SENSITIVE_DATA* outData;
-    rc = Esys_Unseal(
-        esys_context,
-        objectHandle,
-        ESYS_TR_PASSWORD,
-        ESYS_TR_NONE,
-        ESYS_TR_NONE,
-        &outData
-    );
+    for (size_t i = 0; i < key_ids.size(); ++i) {
+        if (!pending[i].valid()) {
+            continue;
+        }
+        try {
+            results[i].key = pending[i].get();
+        } catch (const std::exception &e) {
+            results[i].error = e.what();
+        }
+    }
+    return results;
+}
 
-    if (rc != TSS2_RC_SUCCESS) {
-        Esys_Finalize(&esys_context);
-        logErrorMessage("Error unsealing key using TPM: " + std::to_string(rc), serverErrorLogFile);
-        throw std::runtime_error("Error unsealing key using TPM");
+std::vector<KeyResult> KeyManager::deleteKeys(const std::vector<std::string>& key_ids) {
+    std::vector<KeyResult> results(key_ids.size());
+    auto found = keys.findMany(key_ids);
+    std::vector<KeyLogRecord> records;
+    for (size_t i = 0; i < key_ids.size(); ++i) {
+        if (found[i]) {
+            records.push_back(KeyLogRecord{KeyLogRecordType::Erase, key_ids[i], {}});
+        }
     }
+    std::vector<bool> erased(key_ids.size(), false);
+    persist(records, [&] { erased = keys.eraseMany(key_ids); });
+    for (size_t i = 0; i < key_ids.size(); ++i) {
+        results[i].keyId = key_ids[i];
+        if (!erased[i]) {
+            results[i].error = "Key not found for deletion";
+        } else {
+            backend->forget(key_ids[i]);
+        }
+    }
+    return results;
+}
 
-    std::vector<uint8_t> key(outData->buffer, outData->buffer + outData->size);
+uint32_t KeyManager::rotateKeyEncryptionKey() {
+    std::lock_guard<std::mutex> rotationLock(kekRotationMutex);
+    uint32_t version;
+    {
+        std::lock_guard<std::mutex> lock(kekMutex);
+        version = sealedKeks.empty() ? 1 : sealedKeks.rbegin()->first + 1;
+    }
 
-    Esys_Free(outData);
-    Esys_Finalize(&esys_context);
+    auto kek = generateTPMSymmetricKey();
+    auto sealedKek = sealKey(kekContext + std::to_string(version), kek.clone());
+    auto wrapped = wrapForReplicas(kekContext + std::to_string(version), kek);
+    persist({KeyLogRecord{KeyLogRecordType::Kek, std::to_string(version), sealedKek}}, [&] {
+        std::lock_guard<std::mutex> lock(kekMutex);
+        sealedKeks[version] = std::move(sealedKek);
+    }, {std::move(wrapped)});
+    envelope.installKek(version, kek.data(), kek.size());
+
+    logMessage("Key-encryption key rotated to version " + std::to_string(version), serverLogFile);
+    return version;
+}
 
-    logMessage("TPM key unsealed successfully", serverLogFile);
+DataKey KeyManager::generateDataKey(size_t keyBytes, const std::string& context) {
+    if (keyBytes == 0 || keyBytes > 64) {
+        throw std::invalid_argument("Data key length must be between 1 and 64 bytes");
+    }
+    DataKey dataKey;
+    dataKey.plaintext = KeyBuffer(keyBytes);
+    if (entropyPool) {
+        entropyPool->generate(dataKey.plaintext.data(), keyBytes);
+    } else if (RAND_bytes(dataKey.plaintext.data(), static_cast<int>(keyBytes)) != 1) {
+        throw std::runtime_error("Error generating data key");
+    }
+    dataKey.ciphertextBlob = envelope.wrap(dataKey.plaintext, context);
+    dataKey.kekVersion = EnvelopeCipher::kekVersionOf(dataKey.ciphertextBlob);
+    return dataKey;
+}
+
+KeyBuffer KeyManager::decryptDataKey(const std::vector<uint8_t>& ciphertextBlob, const std::string& context) {
+    return envelope.unwrap(ciphertextBlob, context);
+}
 
+std::vector<uint8_t> KeyManager::sealKey(const std::string& key_id, KeyBuffer key) {
+    auto sealedKey = backend->seal(key_id, std::move(key)).get();
+    logMessage("TPM key sealed successfully", serverLogFile);
+    return sealedKey;
+}
+
+KeyBuffer KeyManager::unsealKey(const std::string& key_id, const StoredKey& stored) {
+    auto key = backend->unseal(key_id, stored.version, stored.sealedBlob).get();
+    logMessage("TPM key unsealed successfully", serverLogFile);
     return key;
 }
 
+std::string KeyManager::replicationRequestAuth(const std::string& path,
+                                               const std::multimap<std::string, std::string>& params) const {
+    if (replicationAuthKey.empty()) {
+        throw std::invalid_argument("This server has no replication key");
+    }
+    return signReplicationRequest(replicationAuthKey, unixNow(), path, params);
+}
+
+bool KeyManager::checkReplicationRequestAuth(const std::string& path, const std::multimap<std::string, std::string>& params,
+                                             const std::string& auth) const {
+    if (replicationAuthKey.empty()) {
+        return false;
+    }
+    char* end = nullptr;
+    errno = 0;
+    long long time = std::strtoll(auth.c_str(), &end, 10);
+    if (end == auth.c_str() || *end != ':' || errno == ERANGE) {
+        return false;
+    }
+    long long skew = static_cast<long long>(unixNow()) - time;
+    if (skew > config.replication.authWindow.count() || -skew > config.replication.authWindow.count()) {
+        return false;
+    }
+    std::string expected = signReplicationRequest(replicationAuthKey, time, path, params);
+    return expected.size() == auth.size() && CRYPTO_memcmp(expected.data(), auth.data(), auth.size()) == 0;
+}
+
+ReplicationToken KeyManager::replicationToken() const {
+    if (changeFeed) {
+        return ReplicationToken{changeFeed->epoch(), changeFeed->lastSeq()};
+    }
+    std::lock_guard<std::mutex> lock(replicaMutex);
+    return replicaPosition;
+}
+
+bool KeyManager::replicationChanges(uint64_t epoch, uint64_t after, size_t limit, std::chrono::milliseconds wait,
+                                    ReplicationBatch& batch) {
+    if (!changeFeed) {
+        throw std::invalid_argument("This server is not a replication primary");
+    }
+    if (epoch != changeFeed->epoch()) {
+        batch.epoch = changeFeed->epoch();
+        batch.lastSeq = changeFeed->lastSeq();
+        batch.changes.clear();
+        return false;
+    }
+    return changeFeed->read(after, limit, wait, batch);
+}
+
+ReplicationSnapshotPage KeyManager::replicationSnapshot(const std::string& after, size_t limit) {
+    if (!changeFeed) {
+        throw std::invalid_argument("This server is not a replication primary");
+    }
+    ReplicationSnapshotPage page;
+    page.epoch = changeFeed->epoch();
+    // Changes are appended only after they are applied, so everything up to
+    // here is already in the store the page is read from.
+    page.seq = changeFeed->lastSeq();
+
+    if (after.empty()) {
+        std::map<uint32_t, std::vector<uint8_t>> keks;
+        {
+            std::lock_guard<std::mutex> lock(kekMutex);
+            keks = sealedKeks;
+        }
+        for (const auto& kek : keks) {
+            std::string context = kekContext + std::to_string(kek.first);
+            auto plaintext = unsealKey(context, StoredKey{kek.second, 0});
+            ReplicationChange change;
+            change.type = KeyLogRecordType::Kek;
+            change.keyId = std::to_string(kek.first);
+            change.wrappedKey = replicationCipher.wrap(plaintext, context);
+            page.changes.push_back(std::move(change));
+        }
+    }
+
+    auto key_ids = keys.idsAfter(after, limit);
+    auto found = keys.findMany(key_ids);
+    std::vector<std::future<KeyBuffer>> pending(key_ids.size());
+    for (size_t i = 0; i < key_ids.size(); ++i) {
+        if (found[i]) {
+            pending[i] = backend->unseal(key_ids[i], found[i]->version, found[i]->sealedBlob);
+        }
+    }
+    for (size_t i = 0; i < key_ids.size(); ++i) {
+        if (!pending[i].valid()) {
+            continue;   // erased since the page was listed; the feed carries the erase
+        }
+        ReplicationChange change;
+        change.keyId = key_ids[i];
+        change.wrappedKey = replicationCipher.wrap(pending[i].get(), key_ids[i]);
+        change.createdAt = found[i]->createdAt;
+        change.expiresAt = found[i]->expiresAt;
+        page.changes.push_back(std::move(change));
+    }
+    page.next = key_ids.size() == limit && limit > 0 ? key_ids.back() : std::string();
+    return page;
+}
+
+void KeyManager::applyReplicated(const std::vector<ReplicationChange>& changes, const ReplicationToken& position) {
+    // Every key is sealed under this node's TPM first, pipelined; the store is
+    // only touched once the whole batch is sealed.
+    std::vector<std::future<std::vector<uint8_t>>> pending(changes.size());
+    std::map<uint32_t, KeyBuffer> keks;
+    for (size_t i = 0; i < changes.size(); ++i) {
+        const auto& change = changes[i];
+        if (change.type == KeyLogRecordType::Put) {
+            pending[i] = backend->seal(change.keyId, replicationCipher.unwrap(change.wrappedKey, change.keyId));
+        } else if (change.type == KeyLogRecordType::Kek) {
+            std::string context = kekContext + change.keyId;
+            KeyBuffer kek = replicationCipher.unwrap(change.wrappedKey, context);
+            pending[i] = backend->seal(context, kek.clone());
+            keks[static_cast<uint32_t>(std::stoul(change.keyId))] = std::move(kek);
+        }
+    }
+
+    std::vector<KeyLogRecord> records;
+    records.reserve(changes.size() + 1);
+    for (size_t i = 0; i < changes.size(); ++i) {
+        const auto& change = changes[i];
+        switch (change.type) {
+        case KeyLogRecordType::Put:
+            records.push_back(KeyLogRecord{KeyLogRecordType::Put, change.keyId, pending[i].get(), change.createdAt, change.expiresAt});
+            break;
+        case KeyLogRecordType::Erase:
+            records.push_back(KeyLogRecord{KeyLogRecordType::Erase, change.keyId, {}});
+            break;
+        case KeyLogRecordType::Kek:
+            records.push_back(KeyLogRecord{KeyLogRecordType::Kek, change.keyId, pending[i].get()});
+            break;
+        default:
+            throw std::invalid_argument("Unexpected replication change for " + change.keyId);
+        }
+    }
+    records.push_back(KeyLogRecord{KeyLogRecordType::ReplicaPosition, formatReplicationToken(position), {}});
+
+    persist(records, [&] {
+        for (const auto& record : records) {
+            if (record.type == KeyLogRecordType::Put) {
+                keys.put(record.keyId, record.sealedBlob, record.createdAt, record.expiresAt);
+            } else if (record.type == KeyLogRecordType::Erase) {
+                keys.erase(record.keyId);
+            } else if (record.type == KeyLogRecordType::Kek) {
+                std::lock_guard<std::mutex> lock(kekMutex);
+                sealedKeks[static_cast<uint32_t>(std::stoul(record.keyId))] = record.sealedBlob;
+            }
+        }
+    });
+    for (const auto& kek : keks) {
+        envelope.installKek(kek.first, kek.second.data(), kek.second.size());
+    }
+    for (const auto& change : changes) {
+        if (change.type != KeyLogRecordType::Kek) {
+            backend->forget(change.keyId);
+        }
+    }
+    replicaApplied += changes.size();
+    setReplicaPosition(position);
+}
+
+void KeyManager::finishReplicaSnapshot(const std::unordered_set<std::string>& present, const ReplicationToken& position) {
+    std::vector<std::string> stale;
+    keys.forEach([&](const std::string& key_id, const StoredKey&) {
+        if (!present.count(key_id)) {
+            stale.push_back(key_id);
+        }
+    });
+    std::vector<KeyLogRecord> records;
+    records.reserve(stale.size() + 1);
+    for (const auto& key_id : stale) {
+        records.push_back(KeyLogRecord{KeyLogRecordType::Erase, key_id, {}});
+    }
+    records.push_back(KeyLogRecord{KeyLogRecordType::ReplicaPosition, formatReplicationToken(position), {}});
+    persist(records, [&] { keys.eraseMany(stale); });
+    for (const auto& key_id : stale) {
+        backend->forget(key_id);
+    }
+    ++replicaSnapshots;
+    setReplicaPosition(position);
+    logMessage("Replica snapshot complete at " + formatReplicationToken(position) + ", " +
+                   std::to_string(stale.size()) + " stale keys erased", serverLogFile);
+}
+
+void KeyManager::setReplicaPosition(const ReplicationToken& position) {
+    {
+        std::lock_guard<std::mutex> lock(replicaMutex);
+        replicaPosition = position;
+        if (position.epoch == replicaPrimary.epoch && position.seq >= replicaPrimary.seq) {
+            replicaCaughtUpAt = std::chrono::steady_clock::now();
+        }
+    }
+    replicaAdvanced.notify_all();
+}
+
+void KeyManager::noteReplicaPoll(const ReplicationToken& primary) {
+    std::lock_guard<std::mutex> lock(replicaMutex);
+    replicaPrimary = primary;
+    if (replicaPosition.epoch == primary.epoch && replicaPosition.seq >= primary.seq) {
+        replicaCaughtUpAt = std::chrono::steady_clock::now();
+    }
+}
+
+bool KeyManager::waitForReplication(const ReplicationToken& token, std::chrono::milliseconds timeout) {
+    if (config.replication.role != ReplicationRole::Replica) {
+        return true;
+    }
+    ++replicaTokenWaits;
+    std::unique_lock<std::mutex> lock(replicaMutex);
+    bool reached = replicaAdvanced.wait_for(lock, timeout, [&] {
+        return replicaPosition.epoch == token.epoch && replicaPosition.seq >= token.seq;
+    });
+    if (!reached) {
+        ++replicaTokenTimeouts;
+    }
+    return reached;
+}
+
+ReplicationStats KeyManager::replicationStats() const {
+    ReplicationStats stats;
+    stats.role = config.replication.role;
+    if (changeFeed) {
+        stats.epoch = changeFeed->epoch();
+        stats.lastSeq = changeFeed->lastSeq();
+        stats.oldestSeq = changeFeed->oldestSeq();
+        return stats;
+    }
+    if (config.replication.role != ReplicationRole::Replica) {
+        return stats;
+    }
+    {
+        std::lock_guard<std::mutex> lock(replicaMutex);
+        stats.epoch = replicaPosition.epoch;
+        stats.lastSeq = replicaPosition.seq;
+        stats.primarySeq = replicaPrimary.seq;
+        bool sameEpoch = replicaPosition.epoch == replicaPrimary.epoch;
+        bool caughtUp = sameEpoch && replicaPosition.seq >= replicaPrimary.seq;
+        // Under a new epoch every change the primary has counts until the snapshot completes.
+        stats.lagChanges = caughtUp ? 0 : replicaPrimary.seq - (sameEpoch ? replicaPosition.seq : 0);
+        if (!caughtUp) {
+            stats.lagMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - replicaCaughtUpAt).count();
+        }
+    }
+    stats.appliedChanges = replicaApplied.load();
+    stats.snapshots = replicaSnapshots.load();
+    stats.failures = replicaFailures.load();
+    stats.tokenWaits = replicaTokenWaits.load();
+    stats.tokenTimeouts = replicaTokenTimeouts.load();
+    return stats;
+}
@@ -4,28 +4,221 @@
 
 #include <string>
 #include <vector>
+#include <atomic>
 #include <mutex>
-#include <unordered_map>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <map>
 #include <ctime>
+#include <functional>
 #include <utility>
+#include <memory>
+#include <unordered_set>
+#include "tpm_backend.h"
+#include "sharded_tpm_backend.h"
+#include "tpm_device_backend.h"
+#include "software_tpm_backend.h"
+#include "batch_signer.h"
+#include "envelope_cipher.h"
+#include "key_buffer.h"
+#include "entropy_pool.h"
+#include "key_store.h"
+#include "key_log.h"
+#include "change_feed.h"
+
+struct KeyRotationConfig {
+    std::chrono::seconds keyLifetime{30 * 24 * 3600};   // expiry set on every stored key; 0 never expires
+    std::chrono::seconds interval{60};                  // background rotation cadence; 0 disables the thread
+    size_t maxKeysPerPass = 1024;                       // expired keys retired per log write
+};
+
+struct KeyRotationStats {
+    uint64_t passes = 0;
+    uint64_t retired = 0;        // expired keys erased
+    uint64_t issued = 0;         // replacement keys generated
+    uint64_t failures = 0;       // background passes that threw
+    uint64_t lastPassUs = 0;
+    int64_t nextExpiry = 0;      // Unix seconds of the earliest expiry, 0 if none
+};
+
+struct KeyManagerConfig {
+    TPMBackendType backend = TPMBackendType::Device;
+    TPMDeviceConfig device;        // used by the Device backend
+    TPMShardConfig shards;         // more than one TCTI shards the Device backend
+    SoftwareTPMConfig software;    // used by the Software backend
+    BatchSignerConfig signer;
+    bool entropyPoolEnabled = true;
+    EntropyPoolConfig entropyPool;
+    size_t keyStoreShards = 64;
+    KeyLogConfig keyLog;
+    KeyRotationConfig rotation;
+    ReplicationConfig replication;
+};
+
+struct DataKey {
+    KeyBuffer plaintext;
+    std::vector<uint8_t> ciphertextBlob;   // wrapped under the current KEK
+    uint32_t kekVersion;
+};
+
+// Per-item outcome of a batch operation; error is empty on success.
+struct KeyResult {
+    std::string keyId;
+    KeyBuffer key;
+    std::string error;
+};
 
 class KeyManager {
 public:
-    KeyManager();
+    explicit KeyManager(const KeyManagerConfig& config = KeyManagerConfig());
+    ~KeyManager();
+
+    KeyManager(const KeyManager&) = delete;
+    KeyManager& operator=(const KeyManager&) = delete;
 
-    std::vector<uint8_t> generateTPMSymmetricKey();
-    void rotateKeys();
-    void addKey(const std::string& key_id, const std::vector<uint8_t>& key);
-    std::vector<uint8_t> getKey(const std::string& key_id);
+    KeyBuffer generateTPMSymmetricKey();
+    // Generates, seals and stores a key under a fresh id.
+    KeyResult generateKey();
+    // Retires every expired key, then issues a new one and returns its id.
+    std::string rotateKeys();
+    // Erases keys whose expiry has passed, touching only the due ones; returns how many.
+    size_t retireExpiredKeys();
+    // Unique across processes and restarts: "<unix seconds>-<process nonce>-<sequence>".
+    std::string newKeyId();
+    // Plaintext keys are moved in and out in KeyBuffers; addKey consumes its key.
+    void addKey(const std::string& key_id, KeyBuffer key);
+    KeyBuffer getKey(const std::string& key_id);
     void deleteKey(const std::string& key_id);
 
+    // Batch variants lock each key store shard once and submit all TPM work to
+    // the backend together, outside any store lock, so it is pipelined.
+    std::vector<KeyResult> generateKeys(size_t count);
+    std::vector<KeyResult> addKeys(std::vector<std::pair<std::string, KeyBuffer>> entries);
+    std::vector<KeyResult> getKeys(const std::vector<std::string>& key_ids);
+    std::vector<KeyResult> deleteKeys(const std::vector<std::string>& key_ids);
+
+    // Envelope encryption: data keys are wrapped in software under a TPM-sealed
+    // KEK, so only KEK creation and rotation touch the TPM.
+    DataKey generateDataKey(size_t keyBytes, const std::string& context);
+    KeyBuffer decryptDataKey(const std::vector<uint8_t>& ciphertextBlob, const std::string& context);
+    uint32_t rotateKeyEncryptionKey();
+
+    // Replication (change_feed.h). A primary publishes every store mutation to
+    // its change feed, in the order it was applied; a replica applies them,
+    // sealing each key again under its own TPM. Replicas take no writes of
+    // their own and run no rotation.
+    ReplicationRole replicationRole() const { return config.replication.role; }
+    // Primary: its newest change. Replica: the newest change it has applied.
+    ReplicationToken replicationToken() const;
+    // Value of the replication auth header for a GET of path with params: the
+    // Unix time and an HMAC-SHA256 over both, under a key derived from the
+    // replication key. The primary checks it before serving the feed or a
+    // snapshot; it is refused on a standalone server or outside authWindow.
+    std::string replicationRequestAuth(const std::string& path, const std::multimap<std::string, std::string>& params) const;
+    bool checkReplicationRequestAuth(const std::string& path, const std::multimap<std::string, std::string>& params,
+                                     const std::string& auth) const;
+    // Primary side of /replication/changes; false when the caller must take a snapshot.
+    bool replicationChanges(uint64_t epoch, uint64_t after, size_t limit, std::chrono::milliseconds wait, ReplicationBatch& batch);
+    // Primary side of /replication/snapshot. Unseals every key on the page.
+    ReplicationSnapshotPage replicationSnapshot(const std::string& after, size_t limit);
+    // Replica side, driven by ReplicaSync. The changes are logged in one write
+    // together with position, the replica's position once they are applied.
+    void applyReplicated(const std::vector<ReplicationChange>& changes, const ReplicationToken& position);
+    // Ends a snapshot: erases local keys missing from present and moves to position.
+    void finishReplicaSnapshot(const std::unordered_set<std::string>& present, const ReplicationToken& position);
+    // Records the primary's newest change, as seen by the last poll, for lag reporting.
+    void noteReplicaPoll(const ReplicationToken& primary);
+    void noteReplicaFailure() { ++replicaFailures; }
+    // Blocks until a replica has applied token or timeout passes; true at once on other roles.
+    bool waitForReplication(const ReplicationToken& token, std::chrono::milliseconds timeout);
+    ReplicationStats replicationStats() const;
+
+    TPMBackend& tpmBackend() { return *backend; }
+    // Null unless the backend is a TPM device; the first TPM when sharded.
+    TPMContextPool* contextPool() { return backend->contextPool(); }
+    BatchSigner& batchSigner() { return *signer; }
+    const std::string& signingPublicKeyPem() const { return backend->signingPublicKeyPem(); }
+    size_t keyCount() const { return keys.size(); }
+    TPMContextPoolStats contextPoolStats() const { return backend->contextPoolStats(); }
+    TPMObjectCacheStats objectCacheStats() const { return backend->objectCacheStats(); }
+    TPMSchedulerStats schedulerStats() const { return backend->schedulerStats(); }
+    std::vector<TPMDeviceStats> tpmDeviceStats() const { return backend->deviceStats(); }
+    BatchSignerStats batchSignerStats() const { return signer->stats(); }
+    EntropyPoolStats entropyPoolStats() const { return entropyPool ? entropyPool->stats() : EntropyPoolStats(); }
+    KeyLogStats keyLogStats() const { return keyLog ? keyLog->stats() : KeyLogStats(); }
+    KeyRotationStats keyRotationStats() const;
+    uint64_t startupMicros() const { return startupTimeUs; }
+    const std::vector<std::pair<std::string, uint64_t>>& startupReport() const { return startupPhases; }
+
 private:
-    std::unordered_map<std::string, std::vector<uint8_t>> keys;
-    std::mutex keysMutex;
+    KeyManagerConfig config;
+    std::unique_ptr<TPMBackend> backend;
+    std::unique_ptr<EntropyPool> entropyPool;
+    std::unique_ptr<BatchSigner> signer;
+    KeyStore keys;
+    std::string keyIdNonce;
+    std::atomic<uint64_t> nextKeySequence{0};
+
+    EnvelopeCipher envelope;
+    std::map<uint32_t, std::vector<uint8_t>> sealedKeks;
+    std::mutex kekMutex;           // guards sealedKeks
+    std::mutex kekRotationMutex;   // serializes rotations; taken before kekMutex
+
+    // Primary only. Applies and appends happen together under publishMutex, so
+    // feed order is store order even for concurrent writes to one key; with a
+    // key log, KeyLog::write also runs them in log order.
+    std::unique_ptr<ChangeFeed> changeFeed;
+    std::mutex publishMutex;
+    // Primary and replica: the shared replication key, installed as version 1,
+    // and the key replication requests are signed with, derived from it.
+    EnvelopeCipher replicationCipher;
+    KeyBuffer replicationAuthKey;
+
+    mutable std::mutex replicaMutex;   // guards the replica fields below
+    std::condition_variable replicaAdvanced;
+    ReplicationToken replicaPosition;
+    ReplicationToken replicaPrimary;   // the primary's newest change at the last poll
+    std::chrono::steady_clock::time_point replicaCaughtUpAt;
+    std::atomic<uint64_t> replicaApplied{0};
+    std::atomic<uint64_t> replicaSnapshots{0};
+    std::atomic<uint64_t> replicaFailures{0};
+    std::atomic<uint64_t> replicaTokenWaits{0};
+    std::atomic<uint64_t> replicaTokenTimeouts{0};
+
+    // Declared last so its compaction thread stops before the state it snapshots goes away.
+    std::unique_ptr<KeyLog> keyLog;
+
+    std::vector<uint8_t> tpmGetRandom(size_t bytes);
+    void recoverKeys();
+    void storeSealed(std::vector<std::pair<std::string, std::vector<uint8_t>>>& sealed,
+                     std::vector<std::vector<uint8_t>> wrapped);
+    int64_t expiryFor(int64_t createdAt) const;
+    void rotationLoop();
+    // Logs records durably (when persistence is on), then applies them in memory
+    // and, on a primary, publishes them. wrapped[i] is the key of records[i]
+    // under the replication key, from wrapForReplicas; Erase records need none.
+    void persist(const std::vector<KeyLogRecord>& records, const std::function<void()>& apply,
+                 std::vector<std::vector<uint8_t>> wrapped = {});
+    // The key under the replication key on a primary; empty otherwise.
+    std::vector<uint8_t> wrapForReplicas(const std::string& context, const KeyBuffer& key) const;
+    void setReplicaPosition(const ReplicationToken& position);
+    std::vector<uint8_t> sealKey(const std::string& key_id, KeyBuffer key);
+    KeyBuffer unsealKey(const std::string& key_id, const StoredKey& stored);
+
+    std::mutex rotationMutex;      // serializes rotation passes
+    std::mutex rotationWakeMutex;
+    std::condition_variable rotationWake;
+    bool rotationStopping = false;
+    std::thread rotationThread;
+    std::atomic<uint64_t> rotationPasses{0};
+    std::atomic<uint64_t> retiredKeys{0};
+    std::atomic<uint64_t> issuedKeys{0};
+    std::atomic<uint64_t> rotationFailures{0};
+    std::atomic<uint64_t> lastRotationUs{0};
 
-    std::vector<uint8_t> sealKey(const std::vector<uint8_t>& key);
-    std::vector<uint8_t> unsealKey(const std::vector<uint8_t>& sealedKey);
-    static constexpr int rotationPeriodDays = 30;
+    uint64_t startupTimeUs = 0;
+    std::vector<std::pair<std::string, uint64_t>> startupPhases;
 };
 
 #endif // KEY_MANAGER_H
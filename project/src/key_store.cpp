@@ -0,0 +1,231 @@
+// key_store.cpp
+#include "key_store.h"
+#include "metrics.h"
+#include <algorithm>
+#include <chrono>
+#include <iterator>
+#include <mutex>
+#include <type_traits>
+
+namespace {
+
+// Uncontended acquisitions cost one try_lock; only actual waits are timed.
+template <typename Lock>
+Lock lockShard(std::shared_mutex& mutex) {
+    static const MetricId waitMetric = registerHistogram(
+        "kms_key_store_lock_wait_seconds",
+        metricLabel("mode", std::is_same<Lock, std::shared_lock<std::shared_mutex>>::value ? "shared" : "exclusive"),
+        "Time spent blocked on a key store shard lock");
+    Lock lock(mutex, std::try_to_lock);
+    if (!lock.owns_lock()) {
+        auto start = std::chrono::steady_clock::now();
+        lock.lock();
+        observeDuration(waitMetric, std::chrono::steady_clock::now() - start);
+    }
+    return lock;
+}
+
+using SharedLock = std::shared_lock<std::shared_mutex>;
+using ExclusiveLock = std::unique_lock<std::shared_mutex>;
+
+} // namespace
+
+KeyStore::KeyStore(size_t shardCount) : shards(shardCount == 0 ? 1 : shardCount) {}
+
+size_t KeyStore::shardIndex(const std::string& key_id) const {
+    return std::hash<std::string>{}(key_id) % shards.size();
+}
+
+std::vector<std::vector<size_t>> KeyStore::groupByShard(const std::vector<std::string>& key_ids) const {
+    std::vector<std::vector<size_t>> groups(shards.size());
+    for (size_t i = 0; i < key_ids.size(); ++i) {
+        groups[shardIndex(key_ids[i])].push_back(i);
+    }
+    return groups;
+}
+
+void KeyStore::publish(Shard& shard, const std::string& key_id, Record record) {
+    auto& slot = shard.records[key_id];
+    if (slot && slot->expiresAt != 0) {
+        shard.expiry.erase({slot->expiresAt, key_id});
+    }
+    if (record->expiresAt != 0) {
+        shard.expiry.emplace(record->expiresAt, key_id);
+    }
+    slot = std::move(record);
+}
+
+bool KeyStore::remove(Shard& shard, const std::string& key_id) {
+    auto it = shard.records.find(key_id);
+    if (it == shard.records.end()) {
+        return false;
+    }
+    if (it->second->expiresAt != 0) {
+        shard.expiry.erase({it->second->expiresAt, key_id});
+    }
+    shard.records.erase(it);
+    return true;
+}
+
+KeyStore::Record KeyStore::find(const std::string& key_id) const {
+    const Shard& shard = shards[shardIndex(key_id)];
+    auto lock = lockShard<SharedLock>(shard.mutex);
+    auto it = shard.records.find(key_id);
+    return it == shard.records.end() ? nullptr : it->second;
+}
+
+uint64_t KeyStore::put(const std::string& key_id, std::vector<uint8_t> sealedBlob, int64_t createdAt, int64_t expiresAt) {
+    auto record = std::make_shared<StoredKey>();
+    record->sealedBlob = std::move(sealedBlob);
+    record->version = nextVersion++;
+    record->createdAt = createdAt;
+    record->expiresAt = expiresAt;
+    uint64_t version = record->version;
+
+    Shard& shard = shards[shardIndex(key_id)];
+    auto lock = lockShard<ExclusiveLock>(shard.mutex);
+    publish(shard, key_id, std::move(record));
+    return version;
+}
+
+bool KeyStore::erase(const std::string& key_id) {
+    Shard& shard = shards[shardIndex(key_id)];
+    auto lock = lockShard<ExclusiveLock>(shard.mutex);
+    return remove(shard, key_id);
+}
+
+std::vector<KeyStore::Record> KeyStore::findMany(const std::vector<std::string>& key_ids) const {
+    std::vector<Record> found(key_ids.size());
+    auto groups = groupByShard(key_ids);
+    for (size_t s = 0; s < shards.size(); ++s) {
+        if (groups[s].empty()) {
+            continue;
+        }
+        auto lock = lockShard<SharedLock>(shards[s].mutex);
+        for (size_t i : groups[s]) {
+            auto it = shards[s].records.find(key_ids[i]);
+            if (it != shards[s].records.end()) {
+                found[i] = it->second;
+            }
+        }
+    }
+    return found;
+}
+
+std::vector<uint64_t> KeyStore::putMany(std::vector<std::pair<std::string, std::vector<uint8_t>>> entries,
+                                        int64_t createdAt, int64_t expiresAt) {
+    std::vector<std::string> key_ids;
+    key_ids.reserve(entries.size());
+    for (const auto& entry : entries) {
+        key_ids.push_back(entry.first);
+    }
+
+    std::vector<uint64_t> versions(entries.size());
+    auto groups = groupByShard(key_ids);
+    for (size_t s = 0; s < shards.size(); ++s) {
+        if (groups[s].empty()) {
+            continue;
+        }
+        auto lock = lockShard<ExclusiveLock>(shards[s].mutex);
+        for (size_t i : groups[s]) {
+            auto record = std::make_shared<StoredKey>();
+            record->sealedBlob = std::move(entries[i].second);
+            record->version = nextVersion++;
+            record->createdAt = createdAt;
+            record->expiresAt = expiresAt;
+            versions[i] = record->version;
+            publish(shards[s], key_ids[i], std::move(record));
+        }
+    }
+    return versions;
+}
+
+std::vector<bool> KeyStore::eraseMany(const std::vector<std::string>& key_ids) {
+    std::vector<bool> erased(key_ids.size(), false);
+    auto groups = groupByShard(key_ids);
+    for (size_t s = 0; s < shards.size(); ++s) {
+        if (groups[s].empty()) {
+            continue;
+        }
+        auto lock = lockShard<ExclusiveLock>(shards[s].mutex);
+        for (size_t i : groups[s]) {
+            erased[i] = remove(shards[s], key_ids[i]);
+        }
+    }
+    return erased;
+}
+
+void KeyStore::forEach(const std::function<void(const std::string&, const StoredKey&)>& fn) const {
+    std::vector<std::pair<std::string, Record>> records;
+    for (const auto& shard : shards) {
+        auto lock = lockShard<SharedLock>(shard.mutex);
+        records.insert(records.end(), shard.records.begin(), shard.records.end());
+    }
+    for (const auto& record : records) {
+        fn(record.first, *record.second);
+    }
+}
+
+std::vector<std::string> KeyStore::dueBy(int64_t now, size_t limit) const {
+    std::vector<std::pair<int64_t, std::string>> due;
+    for (const auto& shard : shards) {
+        auto lock = lockShard<SharedLock>(shard.mutex);
+        size_t taken = 0;
+        for (auto it = shard.expiry.begin(); it != shard.expiry.end() && it->first <= now && taken < limit; ++it, ++taken) {
+            due.push_back(*it);
+        }
+    }
+    if (due.size() > limit) {
+        std::partial_sort(due.begin(), due.begin() + limit, due.end());
+        due.resize(limit);
+    } else {
+        std::sort(due.begin(), due.end());
+    }
+    std::vector<std::string> key_ids;
+    key_ids.reserve(due.size());
+    for (auto& entry : due) {
+        key_ids.push_back(std::move(entry.second));
+    }
+    return key_ids;
+}
+
+std::vector<std::string> KeyStore::idsAfter(const std::string& after, size_t limit) const {
+    // Keeps only the limit smallest ids seen so far, so a page costs one pass over the store.
+    if (limit == 0) {
+        return {};
+    }
+    std::set<std::string> page;
+    for (const auto& shard : shards) {
+        auto lock = lockShard<SharedLock>(shard.mutex);
+        for (const auto& entry : shard.records) {
+            if (entry.first <= after || (page.size() == limit && entry.first >= *page.rbegin())) {
+                continue;
+            }
+            page.insert(entry.first);
+            if (page.size() > limit) {
+                page.erase(std::prev(page.end()));
+            }
+        }
+    }
+    return std::vector<std::string>(page.begin(), page.end());
+}
+
+int64_t KeyStore::nextExpiry() const {
+    int64_t earliest = 0;
+    for (const auto& shard : shards) {
+        auto lock = lockShard<SharedLock>(shard.mutex);
+        if (!shard.expiry.empty() && (earliest == 0 || shard.expiry.begin()->first < earliest)) {
+            earliest = shard.expiry.begin()->first;
+        }
+    }
+    return earliest;
+}
+
+size_t KeyStore::size() const {
+    size_t total = 0;
+    for (const auto& shard : shards) {
+        auto lock = lockShard<SharedLock>(shard.mutex);
+        total += shard.records.size();
+    }
+    return total;
+}
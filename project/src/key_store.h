@@ -0,0 +1,76 @@
+// key_store.h
+#ifndef KEY_STORE_H
+#define KEY_STORE_H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <set>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+struct StoredKey {
+    std::vector<uint8_t> sealedBlob;
+    uint64_t version = 0;   // distinguishes blobs re-stored under the same key_id
+    int64_t createdAt = 0;  // Unix seconds
+    int64_t expiresAt = 0;  // Unix seconds; 0 never expires
+};
+
+// Lock-striped map of sealed key records. Records are immutable once published,
+// so readers take a shard's shared lock just long enough to copy a shared_ptr;
+// no TPM work ever happens while a shard lock is held. Each shard also keeps
+// its expiring records ordered by expiry, so finding due keys costs a lookup
+// per shard rather than a scan of the whole store.
+class KeyStore {
+public:
+    using Record = std::shared_ptr<const StoredKey>;
+
+    explicit KeyStore(size_t shardCount = 64);
+
+    Record find(const std::string& key_id) const;
+    // Publishes a new record and returns its version.
+    uint64_t put(const std::string& key_id, std::vector<uint8_t> sealedBlob, int64_t createdAt, int64_t expiresAt);
+    bool erase(const std::string& key_id);
+
+    // Batch variants lock each touched shard once.
+    std::vector<Record> findMany(const std::vector<std::string>& key_ids) const;
+    std::vector<uint64_t> putMany(std::vector<std::pair<std::string, std::vector<uint8_t>>> entries,
+                                  int64_t createdAt, int64_t expiresAt);
+    std::vector<bool> eraseMany(const std::vector<std::string>& key_ids);
+
+    // Visits a point-in-time copy of every record; no shard lock is held during fn.
+    void forEach(const std::function<void(const std::string&, const StoredKey&)>& fn) const;
+
+    // Ids of up to limit records with 0 < expiresAt <= now, earliest first.
+    std::vector<std::string> dueBy(int64_t now, size_t limit) const;
+    // Up to limit ids greater than after, in order, for paging through the store.
+    std::vector<std::string> idsAfter(const std::string& after, size_t limit) const;
+    // Earliest expiry in the store, or 0 if no record expires.
+    int64_t nextExpiry() const;
+
+    size_t size() const;
+
+private:
+    struct Shard {
+        mutable std::shared_mutex mutex;
+        std::unordered_map<std::string, Record> records;
+        std::set<std::pair<int64_t, std::string>> expiry;   // (expiresAt, key_id) of expiring records
+    };
+
+    // Both expect the shard's exclusive lock to be held.
+    static void publish(Shard& shard, const std::string& key_id, Record record);
+    static bool remove(Shard& shard, const std::string& key_id);
+
+    size_t shardIndex(const std::string& key_id) const;
+    // Groups item positions by shard so each shard is locked once per batch.
+    std::vector<std::vector<size_t>> groupByShard(const std::vector<std::string>& key_ids) const;
+
+    std::vector<Shard> shards;
+    std::atomic<uint64_t> nextVersion{1};
+};
+
+#endif // KEY_STORE_H
@@ -0,0 +1,68 @@
+// key_wire.cpp
+#include "key_wire.h"
+#include <vector>
+
+nlohmann::json keyToJson(const KeyBuffer& key) {
+    // The json tree keeps its own copy of the bytes.
+    return nlohmann::json(std::vector<uint8_t>(key.begin(), key.end()));
+}
+
+KeyBuffer keyFromJson(const nlohmann::json& value) {
+    if (!value.is_array()) {
+        throw std::invalid_argument("key must be an array of bytes");
+    }
+    KeyBuffer key(value.size());
+    for (size_t i = 0; i < value.size(); ++i) {
+        const auto& byte = value[i];
+        if (!byte.is_number_unsigned() || byte.get<uint64_t>() > 0xff) {
+            throw std::invalid_argument("key must be an array of bytes");
+        }
+        key.data()[i] = static_cast<uint8_t>(byte.get<uint64_t>());
+    }
+    return key;
+}
+
+void writeKeyField(CborWriter& writer, const std::string& name, const KeyBuffer& key) {
+    writer.text(name);
+    writer.bytes(key.data(), key.size());
+}
+
+KeyBuffer keyFromCbor(CborReader& reader) {
+    auto view = reader.bytesView();
+    return KeyBuffer(view.first, view.second);
+}
+
+std::string encodeKeyReply(const std::string& keyId, const KeyBuffer& key, bool cbor) {
+    if (!cbor) {
+        return nlohmann::json{{"key_id", keyId}, {"key", keyToJson(key)}}.dump();
+    }
+    CborWriter writer;
+    writer.map(2);
+    writer.field("key_id", keyId);
+    writeKeyField(writer, "key", key);
+    return writer.release();
+}
+
+KeyBuffer decodeKeyReply(const std::string& body, bool cbor) {
+    if (!cbor) {
+        auto json = nlohmann::json::parse(body, nullptr, false);
+        if (json.is_discarded() || !json.is_object() || !json.contains("key")) {
+            throw std::invalid_argument("Malformed key reply");
+        }
+        return keyFromJson(json.at("key"));
+    }
+    KeyBuffer key;
+    bool found = false;
+    readCborMap(body, [&](const std::string& name, CborReader& reader) {
+        if (name != "key") {
+            return false;
+        }
+        key = keyFromCbor(reader);
+        found = true;
+        return true;
+    });
+    if (!found) {
+        throw std::invalid_argument("Malformed key reply");
+    }
+    return key;
+}
@@ -0,0 +1,24 @@
+// key_wire.h
+#ifndef KEY_WIRE_H
+#define KEY_WIRE_H
+
+#include "cbor.h"
+#include "key_buffer.h"
+#include <nlohmann/json.hpp>
+#include <string>
+
+// Key bytes on the wire, shared by the server and the client so both sides
+// agree on the format: a CBOR byte string, or a JSON array of byte values.
+// Keys are read straight into a KeyBuffer; a JSON body still passes through
+// the json tree, which CBOR avoids. Decoding throws std::invalid_argument on
+// anything else.
+nlohmann::json keyToJson(const KeyBuffer& key);
+KeyBuffer keyFromJson(const nlohmann::json& value);
+void writeKeyField(CborWriter& writer, const std::string& name, const KeyBuffer& key);
+KeyBuffer keyFromCbor(CborReader& reader);
+
+// Body of a single-key reply, {"key_id", "key"}, and the key read back from one.
+std::string encodeKeyReply(const std::string& keyId, const KeyBuffer& key, bool cbor);
+KeyBuffer decodeKeyReply(const std::string& body, bool cbor);
+
+#endif // KEY_WIRE_H
@@ -1,73 +1,478 @@
 //kms_client.cpp
 #include "kms_client.h"
-#include <httplib.h>
+#include "cbor.h"
+#include "key_wire.h"
 #include <nlohmann/json.hpp>
 #include <iostream>
 #include <vector>
 
-void KMSClient::generateKey() {
-    httplib::SSLClient cli("localhost", 8080);
-    cli.enable_server_certificate_verification(false);
-    auto res = cli.Post("/generate-key");
+static std::string errorBody(const httplib::Result& res) {
+    return res ? res->body : httplib::to_string(res.error());
+}
+
+// The server's answer for a key_id it has no record of, as opposed to a TPM failure.
+static const char* const keyNotFound = "Key not found";
+
+static bool isCborResponse(const httplib::Response& res) {
+    return res.get_header_value("Content-Type").rfind(cborContentType, 0) == 0;
+}
+
+// Sends a CBOR body (asking for a CBOR reply) or a JSON body. Only the
+// encoder for the chosen format runs.
+template <typename WriteCbor, typename MakeJson>
+static httplib::Result postMessage(HTTPSConnectionPool& connections, bool binaryWire, const std::string& path,
+                                   WriteCbor&& writeCbor, MakeJson&& makeJson) {
+    if (!binaryWire) {
+        return connections.post(path, makeJson().dump(), "application/json");
+    }
+    CborWriter writer;
+    writeCbor(writer);
+    return connections.post(path, writer.data(), cborContentType, {{"Accept", cborContentType}});
+}
+
+static httplib::Headers acceptHeaders(bool binaryWire) {
+    return {{"Accept", binaryWire ? cborContentType : "application/json"}};
+}
+
+// Reads the named byte-string fields of a reply in either format.
+static void readByteFields(const httplib::Response& res, std::initializer_list<std::pair<const char*, std::vector<uint8_t>*>> fields) {
+    if (isCborResponse(res)) {
+        readCborMap(res.body, [&](const std::string& name, CborReader& reader) {
+            for (const auto& field : fields) {
+                if (name == field.first) {
+                    *field.second = reader.bytes();
+                    return true;
+                }
+            }
+            return false;
+        });
+        return;
+    }
+    auto json = nlohmann::json::parse(res.body);
+    for (const auto& field : fields) {
+        *field.second = json.at(field.first).get<std::vector<uint8_t>>();
+    }
+}
+
+// Sends in to path block by block and copies the reply to out as it arrives.
+static uint64_t streamThrough(HTTPSConnectionPool& connections, const std::string& path,
+                              std::istream& in, std::ostream& out, const std::string& action) {
+    std::vector<char> block(64 * 1024);
+    uint64_t written = 0;
+    auto res = connections.postStream(path,
+        [&](size_t, httplib::DataSink& sink) {
+            in.read(block.data(), static_cast<std::streamsize>(block.size()));
+            std::streamsize n = in.gcount();
+            if (n > 0 && !sink.write(block.data(), static_cast<size_t>(n))) {
+                return false;
+            }
+            if (!in) {
+                if (in.bad()) {
+                    return false;
+                }
+                sink.done();
+            }
+            return true;
+        },
+        [&](const char* data, size_t size) {
+            out.write(data, static_cast<std::streamsize>(size));
+            written += size;
+            return static_cast<bool>(out);
+        },
+        "application/octet-stream");
+    if (!res || res->status != 200) {
+        throw std::runtime_error("Error " + action + ": " + errorBody(res));
+    }
+    if (!out) {
+        throw std::runtime_error("Error " + action + ": unable to write output");
+    }
+    return written;
+}
+
+static std::vector<BatchKeyResult> parseBatchResults(const httplib::Response& res) {
+    std::vector<BatchKeyResult> results;
+    if (isCborResponse(res)) {
+        readCborMap(res.body, [&](const std::string& name, CborReader& reader) {
+            if (name != "results") {
+                return false;
+            }
+            results.resize(reader.array());
+            for (auto& result : results) {
+                bool ok = false;
+                for (size_t fields = reader.map(); fields > 0; --fields) {
+                    std::string field = reader.text();
+                    if (field == "key_id") {
+                        result.keyId = reader.text();
+                    } else if (field == "status") {
+                        ok = reader.text() == "ok";
+                    } else if (field == "key") {
+                        result.key = keyFromCbor(reader);
+                    } else if (field == "error") {
+                        result.error = reader.text();
+                    } else {
+                        reader.skip();
+                    }
+                }
+                if (!ok && result.error.empty()) {
+                    result.error = "Unknown error";
+                }
+            }
+            return true;
+        });
+        return results;
+    }
+
+    auto json = nlohmann::json::parse(res.body);
+    for (const auto& item : json.at("results")) {
+        BatchKeyResult result;
+        result.keyId = item.at("key_id").get<std::string>();
+        if (item.value("status", "") == "ok") {
+            if (item.contains("key")) {
+                result.key = keyFromJson(item.at("key"));
+            }
+        } else {
+            result.error = item.value("error", "Unknown error");
+        }
+        results.push_back(std::move(result));
+    }
+    return results;
+}
+
+KMSClient::KMSClient(const KMSClientConfig& config) : connections(config.connections), binaryWire(config.binaryWire) {
+    if (config.keyCache.enabled) {
+        keyCache = std::make_unique<ClientKeyCache>(config.keyCache);
+    }
+}
+
+void KMSClient::invalidateCachedKey(const std::string& key_id) {
+    if (keyCache) {
+        keyCache->invalidate(key_id);
+    }
+}
+
+void KMSClient::clearKeyCache() {
+    if (keyCache) {
+        keyCache->clear();
+    }
+}
+
+std::string KMSClient::generateKey() {
+    auto res = connections.post("/generate-key", "", "application/json", acceptHeaders(binaryWire));
     if (res && res->status == 200) {
-        std::cout << "Key generated: " << res->body << std::endl;
-    } else {
-        throw std::runtime_error("Error generating key: " + (res ? res->body : "Unknown error"));
+        std::string keyId;
+        if (isCborResponse(*res)) {
+            readCborMap(res->body, [&](const std::string& name, CborReader& reader) {
+                if (name != "key_id") {
+                    return false;
+                }
+                keyId = reader.text();
+                return true;
+            });
+        } else {
+            keyId = nlohmann::json::parse(res->body).at("key_id").get<std::string>();
+        }
+        // Generated ids are unique, but a lookup made before the key existed may
+        // have cached "Key not found" under this id; that answer is now wrong.
+        invalidateCachedKey(keyId);
+        return keyId;
     }
+    throw std::runtime_error("Error generating key: " + errorBody(res));
 }
 
 void KMSClient::storeKey(const std::string& key_id, const std::vector<uint8_t>& key) {
-    httplib::SSLClient cli("localhost", 8080);
-    cli.enable_server_certificate_verification(false);
-    nlohmann::json json = { {"key_id", key_id}, {"key", key} };
-    auto res = cli.Post("/store-key", json.dump(), "application/json");
+    auto res = postMessage(connections, binaryWire, "/store-key",
+        [&](CborWriter& writer) {
+            writer.map(2);
+            writer.field("key_id", key_id);
+            writer.field("key", key);
+        },
+        [&] { return nlohmann::json{ {"key_id", key_id}, {"key", key} }; });
+    invalidateCachedKey(key_id);
     if (!(res && res->status == 200)) {
-        throw std::runtime_error("Error storing key: " + (res ? res->body : "Unknown error"));
+        throw std::runtime_error("Error storing key: " + errorBody(res));
     }
 }
 
 void KMSClient::rotateKey() {
-    httplib::SSLClient cli("localhost", 8080);
-    cli.enable_server_certificate_verification(false);
-    auto res = cli.Post("/rotate-key");
+    auto res = connections.post("/rotate-key");
+    // The server does not report which expired keys it dropped, and the key it
+    // issued may have a cached "Key not found", so drop everything.
+    clearKeyCache();
     if (res && res->status == 200) {
         std::cout << "Key rotated: " << res->body << std::endl;
     } else {
-        throw std::runtime_error("Error rotating key: " + (res ? res->body : "Unknown error"));
+        throw std::runtime_error("Error rotating key: " + errorBody(res));
     }
 }
 
-std::vector<uint8_t> KMSClient::fetchKey(const std::string& key_id) {
-    httplib::SSLClient cli("localhost", 8080);
-    cli.enable_server_certificate_verification(false);
-    auto res = cli.Get(("/fetch-key/" + key_id).c_str());
+KeyBuffer KMSClient::fetchKey(const std::string& key_id) {
+    KeyBuffer key;
+    if (keyCache) {
+        switch (keyCache->find(key_id, key)) {
+        case ClientKeyCache::Lookup::Hit:
+            return key;
+        case ClientKeyCache::Lookup::NotFound:
+            throw std::runtime_error("Error fetching key: " + std::string(keyNotFound));
+        case ClientKeyCache::Lookup::Miss:
+            break;
+        }
+    }
+
+    auto res = connections.get("/fetch-key/" + key_id, acceptHeaders(binaryWire));
     if (res && res->status == 200) {
-        auto json = nlohmann::json::parse(res->body);
-        return json.at("key").get<std::vector<uint8_t>>();
+        key = decodeKeyReply(res->body, isCborResponse(*res));
+        if (keyCache) {
+            keyCache->put(key_id, key);
+        }
+        return key;
     } else {
-        throw std::runtime_error("Error fetching key: " + (res ? res->body : "Unknown error"));
+        if (keyCache && res && res->status == 404 && res->body == keyNotFound) {
+            keyCache->putNotFound(key_id);
+        }
+        throw std::runtime_error("Error fetching key: " + errorBody(res));
     }
 }
 
 void KMSClient::deleteKey(const std::string& key_id) {
-    httplib::SSLClient cli("localhost", 8080);
-    cli.enable_server_certificate_verification(false);
-    auto res = cli.Post(("/delete-key/" + key_id).c_str());
-    if (res && res->status == 200) {
-        std::cout << "Key deleted: " << res->body << std::endl;
-    } else {
-        throw std::runtime_error("Error deleting key: " + (res ? res->body : "Unknown error"));
+    auto res = connections.post("/delete-key/" + key_id);
+    invalidateCachedKey(key_id);
+    if (!res || res->status != 200) {
+        throw std::runtime_error("Error deleting key: " + errorBody(res));
     }
 }
 
 void KMSClient::generateCert() {
-    httplib::SSLClient cli("localhost", 8080);
-    cli.enable_server_certificate_verification(false);
-    auto res = cli.Post("/generate-cert");
+    auto res = connections.post("/generate-cert");
     if (res && res->status == 200) {
         std::cout << "Certificate generated: " << res->body << std::endl;
     } else {
-        throw std::runtime_error("Error generating certificate: " + (res ? res->body : "Unknown error"));
+        throw std::runtime_error("Error generating certificate: " + errorBody(res));
     }
 }
 
+
+DataKeyResult KMSClient::generateDataKey(const std::string& context, size_t keyLength) {
+    auto res = postMessage(connections, binaryWire, "/generate-data-key",
+        [&](CborWriter& writer) {
+            writer.map(2);
+            writer.field("key_length", keyLength);
+            writer.field("context", context);
+        },
+        [&] { return nlohmann::json{ {"key_length", keyLength}, {"context", context} }; });
+    if (res && res->status == 200) {
+        DataKeyResult result;
+        readByteFields(*res, {{"plaintext", &result.plaintext}, {"ciphertext_blob", &result.ciphertextBlob}});
+        return result;
+    } else {
+        throw std::runtime_error("Error generating data key: " + errorBody(res));
+    }
+}
+
+std::vector<uint8_t> KMSClient::decryptDataKey(const std::vector<uint8_t>& ciphertextBlob, const std::string& context) {
+    auto res = postMessage(connections, binaryWire, "/decrypt-data-key",
+        [&](CborWriter& writer) {
+            writer.map(2);
+            writer.field("ciphertext_blob", ciphertextBlob);
+            writer.field("context", context);
+        },
+        [&] { return nlohmann::json{ {"ciphertext_blob", ciphertextBlob}, {"context", context} }; });
+    if (res && res->status == 200) {
+        std::vector<uint8_t> plaintext;
+        readByteFields(*res, {{"plaintext", &plaintext}});
+        return plaintext;
+    } else {
+        throw std::runtime_error("Error decrypting data key: " + errorBody(res));
+    }
+}
+
+DigestResult KMSClient::hash(const std::string& data, bool attest) {
+    auto res = connections.post(attest ? "/hash?attest=true" : "/hash", data, "application/octet-stream", acceptHeaders(binaryWire));
+    if (res && res->status == 200) {
+        DigestResult result;
+        readByteFields(*res, {{"digest", &result.digest}, {"ticket", &result.ticket}});
+        return result;
+    } else {
+        throw std::runtime_error("Error hashing data: " + errorBody(res));
+    }
+}
+
+uint64_t KMSClient::encryptStream(std::istream& in, std::ostream& out, const std::string& context) {
+    return streamThrough(connections, "/encrypt?context=" + percentEncode(context), in, out, "encrypting stream");
+}
+
+uint64_t KMSClient::decryptStream(std::istream& in, std::ostream& out, const std::string& context) {
+    return streamThrough(connections, "/decrypt?context=" + percentEncode(context), in, out, "decrypting stream");
+}
+
+BatchSignature KMSClient::sign(const std::vector<uint8_t>& digest, bool batch) {
+    auto res = postMessage(connections, binaryWire, "/sign",
+        [&](CborWriter& writer) {
+            writer.map(2);
+            writer.field("digest", digest);
+            writer.field("batch", batch);
+        },
+        [&] { return nlohmann::json{ {"digest", digest}, {"batch", batch} }; });
+    if (!res || res->status != 200) {
+        throw std::runtime_error("Error signing digest: " + errorBody(res));
+    }
+    BatchSignature result;
+    if (isCborResponse(*res)) {
+        readCborMap(res->body, [&](const std::string& name, CborReader& reader) {
+            if (name == "signature") {
+                result.signature = reader.bytes();
+            } else if (name == "root") {
+                result.root = reader.bytes();
+            } else if (name == "leaf_index") {
+                result.leafIndex = reader.unsignedInt();
+            } else if (name == "tree_size") {
+                result.treeSize = reader.unsignedInt();
+            } else if (name == "proof") {
+                result.proof.resize(reader.array());
+                for (auto& node : result.proof) {
+                    node = reader.bytes();
+                }
+            } else {
+                return false;
+            }
+            return true;
+        });
+        return result;
+    }
+    auto json = nlohmann::json::parse(res->body);
+    result.signature = json.at("signature").get<std::vector<uint8_t>>();
+    result.root = json.at("root").get<std::vector<uint8_t>>();
+    result.leafIndex = json.at("leaf_index").get<uint64_t>();
+    result.treeSize = json.at("tree_size").get<uint64_t>();
+    result.proof = json.at("proof").get<std::vector<std::vector<uint8_t>>>();
+    return result;
+}
+
+std::string KMSClient::signingPublicKey() {
+    auto res = connections.get("/signing-key");
+    if (res && res->status == 200) {
+        return res->body;
+    } else {
+        throw std::runtime_error("Error fetching signing key: " + errorBody(res));
+    }
+}
+
+void KMSClient::rotateKeyEncryptionKey() {
+    auto res = connections.post("/rotate-kek");
+    if (res && res->status == 200) {
+        std::cout << "Key-encryption key rotated: " << res->body << std::endl;
+    } else {
+        throw std::runtime_error("Error rotating key-encryption key: " + errorBody(res));
+    }
+}
+
+std::vector<BatchKeyResult> KMSClient::generateKeys(size_t count) {
+    auto res = postMessage(connections, binaryWire, "/generate-keys",
+        [&](CborWriter& writer) {
+            writer.map(1);
+            writer.field("count", count);
+        },
+        [&] { return nlohmann::json{ {"count", count} }; });
+    if (res && res->status == 200) {
+        auto results = parseBatchResults(*res);
+        for (const auto& result : results) {
+            invalidateCachedKey(result.keyId);
+        }
+        return results;
+    } else {
+        throw std::runtime_error("Error generating keys: " + errorBody(res));
+    }
+}
+
+std::vector<BatchKeyResult> KMSClient::storeKeys(const std::vector<std::pair<std::string, std::vector<uint8_t>>>& keys) {
+    auto res = postMessage(connections, binaryWire, "/store-keys",
+        [&](CborWriter& writer) {
+            writer.map(1);
+            writer.text("keys");
+            writer.array(keys.size());
+            for (const auto& entry : keys) {
+                writer.map(2);
+                writer.field("key_id", entry.first);
+                writer.field("key", entry.second);
+            }
+        },
+        [&] {
+            nlohmann::json items = nlohmann::json::array();
+            for (const auto& entry : keys) {
+                items.push_back({ {"key_id", entry.first}, {"key", entry.second} });
+            }
+            return nlohmann::json{ {"keys", items} };
+        });
+    for (const auto& entry : keys) {
+        invalidateCachedKey(entry.first);
+    }
+    if (res && res->status == 200) {
+        return parseBatchResults(*res);
+    } else {
+        throw std::runtime_error("Error storing keys: " + errorBody(res));
+    }
+}
+
+httplib::Result KMSClient::postKeyIds(const std::string& path, const std::vector<std::string>& key_ids) {
+    return postMessage(connections, binaryWire, path,
+        [&](CborWriter& writer) {
+            writer.map(1);
+            writer.text("key_ids");
+            writer.array(key_ids.size());
+            for (const auto& key_id : key_ids) {
+                writer.text(key_id);
+            }
+        },
+        [&] { return nlohmann::json{ {"key_ids", key_ids} }; });
+}
+
+std::vector<BatchKeyResult> KMSClient::fetchKeys(const std::vector<std::string>& key_ids) {
+    // Cached answers are filled in locally; only the rest go to the server.
+    std::vector<BatchKeyResult> results(key_ids.size());
+    std::vector<std::string> missing;
+    std::vector<size_t> missingPositions;
+    for (size_t i = 0; i < key_ids.size(); ++i) {
+        results[i].keyId = key_ids[i];
+        auto lookup = keyCache ? keyCache->find(key_ids[i], results[i].key) : ClientKeyCache::Lookup::Miss;
+        if (lookup == ClientKeyCache::Lookup::NotFound) {
+            results[i].error = keyNotFound;
+        } else if (lookup == ClientKeyCache::Lookup::Miss) {
+            missing.push_back(key_ids[i]);
+            missingPositions.push_back(i);
+        }
+    }
+    if (missing.empty()) {
+        return results;
+    }
+
+    auto res = postKeyIds("/fetch-keys", missing);
+    if (res && res->status == 200) {
+        auto fetched = parseBatchResults(*res);
+        if (fetched.size() != missing.size()) {
+            throw std::runtime_error("Error fetching keys: server returned " + std::to_string(fetched.size()) +
+                                     " results for " + std::to_string(missing.size()) + " keys");
+        }
+        for (size_t i = 0; i < fetched.size(); ++i) {
+            if (keyCache && fetched[i].error.empty()) {
+                keyCache->put(fetched[i].keyId, fetched[i].key);
+            } else if (keyCache && fetched[i].error == keyNotFound) {
+                keyCache->putNotFound(fetched[i].keyId);
+            }
+            results[missingPositions[i]] = std::move(fetched[i]);
+        }
+        return results;
+    } else {
+        throw std::runtime_error("Error fetching keys: " + errorBody(res));
+    }
+}
+
+std::vector<BatchKeyResult> KMSClient::deleteKeys(const std::vector<std::string>& key_ids) {
+    auto res = postKeyIds("/delete-keys", key_ids);
+    for (const auto& key_id : key_ids) {
+        invalidateCachedKey(key_id);
+    }
+    if (res && res->status == 200) {
+        return parseBatchResults(*res);
+    } else {
+        throw std::runtime_error("Error deleting keys: " + errorBody(res));
+    }
+}
@@ -2,17 +2,85 @@
 #ifndef KMS_CLIENT_H
 #define KMS_CLIENT_H
 
+#include "client_key_cache.h"
+#include "https_connection_pool.h"
+#include "key_buffer.h"
+#include "merkle_tree.h"
+#include <iosfwd>
+#include <memory>
 #include <string>
 #include <vector>
 
+struct DataKeyResult {
+    std::vector<uint8_t> plaintext;
+    std::vector<uint8_t> ciphertextBlob;
+};
+
+struct DigestResult {
+    std::vector<uint8_t> digest;   // SHA-256
+    std::vector<uint8_t> ticket;   // marshalled TPMT_TK_HASHCHECK; empty unless attested
+};
+
+// Per-item outcome of a batch call; error is empty on success.
+struct BatchKeyResult {
+    std::string keyId;
+    KeyBuffer key;
+    std::string error;
+};
+
+struct KMSClientConfig {
+    HTTPSConnectionPoolConfig connections;
+    ClientKeyCacheConfig keyCache;
+    bool binaryWire = true;   // CBOR request and response bodies instead of JSON
+};
+
+// Safe to share between threads; requests run over a pool of keep-alive connections.
 class KMSClient {
 public:
-    void generateKey();
+    explicit KMSClient(const KMSClientConfig& config = KMSClientConfig());
+
+    // Returns the id the server assigned to the new key.
+    std::string generateKey();
     void storeKey(const std::string& key_id, const std::vector<uint8_t>& key);
     void rotateKey();
-    std::vector<uint8_t> fetchKey(const std::string& key_id);
+    KeyBuffer fetchKey(const std::string& key_id);
     void deleteKey(const std::string& key_id);
     void generateCert(); // Add this function
+    DataKeyResult generateDataKey(const std::string& context = "", size_t keyLength = 32);
+    std::vector<uint8_t> decryptDataKey(const std::vector<uint8_t>& ciphertextBlob, const std::string& context = "");
+    void rotateKeyEncryptionKey();
+    // SHA-256 of data computed by the server; with attest the TPM hashes it and returns a ticket.
+    DigestResult hash(const std::string& data, bool attest = false);
+    // Encrypt or decrypt everything read from in on the server, writing the
+    // result to out as it arrives; neither side holds the whole payload. A
+    // decrypted stream is only written once every frame has authenticated.
+    // Both return the number of bytes written.
+    uint64_t encryptStream(std::istream& in, std::ostream& out, const std::string& context = "");
+    uint64_t decryptStream(std::istream& in, std::ostream& out, const std::string& context = "");
+    // TPM signature over a 32-byte SHA-256 digest. Batched signatures cover a
+    // Merkle root; check them with verifyBatchSignature and signingPublicKey().
+    BatchSignature sign(const std::vector<uint8_t>& digest, bool batch = true);
+    // PEM public key of the server's TPM signing key.
+    std::string signingPublicKey();
+
+    std::vector<BatchKeyResult> generateKeys(size_t count);
+    std::vector<BatchKeyResult> storeKeys(const std::vector<std::pair<std::string, std::vector<uint8_t>>>& keys);
+    std::vector<BatchKeyResult> fetchKeys(const std::vector<std::string>& key_ids);
+    std::vector<BatchKeyResult> deleteKeys(const std::vector<std::string>& key_ids);
+
+    // Drops key_id from the local key cache; the next fetch goes to the server.
+    void invalidateCachedKey(const std::string& key_id);
+    void clearKeyCache();
+
+    HTTPSConnectionPoolStats connectionStats() const { return connections.stats(); }
+    ClientKeyCacheStats keyCacheStats() const { return keyCache ? keyCache->stats() : ClientKeyCacheStats(); }
+
+private:
+    httplib::Result postKeyIds(const std::string& path, const std::vector<std::string>& key_ids);
+
+    HTTPSConnectionPool connections;
+    std::unique_ptr<ClientKeyCache> keyCache;   // null unless enabled
+    bool binaryWire;
 };
 
 #endif // KMS_CLIENT_H
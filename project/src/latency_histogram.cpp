@@ -0,0 +1,53 @@
+// latency_histogram.cpp
+#include "latency_histogram.h"
+#include <algorithm>
+#include <cmath>
+
+size_t LatencyHistogram::bucketFor(uint64_t nanos) {
+    if (nanos < subBuckets) {
+        return static_cast<size_t>(nanos);
+    }
+    unsigned shift = 63 - __builtin_clzll(nanos) - subBucketBits;
+    return (shift + 1) * subBuckets + static_cast<size_t>((nanos >> shift) - subBuckets);
+}
+
+uint64_t LatencyHistogram::bucketUpperBound(size_t index) {
+    if (index < subBuckets) {
+        return index;
+    }
+    unsigned shift = static_cast<unsigned>(index / subBuckets - 1);
+    uint64_t sub = index % subBuckets + subBuckets;
+    return ((sub + 1) << shift) - 1;
+}
+
+void LatencyHistogram::record(uint64_t nanos) {
+    ++buckets[bucketFor(nanos)];
+    ++samples;
+    total += nanos;
+    largest = std::max(largest, nanos);
+}
+
+void LatencyHistogram::merge(const LatencyHistogram& other) {
+    for (size_t i = 0; i < buckets.size(); ++i) {
+        buckets[i] += other.buckets[i];
+    }
+    samples += other.samples;
+    total += other.total;
+    largest = std::max(largest, other.largest);
+}
+
+uint64_t LatencyHistogram::percentile(double p) const {
+    if (samples == 0) {
+        return 0;
+    }
+    uint64_t rank = static_cast<uint64_t>(std::ceil(std::clamp(p, 0.0, 100.0) / 100.0 * samples));
+    rank = std::max<uint64_t>(rank, 1);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < buckets.size(); ++i) {
+        seen += buckets[i];
+        if (seen >= rank) {
+            return std::min(bucketUpperBound(i), largest);
+        }
+    }
+    return largest;
+}
@@ -0,0 +1,37 @@
+// latency_histogram.h
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+// Log-linear histogram of nanosecond latencies: 32 linear buckets per power of
+// two, so any percentile is reported within about 3% of the true value. It has
+// a fixed size and never allocates, so benchmark threads each keep their own
+// and merge them at the end instead of storing every sample.
+class LatencyHistogram {
+public:
+    void record(uint64_t nanos);
+    void merge(const LatencyHistogram& other);
+
+    uint64_t count() const { return samples; }
+    uint64_t max() const { return largest; }
+    double mean() const { return samples ? static_cast<double>(total) / samples : 0; }
+    // Upper bound of the bucket holding the p-th percentile, p in [0, 100].
+    uint64_t percentile(double p) const;
+
+private:
+    static constexpr unsigned subBucketBits = 5;
+    static constexpr size_t subBuckets = size_t(1) << subBucketBits;
+
+    static size_t bucketFor(uint64_t nanos);
+    static uint64_t bucketUpperBound(size_t index);
+
+    std::array<uint64_t, 64 * subBuckets> buckets{};
+    uint64_t samples = 0;
+    uint64_t total = 0;
+    uint64_t largest = 0;
+};
+
+#endif // LATENCY_HISTOGRAM_H
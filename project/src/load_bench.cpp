@@ -0,0 +1,297 @@
+// load_bench.cpp
+#include "load_bench.h"
+#include <openssl/rand.h>
+#include <algorithm>
+#include <atomic>
+#include <ctime>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+const char* const operationNames[loadOperationCount] = {"generate", "fetch", "store", "delete"};
+
+// Batches stay well under the server's per-request limit.
+constexpr size_t setupBatchSize = 1000;
+// A request that starts later than this is counted as late: the threads could
+// not keep up with the rate, and its queueing time is part of its latency.
+constexpr auto lateThreshold = std::chrono::milliseconds(1);
+
+uint64_t splitMix(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+std::string runPrefix() {
+    uint8_t nonce[4] = {};
+    RAND_bytes(nonce, sizeof(nonce));
+    std::ostringstream prefix;
+    prefix << "bench-" << std::time(nullptr) << "-" << std::hex;
+    for (uint8_t byte : nonce) {
+        prefix << static_cast<int>(byte >> 4) << static_cast<int>(byte & 0x0f);
+    }
+    return prefix.str();
+}
+
+std::vector<uint8_t> keyFor(uint64_t slot, size_t bytes) {
+    std::vector<uint8_t> key(bytes);
+    uint64_t state = slot;
+    for (size_t i = 0; i < bytes; ++i) {
+        if (i % 8 == 0) {
+            state = splitMix(state);
+        }
+        key[i] = static_cast<uint8_t>(state >> (8 * (i % 8)));
+    }
+    return key;
+}
+
+void storeAll(KMSClient& client, const std::vector<std::string>& ids, size_t keyBytes) {
+    for (size_t begin = 0; begin < ids.size(); begin += setupBatchSize) {
+        std::vector<std::pair<std::string, std::vector<uint8_t>>> batch;
+        for (size_t i = begin; i < std::min(ids.size(), begin + setupBatchSize); ++i) {
+            batch.emplace_back(ids[i], keyFor(i, keyBytes));
+        }
+        for (const auto& result : client.storeKeys(batch)) {
+            if (!result.error.empty()) {
+                throw std::runtime_error("Unable to store benchmark key " + result.keyId + ": " + result.error);
+            }
+        }
+    }
+}
+
+// Shared by all threads: keys this run may delete, fed by store and generate.
+class DeletePool {
+public:
+    void add(std::string key_id) {
+        std::lock_guard<std::mutex> lock(mutex);
+        ids.push_back(std::move(key_id));
+    }
+    bool take(std::string& key_id) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (ids.empty()) {
+            return false;
+        }
+        key_id = std::move(ids.back());
+        ids.pop_back();
+        return true;
+    }
+    std::vector<std::string> drain() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return std::move(ids);
+    }
+
+private:
+    std::mutex mutex;
+    std::vector<std::string> ids;
+};
+
+struct ThreadResult {
+    std::array<LoadOperationResult, loadOperationCount> operations;
+    uint64_t lateStarts = 0;
+    uint64_t skipped = 0;
+    Clock::time_point finishedAt;
+};
+
+} // namespace
+
+std::array<unsigned, loadOperationCount> parseLoadMix(const std::string& mix) {
+    std::array<unsigned, loadOperationCount> weights{};
+    std::stringstream stream(mix);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        size_t separator = item.find('=');
+        std::string name = item.substr(0, separator);
+        auto found = std::find_if(std::begin(operationNames), std::end(operationNames),
+                                  [&](const char* candidate) { return name == candidate; });
+        if (separator == std::string::npos || found == std::end(operationNames)) {
+            throw std::invalid_argument("Expected <operation>=<weight> with generate, fetch, store or delete, got: " + item);
+        }
+        weights[found - std::begin(operationNames)] = static_cast<unsigned>(std::stoul(item.substr(separator + 1)));
+    }
+    unsigned total = 0;
+    for (unsigned weight : weights) {
+        total += weight;
+    }
+    if (total == 0) {
+        throw std::invalid_argument("Operation mix has no weight: " + mix);
+    }
+    return weights;
+}
+
+LoadBenchResult runLoadBenchmark(KMSClient& client, const LoadBenchConfig& config) {
+    if (config.rate <= 0) {
+        throw std::invalid_argument("Benchmark rate must be positive");
+    }
+    unsigned totalWeight = 0;
+    for (unsigned weight : config.mix) {
+        totalWeight += weight;
+    }
+    if (totalWeight == 0) {
+        throw std::invalid_argument("Operation mix has no weight");
+    }
+
+    std::string prefix = runPrefix();
+    std::vector<std::string> fetchIds;
+    std::vector<std::string> deleteIds;
+    for (size_t i = 0; i < std::max<size_t>(config.seedKeys, 1); ++i) {
+        fetchIds.push_back(prefix + "-f" + std::to_string(i));
+        deleteIds.push_back(prefix + "-d" + std::to_string(i));
+    }
+    storeAll(client, fetchIds, config.keyBytes);
+    storeAll(client, deleteIds, config.keyBytes);
+    DeletePool deletable;
+    for (auto& id : deleteIds) {
+        deletable.add(std::move(id));
+    }
+
+    auto interval = std::chrono::duration<double>(1.0 / config.rate);
+    size_t threadCount = std::max<size_t>(config.threads, 1);
+    std::vector<ThreadResult> perThread(threadCount);
+    std::vector<std::thread> threads;
+    std::atomic<uint64_t> nextSlot{0};
+    auto start = Clock::now();
+    auto end = start + config.duration;
+
+    // Threads claim the next due slot as soon as they are free, so a thread
+    // stuck on a slow request never holds up the ones scheduled after it.
+    auto runThread = [&](ThreadResult& result) {
+        for (;;) {
+            uint64_t slot = nextSlot++;
+            auto due = start + std::chrono::duration_cast<Clock::duration>(interval * static_cast<double>(slot));
+            if (due >= end) {
+                break;
+            }
+            std::this_thread::sleep_until(due);
+            if (Clock::now() - due > lateThreshold) {
+                ++result.lateStarts;
+            }
+
+            uint64_t pick = splitMix(slot) % totalWeight;
+            size_t operation = 0;
+            while (pick >= config.mix[operation]) {
+                pick -= config.mix[operation++];
+            }
+            auto& stats = result.operations[operation];
+            try {
+                switch (static_cast<LoadOperation>(operation)) {
+                case LoadOperation::Generate:
+                    deletable.add(client.generateKey());
+                    break;
+                case LoadOperation::Fetch:
+                    client.fetchKey(fetchIds[splitMix(~slot) % fetchIds.size()]);
+                    break;
+                case LoadOperation::Store: {
+                    std::string id = prefix + "-s" + std::to_string(slot);
+                    client.storeKey(id, keyFor(slot, config.keyBytes));
+                    deletable.add(std::move(id));
+                    break;
+                }
+                case LoadOperation::Delete: {
+                    std::string id;
+                    if (!deletable.take(id)) {
+                        ++result.skipped;
+                        continue;
+                    }
+                    client.deleteKey(id);
+                    break;
+                }
+                }
+            } catch (const std::exception&) {
+                ++stats.errors;
+            }
+            ++stats.requests;
+            stats.latency.record(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - due).count());
+        }
+        result.finishedAt = Clock::now();
+    };
+    for (size_t i = 0; i < threadCount; ++i) {
+        threads.emplace_back(runThread, std::ref(perThread[i]));
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    LoadBenchResult result;
+    Clock::time_point finishedAt = end;
+    for (const auto& thread : perThread) {
+        for (size_t i = 0; i < loadOperationCount; ++i) {
+            result.operations[i].requests += thread.operations[i].requests;
+            result.operations[i].errors += thread.operations[i].errors;
+            result.operations[i].latency.merge(thread.operations[i].latency);
+        }
+        result.lateStarts += thread.lateStarts;
+        result.skipped += thread.skipped;
+        finishedAt = std::max(finishedAt, thread.finishedAt);
+    }
+    result.seconds = std::chrono::duration<double>(finishedAt - start).count();
+    result.scheduled = static_cast<uint64_t>(std::chrono::duration<double>(config.duration).count() * config.rate);
+
+    // Best effort: leave the server as the run found it.
+    std::vector<std::string> leftovers = deletable.drain();
+    leftovers.insert(leftovers.end(), fetchIds.begin(), fetchIds.end());
+    for (size_t begin = 0; begin < leftovers.size(); begin += setupBatchSize) {
+        try {
+            client.deleteKeys(std::vector<std::string>(leftovers.begin() + begin,
+                                                       leftovers.begin() + std::min(leftovers.size(), begin + setupBatchSize)));
+        } catch (const std::exception&) {
+        }
+    }
+    return result;
+}
+
+namespace {
+
+nlohmann::json operationReport(const LoadOperationResult& operation, double seconds) {
+    const LatencyHistogram& latency = operation.latency;
+    return {
+        {"requests", operation.requests},
+        {"errors", operation.errors},
+        {"throughput", seconds > 0 ? (operation.requests - operation.errors) / seconds : 0},
+        {"latency_us", {
+            {"p50", latency.percentile(50) / 1000.0},
+            {"p99", latency.percentile(99) / 1000.0},
+            {"p999", latency.percentile(99.9) / 1000.0},
+            {"max", latency.max() / 1000.0},
+            {"mean", latency.mean() / 1000.0},
+        }},
+    };
+}
+
+} // namespace
+
+nlohmann::json loadBenchReport(const LoadBenchConfig& config, const LoadBenchResult& result) {
+    nlohmann::json mix;
+    for (size_t i = 0; i < loadOperationCount; ++i) {
+        mix[operationNames[i]] = config.mix[i];
+    }
+    LoadOperationResult total;
+    nlohmann::json operations = nlohmann::json::object();
+    for (size_t i = 0; i < loadOperationCount; ++i) {
+        const auto& operation = result.operations[i];
+        total.requests += operation.requests;
+        total.errors += operation.errors;
+        total.latency.merge(operation.latency);
+        if (operation.requests > 0) {
+            operations[operationNames[i]] = operationReport(operation, result.seconds);
+        }
+    }
+    return {
+        {"target_rate", config.rate},
+        {"achieved_rate", result.seconds > 0 ? total.requests / result.seconds : 0},
+        {"duration_s", result.seconds},
+        {"threads", std::max<size_t>(config.threads, 1)},
+        {"mix", mix},
+        {"scheduled", result.scheduled},
+        {"late_starts", result.lateStarts},
+        {"skipped_deletes", result.skipped},
+        {"operations", operations},
+        {"total", operationReport(total, result.seconds)},
+    };
+}
@@ -0,0 +1,52 @@
+// load_bench.h
+#ifndef LOAD_BENCH_H
+#define LOAD_BENCH_H
+
+#include "kms_client.h"
+#include "latency_histogram.h"
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <nlohmann/json.hpp>
+
+enum class LoadOperation { Generate = 0, Fetch, Store, Delete };
+constexpr size_t loadOperationCount = 4;
+
+struct LoadBenchConfig {
+    double rate = 100;                       // requests per second across all threads
+    std::chrono::seconds duration{10};
+    size_t threads = 16;                     // must cover rate x latency, or requests start late
+    std::array<unsigned, loadOperationCount> mix{1, 6, 2, 1};   // relative weights, by LoadOperation
+    size_t seedKeys = 64;                    // keys stored before the run for fetch and delete to use
+    size_t keyBytes = 32;
+};
+
+struct LoadOperationResult {
+    uint64_t requests = 0;
+    uint64_t errors = 0;
+    LatencyHistogram latency;                // measured from each request's scheduled start
+};
+
+struct LoadBenchResult {
+    std::array<LoadOperationResult, loadOperationCount> operations;
+    double seconds = 0;
+    uint64_t scheduled = 0;
+    uint64_t lateStarts = 0;                 // requests that began after their scheduled time
+    uint64_t skipped = 0;                    // deletes with no key left to delete
+};
+
+// Parses "generate=1,fetch=6,store=2,delete=1"; unnamed operations get 0.
+// Throws std::invalid_argument on an unknown name or an all-zero mix.
+std::array<unsigned, loadOperationCount> parseLoadMix(const std::string& mix);
+
+// Drives the server at a fixed rate with an open loop: request i is due at
+// start + i / rate whatever happened to earlier requests, and its latency is
+// counted from that time. A slow server therefore shows up as queueing in the
+// percentiles rather than as a quietly lower request rate. Keys stored by the
+// run are deleted again at the end.
+LoadBenchResult runLoadBenchmark(KMSClient& client, const LoadBenchConfig& config);
+
+nlohmann::json loadBenchReport(const LoadBenchConfig& config, const LoadBenchResult& result);
+
+#endif // LOAD_BENCH_H
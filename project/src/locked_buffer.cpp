@@ -0,0 +1,57 @@
+// locked_buffer.cpp
+#include "locked_buffer.h"
+#include "logger.h"
+#include <openssl/crypto.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <stdexcept>
+#include <utility>
+
+LockedBuffer::LockedBuffer(size_t size) : length(size) {
+    size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    mappedLength = ((size + pageSize - 1) / pageSize) * pageSize;
+    if (mappedLength == 0) {
+        mappedLength = pageSize;
+    }
+
+    void* mapping = mmap(nullptr, mappedLength, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapping == MAP_FAILED) {
+        throw std::runtime_error("Unable to allocate locked memory");
+    }
+    if (mlock(mapping, mappedLength) != 0) {
+        // Still usable, but the secret may be swapped out; RLIMIT_MEMLOCK is usually the cause.
+        logErrorMessage("mlock failed for secret buffer; check RLIMIT_MEMLOCK", serverErrorLogFile);
+    }
+#ifdef MADV_DONTDUMP
+    madvise(mapping, mappedLength, MADV_DONTDUMP);
+#endif
+    bytes = static_cast<uint8_t*>(mapping);
+}
+
+LockedBuffer::~LockedBuffer() {
+    release();
+}
+
+LockedBuffer::LockedBuffer(LockedBuffer&& other) noexcept
+    : bytes(std::exchange(other.bytes, nullptr)),
+      length(std::exchange(other.length, 0)),
+      mappedLength(std::exchange(other.mappedLength, 0)) {}
+
+LockedBuffer& LockedBuffer::operator=(LockedBuffer&& other) noexcept {
+    if (this != &other) {
+        release();
+        bytes = std::exchange(other.bytes, nullptr);
+        length = std::exchange(other.length, 0);
+        mappedLength = std::exchange(other.mappedLength, 0);
+    }
+    return *this;
+}
+
+void LockedBuffer::release() {
+    if (bytes != nullptr) {
+        OPENSSL_cleanse(bytes, mappedLength);
+        munlock(bytes, mappedLength);
+        munmap(bytes, mappedLength);
+        bytes = nullptr;
+    }
+}
@@ -0,0 +1,32 @@
+// locked_buffer.h
+#ifndef LOCKED_BUFFER_H
+#define LOCKED_BUFFER_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Page-backed buffer that is mlock'd, excluded from core dumps and wiped on
+// destruction. Used for long-lived secrets such as unwrapped KEKs.
+class LockedBuffer {
+public:
+    explicit LockedBuffer(size_t size);
+    ~LockedBuffer();
+
+    LockedBuffer(LockedBuffer&& other) noexcept;
+    LockedBuffer& operator=(LockedBuffer&& other) noexcept;
+    LockedBuffer(const LockedBuffer&) = delete;
+    LockedBuffer& operator=(const LockedBuffer&) = delete;
+
+    uint8_t* data() { return bytes; }
+    const uint8_t* data() const { return bytes; }
+    size_t size() const { return length; }
+
+private:
+    void release();
+
+    uint8_t* bytes = nullptr;
+    size_t length = 0;
+    size_t mappedLength = 0;
+};
+
+#endif // LOCKED_BUFFER_H
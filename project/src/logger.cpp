@@ -1,13 +1,252 @@
 //logger.cpp
 #include "logger.h"
-#include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <ctime>
 #include <filesystem>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 std::ofstream serverLogFile;
 std::ofstream serverErrorLogFile;
 std::ofstream clientLogFile;
 std::ofstream clientErrorLogFile;
 
+namespace {
+
+constexpr size_t ringCapacity = 8192;   // power of two
+constexpr size_t maxBatch = 512;
+
+struct LogRecord {
+    LogLevel level = LogLevel::Info;
+    std::ofstream* file = nullptr;
+    std::chrono::system_clock::time_point time;
+    std::string message;
+};
+
+// Bounded multi-producer ring (Vyukov's sequence-numbered cells) drained by a
+// single writer thread. Producers only contend on one atomic counter.
+class AsyncLogger {
+public:
+    AsyncLogger() : cells(ringCapacity) {
+        for (size_t i = 0; i < cells.size(); ++i) {
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+        writer = std::thread(&AsyncLogger::run, this);
+    }
+
+    ~AsyncLogger() {
+        {
+            std::lock_guard<std::mutex> lock(wakeMutex);
+            stopping = true;
+        }
+        wake.notify_one();
+        writer.join();
+    }
+
+    bool enabled(LogLevel level) const {
+        return static_cast<int>(level) >= minLevel.load(std::memory_order_relaxed);
+    }
+
+    void push(LogLevel level, std::ofstream& file, const std::string& message) {
+        size_t pos = enqueuePos.load(std::memory_order_relaxed);
+        Cell* cell;
+        while (true) {
+            cell = &cells[pos & (ringCapacity - 1)];
+            size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+            if (diff == 0) {
+                if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                droppedCount.fetch_add(1, std::memory_order_relaxed);
+                return;
+            } else {
+                pos = enqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+        cell->record.level = level;
+        cell->record.file = &file;
+        cell->record.time = std::chrono::system_clock::now();
+        cell->record.message = message;
+        cell->sequence.store(pos + 1, std::memory_order_release);
+
+        // Pairs with the writer's store to writerSleeping; the wait timeout bounds any miss.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (writerSleeping.load(std::memory_order_relaxed)) {
+            std::lock_guard<std::mutex> lock(wakeMutex);
+            wake.notify_one();
+        }
+    }
+
+    void configure(const LoggerConfig& config) {
+        minLevel.store(static_cast<int>(config.level), std::memory_order_relaxed);
+        console.store(config.console, std::memory_order_relaxed);
+        files.store(config.files, std::memory_order_relaxed);
+    }
+
+    LoggerConfig config() const {
+        LoggerConfig result;
+        result.level = static_cast<LogLevel>(minLevel.load(std::memory_order_relaxed));
+        result.console = console.load(std::memory_order_relaxed);
+        result.files = files.load(std::memory_order_relaxed);
+        return result;
+    }
+
+    LoggerStats stats() const {
+        LoggerStats result;
+        result.written = writtenCount.load(std::memory_order_relaxed);
+        result.dropped = droppedCount.load(std::memory_order_relaxed);
+        result.batches = batchCount.load(std::memory_order_relaxed);
+        result.capacity = ringCapacity;
+        return result;
+    }
+
+    void flush() {
+        size_t target = enqueuePos.load(std::memory_order_acquire);
+        std::unique_lock<std::mutex> lock(wakeMutex);
+        wake.notify_one();
+        drained.wait(lock, [&] { return processedPos >= target || stopping; });
+    }
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence{0};
+        LogRecord record;
+    };
+
+    bool pop(LogRecord& out) {
+        Cell& cell = cells[dequeuePos & (ringCapacity - 1)];
+        if (cell.sequence.load(std::memory_order_acquire) != dequeuePos + 1) {
+            return false;
+        }
+        out = std::move(cell.record);
+        cell.sequence.store(dequeuePos + ringCapacity, std::memory_order_release);
+        ++dequeuePos;
+        return true;
+    }
+
+    static std::string prefix(const LogRecord& record) {
+        auto seconds = std::chrono::system_clock::to_time_t(record.time);
+        auto millis = std::chrono::duration_cast<std::chrono::milliseconds>(record.time.time_since_epoch()).count() % 1000;
+        std::tm utc;
+        gmtime_r(&seconds, &utc);
+        char buffer[40];
+        size_t n = std::strftime(buffer, sizeof(buffer), "%Y-%m-%dT%H:%M:%S", &utc);
+        std::snprintf(buffer + n, sizeof(buffer) - n, ".%03dZ %-5s ", static_cast<int>(millis), logLevelName(record.level));
+        return buffer;
+    }
+
+    static void touch(std::vector<std::ostream*>& touched, std::ostream* out) {
+        if (std::find(touched.begin(), touched.end(), out) == touched.end()) {
+            touched.push_back(out);
+        }
+    }
+
+    void write(const LogRecord& record, std::vector<std::ostream*>& touched) {
+        std::string line = prefix(record) + record.message + "\n";
+        if (files.load(std::memory_order_relaxed) && record.file != nullptr && record.file->is_open()) {
+            *record.file << line;
+            touch(touched, record.file);
+        }
+        if (console.load(std::memory_order_relaxed)) {
+            std::ostream& out = record.level >= LogLevel::Warning ? std::cerr : std::cout;
+            out << line;
+            touch(touched, &out);
+        }
+    }
+
+    void run() {
+        uint64_t reportedDrops = 0;
+        std::vector<std::ostream*> touched;
+        LogRecord record;
+        while (true) {
+            size_t count = 0;
+            while (count < maxBatch && pop(record)) {
+                write(record, touched);
+                ++count;
+            }
+
+            uint64_t drops = droppedCount.load(std::memory_order_relaxed);
+            if (drops != reportedDrops) {
+                std::cerr << "Logger dropped " << (drops - reportedDrops) << " messages (ring full)" << "\n";
+                touch(touched, &std::cerr);
+                reportedDrops = drops;
+            }
+
+            // One flush per stream per batch instead of one per line.
+            for (std::ostream* out : touched) {
+                out->flush();
+            }
+            touched.clear();
+            if (count > 0) {
+                writtenCount.fetch_add(count, std::memory_order_relaxed);
+                batchCount.fetch_add(1, std::memory_order_relaxed);
+            }
+
+            std::unique_lock<std::mutex> lock(wakeMutex);
+            processedPos = dequeuePos;
+            drained.notify_all();
+            if (count == maxBatch) {
+                continue;
+            }
+            if (stopping && !hasPending()) {
+                return;
+            }
+            writerSleeping.store(true, std::memory_order_seq_cst);
+            wake.wait_for(lock, std::chrono::milliseconds(100), [this] { return stopping || hasPending(); });
+            writerSleeping.store(false, std::memory_order_relaxed);
+        }
+    }
+
+    bool hasPending() const {
+        const Cell& cell = cells[dequeuePos & (ringCapacity - 1)];
+        return cell.sequence.load(std::memory_order_acquire) == dequeuePos + 1;
+    }
+
+    std::vector<Cell> cells;
+    std::atomic<size_t> enqueuePos{0};
+    size_t dequeuePos = 0;     // writer thread only
+    size_t processedPos = 0;   // dequeuePos as of the last finished batch, under wakeMutex
+
+    std::atomic<int> minLevel{static_cast<int>(LogLevel::Info)};
+    std::atomic<bool> console{true};
+    std::atomic<bool> files{true};
+
+    std::atomic<uint64_t> writtenCount{0};
+    std::atomic<uint64_t> droppedCount{0};
+    std::atomic<uint64_t> batchCount{0};
+
+    std::mutex wakeMutex;
+    std::condition_variable wake;
+    std::condition_variable drained;
+    std::atomic<bool> writerSleeping{false};
+    bool stopping = false;
+    std::thread writer;
+};
+
+// Constructed on first use, so it is destroyed (and drained) before the log streams above.
+AsyncLogger& logger() {
+    static AsyncLogger instance;
+    return instance;
+}
+
+void enqueue(LogLevel level, const std::string& message, std::ofstream& file) {
+    AsyncLogger& instance = logger();
+    if (instance.enabled(level)) {
+        instance.push(level, file, message);
+    }
+}
+
+} // namespace
+
 void initializeLogFiles() {
     std::filesystem::create_directories("logs");
     serverLogFile.open("logs/kms_server.log", std::ios_base::app);
@@ -27,20 +266,23 @@ void initializeLogFiles() {
     if (!clientErrorLogFile.is_open()) {
         throw std::runtime_error("Unable to open client error log file");
     }
+    logger();
 }
 
 void logMessage(const std::string& message, std::ofstream& logFile) {
-    if (logFile.is_open()) {
-        logFile << message << std::endl;
-    }
-    std::cout << message << std::endl;
+    enqueue(LogLevel::Info, message, logFile);
 }
 
 void logErrorMessage(const std::string& message, std::ofstream& errorLogFile) {
-    if (errorLogFile.is_open()) {
-        errorLogFile << message << std::endl;
-    }
-    std::cerr << message << std::endl;
+    enqueue(LogLevel::Error, message, errorLogFile);
+}
+
+void logWarning(const std::string& message, std::ofstream& logFile) {
+    enqueue(LogLevel::Warning, message, logFile);
+}
+
+void logDebug(const std::string& message, std::ofstream& logFile) {
+    enqueue(LogLevel::Debug, message, logFile);
 }
 
 void logTpmError(TSS2_RC rc, const std::string& functionName) {
@@ -53,3 +295,43 @@ void logTpmError(const std::string& message, const std::string& functionName) {
     logErrorMessage(errorMessage, serverErrorLogFile);
 }
 
+void configureLogger(const LoggerConfig& config) {
+    logger().configure(config);
+}
+
+LoggerConfig loggerConfig() {
+    return logger().config();
+}
+
+LoggerStats loggerStats() {
+    return logger().stats();
+}
+
+void flushLogs() {
+    logger().flush();
+}
+
+bool parseLogLevel(const std::string& name, LogLevel& level) {
+    if (name == "debug") {
+        level = LogLevel::Debug;
+    } else if (name == "info") {
+        level = LogLevel::Info;
+    } else if (name == "warning" || name == "warn") {
+        level = LogLevel::Warning;
+    } else if (name == "error") {
+        level = LogLevel::Error;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+const char* logLevelName(LogLevel level) {
+    switch (level) {
+    case LogLevel::Debug: return "DEBUG";
+    case LogLevel::Info: return "INFO";
+    case LogLevel::Warning: return "WARN";
+    case LogLevel::Error: return "ERROR";
+    }
+    return "INFO";
+}
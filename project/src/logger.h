@@ -2,6 +2,7 @@
 #ifndef LOGGER_H
 #define LOGGER_H
 
+#include <cstdint>
 #include <fstream>
 #include <string>
 #include <tss2/tss2_rc.h>
@@ -11,11 +12,38 @@ extern std::ofstream serverErrorLogFile;
 extern std::ofstream clientLogFile;
 extern std::ofstream clientErrorLogFile;
 
+enum class LogLevel { Debug = 0, Info, Warning, Error };
+
+struct LoggerConfig {
+    LogLevel level = LogLevel::Info;   // records below this are discarded by the caller
+    bool console = true;               // echo to stdout (stderr for warnings and errors)
+    bool files = true;                 // write to the log file passed with each record
+};
+
+struct LoggerStats {
+    uint64_t written = 0;
+    uint64_t dropped = 0;    // ring was full; the caller never blocks
+    uint64_t batches = 0;    // writer wake-ups, each ending in one flush per stream
+    size_t capacity = 0;
+};
+
+// Messages are queued on a bounded lock-free ring and written by one
+// background thread, so callers never wait on file or console I/O.
 void logMessage(const std::string& message, std::ofstream& logFile);
 void logErrorMessage(const std::string& message, std::ofstream& errorLogFile);
+void logWarning(const std::string& message, std::ofstream& logFile);
+void logDebug(const std::string& message, std::ofstream& logFile);
 void initializeLogFiles();
 void logTpmError(TSS2_RC rc, const std::string& functionName);
 void logTpmError(const std::string& message, const std::string& functionName);
 
-#endif // LOGGER_H
+void configureLogger(const LoggerConfig& config);
+LoggerConfig loggerConfig();
+LoggerStats loggerStats();
+// Blocks until everything logged before the call has been written.
+void flushLogs();
+
+bool parseLogLevel(const std::string& name, LogLevel& level);
+const char* logLevelName(LogLevel level);
 
+#endif // LOGGER_H
@@ -0,0 +1,125 @@
+// merkle_tree.cpp
+#include "merkle_tree.h"
+#include <openssl/bio.h>
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <memory>
+#include <stdexcept>
+
+namespace {
+
+constexpr uint8_t leafPrefix = 0x00;
+constexpr uint8_t nodePrefix = 0x01;
+
+std::vector<uint8_t> prefixedHash(uint8_t prefix, const std::vector<uint8_t>& first, const std::vector<uint8_t>* second) {
+    std::unique_ptr<EVP_MD_CTX, decltype(&EVP_MD_CTX_free)> ctx(EVP_MD_CTX_new(), EVP_MD_CTX_free);
+    std::vector<uint8_t> hash(EVP_MAX_MD_SIZE);
+    unsigned int size = 0;
+    if (!ctx || EVP_DigestInit_ex(ctx.get(), EVP_sha256(), nullptr) != 1 ||
+        EVP_DigestUpdate(ctx.get(), &prefix, 1) != 1 ||
+        EVP_DigestUpdate(ctx.get(), first.data(), first.size()) != 1 ||
+        (second && EVP_DigestUpdate(ctx.get(), second->data(), second->size()) != 1) ||
+        EVP_DigestFinal_ex(ctx.get(), hash.data(), &size) != 1) {
+        throw std::runtime_error("Error computing Merkle hash");
+    }
+    hash.resize(size);
+    return hash;
+}
+
+} // namespace
+
+std::vector<uint8_t> merkleLeafHash(const std::vector<uint8_t>& digest) {
+    return prefixedHash(leafPrefix, digest, nullptr);
+}
+
+std::vector<uint8_t> merkleNodeHash(const std::vector<uint8_t>& left, const std::vector<uint8_t>& right) {
+    return prefixedHash(nodePrefix, left, &right);
+}
+
+MerkleTree::MerkleTree(const std::vector<std::vector<uint8_t>>& digests) {
+    if (digests.empty()) {
+        throw std::invalid_argument("Merkle tree needs at least one leaf");
+    }
+    levels.emplace_back();
+    levels.back().reserve(digests.size());
+    for (const auto& digest : digests) {
+        levels.back().push_back(merkleLeafHash(digest));
+    }
+    while (levels.back().size() > 1) {
+        const auto& below = levels.back();
+        std::vector<std::vector<uint8_t>> above;
+        above.reserve((below.size() + 1) / 2);
+        for (size_t i = 0; i < below.size(); i += 2) {
+            above.push_back(i + 1 < below.size() ? merkleNodeHash(below[i], below[i + 1]) : below[i]);
+        }
+        levels.push_back(std::move(above));
+    }
+}
+
+std::vector<std::vector<uint8_t>> MerkleTree::proof(size_t index) const {
+    if (index >= size()) {
+        throw std::out_of_range("Merkle leaf index out of range");
+    }
+    std::vector<std::vector<uint8_t>> path;
+    for (size_t level = 0; level + 1 < levels.size(); ++level) {
+        size_t sibling = index ^ 1;
+        if (sibling < levels[level].size()) {
+            path.push_back(levels[level][sibling]);
+        }
+        index /= 2;
+    }
+    return path;
+}
+
+std::vector<uint8_t> merkleRootFromProof(const std::vector<uint8_t>& digest, uint64_t leafIndex, uint64_t treeSize,
+                                         const std::vector<std::vector<uint8_t>>& proof) {
+    if (leafIndex >= treeSize) {
+        throw std::invalid_argument("Merkle leaf index outside the tree");
+    }
+    std::vector<uint8_t> hash = merkleLeafHash(digest);
+    size_t next = 0;
+    for (uint64_t index = leafIndex, width = treeSize; width > 1; index /= 2, width = (width + 1) / 2) {
+        bool hasSibling = (index ^ 1) < width;
+        if (!hasSibling) {
+            continue;
+        }
+        if (next == proof.size()) {
+            throw std::invalid_argument("Merkle proof too short");
+        }
+        hash = (index & 1) ? merkleNodeHash(proof[next], hash) : merkleNodeHash(hash, proof[next]);
+        ++next;
+    }
+    if (next != proof.size()) {
+        throw std::invalid_argument("Merkle proof too long");
+    }
+    return hash;
+}
+
+bool verifyBatchSignature(const std::vector<uint8_t>& digest, const BatchSignature& signature,
+                          const std::string& publicKeyPem) {
+    std::vector<uint8_t> root;
+    try {
+        root = merkleRootFromProof(digest, signature.leafIndex, signature.treeSize, signature.proof);
+    } catch (const std::invalid_argument&) {
+        return false;
+    }
+    if (root.size() != signature.root.size() || CRYPTO_memcmp(root.data(), signature.root.data(), root.size()) != 0) {
+        return false;
+    }
+
+    std::unique_ptr<BIO, decltype(&BIO_free)> bio(BIO_new_mem_buf(publicKeyPem.data(), static_cast<int>(publicKeyPem.size())), BIO_free);
+    if (!bio) {
+        throw std::runtime_error("Error reading signing public key");
+    }
+    std::unique_ptr<EVP_PKEY, decltype(&EVP_PKEY_free)> key(PEM_read_bio_PUBKEY(bio.get(), nullptr, nullptr, nullptr), EVP_PKEY_free);
+    if (!key) {
+        throw std::invalid_argument("Malformed signing public key");
+    }
+    // The TPM signed the root itself as a SHA-256 digest, so verify without hashing it again.
+    std::unique_ptr<EVP_PKEY_CTX, decltype(&EVP_PKEY_CTX_free)> ctx(EVP_PKEY_CTX_new(key.get(), nullptr), EVP_PKEY_CTX_free);
+    if (!ctx || EVP_PKEY_verify_init(ctx.get()) != 1 || EVP_PKEY_CTX_set_signature_md(ctx.get(), EVP_sha256()) != 1) {
+        throw std::runtime_error("Error initializing signature verification");
+    }
+    return EVP_PKEY_verify(ctx.get(), signature.signature.data(), signature.signature.size(), root.data(), root.size()) == 1;
+}
@@ -0,0 +1,50 @@
+// merkle_tree.h
+#ifndef MERKLE_TREE_H
+#define MERKLE_TREE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// What a caller of a batched sign gets back: the TPM's ECDSA P-256 signature
+// over the root of the batch's Merkle tree, and the path from the caller's
+// digest to that root.
+struct BatchSignature {
+    std::vector<uint8_t> signature;            // DER-encoded ECDSA signature over root
+    std::vector<uint8_t> root;
+    uint64_t leafIndex = 0;
+    uint64_t treeSize = 0;
+    std::vector<std::vector<uint8_t>> proof;   // sibling hashes, leaf level first
+};
+
+// SHA-256 tree hashed as in RFC 6962: leaves are H(0x00 | digest) and
+// interior nodes H(0x01 | left | right), so a leaf can never pass for a node
+// and a root is never the caller's own digest. A node without a sibling is
+// carried up unchanged.
+class MerkleTree {
+public:
+    explicit MerkleTree(const std::vector<std::vector<uint8_t>>& digests);
+
+    const std::vector<uint8_t>& root() const { return levels.back().front(); }
+    size_t size() const { return levels.front().size(); }
+    std::vector<std::vector<uint8_t>> proof(size_t index) const;
+
+private:
+    std::vector<std::vector<std::vector<uint8_t>>> levels;   // leaves first, root last
+};
+
+std::vector<uint8_t> merkleLeafHash(const std::vector<uint8_t>& digest);
+std::vector<uint8_t> merkleNodeHash(const std::vector<uint8_t>& left, const std::vector<uint8_t>& right);
+
+// Recomputes the root from a digest and its proof. Throws std::invalid_argument
+// if the proof does not fit a tree of treeSize leaves.
+std::vector<uint8_t> merkleRootFromProof(const std::vector<uint8_t>& digest, uint64_t leafIndex, uint64_t treeSize,
+                                         const std::vector<std::vector<uint8_t>>& proof);
+
+// Verifier for clients: true if digest is included under signature.root and
+// the root is signed by the PEM-encoded public key from GET /signing-key.
+// Needs nothing but OpenSSL.
+bool verifyBatchSignature(const std::vector<uint8_t>& digest, const BatchSignature& signature,
+                          const std::string& publicKeyPem);
+
+#endif // MERKLE_TREE_H
@@ -0,0 +1,318 @@
+// metrics.cpp
+#include "metrics.h"
+#include "logger.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace {
+
+constexpr size_t maxMetrics = 1024;
+
+// Log-linear (HDR-style) buckets over nanoseconds: values below 8 get their own
+// bucket, and every power of two above that is split into 8 sub-buckets, so a
+// recorded value is never off by more than 12.5%. Values past 2^41 ns (~36
+// minutes) land in the last bucket.
+constexpr int subBucketBits = 3;
+constexpr size_t subBuckets = size_t(1) << subBucketBits;
+constexpr int maxExponent = 40;
+constexpr size_t bucketCount = subBuckets + (maxExponent - subBucketBits + 1) * subBuckets;
+
+// Exported `le` bounds, in nanoseconds. Fine buckets are folded into the first
+// bound at or above their upper edge.
+constexpr std::array<uint64_t, 22> exportedBounds = {
+    1000, 5000, 10000, 25000, 50000, 100000, 250000, 500000,
+    1000000, 2500000, 5000000, 10000000, 25000000, 50000000, 100000000, 250000000, 500000000,
+    1000000000, 2500000000, 5000000000, 10000000000, 30000000000
+};
+
+size_t bucketIndex(uint64_t value) {
+    if (value < subBuckets) {
+        return value;
+    }
+    int exponent = 63 - __builtin_clzll(value);
+    if (exponent > maxExponent) {
+        return bucketCount - 1;
+    }
+    size_t sub = (value >> (exponent - subBucketBits)) & (subBuckets - 1);
+    return subBuckets + (exponent - subBucketBits) * subBuckets + sub;
+}
+
+uint64_t bucketUpperBound(size_t index) {
+    if (index < subBuckets) {
+        return index;
+    }
+    size_t exponent = (index - subBuckets) / subBuckets + subBucketBits;
+    size_t sub = (index - subBuckets) % subBuckets;
+    return ((subBuckets + sub + 1) << (exponent - subBucketBits)) - 1;
+}
+
+// Only the owning thread writes a slot, so a plain load+store is enough and
+// avoids a locked read-modify-write; the scraper reads with relaxed loads.
+void bump(std::atomic<uint64_t>& value, uint64_t amount) {
+    value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+}
+
+struct Slot {
+    std::atomic<uint64_t> count{0};
+    std::atomic<uint64_t> sum{0};
+    std::unique_ptr<std::atomic<uint64_t>[]> buckets;   // histograms only
+};
+
+struct Merged {
+    uint64_t count = 0;
+    uint64_t sum = 0;
+    std::vector<uint64_t> buckets;
+
+    void add(const Slot& slot) {
+        count += slot.count.load(std::memory_order_relaxed);
+        sum += slot.sum.load(std::memory_order_relaxed);
+        if (slot.buckets) {
+            buckets.resize(bucketCount);
+            for (size_t i = 0; i < bucketCount; ++i) {
+                buckets[i] += slot.buckets[i].load(std::memory_order_relaxed);
+            }
+        }
+    }
+};
+
+struct MetricInfo {
+    std::string name;
+    std::string labels;
+    std::string help;
+    bool histogram = false;
+};
+
+struct ThreadSlots;
+
+class Registry {
+public:
+    Registry() : retired(maxMetrics) {
+        metrics.reserve(maxMetrics);
+        metrics.push_back({"kms_metrics_overflow_total", "", "Updates to series registered after the metric table was full", false});
+    }
+
+    MetricId add(const std::string& name, const std::string& labels, const std::string& help, bool histogram) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto key = std::make_pair(name, labels);
+        auto it = ids.find(key);
+        if (it != ids.end()) {
+            return it->second;
+        }
+        if (metrics.size() == maxMetrics) {
+            logErrorMessage("Metric table full, not registering " + name + "{" + labels + "}", serverErrorLogFile);
+            return 0;
+        }
+        metrics.push_back({name, labels, help, histogram});
+        ids.emplace(std::move(key), metrics.size() - 1);
+        return metrics.size() - 1;
+    }
+
+    void attach(ThreadSlots* slots) {
+        std::lock_guard<std::mutex> lock(mutex);
+        threads.push_back(slots);
+    }
+
+    // Folds an exiting thread's values into the retired totals.
+    void detach(ThreadSlots* slots);
+
+    std::string render();
+
+private:
+    std::mutex mutex;
+    std::vector<MetricInfo> metrics;
+    std::map<std::pair<std::string, std::string>, MetricId> ids;
+    std::vector<ThreadSlots*> threads;
+    std::vector<Merged> retired;
+};
+
+Registry& registry() {
+    static Registry instance;
+    return instance;
+}
+
+struct ThreadSlots {
+    ThreadSlots() {
+        registry().attach(this);
+    }
+    ~ThreadSlots() {
+        registry().detach(this);
+    }
+
+    Slot& slot(MetricId id, bool histogram) {
+        Slot* slot = slots[id].load(std::memory_order_relaxed);
+        if (slot == nullptr) {
+            owned[id] = std::make_unique<Slot>();
+            slot = owned[id].get();
+            if (histogram && id != 0) {
+                slot->buckets.reset(new std::atomic<uint64_t>[bucketCount]());
+            }
+            slots[id].store(slot, std::memory_order_release);
+        }
+        return *slot;
+    }
+
+    std::array<std::atomic<Slot*>, maxMetrics> slots{};
+    std::array<std::unique_ptr<Slot>, maxMetrics> owned;
+};
+
+void Registry::detach(ThreadSlots* slots) {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (size_t id = 0; id < maxMetrics; ++id) {
+        if (Slot* slot = slots->slots[id].load(std::memory_order_acquire)) {
+            retired[id].add(*slot);
+        }
+    }
+    threads.erase(std::remove(threads.begin(), threads.end(), slots), threads.end());
+}
+
+thread_local ThreadSlots localSlots;
+
+std::string formatNumber(double value) {
+    char buffer[32];
+    std::snprintf(buffer, sizeof(buffer), "%.9g", value);
+    return buffer;
+}
+
+std::string withLabels(const std::string& labels, const std::string& extra) {
+    if (labels.empty() && extra.empty()) {
+        return "";
+    }
+    return "{" + labels + (labels.empty() || extra.empty() ? "" : ",") + extra + "}";
+}
+
+std::string Registry::render() {
+    std::vector<MetricInfo> infos;
+    std::vector<Merged> merged;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        infos = metrics;
+        merged.assign(retired.begin(), retired.begin() + metrics.size());
+        for (ThreadSlots* thread : threads) {
+            for (size_t id = 0; id < metrics.size(); ++id) {
+                if (Slot* slot = thread->slots[id].load(std::memory_order_acquire)) {
+                    merged[id].add(*slot);
+                }
+            }
+        }
+    }
+
+    // Series of one family must be adjacent in the output.
+    std::vector<MetricId> order(infos.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+        order[i] = i;
+    }
+    std::stable_sort(order.begin(), order.end(), [&](MetricId a, MetricId b) { return infos[a].name < infos[b].name; });
+
+    std::string out;
+    std::string family;
+    for (MetricId id : order) {
+        const MetricInfo& info = infos[id];
+        const Merged& values = merged[id];
+        if (info.name != family) {
+            family = info.name;
+            out += "# HELP " + info.name + " " + info.help + "\n";
+            out += "# TYPE " + info.name + (info.histogram ? " histogram\n" : " counter\n");
+        }
+        if (!info.histogram) {
+            out += info.name + withLabels(info.labels, "") + " " + std::to_string(values.count) + "\n";
+            continue;
+        }
+
+        uint64_t cumulative = 0;
+        size_t fine = 0;
+        for (uint64_t bound : exportedBounds) {
+            for (; fine < values.buckets.size() && bucketUpperBound(fine) <= bound; ++fine) {
+                cumulative += values.buckets[fine];
+            }
+            out += info.name + "_bucket" + withLabels(info.labels, "le=\"" + formatNumber(bound / 1e9) + "\"") +
+                   " " + std::to_string(cumulative) + "\n";
+        }
+        out += info.name + "_bucket" + withLabels(info.labels, "le=\"+Inf\"") + " " + std::to_string(values.count) + "\n";
+        out += info.name + "_sum" + withLabels(info.labels, "") + " " + formatNumber(values.sum / 1e9) + "\n";
+        out += info.name + "_count" + withLabels(info.labels, "") + " " + std::to_string(values.count) + "\n";
+    }
+    return out;
+}
+
+} // namespace
+
+MetricId registerCounter(const std::string& name, const std::string& labels, const std::string& help) {
+    return registry().add(name, labels, help, false);
+}
+
+MetricId registerHistogram(const std::string& name, const std::string& labels, const std::string& help) {
+    return registry().add(name, labels, help, true);
+}
+
+void incrementCounter(MetricId id, uint64_t amount) {
+    bump(localSlots.slot(id, false).count, amount);
+}
+
+void observeNanos(MetricId id, uint64_t nanos) {
+    Slot& slot = localSlots.slot(id, true);
+    if (!slot.buckets) {
+        // The overflow counter, or a counter id passed by mistake.
+        bump(slot.count, 1);
+        return;
+    }
+    bump(slot.buckets[bucketIndex(nanos)], 1);
+    bump(slot.sum, nanos);
+    bump(slot.count, 1);
+}
+
+void observeDuration(MetricId id, std::chrono::steady_clock::duration duration) {
+    auto nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+    observeNanos(id, nanos < 0 ? 0 : static_cast<uint64_t>(nanos));
+}
+
+void recordTPMCommand(const char* command, std::chrono::steady_clock::duration duration, TSS2_RC rc) {
+    thread_local std::unordered_map<const char*, MetricId> latencyIds;
+    auto it = latencyIds.find(command);
+    if (it == latencyIds.end()) {
+        MetricId id = registerHistogram("kms_tpm_command_duration_seconds", metricLabel("command", command),
+                                        "Latency of ESAPI commands sent to the TPM");
+        it = latencyIds.emplace(command, id).first;
+    }
+    observeDuration(it->second, duration);
+
+    if (rc != TSS2_RC_SUCCESS) {
+        char code[16];
+        std::snprintf(code, sizeof(code), "0x%08x", static_cast<unsigned>(rc));
+        incrementCounter(registerCounter("kms_tpm_command_errors_total",
+                                         metricLabel("command", command) + "," + metricLabel("rc", code),
+                                         "ESAPI commands that returned an error, by TSS2_RC"));
+    }
+}
+
+std::string metricLabel(const std::string& name, const std::string& value) {
+    std::string escaped;
+    for (char c : value) {
+        if (c == '\\' || c == '"') {
+            escaped += '\\';
+            escaped += c;
+        } else if (c == '\n') {
+            escaped += "\\n";
+        } else {
+            escaped += c;
+        }
+    }
+    return name + "=\"" + escaped + "\"";
+}
+
+std::string renderMetrics() {
+    return registry().render();
+}
+
+void appendMetric(std::string& out, const std::string& name, const char* type, const std::string& help, double value) {
+    out += "# HELP " + name + " " + help + "\n";
+    out += "# TYPE " + name + " " + type + "\n";
+    out += name + " " + formatNumber(value) + "\n";
+}
@@ -0,0 +1,46 @@
+// metrics.h
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <tss2/tss2_rc.h>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+using MetricId = size_t;
+
+// Registration takes the registry lock, so hot paths register once and keep
+// the id. `labels` is a Prometheus label list without braces, built with
+// metricLabel(); registering the same name and labels again returns the same id.
+MetricId registerCounter(const std::string& name, const std::string& labels, const std::string& help);
+MetricId registerHistogram(const std::string& name, const std::string& labels, const std::string& help);
+
+// Updates only touch the calling thread's own slots: no locks and no shared
+// cache lines. Threads are merged when the metrics are rendered.
+void incrementCounter(MetricId id, uint64_t amount = 1);
+void observeNanos(MetricId id, uint64_t nanos);
+void observeDuration(MetricId id, std::chrono::steady_clock::duration duration);
+
+// Latency of one Esys_* command, plus a failure count by TSS2_RC when rc is
+// an error. `command` must be a string literal; ids are cached per thread by address.
+void recordTPMCommand(const char* command, std::chrono::steady_clock::duration duration, TSS2_RC rc);
+
+// Times one synchronous ESAPI call:
+//   rc = timedEsys("Esys_Load", [&] { return Esys_Load(...); });
+template <typename Call>
+TSS2_RC timedEsys(const char* command, Call&& call) {
+    auto start = std::chrono::steady_clock::now();
+    TSS2_RC rc = call();
+    recordTPMCommand(command, std::chrono::steady_clock::now() - start, rc);
+    return rc;
+}
+
+std::string metricLabel(const std::string& name, const std::string& value);
+
+// Prometheus text exposition of every registered metric.
+std::string renderMetrics();
+// For values that already live elsewhere (pool sizes, totals kept by a component).
+void appendMetric(std::string& out, const std::string& name, const char* type, const std::string& help, double value);
+
+#endif // METRICS_H
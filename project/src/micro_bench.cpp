@@ -0,0 +1,135 @@
+// micro_bench.cpp
+#include "micro_bench.h"
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <ctime>
+#include <thread>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double threadCpuSeconds() {
+    timespec now{};
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+struct ThreadResult {
+    uint64_t iterations = 0;
+    uint64_t errors = 0;
+    double cpuSeconds = 0;
+    Clock::time_point finishedAt;
+    LatencyHistogram latency;
+};
+
+void runThread(const MicroBenchOperation& op, size_t thread, Clock::time_point measureFrom,
+               Clock::time_point measureUntil, ThreadResult& result) {
+    uint64_t iteration = 0;
+    while (Clock::now() < measureFrom) {
+        try {
+            op(thread, iteration);
+        } catch (const std::exception&) {
+        }
+        ++iteration;
+    }
+
+    double cpuStart = threadCpuSeconds();
+    for (auto start = Clock::now(); start < measureUntil; ++iteration) {
+        bool failed = false;
+        try {
+            op(thread, iteration);
+        } catch (const std::exception&) {
+            failed = true;
+        }
+        auto end = Clock::now();
+        if (failed) {
+            ++result.errors;
+        } else {
+            ++result.iterations;
+            result.latency.record(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+        }
+        start = end;
+    }
+    result.cpuSeconds = threadCpuSeconds() - cpuStart;
+    result.finishedAt = Clock::now();
+}
+
+} // namespace
+
+MicroBenchResult runMicroBenchmark(const std::string& name, size_t threads, size_t bytesPerOp,
+                                   const MicroBenchOperation& op, const MicroBenchConfig& config) {
+    size_t threadCount = std::max<size_t>(threads, 1);
+    std::vector<ThreadResult> perThread(threadCount);
+    std::vector<std::thread> workers;
+    auto measureFrom = Clock::now() + config.warmup;
+    auto measureUntil = measureFrom + config.duration;
+    for (size_t i = 0; i < threadCount; ++i) {
+        workers.emplace_back(runThread, std::cref(op), i, measureFrom, measureUntil, std::ref(perThread[i]));
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    MicroBenchResult result;
+    result.name = name;
+    result.threads = threadCount;
+    result.bytesPerOp = bytesPerOp;
+    // The phase ends when the last call that started before the deadline returns.
+    Clock::time_point finishedAt = measureUntil;
+    for (const auto& thread : perThread) {
+        result.iterations += thread.iterations;
+        result.errors += thread.errors;
+        result.cpuSeconds += thread.cpuSeconds;
+        result.latency.merge(thread.latency);
+        finishedAt = std::max(finishedAt, thread.finishedAt);
+    }
+    result.seconds = std::chrono::duration<double>(finishedAt - measureFrom).count();
+    return result;
+}
+
+nlohmann::json microBenchReport(const std::vector<MicroBenchResult>& results) {
+    char host[256] = {};
+    gethostname(host, sizeof(host) - 1);
+    char date[64] = {};
+    std::time_t now = std::time(nullptr);
+    std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S%z", std::localtime(&now));
+
+    nlohmann::json report;
+    report["context"] = {
+        {"date", date},
+        {"host_name", host},
+        {"executable", "kms_bench"},
+        {"num_cpus", std::thread::hardware_concurrency()},
+    };
+    report["benchmarks"] = nlohmann::json::array();
+    for (const auto& result : results) {
+        // As in Google Benchmark, per-iteration times are summed across
+        // threads, so real_time is the latency one caller sees on average.
+        double perIteration = result.iterations ? 1e9 / result.iterations : 0;
+        double rate = result.seconds > 0 ? result.iterations / result.seconds : 0;
+        nlohmann::json entry = {
+            {"name", result.name},
+            {"run_name", result.name},
+            {"run_type", "iteration"},
+            {"repetitions", 1},
+            {"threads", result.threads},
+            {"iterations", result.iterations},
+            {"real_time", result.seconds * result.threads * perIteration},
+            {"cpu_time", result.cpuSeconds * perIteration},
+            {"time_unit", "ns"},
+            {"items_per_second", rate},
+            {"errors", result.errors},
+            {"p50_ns", result.latency.percentile(50)},
+            {"p99_ns", result.latency.percentile(99)},
+            {"p999_ns", result.latency.percentile(99.9)},
+            {"max_ns", result.latency.max()},
+        };
+        if (result.bytesPerOp > 0) {
+            entry["bytes_per_second"] = rate * result.bytesPerOp;
+        }
+        report["benchmarks"].push_back(entry);
+    }
+    return report;
+}
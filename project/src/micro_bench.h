@@ -0,0 +1,42 @@
+// micro_bench.h
+#ifndef MICRO_BENCH_H
+#define MICRO_BENCH_H
+
+#include "latency_histogram.h"
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+struct MicroBenchConfig {
+    std::chrono::milliseconds warmup{200};   // run but not measured: fills caches and pools
+    std::chrono::seconds duration{2};        // measured time per case
+};
+
+struct MicroBenchResult {
+    std::string name;                // "<operation>[/<bytes>]/threads:<n>"
+    size_t threads = 0;
+    size_t bytesPerOp = 0;           // 0 when the operation has no payload size
+    uint64_t iterations = 0;         // successful operations in the measured phase
+    uint64_t errors = 0;
+    double seconds = 0;              // wall time of the measured phase
+    double cpuSeconds = 0;           // CPU time of the benchmark threads, summed
+    LatencyHistogram latency;
+};
+
+// One operation of a benchmark case. thread is the caller's index and
+// iteration counts that thread's calls, so cases can pick inputs without
+// sharing state. An exception counts as an error; the run carries on.
+using MicroBenchOperation = std::function<void(size_t thread, uint64_t iteration)>;
+
+// Runs op on threads threads for the warmup and then the measured duration,
+// timing every call. A small in-tree harness rather than a dependency: it
+// reports in Google Benchmark's JSON layout so the same tooling can read it.
+MicroBenchResult runMicroBenchmark(const std::string& name, size_t threads, size_t bytesPerOp,
+                                   const MicroBenchOperation& op, const MicroBenchConfig& config);
+
+nlohmann::json microBenchReport(const std::vector<MicroBenchResult>& results);
+
+#endif // MICRO_BENCH_H
@@ -0,0 +1,141 @@
+// replica_sync.cpp
+#include "replica_sync.h"
+#include "cbor.h"
+#include "logger.h"
+#include <algorithm>
+#include <cstdio>
+#include <stdexcept>
+#include <unordered_set>
+
+namespace {
+
+std::string epochParam(uint64_t epoch) {
+    char text[17];
+    std::snprintf(text, sizeof(text), "%016llx", static_cast<unsigned long long>(epoch));
+    return text;
+}
+
+} // namespace
+
+ReplicaSync::ReplicaSync(KeyManager& keyManager, const ReplicaSyncConfig& config)
+    : keyManager(keyManager), config(config), primary([&] {
+          HTTPSConnectionPoolConfig poolConfig = config.primary;
+          poolConfig.size = 1;
+          // A poll is held open for pollWait before the primary answers.
+          poolConfig.readTimeout = std::max(poolConfig.readTimeout, config.pollWait + std::chrono::seconds(5));
+          return poolConfig;
+      }()) {
+    thread = std::thread(&ReplicaSync::run, this);
+    logMessage("Replicating from " + config.primary.host + ":" + std::to_string(config.primary.port), serverLogFile);
+}
+
+ReplicaSync::~ReplicaSync() {
+    {
+        std::lock_guard<std::mutex> lock(stopMutex);
+        stopping = true;
+    }
+    stopWanted.notify_all();
+    if (thread.joinable()) {
+        thread.join();
+    }
+}
+
+bool ReplicaSync::pause(std::chrono::milliseconds delay) {
+    std::unique_lock<std::mutex> lock(stopMutex);
+    return !stopWanted.wait_for(lock, delay, [this] { return stopping; });
+}
+
+void ReplicaSync::run() {
+    while (pause(std::chrono::milliseconds(0))) {
+        try {
+            if (!poll()) {
+                snapshot();
+            }
+        } catch (const std::exception& e) {
+            keyManager.noteReplicaFailure();
+            logErrorMessage("Replication from the primary failed: " + std::string(e.what()), serverErrorLogFile);
+            pause(config.retryInterval);
+        }
+    }
+}
+
+std::string ReplicaSync::fetch(const std::string& path, const std::multimap<std::string, std::string>& params, bool& gone) {
+    std::string target = path;
+    char separator = '?';
+    for (const auto& param : params) {
+        target += separator + percentEncode(param.first) + "=" + percentEncode(param.second);
+        separator = '&';
+    }
+    auto res = primary.get(target, {{"Accept", cborContentType},
+                                    {replicationAuthHeader, keyManager.replicationRequestAuth(path, params)}});
+    if (!res) {
+        throw std::runtime_error("Primary unreachable: " + httplib::to_string(res.error()));
+    }
+    gone = res->status == 410;
+    if (!gone && res->status != 200) {
+        throw std::runtime_error("Primary answered " + std::to_string(res->status) + ": " + res->body);
+    }
+    return res->body;
+}
+
+bool ReplicaSync::poll() {
+    ReplicationToken position = keyManager.replicationToken();
+    bool gone = false;
+    std::string body = fetch("/replication/changes",
+                             {{"epoch", epochParam(position.epoch)},
+                              {"after", std::to_string(position.seq)},
+                              {"limit", std::to_string(config.batchChanges)},
+                              {"wait_ms", std::to_string(config.pollWait.count())}}, gone);
+    if (gone) {
+        return false;
+    }
+    ReplicationBatch batch = decodeReplicationBatch(body);
+    keyManager.noteReplicaPoll(ReplicationToken{batch.epoch, batch.lastSeq});
+    if (batch.changes.empty()) {
+        return true;
+    }
+    uint64_t expected = position.seq + 1;
+    for (const auto& change : batch.changes) {
+        if (change.seq != expected++) {
+            throw std::runtime_error("Primary sent change " + std::to_string(change.seq) + " out of order");
+        }
+    }
+    keyManager.applyReplicated(batch.changes, ReplicationToken{batch.epoch, batch.changes.back().seq});
+    return true;
+}
+
+void ReplicaSync::snapshot() {
+    logMessage("Replica copying a snapshot from the primary", serverLogFile);
+    // Pages are applied as they arrive, but the position only moves once the
+    // copy is complete, so read-your-writes tokens wait for the whole snapshot.
+    ReplicationToken held = keyManager.replicationToken();
+    ReplicationToken start;
+    std::unordered_set<std::string> present;
+    std::string after;
+    bool first = true;
+    do {
+        if (!pause(std::chrono::milliseconds(0))) {
+            return;
+        }
+        bool gone = false;
+        ReplicationSnapshotPage page = decodeReplicationSnapshot(
+            fetch("/replication/snapshot", {{"after", after}, {"limit", std::to_string(config.snapshotPageKeys)}}, gone));
+        if (gone) {
+            throw std::runtime_error("Primary refused a snapshot");
+        }
+        if (first) {
+            start = ReplicationToken{page.epoch, page.seq};
+            first = false;
+        } else if (page.epoch != start.epoch) {
+            throw std::runtime_error("Primary restarted during the snapshot");
+        }
+        for (const auto& change : page.changes) {
+            if (change.type == KeyLogRecordType::Put) {
+                present.insert(change.keyId);
+            }
+        }
+        keyManager.applyReplicated(page.changes, held);
+        after = page.next;
+    } while (!after.empty());
+    keyManager.finishReplicaSnapshot(present, start);
+}
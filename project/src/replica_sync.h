@@ -0,0 +1,58 @@
+// replica_sync.h
+#ifndef REPLICA_SYNC_H
+#define REPLICA_SYNC_H
+
+#include "https_connection_pool.h"
+#include "key_manager.h"
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+struct ReplicaSyncConfig {
+    HTTPSConnectionPoolConfig primary;               // host, port and CA of the primary
+    std::chrono::milliseconds pollWait{1000};        // how long the primary holds a poll with nothing new
+    size_t batchChanges = 1024;                      // changes asked for per poll
+    size_t snapshotPageKeys = 256;                   // keys per snapshot page; each is unsealed on the primary
+    std::chrono::milliseconds retryInterval{1000};   // pause after a failed poll or apply
+};
+
+// Replica side of log shipping. One thread long-polls the primary's
+// /replication/changes and hands each batch to KeyManager::applyReplicated.
+// When the primary answers 410, because it restarted or this replica fell
+// further behind than its feed reaches, the thread copies the primary page by
+// page from /replication/snapshot and then resumes the feed from the position
+// the first page was taken at. Failures are counted and retried; the replica
+// keeps serving what it has in the meantime.
+class ReplicaSync {
+public:
+    ReplicaSync(KeyManager& keyManager, const ReplicaSyncConfig& config);
+    ~ReplicaSync();
+
+    ReplicaSync(const ReplicaSync&) = delete;
+    ReplicaSync& operator=(const ReplicaSync&) = delete;
+
+private:
+    void run();
+    // Applies one batch of changes; false when the primary asks for a snapshot.
+    bool poll();
+    void snapshot();
+    // GET of path with params, signed with the replication key. Body of a 200
+    // response; gone is set instead on 410. Anything else throws.
+    std::string fetch(const std::string& path, const std::multimap<std::string, std::string>& params, bool& gone);
+    // Sleeps for delay unless the thread is stopping; returns false if it is.
+    bool pause(std::chrono::milliseconds delay);
+
+    KeyManager& keyManager;
+    ReplicaSyncConfig config;
+    HTTPSConnectionPool primary;
+
+    std::mutex stopMutex;
+    std::condition_variable stopWanted;
+    bool stopping = false;
+    std::thread thread;
+};
+
+#endif // REPLICA_SYNC_H
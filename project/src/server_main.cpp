@@ -1,30 +1,133 @@
 //server_main.cpp
 #include "handlers.h"
 #include "key_manager.h"
+#include "replica_sync.h"
+#include "key_arena.h"
 #include "logger.h"
+#include "config.h"
 #include <httplib.h>
 #include <iostream>
 #include <nlohmann/json.hpp>
 #include <fstream>
 #include <sstream>
+#include <memory>
+#include <stdexcept>
 #include <filesystem> // Include this header
 
-int main() {
+namespace {
+
+int runServer() {
     initializeLogFiles();
-    KeyManager km;
 
-    std::filesystem::path certPath = std::filesystem::current_path() / "certs/myapp-localhost.crt";
-    std::filesystem::path keyPath = std::filesystem::current_path() / "certs/myapp-localhost.key";
+    LoggerConfig logConfig;
+    if (!parseLogLevel(getEnvString("KMS_LOG_LEVEL", "info"), logConfig.level)) {
+        logErrorMessage("Unknown KMS_LOG_LEVEL, using info", serverErrorLogFile);
+    }
+    logConfig.console = getEnvBool("KMS_LOG_CONSOLE", true);
+    logConfig.files = getEnvBool("KMS_LOG_FILES", true);
+    configureLogger(logConfig);
+
+    // Before the key manager exists, so every plaintext key lands in a configured arena.
+    KeyArenaConfig arenaConfig;
+    arenaConfig.slotSize = static_cast<size_t>(getEnvLong("KMS_KEY_ARENA_SLOT_BYTES", 64));
+    arenaConfig.slotsPerSlab = static_cast<size_t>(getEnvLong("KMS_KEY_ARENA_SLAB_SLOTS", 512));
+    KeyArena::configure(arenaConfig);
+
+    KeyManagerConfig kmConfig;
+    if (!parseTPMBackendType(getEnvString("KMS_TPM_BACKEND", "tpm"), kmConfig.backend)) {
+        logErrorMessage("KMS_TPM_BACKEND must be tpm or software", serverErrorLogFile);
+        return 1;
+    }
+    // Empty puts the state file in KMS_DATA_DIR; see KeyManager.
+    kmConfig.software.stateFile = getEnvString("KMS_SOFTWARE_TPM_STATE", "");
+    kmConfig.device.contextPool.size = static_cast<size_t>(getEnvLong("KMS_TPM_CONTEXT_POOL_SIZE", 4));
+    // Several TCTIs separated by ';' shard TPM work over that many TPMs.
+    kmConfig.shards.tctis = getEnvList("KMS_TPM_TCTI", ';');
+    kmConfig.device.contextPool.tcti = kmConfig.shards.tctis.empty() ? "" : kmConfig.shards.tctis.front();
+    kmConfig.shards.failureThreshold = static_cast<uint32_t>(getEnvLong("KMS_TPM_FAILURE_THRESHOLD", 3));
+    kmConfig.shards.retryAfter = std::chrono::milliseconds(getEnvLong("KMS_TPM_RETRY_AFTER_MS", 5000));
+    kmConfig.device.contextPool.acquireTimeout = std::chrono::milliseconds(getEnvLong("KMS_TPM_ACQUIRE_TIMEOUT_MS", 5000));
+    kmConfig.device.objectCache.primaryHandle = static_cast<TPM2_HANDLE>(getEnvLong("KMS_TPM_PRIMARY_HANDLE", 0x81000001));
+    kmConfig.device.objectCache.signingKeyHandle = static_cast<TPM2_HANDLE>(getEnvLong("KMS_TPM_SIGNING_KEY_HANDLE", 0x81000002));
+    kmConfig.device.objectCache.maxLoadedPerContext = static_cast<size_t>(getEnvLong("KMS_TPM_LOADED_OBJECTS_PER_CONTEXT", 3));
+    kmConfig.device.objectCache.maxSavedContexts = static_cast<size_t>(getEnvLong("KMS_TPM_SAVED_CONTEXTS", 1024));
+    kmConfig.device.scheduler.maxInFlight = static_cast<size_t>(getEnvLong("KMS_TPM_MAX_IN_FLIGHT", 0));
+    kmConfig.device.scheduler.pollInterval = std::chrono::milliseconds(getEnvLong("KMS_TPM_POLL_INTERVAL_MS", 1));
+    kmConfig.signer.window = std::chrono::microseconds(getEnvLong("KMS_SIGN_BATCH_WINDOW_US", 2000));
+    kmConfig.signer.maxBatchSize = static_cast<size_t>(getEnvLong("KMS_SIGN_MAX_BATCH", 256));
+    kmConfig.entropyPoolEnabled = getEnvBool("KMS_ENTROPY_POOL", true);
+    kmConfig.entropyPool.capacity = static_cast<size_t>(getEnvLong("KMS_ENTROPY_POOL_BYTES", 4096));
+    kmConfig.entropyPool.lowWaterMark = static_cast<size_t>(getEnvLong("KMS_ENTROPY_LOW_WATER_BYTES", 1024));
+    kmConfig.entropyPool.reseedInterval = std::chrono::seconds(getEnvLong("KMS_ENTROPY_RESEED_INTERVAL_S", 60));
+    kmConfig.entropyPool.reseedRequests = static_cast<uint64_t>(getEnvLong("KMS_ENTROPY_RESEED_REQUESTS", 4096));
+    kmConfig.keyStoreShards = static_cast<size_t>(getEnvLong("KMS_KEY_STORE_SHARDS", 64));
+    kmConfig.keyLog.directory = getEnvString("KMS_DATA_DIR", "data");
+    kmConfig.keyLog.compactAfterBytes = static_cast<size_t>(getEnvLong("KMS_STORE_COMPACT_BYTES", 64L * 1024 * 1024));
+    kmConfig.keyLog.groupCommitDelay = std::chrono::microseconds(getEnvLong("KMS_STORE_GROUP_COMMIT_US", 0));
+    kmConfig.rotation.keyLifetime = std::chrono::seconds(getEnvLong("KMS_KEY_LIFETIME_DAYS", 30) * 24 * 3600);
+    kmConfig.rotation.interval = std::chrono::seconds(getEnvLong("KMS_ROTATION_INTERVAL_S", 60));
+    kmConfig.rotation.maxKeysPerPass = static_cast<size_t>(getEnvLong("KMS_ROTATION_MAX_KEYS_PER_PASS", 1024));
+    if (!parseReplicationRole(getEnvString("KMS_REPLICATION_ROLE", "standalone"), kmConfig.replication.role)) {
+        logErrorMessage("KMS_REPLICATION_ROLE must be standalone, primary or replica", serverErrorLogFile);
+        return 1;
+    }
+    kmConfig.replication.keyFile = getEnvString("KMS_REPLICATION_KEY_FILE", "");
+    kmConfig.replication.feedRecords = static_cast<size_t>(getEnvLong("KMS_REPLICATION_FEED_RECORDS", 65536));
+    kmConfig.replication.authWindow = std::chrono::seconds(getEnvLong("KMS_REPLICATION_AUTH_WINDOW_S", 60));
+    KeyManager km(kmConfig);
 
-    httplib::SSLServer svr(certPath.string().c_str(), keyPath.string().c_str());
+    KMSServerConfig serverConfig;
+    serverConfig.host = getEnvString("KMS_LISTEN_HOST", serverConfig.host);
+    serverConfig.port = static_cast<int>(getEnvLong("KMS_LISTEN_PORT", serverConfig.port));
+    serverConfig.certPath = getEnvString("KMS_TLS_CERT", (std::filesystem::current_path() / serverConfig.certPath).string());
+    serverConfig.keyPath = getEnvString("KMS_TLS_KEY", (std::filesystem::current_path() / serverConfig.keyPath).string());
+    serverConfig.workerThreads = static_cast<size_t>(getEnvLong("KMS_SERVER_THREADS", 0));
+    serverConfig.maxQueuedRequests = static_cast<size_t>(getEnvLong("KMS_SERVER_MAX_QUEUED", 0));
+    serverConfig.keepAliveMaxCount = static_cast<size_t>(getEnvLong("KMS_KEEP_ALIVE_MAX_REQUESTS", 100));
+    serverConfig.keepAliveTimeout = std::chrono::seconds(getEnvLong("KMS_KEEP_ALIVE_TIMEOUT_S", 5));
+    serverConfig.readTimeout = std::chrono::seconds(getEnvLong("KMS_READ_TIMEOUT_S", 5));
+    serverConfig.writeTimeout = std::chrono::seconds(getEnvLong("KMS_WRITE_TIMEOUT_S", 5));
+    serverConfig.tls.sessionCacheSize = getEnvLong("KMS_TLS_SESSION_CACHE", 20480);
+    serverConfig.tls.sessionTimeout = std::chrono::seconds(getEnvLong("KMS_TLS_SESSION_TIMEOUT_S", 7200));
+    serverConfig.tls.sessionTickets = getEnvBool("KMS_TLS_TICKETS", true);
+    serverConfig.tls.ticketKeyFile = getEnvString("KMS_TLS_TICKET_KEY_FILE", "");
+    serverConfig.streamChunkSize = static_cast<size_t>(getEnvLong("KMS_STREAM_CHUNK_BYTES", 64 * 1024));
+    serverConfig.streamMemoryLimit = static_cast<size_t>(getEnvLong("KMS_STREAM_MEMORY_BYTES", 1024 * 1024));
+    serverConfig.streamSpillDirectory = getEnvString("KMS_STREAM_SPILL_DIR", "");
+    serverConfig.replicationWait = std::chrono::milliseconds(getEnvLong("KMS_REPLICATION_READ_WAIT_MS", 2000));
 
-    // Register handlers (ensure you add all necessary handlers here)
-    startKMSServer(km);
+    // Stopped, with its thread, before km when main returns.
+    std::unique_ptr<ReplicaSync> replicaSync;
+    if (kmConfig.replication.role == ReplicationRole::Replica) {
+        ReplicaSyncConfig syncConfig;
+        syncConfig.primary.host = getEnvString("KMS_REPLICATION_PRIMARY_HOST", "localhost");
+        syncConfig.primary.port = static_cast<int>(getEnvLong("KMS_REPLICATION_PRIMARY_PORT", 8080));
+        syncConfig.primary.caCertPath = getEnvString("KMS_REPLICATION_PRIMARY_CA", syncConfig.primary.caCertPath);
+        syncConfig.pollWait = std::chrono::milliseconds(getEnvLong("KMS_REPLICATION_POLL_WAIT_MS", 1000));
+        syncConfig.batchChanges = static_cast<size_t>(getEnvLong("KMS_REPLICATION_BATCH", 1024));
+        syncConfig.snapshotPageKeys = static_cast<size_t>(getEnvLong("KMS_REPLICATION_SNAPSHOT_PAGE", 256));
+        replicaSync = std::make_unique<ReplicaSync>(km, syncConfig);
+    }
 
-    std::cout << "Server started at https://localhost:8080" << std::endl;
-    logMessage("Server started at https://localhost:8080", serverLogFile);
-    svr.listen("0.0.0.0", 8080);
+    std::cout << "Server starting on https://" << serverConfig.host << ":" << serverConfig.port << std::endl;
+    try {
+        startKMSServer(km, serverConfig);
+    } catch (const std::exception& e) {
+        std::cerr << "Server failed: " << e.what() << std::endl;
+        return 1;
+    }
 
     return 0;
 }
 
+} // namespace
+
+int main() {
+    try {
+        return runServer();
+    } catch (const std::invalid_argument& e) {
+        // A malformed KMS_* setting; better to refuse to start than to run on a misread value.
+        std::cerr << "Invalid configuration: " << e.what() << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,75 @@
+// server_tls.cpp
+#include "server_tls.h"
+#include "logger.h"
+#include <openssl/crypto.h>
+#include <openssl/rand.h>
+#include <array>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+namespace {
+
+constexpr size_t ticketKeySize = 80;
+
+// Any fixed value works; OpenSSL refuses to resume a session from a context with a different one.
+const unsigned char sessionIdContext[] = "kms_server";
+
+std::array<unsigned char, ticketKeySize> loadTicketKeys(const std::string& path) {
+    std::array<unsigned char, ticketKeySize> keys{};
+    if (path.empty()) {
+        if (RAND_bytes(keys.data(), static_cast<int>(keys.size())) != 1) {
+            throw std::runtime_error("Unable to generate TLS ticket keys");
+        }
+        return keys;
+    }
+
+    std::ifstream in(path, std::ios::binary);
+    std::string contents((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    if (!in.good() && !in.eof()) {
+        throw std::runtime_error("Unable to read TLS ticket key file " + path);
+    }
+    if (contents.size() != ticketKeySize) {
+        OPENSSL_cleanse(&contents[0], contents.size());
+        throw std::runtime_error("TLS ticket key file " + path + " must hold exactly 80 bytes");
+    }
+    std::copy(contents.begin(), contents.end(), keys.begin());
+    OPENSSL_cleanse(&contents[0], contents.size());
+    return keys;
+}
+
+} // namespace
+
+void configureSessionResumption(SSL_CTX* ctx, const ServerTLSConfig& config) {
+    SSL_CTX_set_session_cache_mode(ctx, config.sessionCacheSize > 0 ? SSL_SESS_CACHE_SERVER : SSL_SESS_CACHE_OFF);
+    SSL_CTX_sess_set_cache_size(ctx, config.sessionCacheSize);
+    SSL_CTX_set_timeout(ctx, static_cast<long>(config.sessionTimeout.count()));
+    SSL_CTX_set_session_id_context(ctx, sessionIdContext, sizeof(sessionIdContext) - 1);
+
+    if (!config.sessionTickets) {
+        SSL_CTX_set_options(ctx, SSL_OP_NO_TICKET);
+        logMessage("TLS session cache: " + std::to_string(config.sessionCacheSize) + " sessions, tickets disabled", serverLogFile);
+        return;
+    }
+
+    SSL_CTX_clear_options(ctx, SSL_OP_NO_TICKET);
+    auto keys = loadTicketKeys(config.ticketKeyFile);
+    long set = SSL_CTX_set_tlsext_ticket_keys(ctx, keys.data(), static_cast<long>(keys.size()));
+    OPENSSL_cleanse(keys.data(), keys.size());
+    if (set != 1) {
+        throw std::runtime_error("Unable to install TLS ticket keys");
+    }
+    logMessage("TLS session cache: " + std::to_string(config.sessionCacheSize) + " sessions, tickets " +
+               (config.ticketKeyFile.empty() ? "with per-process keys" : "with keys from " + config.ticketKeyFile),
+               serverLogFile);
+}
+
+ServerTLSStats serverTLSStats(SSL_CTX* ctx) {
+    ServerTLSStats stats;
+    stats.handshakes = static_cast<uint64_t>(SSL_CTX_sess_accept_good(ctx));
+    stats.resumed = static_cast<uint64_t>(SSL_CTX_sess_hits(ctx));
+    stats.misses = static_cast<uint64_t>(SSL_CTX_sess_misses(ctx));
+    stats.timeouts = static_cast<uint64_t>(SSL_CTX_sess_timeouts(ctx));
+    stats.cached = static_cast<uint64_t>(SSL_CTX_sess_number(ctx));
+    return stats;
+}
@@ -0,0 +1,33 @@
+// server_tls.h
+#ifndef SERVER_TLS_H
+#define SERVER_TLS_H
+
+#include <openssl/ssl.h>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+struct ServerTLSConfig {
+    long sessionCacheSize = 20480;            // sessions kept for session-ID resumption
+    std::chrono::seconds sessionTimeout{7200};
+    bool sessionTickets = true;
+    // 80 bytes (16-byte name, 32-byte HMAC key, 32-byte AES key) shared by every
+    // server that should accept each other's tickets. Empty = random per process.
+    std::string ticketKeyFile;
+};
+
+struct ServerTLSStats {
+    uint64_t handshakes = 0;   // completed server handshakes
+    uint64_t resumed = 0;      // abbreviated handshakes, by session ID or ticket
+    uint64_t misses = 0;       // session IDs offered but not found in the cache
+    uint64_t timeouts = 0;     // sessions offered after they expired
+    uint64_t cached = 0;       // sessions currently in the cache
+};
+
+// Enables the server-side session cache and session tickets on ctx so
+// reconnecting clients skip the full handshake. Throws if the ticket key
+// file cannot be used.
+void configureSessionResumption(SSL_CTX* ctx, const ServerTLSConfig& config);
+ServerTLSStats serverTLSStats(SSL_CTX* ctx);
+
+#endif // SERVER_TLS_H
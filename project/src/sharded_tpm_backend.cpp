@@ -0,0 +1,307 @@
+// sharded_tpm_backend.cpp
+#include "sharded_tpm_backend.h"
+#include "logger.h"
+#include <algorithm>
+#include <exception>
+#include <future>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+
+namespace {
+
+// "KMSD" followed by the big-endian storagePrimaryId() of the sealing TPM.
+const uint8_t blobTag[] = {'K', 'M', 'S', 'D'};
+const size_t blobHeaderSize = sizeof(blobTag) + 8;
+
+uint64_t mix(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+uint64_t ringPoint(const std::string& key) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (unsigned char c : key) {
+        h = (h ^ c) * 0x100000001b3ULL;
+    }
+    return mix(h);
+}
+
+std::vector<uint8_t> tagBlob(uint64_t id, const std::vector<uint8_t>& blob) {
+    std::vector<uint8_t> tagged;
+    tagged.reserve(blobHeaderSize + blob.size());
+    tagged.insert(tagged.end(), blobTag, blobTag + sizeof(blobTag));
+    for (int shift = 56; shift >= 0; shift -= 8) {
+        tagged.push_back(static_cast<uint8_t>(id >> shift));
+    }
+    tagged.insert(tagged.end(), blob.begin(), blob.end());
+    return tagged;
+}
+
+bool readBlobTag(const std::vector<uint8_t>& blob, uint64_t& id) {
+    if (blob.size() <= blobHeaderSize || !std::equal(blobTag, blobTag + sizeof(blobTag), blob.begin())) {
+        return false;
+    }
+    id = 0;
+    for (size_t i = sizeof(blobTag); i < blobHeaderSize; ++i) {
+        id = (id << 8) | blob[i];
+    }
+    return true;
+}
+
+std::string hexId(uint64_t id) {
+    std::ostringstream out;
+    out << std::hex << id;
+    return out.str();
+}
+
+int64_t nowTicks() {
+    return std::chrono::steady_clock::now().time_since_epoch().count();
+}
+
+} // namespace
+
+ShardedTPMBackend::ShardedTPMBackend(const TPMDeviceConfig& deviceConfig, const TPMShardConfig& shards,
+                                     StartupTimer& timer)
+    : config(shards) {
+    if (config.tctis.empty()) {
+        throw std::invalid_argument("Sharded TPM backend needs at least one TCTI");
+    }
+    config.virtualNodes = std::max<size_t>(config.virtualNodes, 1);
+    config.failureThreshold = std::max<uint32_t>(config.failureThreshold, 1);
+
+    // Each TPM's startup is dominated by its own primary and signing key
+    // creation, so they run side by side.
+    std::vector<std::future<std::unique_ptr<TPMDeviceBackend>>> starting;
+    for (const auto& tcti : config.tctis) {
+        TPMDeviceConfig perDevice = deviceConfig;
+        perDevice.contextPool.tcti = tcti;
+        starting.push_back(std::async(std::launch::async, [perDevice] {
+            StartupTimer deviceTimer;
+            auto backend = std::make_unique<TPMDeviceBackend>(perDevice, deviceTimer);
+            logMessage("TPM " + perDevice.contextPool.tcti + " started: " + deviceTimer.report(), serverLogFile);
+            return backend;
+        }));
+    }
+    for (auto& started : starting) {
+        auto device = std::make_unique<Device>();
+        device->backend = started.get();
+        devices.push_back(std::move(device));
+    }
+    timer.phase("tpm devices");
+
+    for (size_t i = 0; i < devices.size(); ++i) {
+        for (size_t j = 0; j < i; ++j) {
+            if (devices[i]->backend->id() == devices[j]->backend->id()) {
+                throw std::runtime_error("TCTIs " + devices[j]->backend->tcti() + " and " + devices[i]->backend->tcti() +
+                                         " reach the same TPM");
+            }
+        }
+        std::string node = hexId(devices[i]->backend->id());
+        for (size_t replica = 0; replica < config.virtualNodes; ++replica) {
+            ring.emplace_back(ringPoint(node + "#" + std::to_string(replica)), i);
+        }
+    }
+    std::sort(ring.begin(), ring.end());
+    logMessage("Sharding TPM work over " + std::to_string(devices.size()) + " TPMs", serverLogFile);
+}
+
+bool ShardedTPMBackend::healthy(const Device& device) const {
+    return device.skipUntil.load(std::memory_order_relaxed) <= nowTicks();
+}
+
+void ShardedTPMBackend::record(Device& device, bool succeeded) {
+    if (succeeded) {
+        if (device.consecutiveFailures.exchange(0) >= config.failureThreshold) {
+            logMessage("TPM " + device.backend->tcti() + " recovered", serverLogFile);
+        }
+        device.skipUntil.store(0, std::memory_order_relaxed);
+        return;
+    }
+    device.failures.fetch_add(1, std::memory_order_relaxed);
+    uint32_t failures = device.consecutiveFailures.fetch_add(1) + 1;
+    if (failures >= config.failureThreshold) {
+        auto until = std::chrono::steady_clock::now() + config.retryAfter;
+        device.skipUntil.store(until.time_since_epoch().count(), std::memory_order_relaxed);
+        if (failures == config.failureThreshold) {
+            logWarning("TPM " + device.backend->tcti() + " failed " + std::to_string(failures) +
+                           " commands in a row; skipping it for new work",
+                       serverLogFile);
+        }
+    }
+}
+
+template <typename T>
+T ShardedTPMBackend::settle(Device& device, std::future<T>& result) {
+    try {
+        T value = result.get();
+        record(device, true);
+        return value;
+    } catch (const std::invalid_argument&) {
+        // The request was bad, not the TPM.
+        throw;
+    } catch (...) {
+        record(device, false);
+        throw;
+    }
+}
+
+template <typename T>
+std::future<T> ShardedTPMBackend::tracked(Device& device, std::future<T> result) {
+    // Deferred, so the outcome is recorded on the caller's thread when it collects the result.
+    return std::async(std::launch::deferred, [this, &device, result = std::move(result)]() mutable {
+        return settle(device, result);
+    });
+}
+
+ShardedTPMBackend::Device& ShardedTPMBackend::placement(const std::string& key_id) {
+    auto start = std::lower_bound(ring.begin(), ring.end(), std::make_pair(ringPoint(key_id), size_t(0)));
+    size_t first = start == ring.end() ? 0 : static_cast<size_t>(start - ring.begin());
+    for (size_t step = 0; step < ring.size(); ++step) {
+        Device& device = *devices[ring[(first + step) % ring.size()].second];
+        if (healthy(device)) {
+            return device;
+        }
+    }
+    // Every TPM is failing; the owner by placement is as good a try as any.
+    return *devices[ring[first].second];
+}
+
+ShardedTPMBackend::Device& ShardedTPMBackend::nextHealthy() {
+    size_t start = nextDevice.fetch_add(1, std::memory_order_relaxed);
+    for (size_t step = 0; step < devices.size(); ++step) {
+        Device& device = *devices[(start + step) % devices.size()];
+        if (healthy(device)) {
+            return device;
+        }
+    }
+    return *devices[start % devices.size()];
+}
+
+size_t ShardedTPMBackend::maxRandomBytes() const {
+    size_t smallest = std::numeric_limits<size_t>::max();
+    for (const auto& device : devices) {
+        smallest = std::min(smallest, device->backend->maxRandomBytes());
+    }
+    return smallest;
+}
+
+std::future<std::vector<uint8_t>> ShardedTPMBackend::getRandom(size_t bytes) {
+    Device& device = nextHealthy();
+    return tracked(device, device.backend->getRandom(bytes));
+}
+
+std::future<std::vector<uint8_t>> ShardedTPMBackend::seal(const std::string& key_id, KeyBuffer key) {
+    Device& device = placement(key_id);
+    device.seals.fetch_add(1, std::memory_order_relaxed);
+    uint64_t id = device.backend->id();
+    auto sealed = device.backend->seal(key_id, std::move(key));
+    return std::async(std::launch::deferred, [this, &device, id, sealed = std::move(sealed)]() mutable {
+        return tagBlob(id, settle(device, sealed));
+    });
+}
+
+std::future<KeyBuffer> ShardedTPMBackend::unseal(const std::string& key_id, uint64_t version,
+                                                 const std::vector<uint8_t>& sealedBlob) {
+    uint64_t id = 0;
+    if (!readBlobTag(sealedBlob, id)) {
+        Device& device = *devices.front();
+        device.unseals.fetch_add(1, std::memory_order_relaxed);
+        return tracked(device, device.backend->unseal(key_id, version, sealedBlob));
+    }
+    for (auto& device : devices) {
+        if (device->backend->id() == id) {
+            device->unseals.fetch_add(1, std::memory_order_relaxed);
+            std::vector<uint8_t> inner(sealedBlob.begin() + blobHeaderSize, sealedBlob.end());
+            return tracked(*device, device->backend->unseal(key_id, version, inner));
+        }
+    }
+    // Delivered through the future like any other unseal error, so pipelined callers see it on get().
+    std::promise<KeyBuffer> missing;
+    missing.set_exception(std::make_exception_ptr(
+        std::runtime_error("Key " + key_id + " was sealed by TPM " + hexId(id) + ", which is not configured")));
+    return missing.get_future();
+}
+
+void ShardedTPMBackend::forget(const std::string& key_id) {
+    for (auto& device : devices) {
+        device->backend->forget(key_id);
+    }
+}
+
+std::future<std::vector<uint8_t>> ShardedTPMBackend::hash(const std::string& data) {
+    Device& device = nextHealthy();
+    return tracked(device, device.backend->hash(data));
+}
+
+std::future<std::vector<uint8_t>> ShardedTPMBackend::sign(const std::string& digest) {
+    Device& device = *devices.front();
+    return tracked(device, device.backend->sign(digest));
+}
+
+TPMContextPoolStats ShardedTPMBackend::contextPoolStats() const {
+    TPMContextPoolStats total;
+    for (const auto& device : devices) {
+        TPMContextPoolStats stats = device->backend->contextPoolStats();
+        total.size += stats.size;
+        total.available += stats.available;
+        total.leases += stats.leases;
+        total.waits += stats.waits;
+        total.waitTimeUs += stats.waitTimeUs;
+        total.holdTimeUs += stats.holdTimeUs;
+        total.reconnects += stats.reconnects;
+    }
+    return total;
+}
+
+TPMObjectCacheStats ShardedTPMBackend::objectCacheStats() const {
+    TPMObjectCacheStats total;
+    for (const auto& device : devices) {
+        TPMObjectCacheStats stats = device->backend->objectCacheStats();
+        total.hits += stats.hits;
+        total.contextLoads += stats.contextLoads;
+        total.misses += stats.misses;
+        total.evictions += stats.evictions;
+        total.savedContexts += stats.savedContexts;
+    }
+    return total;
+}
+
+TPMSchedulerStats ShardedTPMBackend::schedulerStats() const {
+    TPMSchedulerStats total;
+    for (const auto& device : devices) {
+        TPMSchedulerStats stats = device->backend->schedulerStats();
+        total.queueDepth += stats.queueDepth;
+        total.inFlight += stats.inFlight;
+        total.peakQueueDepth = std::max(total.peakQueueDepth, stats.peakQueueDepth);
+        total.submitted += stats.submitted;
+        total.completed += stats.completed;
+        total.failed += stats.failed;
+        total.randomCommands += stats.randomCommands;
+        total.randomMerged += stats.randomMerged;
+        total.queueWaitUs += stats.queueWaitUs;
+        total.serviceTimeUs += stats.serviceTimeUs;
+    }
+    return total;
+}
+
+std::vector<TPMDeviceStats> ShardedTPMBackend::deviceStats() const {
+    std::vector<TPMDeviceStats> all;
+    for (const auto& device : devices) {
+        TPMSchedulerStats scheduler = device->backend->schedulerStats();
+        TPMDeviceStats stats;
+        stats.tcti = device->backend->tcti();
+        stats.id = device->backend->id();
+        stats.healthy = healthy(*device);
+        stats.seals = device->seals.load(std::memory_order_relaxed);
+        stats.unseals = device->unseals.load(std::memory_order_relaxed);
+        stats.failures = device->failures.load(std::memory_order_relaxed);
+        stats.consecutiveFailures = device->consecutiveFailures.load(std::memory_order_relaxed);
+        stats.queueDepth = scheduler.queueDepth;
+        stats.inFlight = scheduler.inFlight;
+        all.push_back(stats);
+    }
+    return all;
+}
@@ -0,0 +1,82 @@
+// sharded_tpm_backend.h
+#ifndef SHARDED_TPM_BACKEND_H
+#define SHARDED_TPM_BACKEND_H
+
+#include "tpm_backend.h"
+#include "tpm_device_backend.h"
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+struct TPMShardConfig {
+    std::vector<std::string> tctis;               // one per TPM; more than one enables sharding
+    size_t virtualNodes = 64;                     // points per TPM on the placement ring
+    uint32_t failureThreshold = 3;                // consecutive failures before a TPM is skipped
+    std::chrono::milliseconds retryAfter{5000};   // how long a failing TPM gets no new keys
+};
+
+// Spreads TPM work over several TPMs, each a TPMDeviceBackend with its own
+// context pool, object cache and scheduler queue. New keys are placed by
+// consistent hashing of the key id, so adding a TPM moves only its share of
+// placements. Sealed blobs are tagged with their TPM's storagePrimaryId() and
+// always go back to that TPM to be unsealed, wherever the ring now points.
+//
+// A TPM that fails failureThreshold commands in a row is skipped for new keys,
+// random bytes and hashing for retryAfter, then tried again. Its own keys
+// still go to it, since no other TPM can unseal them. Signing always uses the
+// first TPM, so there is one signing key to publish.
+class ShardedTPMBackend : public TPMBackend {
+public:
+    // Starts every TPM in parallel; config.contextPool.tcti is replaced by each of shards.tctis.
+    ShardedTPMBackend(const TPMDeviceConfig& config, const TPMShardConfig& shards, StartupTimer& timer);
+
+    TPMBackendType type() const override { return TPMBackendType::Device; }
+    size_t maxRandomBytes() const override;
+
+    std::future<std::vector<uint8_t>> getRandom(size_t bytes) override;
+    std::future<std::vector<uint8_t>> seal(const std::string& key_id, KeyBuffer key) override;
+    // Blobs without a tag predate sharding and belong to the first TPM.
+    std::future<KeyBuffer> unseal(const std::string& key_id, uint64_t version, const std::vector<uint8_t>& sealedBlob) override;
+    void forget(const std::string& key_id) override;
+    std::future<std::vector<uint8_t>> hash(const std::string& data) override;
+    std::future<std::vector<uint8_t>> sign(const std::string& digest) override;
+    const std::string& signingPublicKeyPem() const override { return devices.front()->backend->signingPublicKeyPem(); }
+
+    TPMContextPool* contextPool() override { return devices.front()->backend->contextPool(); }
+    TPMContextPoolStats contextPoolStats() const override;
+    TPMObjectCacheStats objectCacheStats() const override;
+    TPMSchedulerStats schedulerStats() const override;
+    std::vector<TPMDeviceStats> deviceStats() const override;
+
+private:
+    struct Device {
+        std::unique_ptr<TPMDeviceBackend> backend;
+        std::atomic<uint32_t> consecutiveFailures{0};
+        std::atomic<int64_t> skipUntil{0};   // steady_clock ticks
+        std::atomic<uint64_t> seals{0};
+        std::atomic<uint64_t> unseals{0};
+        std::atomic<uint64_t> failures{0};
+    };
+
+    bool healthy(const Device& device) const;
+    void record(Device& device, bool succeeded);
+    // Waits for a command on device and records how it went.
+    template <typename T>
+    T settle(Device& device, std::future<T>& result);
+    template <typename T>
+    std::future<T> tracked(Device& device, std::future<T> result);
+    // First healthy TPM at or after key_id's point on the ring.
+    Device& placement(const std::string& key_id);
+    // Healthy TPMs in turn, for work any of them can do.
+    Device& nextHealthy();
+
+    TPMShardConfig config;
+    std::vector<std::unique_ptr<Device>> devices;
+    std::vector<std::pair<uint64_t, size_t>> ring;   // (point, device index), sorted
+    std::atomic<size_t> nextDevice{0};
+};
+
+#endif // SHARDED_TPM_BACKEND_H
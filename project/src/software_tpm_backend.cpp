@@ -0,0 +1,186 @@
+// software_tpm_backend.cpp
+#include "software_tpm_backend.h"
+#include "logger.h"
+#include <openssl/crypto.h>
+#include <openssl/hmac.h>
+#include <openssl/pem.h>
+#include <openssl/rand.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace {
+
+using PKey = std::unique_ptr<EVP_PKEY, decltype(&EVP_PKEY_free)>;
+
+// Labels the derivation so the sealing key is never the signing key itself.
+const char sealingKeyLabel[] = "kms software tpm sealing key";
+
+// The work is done on the calling thread; the future is ready on return.
+template <typename T, typename Fn>
+std::future<T> completed(Fn&& fn) {
+    std::promise<T> result;
+    try {
+        result.set_value(fn());
+    } catch (...) {
+        result.set_exception(std::current_exception());
+    }
+    return result.get_future();
+}
+
+PKey generateSigningKey() {
+    PKey key(EVP_EC_gen("P-256"), EVP_PKEY_free);
+    if (!key) {
+        throw std::runtime_error("Unable to generate software signing key");
+    }
+    return key;
+}
+
+PKey readSigningKey(const std::string& path) {
+    FILE* in = std::fopen(path.c_str(), "r");
+    if (in == nullptr) {
+        if (errno == ENOENT) {
+            return PKey(nullptr, EVP_PKEY_free);
+        }
+        throw std::runtime_error("Unable to read software TPM state " + path);
+    }
+    PKey key(PEM_read_PrivateKey(in, nullptr, nullptr, nullptr), EVP_PKEY_free);
+    std::fclose(in);
+    if (!key || EVP_PKEY_get_base_id(key.get()) != EVP_PKEY_EC) {
+        throw std::runtime_error("Software TPM state " + path + " does not hold an EC private key");
+    }
+    return key;
+}
+
+void writeSigningKey(const std::string& path, EVP_PKEY* key) {
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        throw std::runtime_error("Unable to create software TPM state " + path + ": " + std::strerror(errno));
+    }
+    FILE* out = ::fdopen(fd, "w");
+    if (out == nullptr) {
+        ::close(fd);
+        ::unlink(path.c_str());
+        throw std::runtime_error("Unable to create software TPM state " + path);
+    }
+    bool written = PEM_write_PrivateKey(out, key, nullptr, nullptr, 0, nullptr, nullptr) == 1;
+    written = std::fflush(out) == 0 && ::fsync(fd) == 0 && written;
+    if (std::fclose(out) != 0 || !written) {
+        ::unlink(path.c_str());
+        throw std::runtime_error("Unable to write software TPM state " + path);
+    }
+}
+
+PKey loadSigningKey(const std::string& path) {
+    if (path.empty()) {
+        return generateSigningKey();
+    }
+    PKey key = readSigningKey(path);
+    if (!key) {
+        key = generateSigningKey();
+        std::filesystem::path parent = std::filesystem::path(path).parent_path();
+        if (!parent.empty()) {
+            std::filesystem::create_directories(parent);
+        }
+        writeSigningKey(path, key.get());
+        logMessage("Created software TPM state " + path, serverLogFile);
+    }
+    return key;
+}
+
+std::string publicKeyPemOf(EVP_PKEY* key) {
+    std::unique_ptr<BIO, decltype(&BIO_free)> bio(BIO_new(BIO_s_mem()), BIO_free);
+    if (!bio || PEM_write_bio_PUBKEY(bio.get(), key) != 1) {
+        throw std::runtime_error("Unable to encode software signing key");
+    }
+    char* data = nullptr;
+    long size = BIO_get_mem_data(bio.get(), &data);
+    return std::string(data, static_cast<size_t>(size));
+}
+
+// HMAC-SHA256 keyed with the DER private key, so one state file gives both keys.
+KeyBuffer deriveSealingKey(EVP_PKEY* key) {
+    int derSize = i2d_PrivateKey(key, nullptr);
+    if (derSize <= 0) {
+        throw std::runtime_error("Unable to encode software signing key");
+    }
+    KeyBuffer der(static_cast<size_t>(derSize));
+    unsigned char* cursor = der.data();
+    if (i2d_PrivateKey(key, &cursor) != derSize) {
+        throw std::runtime_error("Unable to encode software signing key");
+    }
+    KeyBuffer sealingKey(EnvelopeCipher::kekSize);
+    unsigned int length = 0;
+    if (HMAC(EVP_sha256(), der.data(), derSize, reinterpret_cast<const unsigned char*>(sealingKeyLabel),
+             sizeof(sealingKeyLabel) - 1, sealingKey.data(), &length) == nullptr ||
+        length != sealingKey.size()) {
+        throw std::runtime_error("Unable to derive software sealing key");
+    }
+    return sealingKey;
+}
+
+} // namespace
+
+SoftwareTPMBackend::SoftwareTPMBackend(const SoftwareTPMConfig& config)
+    : signingKey(loadSigningKey(config.stateFile)) {
+    publicKeyPem = publicKeyPemOf(signingKey.get());
+    KeyBuffer sealingKey = deriveSealingKey(signingKey.get());
+    sealer.installKek(1, sealingKey.data(), sealingKey.size());
+    logWarning("Using the software TPM backend: keys are sealed in process, not by a TPM", serverLogFile);
+}
+
+std::future<std::vector<uint8_t>> SoftwareTPMBackend::getRandom(size_t bytes) {
+    return completed<std::vector<uint8_t>>([bytes] {
+        std::vector<uint8_t> random(bytes);
+        if (RAND_bytes(random.data(), static_cast<int>(random.size())) != 1) {
+            throw std::runtime_error("Error generating random bytes");
+        }
+        return random;
+    });
+}
+
+std::future<std::vector<uint8_t>> SoftwareTPMBackend::seal(const std::string&, KeyBuffer key) {
+    return completed<std::vector<uint8_t>>([&] { return sealer.wrap(key, std::string()); });
+}
+
+std::future<KeyBuffer> SoftwareTPMBackend::unseal(const std::string&, uint64_t, const std::vector<uint8_t>& sealedBlob) {
+    return completed<KeyBuffer>([&] { return sealer.unwrap(sealedBlob, std::string()); });
+}
+
+std::future<std::vector<uint8_t>> SoftwareTPMBackend::hash(const std::string& data) {
+    return completed<std::vector<uint8_t>>([&] {
+        std::vector<uint8_t> digest(EVP_MAX_MD_SIZE);
+        unsigned int length = 0;
+        if (EVP_Digest(data.data(), data.size(), digest.data(), &length, EVP_sha256(), nullptr) != 1) {
+            throw std::runtime_error("Error computing SHA-256");
+        }
+        digest.resize(length);
+        return digest;
+    });
+}
+
+std::future<std::vector<uint8_t>> SoftwareTPMBackend::sign(const std::string& digest) {
+    return completed<std::vector<uint8_t>>([&] {
+        if (digest.size() != 32) {
+            throw std::invalid_argument("Digest must be 32 bytes");
+        }
+        std::unique_ptr<EVP_PKEY_CTX, decltype(&EVP_PKEY_CTX_free)> ctx(EVP_PKEY_CTX_new(signingKey.get(), nullptr),
+                                                                        EVP_PKEY_CTX_free);
+        size_t length = 0;
+        const auto* input = reinterpret_cast<const unsigned char*>(digest.data());
+        if (!ctx || EVP_PKEY_sign_init(ctx.get()) != 1 || EVP_PKEY_CTX_set_signature_md(ctx.get(), EVP_sha256()) != 1 ||
+            EVP_PKEY_sign(ctx.get(), nullptr, &length, input, digest.size()) != 1) {
+            throw std::runtime_error("Error signing digest");
+        }
+        std::vector<uint8_t> signature(length);
+        if (EVP_PKEY_sign(ctx.get(), signature.data(), &length, input, digest.size()) != 1) {
+            throw std::runtime_error("Error signing digest");
+        }
+        signature.resize(length);
+        return signature;
+    });
+}
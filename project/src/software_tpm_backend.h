@@ -0,0 +1,44 @@
+// software_tpm_backend.h
+#ifndef SOFTWARE_TPM_BACKEND_H
+#define SOFTWARE_TPM_BACKEND_H
+
+#include "tpm_backend.h"
+#include "envelope_cipher.h"
+#include <openssl/evp.h>
+#include <memory>
+#include <string>
+
+struct SoftwareTPMConfig {
+    // PEM private key that stands in for the TPM's primaries. Created on first
+    // start; empty generates a per-process key, so sealed keys do not survive
+    // a restart. KeyManager puts it in the key log directory when that is set.
+    std::string stateFile;
+};
+
+// TPMBackend in process, on OpenSSL: RAND_bytes for random, SHA-256 for hash,
+// an ECDSA P-256 key for sign, and AES-256-GCM under a key derived from that
+// key for seal. It keeps no secret from the host and is meant for tests,
+// benchmarks and development without a TPM, never for production keys.
+class SoftwareTPMBackend : public TPMBackend {
+public:
+    explicit SoftwareTPMBackend(const SoftwareTPMConfig& config = SoftwareTPMConfig());
+
+    TPMBackendType type() const override { return TPMBackendType::Software; }
+    size_t maxRandomBytes() const override { return 4096; }
+
+    std::future<std::vector<uint8_t>> getRandom(size_t bytes) override;
+    std::future<std::vector<uint8_t>> seal(const std::string&, KeyBuffer key) override;
+    std::future<KeyBuffer> unseal(const std::string& key_id, uint64_t version, const std::vector<uint8_t>& sealedBlob) override;
+    void forget(const std::string&) override {}
+    std::future<std::vector<uint8_t>> hash(const std::string& data) override;
+    std::future<std::vector<uint8_t>> sign(const std::string& digest) override;
+    const std::string& signingPublicKeyPem() const override { return publicKeyPem; }
+
+private:
+    std::unique_ptr<EVP_PKEY, decltype(&EVP_PKEY_free)> signingKey;
+    std::string publicKeyPem;
+    // Holds the sealing key as its only KEK, so seal and unseal are wrap and unwrap.
+    EnvelopeCipher sealer;
+};
+
+#endif // SOFTWARE_TPM_BACKEND_H
@@ -0,0 +1,79 @@
+// spill_buffer.cpp
+#include "spill_buffer.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+#include <unistd.h>
+
+SpillBuffer::SpillBuffer(size_t memoryLimit, const std::string& directory)
+    : memoryLimit(memoryLimit), directory(directory) {}
+
+SpillBuffer::~SpillBuffer() {
+    if (fd >= 0) {
+        ::close(fd);
+    }
+}
+
+void SpillBuffer::spill() {
+    std::string dir = directory.empty() ? std::filesystem::temp_directory_path().string() : directory;
+    std::string path = dir + "/kms-spill-XXXXXX";
+    fd = ::mkstemp(path.data());
+    if (fd < 0) {
+        throw std::runtime_error("Unable to create spill file in " + dir + ": " + std::strerror(errno));
+    }
+    // Unlinked at once, so the file disappears with the descriptor even after a crash.
+    ::unlink(path.c_str());
+    std::vector<uint8_t> buffered;
+    buffered.swap(memory);
+    total = 0;
+    append(buffered.data(), buffered.size());
+}
+
+void SpillBuffer::append(const uint8_t* data, size_t size) {
+    if (fd < 0 && memory.size() + size > memoryLimit) {
+        spill();
+    }
+    if (fd < 0) {
+        memory.insert(memory.end(), data, data + size);
+        total += size;
+        return;
+    }
+    while (size > 0) {
+        ssize_t n = ::write(fd, data, size);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::runtime_error("Error writing spill file: " + std::string(std::strerror(errno)));
+        }
+        data += n;
+        size -= static_cast<size_t>(n);
+        total += static_cast<uint64_t>(n);
+    }
+}
+
+size_t SpillBuffer::read(uint64_t offset, uint8_t* out, size_t length) const {
+    if (offset >= total) {
+        return 0;
+    }
+    length = static_cast<size_t>(std::min<uint64_t>(length, total - offset));
+    if (fd < 0) {
+        std::memcpy(out, memory.data() + offset, length);
+        return length;
+    }
+    size_t done = 0;
+    while (done < length) {
+        ssize_t n = ::pread(fd, out + done, length - done, static_cast<off_t>(offset + done));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            throw std::runtime_error("Error reading spill file");
+        }
+        done += static_cast<size_t>(n);
+    }
+    return done;
+}
@@ -0,0 +1,37 @@
+// spill_buffer.h
+#ifndef SPILL_BUFFER_H
+#define SPILL_BUFFER_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Append-only byte buffer that moves to an unlinked temporary file once it
+// outgrows memoryLimit, so a request's memory use stays bounded whatever the
+// size of its body. Only ever given ciphertext, since it may reach the disk.
+class SpillBuffer {
+public:
+    // An empty directory means the system temporary directory.
+    SpillBuffer(size_t memoryLimit, const std::string& directory);
+    ~SpillBuffer();
+
+    SpillBuffer(const SpillBuffer&) = delete;
+    SpillBuffer& operator=(const SpillBuffer&) = delete;
+
+    void append(const uint8_t* data, size_t size);
+    // Copies up to length bytes starting at offset and returns how many were copied.
+    size_t read(uint64_t offset, uint8_t* out, size_t length) const;
+    uint64_t size() const { return total; }
+    bool spilled() const { return fd >= 0; }
+
+private:
+    void spill();
+
+    size_t memoryLimit;
+    std::string directory;
+    std::vector<uint8_t> memory;
+    int fd = -1;
+    uint64_t total = 0;
+};
+
+#endif // SPILL_BUFFER_H
@@ -0,0 +1,236 @@
+// stream_cipher.cpp
+#include "stream_cipher.h"
+#include <openssl/crypto.h>
+#include <openssl/rand.h>
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+namespace {
+
+constexpr uint8_t streamMagic[4] = {'K', 'M', 'S', 'S'};
+constexpr uint8_t streamFormat = 1;
+constexpr size_t noncePrefixSize = 7;
+constexpr size_t fixedHeaderSize = 4 + 1 + 4 + noncePrefixSize + 2;
+constexpr size_t frameHeaderSize = 4;
+constexpr size_t tagSize = 16;
+constexpr size_t dataKeySize = 32;
+constexpr uint32_t lastFrameFlag = 0x80000000u;
+
+void putU32(uint8_t* p, uint32_t value) {
+    p[0] = static_cast<uint8_t>(value >> 24);
+    p[1] = static_cast<uint8_t>(value >> 16);
+    p[2] = static_cast<uint8_t>(value >> 8);
+    p[3] = static_cast<uint8_t>(value);
+}
+
+uint32_t getU32(const uint8_t* p) {
+    return (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16) |
+           (static_cast<uint32_t>(p[2]) << 8) | static_cast<uint32_t>(p[3]);
+}
+
+// prefix | u32 frame counter | u8 last-frame flag
+void frameNonce(uint8_t* nonce, const std::vector<uint8_t>& header, uint32_t counter, bool last) {
+    std::memcpy(nonce, header.data() + 9, noncePrefixSize);
+    putU32(nonce + noncePrefixSize, counter);
+    nonce[noncePrefixSize + 4] = last ? 1 : 0;
+}
+
+} // namespace
+
+StreamEncryptor::StreamEncryptor(KeyBuffer dataKey, const std::vector<uint8_t>& wrappedKey, size_t chunkSize, ByteSink sink)
+    : key(std::move(dataKey)), ctx(EVP_CIPHER_CTX_new(), EVP_CIPHER_CTX_free), chunkSize(chunkSize), sink(std::move(sink)) {
+    if (key.size() != dataKeySize) {
+        throw std::invalid_argument("Stream data key must be 32 bytes");
+    }
+    if (chunkSize == 0 || chunkSize > maxStreamChunkSize) {
+        throw std::invalid_argument("Stream chunk size must be between 1 byte and 1 MiB");
+    }
+    if (wrappedKey.empty() || wrappedKey.size() > 0xFFFF) {
+        throw std::invalid_argument("Wrapped stream key has an invalid length");
+    }
+
+    header.resize(fixedHeaderSize);
+    std::memcpy(header.data(), streamMagic, sizeof(streamMagic));
+    header[4] = streamFormat;
+    putU32(header.data() + 5, static_cast<uint32_t>(chunkSize));
+    if (RAND_bytes(header.data() + 9, noncePrefixSize) != 1) {
+        throw std::runtime_error("Unable to generate stream nonce");
+    }
+    header[16] = static_cast<uint8_t>(wrappedKey.size() >> 8);
+    header[17] = static_cast<uint8_t>(wrappedKey.size());
+    header.insert(header.end(), wrappedKey.begin(), wrappedKey.end());
+
+    if (!ctx || EVP_EncryptInit_ex(ctx.get(), EVP_aes_256_gcm(), nullptr, key.data(), nullptr) != 1) {
+        throw std::runtime_error("Error initializing stream encryption");
+    }
+    chunk.reserve(chunkSize);
+    frame.resize(frameHeaderSize + chunkSize + tagSize);
+    this->sink(header.data(), header.size());
+}
+
+StreamEncryptor::~StreamEncryptor() {
+    OPENSSL_cleanse(chunk.data(), chunk.capacity());
+}
+
+void StreamEncryptor::update(const uint8_t* data, size_t size) {
+    if (finished) {
+        throw std::logic_error("Stream already finished");
+    }
+    while (size > 0) {
+        // A full chunk is only sealed once more input arrives, so the last
+        // frame always carries the last-frame flag.
+        if (chunk.size() == chunkSize) {
+            seal(false);
+        }
+        size_t take = std::min(size, chunkSize - chunk.size());
+        chunk.insert(chunk.end(), data, data + take);
+        data += take;
+        size -= take;
+    }
+}
+
+void StreamEncryptor::finish() {
+    if (finished) {
+        throw std::logic_error("Stream already finished");
+    }
+    seal(true);
+    finished = true;
+}
+
+void StreamEncryptor::seal(bool last) {
+    if (counter == UINT32_MAX) {
+        throw std::runtime_error("Stream too long");
+    }
+    uint8_t nonce[12];
+    frameNonce(nonce, header, counter, last);
+    uint8_t* ciphertext = frame.data() + frameHeaderSize;
+    int len = 0;
+    int finalLen = 0;
+    if (EVP_EncryptInit_ex(ctx.get(), nullptr, nullptr, nullptr, nonce) != 1 ||
+        EVP_EncryptUpdate(ctx.get(), nullptr, &len, header.data(), static_cast<int>(header.size())) != 1 ||
+        EVP_EncryptUpdate(ctx.get(), ciphertext, &len, chunk.data(), static_cast<int>(chunk.size())) != 1 ||
+        EVP_EncryptFinal_ex(ctx.get(), ciphertext + len, &finalLen) != 1 ||
+        EVP_CIPHER_CTX_ctrl(ctx.get(), EVP_CTRL_GCM_GET_TAG, tagSize, ciphertext + chunk.size()) != 1) {
+        throw std::runtime_error("Error encrypting stream frame");
+    }
+    putU32(frame.data(), static_cast<uint32_t>(chunk.size()) | (last ? lastFrameFlag : 0));
+    sink(frame.data(), frameHeaderSize + chunk.size() + tagSize);
+    OPENSSL_cleanse(chunk.data(), chunk.size());
+    chunk.clear();
+    ++counter;
+}
+
+StreamDecryptor::StreamDecryptor(KeyUnwrapper unwrap, ByteSink sink)
+    : unwrap(std::move(unwrap)), sink(std::move(sink)), wanted(fixedHeaderSize), ctx(nullptr, EVP_CIPHER_CTX_free) {
+    pending.reserve(fixedHeaderSize);
+}
+
+StreamDecryptor::~StreamDecryptor() {
+    OPENSSL_cleanse(plaintext.data(), plaintext.size());
+}
+
+void StreamDecryptor::update(const uint8_t* data, size_t size) {
+    while (size > 0) {
+        if (state == State::Done) {
+            throw std::invalid_argument("Trailing data after the last stream frame");
+        }
+        size_t take = std::min(size, wanted - pending.size());
+        pending.insert(pending.end(), data, data + take);
+        data += take;
+        size -= take;
+        if (pending.size() == wanted) {
+            advance();
+        }
+    }
+}
+
+void StreamDecryptor::finish() const {
+    if (state != State::Done) {
+        throw std::invalid_argument("Encrypted stream is truncated");
+    }
+}
+
+void StreamDecryptor::advance() {
+    switch (state) {
+    case State::FixedHeader: {
+        if (std::memcmp(pending.data(), streamMagic, sizeof(streamMagic)) != 0 || pending[4] != streamFormat) {
+            throw std::invalid_argument("Not an encrypted stream");
+        }
+        chunkSize = getU32(pending.data() + 5);
+        size_t wrappedSize = (static_cast<size_t>(pending[16]) << 8) | pending[17];
+        if (chunkSize == 0 || chunkSize > maxStreamChunkSize || wrappedSize == 0) {
+            throw std::invalid_argument("Malformed encrypted stream header");
+        }
+        state = State::WrappedKey;
+        wanted = fixedHeaderSize + wrappedSize;
+        return;
+    }
+    case State::WrappedKey: {
+        header = pending;
+        try {
+            key = unwrap(std::vector<uint8_t>(header.begin() + fixedHeaderSize, header.end()));
+        } catch (const std::exception &e) {
+            throw std::invalid_argument("Unable to unwrap the stream key: " + std::string(e.what()));
+        }
+        if (key.size() != dataKeySize) {
+            throw std::invalid_argument("Stream data key has the wrong length");
+        }
+        ctx.reset(EVP_CIPHER_CTX_new());
+        if (!ctx || EVP_DecryptInit_ex(ctx.get(), EVP_aes_256_gcm(), nullptr, key.data(), nullptr) != 1) {
+            throw std::runtime_error("Error initializing stream decryption");
+        }
+        plaintext.resize(chunkSize);
+        pending.clear();
+        pending.reserve(chunkSize + tagSize);
+        state = State::FrameHeader;
+        wanted = frameHeaderSize;
+        return;
+    }
+    case State::FrameHeader: {
+        uint32_t value = getU32(pending.data());
+        lastFrame = (value & lastFrameFlag) != 0;
+        frameLength = value & ~lastFrameFlag;
+        if (frameLength > chunkSize) {
+            throw std::invalid_argument("Stream frame larger than the chunk size");
+        }
+        pending.clear();
+        state = State::FrameBody;
+        wanted = frameLength + tagSize;
+        return;
+    }
+    case State::FrameBody:
+        open();
+        pending.clear();
+        state = lastFrame ? State::Done : State::FrameHeader;
+        wanted = frameHeaderSize;
+        return;
+    case State::Done:
+        return;
+    }
+}
+
+void StreamDecryptor::open() {
+    if (counter == UINT32_MAX) {
+        throw std::invalid_argument("Stream too long");
+    }
+    uint8_t nonce[12];
+    frameNonce(nonce, header, counter, lastFrame);
+    int len = 0;
+    int finalLen = 0;
+    if (EVP_DecryptInit_ex(ctx.get(), nullptr, nullptr, nullptr, nonce) != 1 ||
+        EVP_DecryptUpdate(ctx.get(), nullptr, &len, header.data(), static_cast<int>(header.size())) != 1 ||
+        EVP_DecryptUpdate(ctx.get(), plaintext.data(), &len, pending.data(), static_cast<int>(frameLength)) != 1 ||
+        EVP_CIPHER_CTX_ctrl(ctx.get(), EVP_CTRL_GCM_SET_TAG, tagSize, pending.data() + frameLength) != 1 ||
+        EVP_DecryptFinal_ex(ctx.get(), plaintext.data() + len, &finalLen) != 1) {
+        OPENSSL_cleanse(plaintext.data(), frameLength);
+        throw std::invalid_argument("Stream frame " + std::to_string(counter) + " failed authentication");
+    }
+    if (sink) {
+        sink(plaintext.data(), frameLength);
+    }
+    OPENSSL_cleanse(plaintext.data(), frameLength);
+    plaintextBytes += frameLength;
+    ++counter;
+}
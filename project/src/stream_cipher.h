@@ -0,0 +1,96 @@
+// stream_cipher.h
+#ifndef STREAM_CIPHER_H
+#define STREAM_CIPHER_H
+
+#include "key_buffer.h"
+#include <openssl/evp.h>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+constexpr size_t defaultStreamChunkSize = 64 * 1024;
+constexpr size_t maxStreamChunkSize = 1 << 20;
+
+using ByteSink = std::function<void(const uint8_t* data, size_t size)>;
+
+// Framed AES-256-GCM for payloads of any length, in the style of the STREAM
+// construction. Every stream has its own data key, wrapped by the caller
+// (under the TPM-sealed KEK) and carried in the header:
+//
+//   header: "KMSS" | u8 format | u32 chunk size | 7-byte nonce prefix |
+//           u16 wrapped key length | wrapped data key
+//   frame:  u32 plaintext length, top bit set on the last frame |
+//           ciphertext | 16-byte tag
+//
+// Frame i is sealed with nonce = prefix | u32 i | u8 last-frame flag and the
+// header as AAD, so frames cannot be reordered, dropped, replayed from another
+// stream or cut off after any frame but the last without failing
+// authentication. Both directions hold at most one frame in memory.
+class StreamEncryptor {
+public:
+    StreamEncryptor(KeyBuffer dataKey, const std::vector<uint8_t>& wrappedKey, size_t chunkSize, ByteSink sink);
+    ~StreamEncryptor();
+
+    StreamEncryptor(const StreamEncryptor&) = delete;
+    StreamEncryptor& operator=(const StreamEncryptor&) = delete;
+
+    void update(const uint8_t* data, size_t size);
+    // Seals the last frame, which may be empty.
+    void finish();
+
+private:
+    void seal(bool last);
+
+    KeyBuffer key;
+    std::unique_ptr<EVP_CIPHER_CTX, decltype(&EVP_CIPHER_CTX_free)> ctx;
+    std::vector<uint8_t> header;
+    std::vector<uint8_t> chunk;
+    std::vector<uint8_t> frame;
+    size_t chunkSize;
+    uint32_t counter = 0;
+    bool finished = false;
+    ByteSink sink;
+};
+
+class StreamDecryptor {
+public:
+    // Returns the plaintext data key for a wrapped one.
+    using KeyUnwrapper = std::function<KeyBuffer(const std::vector<uint8_t>& wrappedKey)>;
+
+    // With no sink, frames are only authenticated.
+    explicit StreamDecryptor(KeyUnwrapper unwrap, ByteSink sink = nullptr);
+    ~StreamDecryptor();
+
+    StreamDecryptor(const StreamDecryptor&) = delete;
+    StreamDecryptor& operator=(const StreamDecryptor&) = delete;
+
+    // Throws std::invalid_argument on malformed or unauthentic input.
+    void update(const uint8_t* data, size_t size);
+    // Throws std::invalid_argument if the last frame has not been seen.
+    void finish() const;
+    uint64_t plaintextSize() const { return plaintextBytes; }
+
+private:
+    enum class State { FixedHeader, WrappedKey, FrameHeader, FrameBody, Done };
+
+    void advance();
+    void open();
+
+    KeyUnwrapper unwrap;
+    ByteSink sink;
+    State state = State::FixedHeader;
+    size_t wanted;                    // bytes of pending needed to leave the current state
+    std::vector<uint8_t> pending;
+    std::vector<uint8_t> header;
+    std::vector<uint8_t> plaintext;
+    KeyBuffer key;
+    std::unique_ptr<EVP_CIPHER_CTX, decltype(&EVP_CIPHER_CTX_free)> ctx;
+    size_t chunkSize = 0;
+    size_t frameLength = 0;
+    bool lastFrame = false;
+    uint32_t counter = 0;
+    uint64_t plaintextBytes = 0;
+};
+
+#endif // STREAM_CIPHER_H
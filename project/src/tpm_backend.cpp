@@ -0,0 +1,17 @@
+// tpm_backend.cpp
+#include "tpm_backend.h"
+
+bool parseTPMBackendType(const std::string& name, TPMBackendType& type) {
+    if (name == "tpm") {
+        type = TPMBackendType::Device;
+    } else if (name == "software") {
+        type = TPMBackendType::Software;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+const char* tpmBackendTypeName(TPMBackendType type) {
+    return type == TPMBackendType::Software ? "software" : "tpm";
+}
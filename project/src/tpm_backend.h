@@ -0,0 +1,73 @@
+// tpm_backend.h
+#ifndef TPM_BACKEND_H
+#define TPM_BACKEND_H
+
+#include "key_buffer.h"
+#include "tpm_context_pool.h"
+#include "tpm_object_cache.h"
+#include "tpm_scheduler.h"
+#include <cstddef>
+#include <cstdint>
+#include <future>
+#include <string>
+#include <vector>
+
+enum class TPMBackendType { Device, Software };
+
+// One TPM of a sharded backend, as reported in /stats.
+struct TPMDeviceStats {
+    std::string tcti;
+    uint64_t id = 0;                  // TPMObjectCache::storagePrimaryId()
+    bool healthy = true;
+    uint64_t seals = 0;               // keys placed on this TPM
+    uint64_t unseals = 0;
+    uint64_t failures = 0;
+    uint32_t consecutiveFailures = 0;
+    size_t queueDepth = 0;
+    size_t inFlight = 0;
+};
+
+// Accepts "tpm" and "software"; returns false for anything else.
+bool parseTPMBackendType(const std::string& name, TPMBackendType& type);
+const char* tpmBackendTypeName(TPMBackendType type);
+
+// The TPM operations KeyManager and BatchSigner depend on. TPMDeviceBackend
+// runs them on a real TPM or swtpm; SoftwareTPMBackend runs them in process
+// with OpenSSL, so the HTTP, store and caching layers can be tested and
+// profiled without a TPM. Every call may complete on another thread; errors
+// are delivered through the future.
+class TPMBackend {
+public:
+    virtual ~TPMBackend() = default;
+
+    virtual TPMBackendType type() const = 0;
+    // Largest getRandom() the backend serves with a single command.
+    virtual size_t maxRandomBytes() const = 0;
+
+    virtual std::future<std::vector<uint8_t>> getRandom(size_t bytes) = 0;
+    // Seals key so that only this backend can unseal it; yields the opaque blob.
+    // key_id only picks where the key is placed when there is a choice.
+    virtual std::future<std::vector<uint8_t>> seal(const std::string& key_id, KeyBuffer key) = 0;
+    // version distinguishes blobs stored under the same key_id over time.
+    virtual std::future<KeyBuffer> unseal(const std::string& key_id, uint64_t version, const std::vector<uint8_t>& sealedBlob) = 0;
+    // Drops anything cached for key_id once its blob is replaced or erased.
+    virtual void forget(const std::string& key_id) = 0;
+    // SHA-256 of data of any size.
+    virtual std::future<std::vector<uint8_t>> hash(const std::string& data) = 0;
+    // ECDSA P-256 signature of a SHA-256 digest, DER-encoded.
+    virtual std::future<std::vector<uint8_t>> sign(const std::string& digest) = 0;
+    // PEM SubjectPublicKeyInfo of the key sign() uses.
+    virtual const std::string& signingPublicKeyPem() const = 0;
+
+    // Device internals for /stats and attested hashing. Backends without a
+    // TPM report zeros and no pool; sharded backends sum over their TPMs and
+    // attest on the first one.
+    virtual TPMContextPool* contextPool() { return nullptr; }
+    virtual TPMContextPoolStats contextPoolStats() const { return TPMContextPoolStats(); }
+    virtual TPMObjectCacheStats objectCacheStats() const { return TPMObjectCacheStats(); }
+    virtual TPMSchedulerStats schedulerStats() const { return TPMSchedulerStats(); }
+    // One entry per TPM when work is sharded over several, otherwise empty.
+    virtual std::vector<TPMDeviceStats> deviceStats() const { return {}; }
+};
+
+#endif // TPM_BACKEND_H
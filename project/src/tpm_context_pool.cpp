@@ -0,0 +1,176 @@
+// tpm_context_pool.cpp
+#include "tpm_context_pool.h"
+#include "logger.h"
+#include "metrics.h"
+#include <tss2/tss2_tctildr.h>
+#include <stdexcept>
+#include <utility>
+
+namespace {
+
+uint64_t elapsedMicros(std::chrono::steady_clock::time_point since) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - since).count();
+}
+
+} // namespace
+
+bool isTPMTransportError(TSS2_RC rc) {
+    TSS2_RC layer = rc & TSS2_RC_LAYER_MASK;
+    return rc != TSS2_RC_SUCCESS && (layer == TSS2_TCTI_RC_LAYER || layer == TSS2_RESMGR_RC_LAYER);
+}
+
+TPMContextPool::Lease::Lease(TPMContextPool* pool, size_t slotIndex, ESYS_CONTEXT* context, uint64_t slotGeneration)
+    : pool(pool), slotIndex(slotIndex), context(context), slotGeneration(slotGeneration),
+      leasedAt(std::chrono::steady_clock::now()) {}
+
+TPMContextPool::Lease::Lease(Lease&& other) noexcept
+    : pool(std::exchange(other.pool, nullptr)), slotIndex(other.slotIndex),
+      context(std::exchange(other.context, nullptr)), slotGeneration(other.slotGeneration),
+      broken(other.broken), leasedAt(other.leasedAt) {}
+
+TPMContextPool::Lease::~Lease() {
+    if (pool != nullptr) {
+        pool->release(slotIndex, leasedAt, broken);
+    }
+}
+
+void TPMContextPool::Lease::check(TSS2_RC rc) {
+    if (isTPMTransportError(rc)) {
+        broken = true;
+    }
+}
+
+TPMContextPool::TPMContextPool(const TPMContextPoolConfig& config)
+    : config(config), slots(config.size == 0 ? 1 : config.size) {
+    for (size_t i = 0; i < slots.size(); ++i) {
+        try {
+            connect(slots[i]);
+        } catch (...) {
+            for (auto& slot : slots) {
+                disconnect(slot);
+            }
+            throw;
+        }
+        idleSlots.push_back(i);
+    }
+    logMessage("TPM context pool opened " + std::to_string(slots.size()) + " contexts", serverLogFile);
+}
+
+TPMContextPool::~TPMContextPool() {
+    for (auto& slot : slots) {
+        disconnect(slot);
+    }
+}
+
+void TPMContextPool::connect(Slot& slot) {
+    TSS2_TCTI_CONTEXT* tcti = nullptr;
+    TSS2_RC rc;
+    if (!config.tcti.empty()) {
+        rc = Tss2_TctiLdr_Initialize(config.tcti.c_str(), &tcti);
+        if (rc != TSS2_RC_SUCCESS) {
+            logErrorMessage("Error loading TCTI '" + config.tcti + "': " + std::to_string(rc), serverErrorLogFile);
+            throw std::runtime_error("Error loading TCTI");
+        }
+    }
+
+    ESYS_CONTEXT* context = nullptr;
+    rc = timedEsys("Esys_Initialize", [&] { return Esys_Initialize(&context, tcti, NULL); });
+    if (rc != TSS2_RC_SUCCESS) {
+        if (tcti != nullptr) {
+            Tss2_TctiLdr_Finalize(&tcti);
+        }
+        logErrorMessage("Error initializing TPM: " + std::to_string(rc), serverErrorLogFile);
+        throw std::runtime_error("Error initializing TPM");
+    }
+
+    slot.context = context;
+    slot.tcti = tcti;
+    ++slot.generation;
+}
+
+void TPMContextPool::disconnect(Slot& slot) {
+    if (slot.context != nullptr) {
+        Esys_Finalize(&slot.context);
+        slot.context = nullptr;
+    }
+    if (slot.tcti != nullptr) {
+        Tss2_TctiLdr_Finalize(&slot.tcti);
+        slot.tcti = nullptr;
+    }
+}
+
+TPMContextPool::Lease TPMContextPool::acquire() {
+    std::unique_lock<std::mutex> lock(poolMutex);
+    if (idleSlots.empty()) {
+        ++waitCount;
+        auto waitStart = std::chrono::steady_clock::now();
+        bool acquired = slotAvailable.wait_for(lock, config.acquireTimeout, [this] { return !idleSlots.empty(); });
+        waitTimeUs += elapsedMicros(waitStart);
+        static const MetricId waitMetric = registerHistogram("kms_tpm_context_wait_seconds", "",
+                                                             "Time callers blocked waiting for a pooled TPM context");
+        observeDuration(waitMetric, std::chrono::steady_clock::now() - waitStart);
+        if (!acquired) {
+            logErrorMessage("Timed out waiting for a TPM context", serverErrorLogFile);
+            throw std::runtime_error("Timed out waiting for a TPM context");
+        }
+    }
+    return leaseIdleSlot(lock);
+}
+
+std::optional<TPMContextPool::Lease> TPMContextPool::tryAcquire() {
+    std::unique_lock<std::mutex> lock(poolMutex);
+    if (idleSlots.empty()) {
+        return std::nullopt;
+    }
+    return leaseIdleSlot(lock);
+}
+
+// Expects poolMutex to be held and idleSlots to be non-empty.
+TPMContextPool::Lease TPMContextPool::leaseIdleSlot(std::unique_lock<std::mutex>& lock) {
+    size_t index = idleSlots.back();
+    idleSlots.pop_back();
+    ++leaseCount;
+    Slot& slot = slots[index];
+
+    if (slot.context == nullptr) {
+        // The previous holder saw a transport error; reconnect outside the pool lock.
+        lock.unlock();
+        try {
+            connect(slot);
+        } catch (...) {
+            lock.lock();
+            idleSlots.push_back(index);
+            slotAvailable.notify_one();
+            throw;
+        }
+        lock.lock();
+        ++reconnectCount;
+        logMessage("TPM context " + std::to_string(index) + " reconnected", serverLogFile);
+    }
+
+    return Lease(this, index, slot.context, slot.generation);
+}
+
+void TPMContextPool::release(size_t slotIndex, std::chrono::steady_clock::time_point leasedAt, bool broken) {
+    if (broken) {
+        logErrorMessage("Dropping broken TPM context " + std::to_string(slotIndex), serverErrorLogFile);
+        disconnect(slots[slotIndex]);
+    }
+    std::lock_guard<std::mutex> lock(poolMutex);
+    holdTimeUs += elapsedMicros(leasedAt);
+    idleSlots.push_back(slotIndex);
+    slotAvailable.notify_one();
+}
+
+TPMContextPoolStats TPMContextPool::stats() const {
+    std::lock_guard<std::mutex> lock(poolMutex);
+    TPMContextPoolStats result;
+    result.size = slots.size();
+    result.available = idleSlots.size();
+    result.leases = leaseCount;
+    result.waits = waitCount;
+    result.waitTimeUs = waitTimeUs;
+    result.holdTimeUs = holdTimeUs;
+    result.reconnects = reconnectCount;
+    return result;
+}
@@ -0,0 +1,99 @@
+// tpm_context_pool.h
+#ifndef TPM_CONTEXT_POOL_H
+#define TPM_CONTEXT_POOL_H
+
+#include <tss2/tss2_esys.h>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+struct TPMContextPoolConfig {
+    size_t size = 4;
+    std::string tcti;   // TCTI config string for Tss2_TctiLdr, empty = ESAPI default
+    std::chrono::milliseconds acquireTimeout{5000};
+};
+
+struct TPMContextPoolStats {
+    size_t size = 0;
+    size_t available = 0;
+    uint64_t leases = 0;
+    uint64_t waits = 0;         // acquisitions that found no idle context
+    uint64_t waitTimeUs = 0;    // total time spent waiting for a context
+    uint64_t holdTimeUs = 0;    // total time contexts were leased out
+    uint64_t reconnects = 0;
+};
+
+// Fixed set of ESYS contexts opened once and leased out per TPM operation,
+// so requests do not pay for Esys_Initialize/Esys_Finalize each time.
+class TPMContextPool {
+public:
+    class Lease {
+    public:
+        Lease(Lease&& other) noexcept;
+        Lease& operator=(Lease&&) = delete;
+        Lease(const Lease&) = delete;
+        Lease& operator=(const Lease&) = delete;
+        ~Lease();
+
+        ESYS_CONTEXT* get() const { return context; }
+        size_t index() const { return slotIndex; }
+        uint64_t generation() const { return slotGeneration; }
+        // Marks the context for reconnection if rc is a transport-level failure.
+        void check(TSS2_RC rc);
+
+    private:
+        friend class TPMContextPool;
+        Lease(TPMContextPool* pool, size_t slotIndex, ESYS_CONTEXT* context, uint64_t slotGeneration);
+
+        TPMContextPool* pool;
+        size_t slotIndex;
+        ESYS_CONTEXT* context;
+        uint64_t slotGeneration;
+        bool broken = false;
+        std::chrono::steady_clock::time_point leasedAt;
+    };
+
+    explicit TPMContextPool(const TPMContextPoolConfig& config = TPMContextPoolConfig());
+    ~TPMContextPool();
+
+    TPMContextPool(const TPMContextPool&) = delete;
+    TPMContextPool& operator=(const TPMContextPool&) = delete;
+
+    Lease acquire();
+    // Returns immediately with no lease when every context is busy.
+    std::optional<Lease> tryAcquire();
+    TPMContextPoolStats stats() const;
+    size_t size() const { return slots.size(); }
+
+private:
+    struct Slot {
+        ESYS_CONTEXT* context = nullptr;
+        TSS2_TCTI_CONTEXT* tcti = nullptr;
+        uint64_t generation = 0;   // bumped on every reconnect
+    };
+
+    void connect(Slot& slot);
+    void disconnect(Slot& slot);
+    Lease leaseIdleSlot(std::unique_lock<std::mutex>& lock);
+    void release(size_t slotIndex, std::chrono::steady_clock::time_point leasedAt, bool broken);
+
+    TPMContextPoolConfig config;
+    std::vector<Slot> slots;
+    std::vector<size_t> idleSlots;
+    mutable std::mutex poolMutex;
+    std::condition_variable slotAvailable;
+
+    uint64_t leaseCount = 0;
+    uint64_t waitCount = 0;
+    uint64_t waitTimeUs = 0;
+    uint64_t holdTimeUs = 0;
+    uint64_t reconnectCount = 0;
+};
+
+bool isTPMTransportError(TSS2_RC rc);
+
+#endif // TPM_CONTEXT_POOL_H
@@ -0,0 +1,70 @@
+// tpm_device_backend.cpp
+#include "tpm_device_backend.h"
+#include "tpm_hash_stream.h"
+#include <algorithm>
+
+TPMDeviceBackend::TPMDeviceBackend(const TPMDeviceConfig& config, StartupTimer& timer)
+    : tctiConfig(config.contextPool.tcti) {
+    checkTPMDeviceAccess();
+    pool = std::make_unique<TPMContextPool>(config.contextPool);
+    timer.phase("context pool");
+
+    TPMProperties fixed;
+    {
+        auto lease = pool->acquire();
+        fixed = readTPMProperties(lease, TPM2_PT_FIXED);
+        TPMProperties variable = readTPMProperties(lease, TPM2_PT_VAR);
+        resetDALockoutIfNeeded(lease, variable);
+        logTPMSummary(fixed, variable);
+    }
+    timer.phase("capabilities");
+
+    objectCache = std::make_unique<TPMObjectCache>(*pool, config.objectCache);
+    objectCache->ensureStoragePrimary();
+    timer.phase("storage primary");
+
+    objectCache->ensureSigningKey();
+    timer.phase("signing key");
+
+    maxDigest = fixed.count(TPM2_PT_MAX_DIGEST) ? fixed[TPM2_PT_MAX_DIGEST] : 32;
+    TPMSchedulerConfig schedulerConfig = config.scheduler;
+    schedulerConfig.maxRandomBytes = std::min<size_t>(schedulerConfig.maxRandomBytes, maxDigest);
+    scheduler = std::make_unique<TPMScheduler>(*pool, *objectCache, schedulerConfig);
+    timer.phase("scheduler");
+}
+
+std::future<std::vector<uint8_t>> TPMDeviceBackend::getRandom(size_t bytes) {
+    return scheduler->getRandom(bytes);
+}
+
+std::future<std::vector<uint8_t>> TPMDeviceBackend::seal(const std::string&, KeyBuffer key) {
+    return scheduler->seal(std::move(key));
+}
+
+std::future<KeyBuffer> TPMDeviceBackend::unseal(const std::string& key_id, uint64_t version, const std::vector<uint8_t>& sealedBlob) {
+    return scheduler->unseal(key_id, version, sealedBlob);
+}
+
+void TPMDeviceBackend::forget(const std::string& key_id) {
+    objectCache->invalidate(key_id);
+}
+
+std::future<std::vector<uint8_t>> TPMDeviceBackend::hash(const std::string& data) {
+    TPM2B_MAX_BUFFER probe;
+    if (data.size() <= sizeof(probe.buffer)) {
+        return scheduler->hash(data);
+    }
+    std::promise<std::vector<uint8_t>> result;
+    try {
+        StreamingHash hasher(pool.get(), true);
+        hasher.update(data);
+        result.set_value(hasher.finish().digest);
+    } catch (...) {
+        result.set_exception(std::current_exception());
+    }
+    return result.get_future();
+}
+
+std::future<std::vector<uint8_t>> TPMDeviceBackend::sign(const std::string& digest) {
+    return scheduler->sign(digest);
+}
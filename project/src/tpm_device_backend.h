@@ -0,0 +1,56 @@
+// tpm_device_backend.h
+#ifndef TPM_DEVICE_BACKEND_H
+#define TPM_DEVICE_BACKEND_H
+
+#include "tpm_backend.h"
+#include "tpm_context_pool.h"
+#include "tpm_object_cache.h"
+#include "tpm_scheduler.h"
+#include "tpm_startup.h"
+#include <memory>
+
+struct TPMDeviceConfig {
+    TPMContextPoolConfig contextPool;
+    TPMObjectCacheConfig objectCache;
+    TPMSchedulerConfig scheduler;
+};
+
+// A real TPM or swtpm behind a context pool, object cache and scheduler.
+// Construction runs the device startup: checks access, reads capabilities,
+// clears dictionary-attack lockout if needed, and makes sure the storage
+// primary and signing key are persistent. Each step is reported to timer.
+class TPMDeviceBackend : public TPMBackend {
+public:
+    TPMDeviceBackend(const TPMDeviceConfig& config, StartupTimer& timer);
+
+    TPMBackendType type() const override { return TPMBackendType::Device; }
+    size_t maxRandomBytes() const override { return maxDigest; }
+
+    std::future<std::vector<uint8_t>> getRandom(size_t bytes) override;
+    std::future<std::vector<uint8_t>> seal(const std::string& key_id, KeyBuffer key) override;
+    std::future<KeyBuffer> unseal(const std::string& key_id, uint64_t version, const std::vector<uint8_t>& sealedBlob) override;
+    void forget(const std::string& key_id) override;
+    // Input that fits one TPM2B_MAX_BUFFER goes through the scheduler; anything
+    // larger is hashed with a sequence on the calling thread.
+    std::future<std::vector<uint8_t>> hash(const std::string& data) override;
+    std::future<std::vector<uint8_t>> sign(const std::string& digest) override;
+    const std::string& signingPublicKeyPem() const override { return objectCache->signingPublicKeyPem(); }
+
+    TPMContextPool* contextPool() override { return pool.get(); }
+    TPMContextPoolStats contextPoolStats() const override { return pool->stats(); }
+    TPMObjectCacheStats objectCacheStats() const override { return objectCache->stats(); }
+    TPMSchedulerStats schedulerStats() const override { return scheduler->stats(); }
+
+    const std::string& tcti() const { return tctiConfig; }
+    uint64_t id() const { return objectCache->storagePrimaryId(); }
+
+private:
+    std::string tctiConfig;
+    size_t maxDigest = 32;
+    // Declared in dependency order so the scheduler stops first.
+    std::unique_ptr<TPMContextPool> pool;
+    std::unique_ptr<TPMObjectCache> objectCache;
+    std::unique_ptr<TPMScheduler> scheduler;
+};
+
+#endif // TPM_DEVICE_BACKEND_H
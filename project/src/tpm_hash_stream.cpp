@@ -0,0 +1,220 @@
+// tpm_hash_stream.cpp
+#include "tpm_hash_stream.h"
+#include "logger.h"
+#include "metrics.h"
+#include <tss2/tss2_mu.h>
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+
+std::vector<uint8_t> marshalTicket(const TPMT_TK_HASHCHECK* validation) {
+    // The TPM returns a NULL ticket for data it refuses to vouch for, such as
+    // input that starts with TPM_GENERATED_VALUE.
+    if (validation == nullptr || validation->hierarchy == TPM2_RH_NULL) {
+        return {};
+    }
+    std::vector<uint8_t> ticket(sizeof(TPMT_TK_HASHCHECK));
+    size_t offset = 0;
+    if (Tss2_MU_TPMT_TK_HASHCHECK_Marshal(validation, ticket.data(), ticket.size(), &offset) != TSS2_RC_SUCCESS) {
+        throw std::runtime_error("Error marshalling hash-check ticket");
+    }
+    ticket.resize(offset);
+    return ticket;
+}
+
+} // namespace
+
+StreamingHash::StreamingHash(TPMContextPool* pool, bool attest)
+    : pool(pool), attest(attest), software(nullptr, EVP_MD_CTX_free) {
+    if (attest && pool == nullptr) {
+        throw std::invalid_argument("Attested hashing needs a TPM device backend");
+    }
+    if (!attest) {
+        software.reset(EVP_MD_CTX_new());
+        if (!software || EVP_DigestInit_ex(software.get(), EVP_sha256(), nullptr) != 1) {
+            throw std::runtime_error("Error initializing SHA-256");
+        }
+    }
+}
+
+StreamingHash::~StreamingHash() {
+    if (lease) {
+        abandon();
+    }
+}
+
+void StreamingHash::update(const uint8_t* data, size_t size) {
+    if (finished) {
+        throw std::logic_error("Hash already finished");
+    }
+    bytes += size;
+    if (!attest) {
+        if (EVP_DigestUpdate(software.get(), data, size) != 1) {
+            throw std::runtime_error("Error computing SHA-256");
+        }
+        return;
+    }
+    while (size > 0) {
+        // A full chunk is only sent once more input arrives, so the last one
+        // is always left for SequenceComplete or a one-shot Esys_Hash.
+        if (chunk.size == sizeof(chunk.buffer)) {
+            sendChunk();
+        }
+        size_t take = std::min(size, sizeof(chunk.buffer) - chunk.size);
+        std::memcpy(chunk.buffer + chunk.size, data, take);
+        chunk.size = static_cast<UINT16>(chunk.size + take);
+        data += take;
+        size -= take;
+    }
+}
+
+void StreamingHash::sendChunk() {
+    if (!lease) {
+        lease.emplace(pool->acquire());
+        TPM2B_AUTH auth = {};
+        TSS2_RC rc = timedEsys("Esys_HashSequenceStart", [&] {
+            return Esys_HashSequenceStart(lease->get(), ESYS_TR_NONE, ESYS_TR_NONE, ESYS_TR_NONE,
+                                          &auth, TPM2_ALG_SHA256, &sequence);
+        });
+        ++tpmCommands;
+        if (rc != TSS2_RC_SUCCESS) {
+            lease->check(rc);
+            lease.reset();
+            sequence = ESYS_TR_NONE;
+            logErrorMessage("Error starting TPM hash sequence: " + std::to_string(rc), serverErrorLogFile);
+            throw std::runtime_error("Error hashing data using TPM");
+        }
+    }
+
+    // Commands on one sequence run in order, so at most one update is outstanding.
+    finishUpdate();
+    // _Async marshals the buffer into the command before returning, so the
+    // chunk can be refilled while the TPM works on it.
+    updateSentAt = std::chrono::steady_clock::now();
+    TSS2_RC rc = Esys_SequenceUpdate_Async(lease->get(), sequence, ESYS_TR_PASSWORD, ESYS_TR_NONE, ESYS_TR_NONE, &chunk);
+    ++tpmCommands;
+    if (rc != TSS2_RC_SUCCESS) {
+        recordTPMCommand("Esys_SequenceUpdate", std::chrono::steady_clock::now() - updateSentAt, rc);
+        lease->check(rc);
+        abandon();
+        logErrorMessage("Error sending TPM hash sequence update: " + std::to_string(rc), serverErrorLogFile);
+        throw std::runtime_error("Error hashing data using TPM");
+    }
+    updateInFlight = true;
+    chunk.size = 0;
+}
+
+void StreamingHash::finishUpdate() {
+    if (!updateInFlight) {
+        return;
+    }
+    TSS2_RC rc = Esys_SequenceUpdate_Finish(lease->get());
+    recordTPMCommand("Esys_SequenceUpdate", std::chrono::steady_clock::now() - updateSentAt, rc);
+    updateInFlight = false;
+    if (rc != TSS2_RC_SUCCESS) {
+        lease->check(rc);
+        abandon();
+        logErrorMessage("Error updating TPM hash sequence: " + std::to_string(rc), serverErrorLogFile);
+        throw std::runtime_error("Error hashing data using TPM");
+    }
+}
+
+HashResult StreamingHash::finish() {
+    if (finished) {
+        throw std::logic_error("Hash already finished");
+    }
+    finished = true;
+
+    if (!attest) {
+        HashResult result;
+        result.digest.resize(EVP_MAX_MD_SIZE);
+        unsigned int size = 0;
+        if (EVP_DigestFinal_ex(software.get(), result.digest.data(), &size) != 1) {
+            throw std::runtime_error("Error computing SHA-256");
+        }
+        result.digest.resize(size);
+        result.bytes = bytes;
+        return result;
+    }
+    return lease ? completeSequence() : hashOneShot();
+}
+
+HashResult StreamingHash::hashOneShot() {
+    auto shortLease = pool->acquire();
+    TPM2B_DIGEST* digest = NULL;
+    TPMT_TK_HASHCHECK* validation = NULL;
+    TSS2_RC rc = timedEsys("Esys_Hash", [&] {
+        return Esys_Hash(shortLease.get(), ESYS_TR_NONE, ESYS_TR_NONE, ESYS_TR_NONE, &chunk,
+                         TPM2_ALG_SHA256, ESYS_TR_RH_OWNER, &digest, &validation);
+    });
+    if (rc != TSS2_RC_SUCCESS) {
+        shortLease.check(rc);
+        logErrorMessage("Error generating hash using TPM: " + std::to_string(rc), serverErrorLogFile);
+        throw std::runtime_error("Error generating hash using TPM");
+    }
+
+    HashResult result;
+    result.digest.assign(digest->buffer, digest->buffer + digest->size);
+    result.bytes = bytes;
+    result.tpmCommands = 1;
+    try {
+        result.ticket = marshalTicket(validation);
+    } catch (...) {
+        Esys_Free(digest);
+        Esys_Free(validation);
+        throw;
+    }
+    Esys_Free(digest);
+    Esys_Free(validation);
+    return result;
+}
+
+HashResult StreamingHash::completeSequence() {
+    finishUpdate();
+    TPM2B_DIGEST* digest = NULL;
+    TPMT_TK_HASHCHECK* validation = NULL;
+    TSS2_RC rc = timedEsys("Esys_SequenceComplete", [&] {
+        return Esys_SequenceComplete(lease->get(), sequence, ESYS_TR_PASSWORD, ESYS_TR_NONE, ESYS_TR_NONE,
+                                     &chunk, ESYS_TR_RH_OWNER, &digest, &validation);
+    });
+    ++tpmCommands;
+    if (rc != TSS2_RC_SUCCESS) {
+        lease->check(rc);
+        abandon();
+        logErrorMessage("Error completing TPM hash sequence: " + std::to_string(rc), serverErrorLogFile);
+        throw std::runtime_error("Error hashing data using TPM");
+    }
+    // The TPM flushes the sequence object when it completes.
+    sequence = ESYS_TR_NONE;
+    lease.reset();
+
+    HashResult result;
+    result.digest.assign(digest->buffer, digest->buffer + digest->size);
+    result.bytes = bytes;
+    result.tpmCommands = tpmCommands;
+    try {
+        result.ticket = marshalTicket(validation);
+    } catch (...) {
+        Esys_Free(digest);
+        Esys_Free(validation);
+        throw;
+    }
+    Esys_Free(digest);
+    Esys_Free(validation);
+    return result;
+}
+
+// Drops an unfinished sequence so it does not occupy a TPM object slot.
+void StreamingHash::abandon() {
+    if (updateInFlight) {
+        Esys_SequenceUpdate_Finish(lease->get());
+        updateInFlight = false;
+    }
+    if (sequence != ESYS_TR_NONE) {
+        timedEsys("Esys_FlushContext", [&] { return Esys_FlushContext(lease->get(), sequence); });
+        sequence = ESYS_TR_NONE;
+    }
+    lease.reset();
+}
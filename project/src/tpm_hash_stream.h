@@ -0,0 +1,68 @@
+// tpm_hash_stream.h
+#ifndef TPM_HASH_STREAM_H
+#define TPM_HASH_STREAM_H
+
+#include "tpm_context_pool.h"
+#include <tss2/tss2_esys.h>
+#include <openssl/evp.h>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+struct HashResult {
+    std::vector<uint8_t> digest;     // SHA-256
+    std::vector<uint8_t> ticket;     // marshalled TPMT_TK_HASHCHECK; empty unless attested
+    uint64_t bytes = 0;
+    uint64_t tpmCommands = 0;        // 0 on the software path
+};
+
+// SHA-256 over input of any size, fed in pieces as it arrives.
+//
+// Without attestation the digest is computed in software and the TPM is never
+// involved. With attestation the data goes through the TPM, which is the only
+// way to get a hash-check ticket proving the TPM saw it: input that fits one
+// TPM2B_MAX_BUFFER costs a single Esys_Hash, anything larger a hash sequence.
+// One SequenceUpdate is kept in flight while the caller reads the next chunk,
+// so the TPM works while input is still arriving. A sequence is bound to the
+// context it was started on, so the stream holds one pooled context from its
+// second chunk until finish(). pool may be null, e.g. under the software TPM
+// backend, in which case attest throws std::invalid_argument.
+class StreamingHash {
+public:
+    StreamingHash(TPMContextPool* pool, bool attest);
+    ~StreamingHash();
+
+    StreamingHash(const StreamingHash&) = delete;
+    StreamingHash& operator=(const StreamingHash&) = delete;
+
+    void update(const uint8_t* data, size_t size);
+    void update(const std::string& data) { update(reinterpret_cast<const uint8_t*>(data.data()), data.size()); }
+    // Completes the hash; the object cannot be updated afterwards.
+    HashResult finish();
+
+private:
+    void sendChunk();
+    void finishUpdate();
+    HashResult completeSequence();
+    HashResult hashOneShot();
+    void abandon();
+
+    TPMContextPool* pool;
+    bool attest;
+    bool finished = false;
+    uint64_t bytes = 0;
+    uint64_t tpmCommands = 0;
+
+    std::unique_ptr<EVP_MD_CTX, decltype(&EVP_MD_CTX_free)> software;
+
+    std::optional<TPMContextPool::Lease> lease;
+    ESYS_TR sequence = ESYS_TR_NONE;
+    bool updateInFlight = false;
+    std::chrono::steady_clock::time_point updateSentAt;
+    TPM2B_MAX_BUFFER chunk = {};      // input not yet sent to the TPM
+};
+
+#endif // TPM_HASH_STREAM_H
@@ -0,0 +1,422 @@
+// tpm_object_cache.cpp
+#include "tpm_object_cache.h"
+#include "logger.h"
+#include "metrics.h"
+#include <tss2/tss2_mu.h>
+#include <openssl/bio.h>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+
+std::vector<uint8_t> marshalSealedObject(const TPM2B_PUBLIC& outPublic, const TPM2B_PRIVATE& outPrivate) {
+    std::vector<uint8_t> blob(sizeof(TPM2B_PUBLIC) + sizeof(TPM2B_PRIVATE));
+    size_t offset = 0;
+    TSS2_RC rc = Tss2_MU_TPM2B_PUBLIC_Marshal(&outPublic, blob.data(), blob.size(), &offset);
+    if (rc == TSS2_RC_SUCCESS) {
+        rc = Tss2_MU_TPM2B_PRIVATE_Marshal(&outPrivate, blob.data(), blob.size(), &offset);
+    }
+    if (rc != TSS2_RC_SUCCESS) {
+        logErrorMessage("Error marshalling sealed object: " + std::to_string(rc), serverErrorLogFile);
+        throw std::runtime_error("Error marshalling sealed object");
+    }
+    blob.resize(offset);
+    return blob;
+}
+
+void unmarshalSealedObject(const std::vector<uint8_t>& blob, TPM2B_PUBLIC& outPublic, TPM2B_PRIVATE& outPrivate) {
+    size_t offset = 0;
+    outPublic = {};
+    outPrivate = {};
+    TSS2_RC rc = Tss2_MU_TPM2B_PUBLIC_Unmarshal(blob.data(), blob.size(), &offset, &outPublic);
+    if (rc == TSS2_RC_SUCCESS) {
+        rc = Tss2_MU_TPM2B_PRIVATE_Unmarshal(blob.data(), blob.size(), &offset, &outPrivate);
+    }
+    if (rc != TSS2_RC_SUCCESS) {
+        logErrorMessage("Error unmarshalling sealed object: " + std::to_string(rc), serverErrorLogFile);
+        throw std::runtime_error("Malformed sealed key blob");
+    }
+}
+
+namespace {
+
+// SubjectPublicKeyInfo for a P-256 point is a fixed DER prefix followed by the
+// uncompressed point, so it can be assembled without OpenSSL's EC key types.
+std::string eccPublicKeyPem(const TPMS_ECC_POINT& point) {
+    static const uint8_t spkiPrefix[] = {
+        0x30, 0x59, 0x30, 0x13, 0x06, 0x07, 0x2a, 0x86, 0x48, 0xce, 0x3d, 0x02, 0x01,
+        0x06, 0x08, 0x2a, 0x86, 0x48, 0xce, 0x3d, 0x03, 0x01, 0x07, 0x03, 0x42, 0x00, 0x04
+    };
+    constexpr size_t coordinateSize = 32;
+    if (point.x.size > coordinateSize || point.y.size > coordinateSize) {
+        throw std::runtime_error("Signing key is not a P-256 point");
+    }
+    std::vector<uint8_t> der(spkiPrefix, spkiPrefix + sizeof(spkiPrefix));
+    der.resize(sizeof(spkiPrefix) + 2 * coordinateSize);
+    std::memcpy(der.data() + sizeof(spkiPrefix) + coordinateSize - point.x.size, point.x.buffer, point.x.size);
+    std::memcpy(der.data() + der.size() - point.y.size, point.y.buffer, point.y.size);
+
+    const unsigned char* cursor = der.data();
+    std::unique_ptr<EVP_PKEY, decltype(&EVP_PKEY_free)> key(d2i_PUBKEY(nullptr, &cursor, static_cast<long>(der.size())), EVP_PKEY_free);
+    std::unique_ptr<BIO, decltype(&BIO_free)> bio(BIO_new(BIO_s_mem()), BIO_free);
+    if (!key || !bio || PEM_write_bio_PUBKEY(bio.get(), key.get()) != 1) {
+        throw std::runtime_error("Error encoding signing public key");
+    }
+    char* data = nullptr;
+    long size = BIO_get_mem_data(bio.get(), &data);
+    return std::string(data, static_cast<size_t>(size));
+}
+
+} // namespace
+
+TPMObjectCache::TPMObjectCache(TPMContextPool& pool, const TPMObjectCacheConfig& config)
+    : pool(pool), config(config), slots(pool.size()) {
+    if (this->config.maxLoadedPerContext == 0) {
+        this->config.maxLoadedPerContext = 1;
+    }
+}
+
+TPMObjectCache::~TPMObjectCache() {
+    // Transient objects go away with the pooled connections; nothing to flush here.
+}
+
+TPM2B_PUBLIC TPMObjectCache::ensurePersistentPrimary(TPM2_HANDLE handle, const TPM2B_PUBLIC& inPublic, const std::string& name) {
+    auto lease = pool.acquire();
+    ESYS_CONTEXT* esys_context = lease.get();
+
+    ESYS_TR existing = ESYS_TR_NONE;
+    TSS2_RC rc = timedEsys("Esys_TR_FromTPMPublic", [&] {
+        return Esys_TR_FromTPMPublic(esys_context, handle, ESYS_TR_NONE, ESYS_TR_NONE, ESYS_TR_NONE, &existing);
+    });
+    if (rc == TSS2_RC_SUCCESS) {
+        TPM2B_PUBLIC* existingPublic = NULL;
+        rc = timedEsys("Esys_ReadPublic", [&] {
+            return Esys_ReadPublic(esys_context, existing, ESYS_TR_NONE, ESYS_TR_NONE, ESYS_TR_NONE, &existingPublic, NULL, NULL);
+        });
+        Esys_TR_Close(esys_context, &existing);
+        if (rc != TSS2_RC_SUCCESS) {
+            lease.check(rc);
+            logErrorMessage("Error reading " + name + ": " + std::to_string(rc), serverErrorLogFile);
+            throw std::runtime_error("Error reading " + name);
+        }
+        TPM2B_PUBLIC result = *existingPublic;
+        Esys_Free(existingPublic);
+        logMessage("Using existing " + name + " at persistent handle " + std::to_string(handle), serverLogFile);
+        return result;
+    }
+    lease.check(rc);
+
+    TPM2B_SENSITIVE_CREATE inSensitive = {};
+    TPM2B_DATA outsideInfo = {};
+    TPML_PCR_SELECTION creationPCR = {};
+    ESYS_TR transientHandle = ESYS_TR_NONE;
+    TPM2B_PUBLIC* outPublic = NULL;
+    TPM2B_CREATION_DATA* creationData = NULL;
+    TPM2B_DIGEST* creationHash = NULL;
+    TPMT_TK_CREATION* creationTicket = NULL;
+
+    rc = timedEsys("Esys_CreatePrimary", [&] {
+        return Esys_CreatePrimary(
+            esys_context,
+            ESYS_TR_RH_OWNER,
+            ESYS_TR_PASSWORD,
+            ESYS_TR_NONE,
+            ESYS_TR_NONE,
+            &inSensitive,
+            &inPublic,
+            &outsideInfo,
+            &creationPCR,
+            &transientHandle,
+            &outPublic,
+            &creationData,
+            &creationHash,
+            &creationTicket
+        );
+    });
+
+    if (rc != TSS2_RC_SUCCESS) {
+        lease.check(rc);
+        logErrorMessage("Error creating " + name + ": " + std::to_string(rc), serverErrorLogFile);
+        throw std::runtime_error("Error creating " + name);
+    }
+
+    TPM2B_PUBLIC result = *outPublic;
+    Esys_Free(outPublic);
+    Esys_Free(creationData);
+    Esys_Free(creationHash);
+    Esys_Free(creationTicket);
+
+    ESYS_TR persistentHandle = ESYS_TR_NONE;
+    rc = timedEsys("Esys_EvictControl", [&] {
+        return Esys_EvictControl(
+            esys_context,
+            ESYS_TR_RH_OWNER,
+            transientHandle,
+            ESYS_TR_PASSWORD,
+            ESYS_TR_NONE,
+            ESYS_TR_NONE,
+            handle,
+            &persistentHandle
+        );
+    });
+    timedEsys("Esys_FlushContext", [&] { return Esys_FlushContext(esys_context, transientHandle); });
+
+    if (rc != TSS2_RC_SUCCESS) {
+        lease.check(rc);
+        logErrorMessage("Error persisting " + name + ": " + std::to_string(rc), serverErrorLogFile);
+        throw std::runtime_error("Error persisting " + name);
+    }
+
+    Esys_TR_Close(esys_context, &persistentHandle);
+    logMessage(name + " created at persistent handle " + std::to_string(handle), serverLogFile);
+    return result;
+}
+
+void TPMObjectCache::ensureStoragePrimary() {
+    TPM2B_PUBLIC inPublic = {};
+    inPublic.publicArea.type = TPM2_ALG_ECC;
+    inPublic.publicArea.nameAlg = TPM2_ALG_SHA256;
+    inPublic.publicArea.objectAttributes = (TPMA_OBJECT_USERWITHAUTH | TPMA_OBJECT_RESTRICTED |
+                                             TPMA_OBJECT_DECRYPT | TPMA_OBJECT_FIXEDTPM |
+                                             TPMA_OBJECT_FIXEDPARENT | TPMA_OBJECT_SENSITIVEDATAORIGIN |
+                                             TPMA_OBJECT_NODA);
+    inPublic.publicArea.parameters.eccDetail.symmetric.algorithm = TPM2_ALG_AES;
+    inPublic.publicArea.parameters.eccDetail.symmetric.keyBits.aes = 128;
+    inPublic.publicArea.parameters.eccDetail.symmetric.mode.aes = TPM2_ALG_CFB;
+    inPublic.publicArea.parameters.eccDetail.scheme.scheme = TPM2_ALG_NULL;
+    inPublic.publicArea.parameters.eccDetail.curveID = TPM2_ECC_NIST_P256;
+    inPublic.publicArea.parameters.eccDetail.kdf.scheme = TPM2_ALG_NULL;
+
+    TPM2B_PUBLIC outPublic = ensurePersistentPrimary(config.primaryHandle, inPublic, "Storage primary");
+    const TPMS_ECC_POINT& point = outPublic.publicArea.unique.ecc;
+    std::unique_ptr<EVP_MD_CTX, decltype(&EVP_MD_CTX_free)> md(EVP_MD_CTX_new(), EVP_MD_CTX_free);
+    uint8_t digest[EVP_MAX_MD_SIZE];
+    if (!md || EVP_DigestInit_ex(md.get(), EVP_sha256(), nullptr) != 1 ||
+        EVP_DigestUpdate(md.get(), point.x.buffer, point.x.size) != 1 ||
+        EVP_DigestUpdate(md.get(), point.y.buffer, point.y.size) != 1 ||
+        EVP_DigestFinal_ex(md.get(), digest, nullptr) != 1) {
+        throw std::runtime_error("Error fingerprinting storage primary");
+    }
+    primaryId = 0;
+    for (size_t i = 0; i < sizeof(primaryId); ++i) {
+        primaryId = (primaryId << 8) | digest[i];
+    }
+}
+
+void TPMObjectCache::ensureSigningKey() {
+    TPM2B_PUBLIC inPublic = {};
+    inPublic.publicArea.type = TPM2_ALG_ECC;
+    inPublic.publicArea.nameAlg = TPM2_ALG_SHA256;
+    inPublic.publicArea.objectAttributes = (TPMA_OBJECT_USERWITHAUTH | TPMA_OBJECT_SIGN_ENCRYPT |
+                                             TPMA_OBJECT_FIXEDTPM | TPMA_OBJECT_FIXEDPARENT |
+                                             TPMA_OBJECT_SENSITIVEDATAORIGIN | TPMA_OBJECT_NODA);
+    inPublic.publicArea.parameters.eccDetail.symmetric.algorithm = TPM2_ALG_NULL;
+    inPublic.publicArea.parameters.eccDetail.scheme.scheme = TPM2_ALG_ECDSA;
+    inPublic.publicArea.parameters.eccDetail.scheme.details.ecdsa.hashAlg = TPM2_ALG_SHA256;
+    inPublic.publicArea.parameters.eccDetail.curveID = TPM2_ECC_NIST_P256;
+    inPublic.publicArea.parameters.eccDetail.kdf.scheme = TPM2_ALG_NULL;
+
+    TPM2B_PUBLIC outPublic = ensurePersistentPrimary(config.signingKeyHandle, inPublic, "Signing key");
+    const TPMT_PUBLIC& area = outPublic.publicArea;
+    if (area.type != TPM2_ALG_ECC || area.parameters.eccDetail.curveID != TPM2_ECC_NIST_P256 ||
+        !(area.objectAttributes & TPMA_OBJECT_SIGN_ENCRYPT) || (area.objectAttributes & TPMA_OBJECT_RESTRICTED)) {
+        logErrorMessage("Persistent handle " + std::to_string(config.signingKeyHandle) +
+                        " does not hold an unrestricted P-256 signing key", serverErrorLogFile);
+        throw std::runtime_error("Unsuitable object at the signing key handle");
+    }
+    signingKeyPem = eccPublicKeyPem(area.unique.ecc);
+}
+
+TPMObjectCache::SlotState& TPMObjectCache::slotFor(TPMContextPool::Lease& lease) {
+    SlotState& slot = slots[lease.index()];
+    if (slot.generation != lease.generation()) {
+        // The context was reconnected; every handle we knew about died with the old one.
+        slot = SlotState();
+        slot.generation = lease.generation();
+    }
+    return slot;
+}
+
+ESYS_TR TPMObjectCache::resolvePersistent(TPMContextPool::Lease& lease, TPM2_HANDLE handle, ESYS_TR& cached,
+                                          const std::string& name) {
+    if (cached == ESYS_TR_NONE) {
+        TSS2_RC rc = timedEsys("Esys_TR_FromTPMPublic", [&] {
+            return Esys_TR_FromTPMPublic(lease.get(), handle, ESYS_TR_NONE, ESYS_TR_NONE, ESYS_TR_NONE, &cached);
+        });
+        if (rc != TSS2_RC_SUCCESS) {
+            cached = ESYS_TR_NONE;
+            lease.check(rc);
+            logErrorMessage("Error resolving " + name + ": " + std::to_string(rc), serverErrorLogFile);
+            throw std::runtime_error("Error resolving " + name);
+        }
+    }
+    return cached;
+}
+
+ESYS_TR TPMObjectCache::storagePrimary(TPMContextPool::Lease& lease) {
+    return resolvePersistent(lease, config.primaryHandle, slotFor(lease).primary, "storage primary");
+}
+
+ESYS_TR TPMObjectCache::signingKey(TPMContextPool::Lease& lease) {
+    return resolvePersistent(lease, config.signingKeyHandle, slotFor(lease).signingKey, "signing key");
+}
+
+void TPMObjectCache::evictLeastRecent(TPMContextPool::Lease& lease, SlotState& slot) {
+    LoadedObject victim = slot.lru.back();
+    slot.lru.pop_back();
+    slot.index.erase(victim.keyId);
+
+    TPMS_CONTEXT* context = NULL;
+    TSS2_RC rc = timedEsys("Esys_ContextSave", [&] { return Esys_ContextSave(lease.get(), victim.handle, &context); });
+    if (rc == TSS2_RC_SUCCESS) {
+        rememberSavedContext(victim.keyId, victim.version, *context);
+        Esys_Free(context);
+    } else {
+        lease.check(rc);
+        logTpmError(rc, "Esys_ContextSave");
+    }
+    timedEsys("Esys_FlushContext", [&] { return Esys_FlushContext(lease.get(), victim.handle); });
+    ++evictionCount;
+}
+
+void TPMObjectCache::rememberSavedContext(const std::string& key_id, uint64_t version, const TPMS_CONTEXT& context) {
+    std::lock_guard<std::mutex> lock(savedMutex);
+    auto it = saved.find(key_id);
+    if (it != saved.end()) {
+        savedOrder.erase(it->second.order);
+        saved.erase(it);
+    }
+    while (!saved.empty() && saved.size() >= config.maxSavedContexts) {
+        saved.erase(savedOrder.back());
+        savedOrder.pop_back();
+    }
+    if (config.maxSavedContexts == 0) {
+        return;
+    }
+    savedOrder.push_front(key_id);
+    saved.emplace(key_id, SavedContext{version, context, savedOrder.begin()});
+}
+
+bool TPMObjectCache::restoreSavedContext(TPMContextPool::Lease& lease, const std::string& key_id, uint64_t version, ESYS_TR& handle) {
+    TPMS_CONTEXT context;
+    {
+        std::lock_guard<std::mutex> lock(savedMutex);
+        auto it = saved.find(key_id);
+        if (it == saved.end()) {
+            return false;
+        }
+        if (it->second.version != version) {
+            savedOrder.erase(it->second.order);
+            saved.erase(it);
+            return false;
+        }
+        context = it->second.context;
+    }
+
+    TSS2_RC rc = timedEsys("Esys_ContextLoad", [&] { return Esys_ContextLoad(lease.get(), &context, &handle); });
+    if (rc != TSS2_RC_SUCCESS) {
+        // Saved contexts do not survive a TPM reset; fall back to a full load.
+        lease.check(rc);
+        logTpmError(rc, "Esys_ContextLoad");
+        invalidate(key_id);
+        return false;
+    }
+    return true;
+}
+
+ESYS_TR TPMObjectCache::loadSealedObject(TPMContextPool::Lease& lease, const std::string& key_id, uint64_t version,
+                                         const std::vector<uint8_t>& sealedBlob) {
+    SlotState& slot = slotFor(lease);
+
+    auto found = slot.index.find(key_id);
+    if (found != slot.index.end()) {
+        if (found->second->version == version) {
+            slot.lru.splice(slot.lru.begin(), slot.lru, found->second);
+            ++hitCount;
+            return found->second->handle;
+        }
+        // A newer blob was stored under the same id.
+        timedEsys("Esys_FlushContext", [&] { return Esys_FlushContext(lease.get(), found->second->handle); });
+        slot.lru.erase(found->second);
+        slot.index.erase(found);
+    }
+
+    while (slot.lru.size() >= config.maxLoadedPerContext) {
+        evictLeastRecent(lease, slot);
+    }
+
+    ESYS_TR handle = ESYS_TR_NONE;
+    if (restoreSavedContext(lease, key_id, version, handle)) {
+        ++contextLoadCount;
+    } else {
+        ESYS_TR parent = storagePrimary(lease);
+
+        TPM2B_PUBLIC inPublic;
+        TPM2B_PRIVATE inPrivate;
+        unmarshalSealedObject(sealedBlob, inPublic, inPrivate);
+
+        TSS2_RC rc;
+        for (;;) {
+            rc = timedEsys("Esys_Load", [&] {
+                return Esys_Load(
+                    lease.get(),
+                    parent,
+                    ESYS_TR_PASSWORD,
+                    ESYS_TR_NONE,
+                    ESYS_TR_NONE,
+                    &inPrivate,
+                    &inPublic,
+                    &handle
+                );
+            });
+            // Without a resource manager all contexts share the TPM's few transient slots.
+            if (rc != TPM2_RC_OBJECT_MEMORY || slot.lru.empty()) {
+                break;
+            }
+            evictLeastRecent(lease, slot);
+        }
+
+        if (rc != TSS2_RC_SUCCESS) {
+            lease.check(rc);
+            logErrorMessage("Error loading key using TPM: " + std::to_string(rc), serverErrorLogFile);
+            throw std::runtime_error("Error loading key using TPM");
+        }
+        ++missCount;
+    }
+
+    slot.lru.push_front(LoadedObject{key_id, version, handle});
+    slot.index[key_id] = slot.lru.begin();
+    return handle;
+}
+
+void TPMObjectCache::discard(TPMContextPool::Lease& lease, const std::string& key_id) {
+    SlotState& slot = slotFor(lease);
+    auto found = slot.index.find(key_id);
+    if (found != slot.index.end()) {
+        timedEsys("Esys_FlushContext", [&] { return Esys_FlushContext(lease.get(), found->second->handle); });
+        slot.lru.erase(found->second);
+        slot.index.erase(found);
+    }
+    invalidate(key_id);
+}
+
+void TPMObjectCache::invalidate(const std::string& key_id) {
+    std::lock_guard<std::mutex> lock(savedMutex);
+    auto it = saved.find(key_id);
+    if (it != saved.end()) {
+        savedOrder.erase(it->second.order);
+        saved.erase(it);
+    }
+}
+
+TPMObjectCacheStats TPMObjectCache::stats() const {
+    TPMObjectCacheStats result;
+    result.hits = hitCount;
+    result.contextLoads = contextLoadCount;
+    result.misses = missCount;
+    result.evictions = evictionCount;
+    std::lock_guard<std::mutex> lock(savedMutex);
+    result.savedContexts = saved.size();
+    return result;
+}
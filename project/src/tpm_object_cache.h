@@ -0,0 +1,118 @@
+// tpm_object_cache.h
+#ifndef TPM_OBJECT_CACHE_H
+#define TPM_OBJECT_CACHE_H
+
+#include "tpm_context_pool.h"
+#include <tss2/tss2_esys.h>
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct TPMObjectCacheConfig {
+    TPM2_HANDLE primaryHandle = 0x81000001;  // persistent handle of the storage primary
+    TPM2_HANDLE signingKeyHandle = 0x81000002;  // persistent handle of the ECDSA P-256 signing key
+    size_t maxLoadedPerContext = 3;          // transient objects kept loaded per pooled context
+    size_t maxSavedContexts = 1024;          // evicted objects kept as ContextSave blobs
+};
+
+struct TPMObjectCacheStats {
+    uint64_t hits = 0;          // object already loaded in the leased context
+    uint64_t contextLoads = 0;  // restored from a saved context instead of Esys_Load
+    uint64_t misses = 0;        // full Esys_Load from the sealed blob
+    uint64_t evictions = 0;
+    size_t savedContexts = 0;
+};
+
+// Keeps the storage primary persistent and sealed objects loaded across
+// requests. Loaded handles are tracked per pooled context (ESYS_TR values are
+// context-local); evicted objects are swapped out with Esys_ContextSave so a
+// later fetch can Esys_ContextLoad them without re-running Esys_Load.
+class TPMObjectCache {
+public:
+    TPMObjectCache(TPMContextPool& pool, const TPMObjectCacheConfig& config = TPMObjectCacheConfig());
+    ~TPMObjectCache();
+
+    TPMObjectCache(const TPMObjectCache&) = delete;
+    TPMObjectCache& operator=(const TPMObjectCache&) = delete;
+
+    // Creates the storage primary and makes it persistent unless it already exists.
+    void ensureStoragePrimary();
+    ESYS_TR storagePrimary(TPMContextPool::Lease& lease);
+    // First 8 bytes of SHA-256 over the storage primary's public point. The
+    // primary derives from the TPM's storage seed, so this tells TPMs apart
+    // and names the one a sealed blob belongs to. Set by ensureStoragePrimary().
+    uint64_t storagePrimaryId() const { return primaryId; }
+    // Same for the signing key, an unrestricted ECDSA P-256 primary that signs
+    // external digests. Fails if another kind of object holds its handle.
+    void ensureSigningKey();
+    ESYS_TR signingKey(TPMContextPool::Lease& lease);
+    // PEM SubjectPublicKeyInfo of the signing key; set by ensureSigningKey().
+    const std::string& signingPublicKeyPem() const { return signingKeyPem; }
+
+    // Returns a handle to the sealed object for key_id in the leased context.
+    // version distinguishes blobs stored under the same key_id over time.
+    ESYS_TR loadSealedObject(TPMContextPool::Lease& lease, const std::string& key_id, uint64_t version,
+                             const std::vector<uint8_t>& sealedBlob);
+    // Flushes key_id from the leased context, e.g. after a failed unseal.
+    void discard(TPMContextPool::Lease& lease, const std::string& key_id);
+    // Forgets the saved context of key_id; loaded copies age out through the LRU.
+    void invalidate(const std::string& key_id);
+
+    TPMObjectCacheStats stats() const;
+
+private:
+    struct LoadedObject {
+        std::string keyId;
+        uint64_t version;
+        ESYS_TR handle;
+    };
+
+    struct SavedContext {
+        uint64_t version;
+        TPMS_CONTEXT context;
+        std::list<std::string>::iterator order;
+    };
+
+    // Only touched by the holder of the matching pool lease, so it needs no lock.
+    struct SlotState {
+        uint64_t generation = 0;
+        ESYS_TR primary = ESYS_TR_NONE;
+        ESYS_TR signingKey = ESYS_TR_NONE;
+        std::list<LoadedObject> lru;
+        std::unordered_map<std::string, std::list<LoadedObject>::iterator> index;
+    };
+
+    // Creates a primary under the owner hierarchy and persists it at handle,
+    // unless an object already lives there. Returns the object's public area.
+    TPM2B_PUBLIC ensurePersistentPrimary(TPM2_HANDLE handle, const TPM2B_PUBLIC& inPublic, const std::string& name);
+    ESYS_TR resolvePersistent(TPMContextPool::Lease& lease, TPM2_HANDLE handle, ESYS_TR& cached, const std::string& name);
+    SlotState& slotFor(TPMContextPool::Lease& lease);
+    void evictLeastRecent(TPMContextPool::Lease& lease, SlotState& slot);
+    bool restoreSavedContext(TPMContextPool::Lease& lease, const std::string& key_id, uint64_t version, ESYS_TR& handle);
+    void rememberSavedContext(const std::string& key_id, uint64_t version, const TPMS_CONTEXT& context);
+
+    TPMContextPool& pool;
+    TPMObjectCacheConfig config;
+    std::vector<SlotState> slots;
+    std::string signingKeyPem;
+    uint64_t primaryId = 0;
+
+    mutable std::mutex savedMutex;
+    std::unordered_map<std::string, SavedContext> saved;
+    std::list<std::string> savedOrder;   // most recently saved first
+
+    std::atomic<uint64_t> hitCount{0};
+    std::atomic<uint64_t> contextLoadCount{0};
+    std::atomic<uint64_t> missCount{0};
+    std::atomic<uint64_t> evictionCount{0};
+};
+
+// Sealed blobs are the marshalled TPM2B_PUBLIC followed by the TPM2B_PRIVATE.
+std::vector<uint8_t> marshalSealedObject(const TPM2B_PUBLIC& outPublic, const TPM2B_PRIVATE& outPrivate);
+void unmarshalSealedObject(const std::vector<uint8_t>& blob, TPM2B_PUBLIC& outPublic, TPM2B_PRIVATE& outPrivate);
+
+#endif // TPM_OBJECT_CACHE_H
@@ -0,0 +1,554 @@
+// tpm_scheduler.cpp
+#include "tpm_scheduler.h"
+#include "logger.h"
+#include "metrics.h"
+#include <openssl/bn.h>
+#include <openssl/crypto.h>
+#include <openssl/ecdsa.h>
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+
+uint64_t elapsedMicros(std::chrono::steady_clock::time_point since) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - since).count();
+}
+
+// Upper bound on random bytes served by one merged command.
+constexpr size_t randomMergeBytes = 256;
+
+// The TPM returns r and s as raw integers; verifiers expect the DER SEQUENCE.
+std::vector<uint8_t> derEcdsaSignature(const TPMS_SIGNATURE_ECC& ecdsa) {
+    std::unique_ptr<ECDSA_SIG, decltype(&ECDSA_SIG_free)> sig(ECDSA_SIG_new(), ECDSA_SIG_free);
+    BIGNUM* r = BN_bin2bn(ecdsa.signatureR.buffer, ecdsa.signatureR.size, nullptr);
+    BIGNUM* s = BN_bin2bn(ecdsa.signatureS.buffer, ecdsa.signatureS.size, nullptr);
+    if (!sig || !r || !s || ECDSA_SIG_set0(sig.get(), r, s) != 1) {
+        BN_free(r);
+        BN_free(s);
+        throw std::runtime_error("Error encoding TPM signature");
+    }
+    int size = i2d_ECDSA_SIG(sig.get(), nullptr);
+    std::vector<uint8_t> der(size > 0 ? static_cast<size_t>(size) : 0);
+    unsigned char* cursor = der.data();
+    if (size <= 0 || i2d_ECDSA_SIG(sig.get(), &cursor) != size) {
+        throw std::runtime_error("Error encoding TPM signature");
+    }
+    return der;
+}
+
+} // namespace
+
+TPMScheduler::TPMScheduler(TPMContextPool& pool, TPMObjectCache& objectCache, const TPMSchedulerConfig& config)
+    : pool(pool), objectCache(objectCache), config(config) {
+    if (this->config.maxInFlight == 0 || this->config.maxInFlight > pool.size()) {
+        this->config.maxInFlight = pool.size();
+    }
+    if (this->config.maxRandomBytes == 0) {
+        this->config.maxRandomBytes = 32;
+    }
+    driver = std::thread(&TPMScheduler::run, this);
+    logMessage("TPM scheduler started (" + std::to_string(this->config.maxInFlight) + " commands in flight)", serverLogFile);
+}
+
+TPMScheduler::~TPMScheduler() {
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        stopping = true;
+    }
+    queueChanged.notify_all();
+    if (driver.joinable()) {
+        driver.join();
+    }
+}
+
+std::future<std::vector<uint8_t>> TPMScheduler::submit(std::unique_ptr<Request> request) {
+    auto future = request->result.get_future();
+    enqueue(std::move(request));
+    return future;
+}
+
+void TPMScheduler::enqueue(std::unique_ptr<Request> request) {
+    request->queuedAt = std::chrono::steady_clock::now();
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        if (stopping) {
+            throw std::runtime_error("TPM scheduler is shutting down");
+        }
+        queue.push_back(std::move(request));
+        peakQueueDepth = std::max(peakQueueDepth, queue.size());
+    }
+    ++submittedCount;
+    queueChanged.notify_one();
+}
+
+void TPMScheduler::reject(Request& request, const std::string& message) {
+    auto error = std::make_exception_ptr(std::runtime_error(message));
+    if (request.op == Operation::Unseal) {
+        request.unsealed.set_exception(error);
+    } else {
+        request.result.set_exception(error);
+    }
+}
+
+std::future<std::vector<uint8_t>> TPMScheduler::getRandom(size_t bytes) {
+    if (bytes == 0) {
+        std::promise<std::vector<uint8_t>> empty;
+        empty.set_value({});
+        return empty.get_future();
+    }
+    auto request = std::make_unique<Request>();
+    request->op = Operation::Random;
+    request->bytes = bytes;
+    return submit(std::move(request));
+}
+
+std::future<std::vector<uint8_t>> TPMScheduler::seal(KeyBuffer key) {
+    TPM2B_SENSITIVE_CREATE probe;
+    if (key.size() > sizeof(probe.sensitive.data.buffer)) {
+        throw std::runtime_error("Key too large to seal");
+    }
+    auto request = std::make_unique<Request>();
+    request->op = Operation::Create;
+    request->key = std::move(key);
+    return submit(std::move(request));
+}
+
+std::future<KeyBuffer> TPMScheduler::unseal(const std::string& key_id, uint64_t version, const std::vector<uint8_t>& sealedBlob) {
+    auto request = std::make_unique<Request>();
+    request->op = Operation::Unseal;
+    request->keyId = key_id;
+    request->version = version;
+    request->input = sealedBlob;
+    auto future = request->unsealed.get_future();
+    enqueue(std::move(request));
+    return future;
+}
+
+std::future<std::vector<uint8_t>> TPMScheduler::hash(const std::string& data) {
+    TPM2B_MAX_BUFFER probe;
+    if (data.size() > sizeof(probe.buffer)) {
+        throw std::runtime_error("Data too large to hash in one TPM command");
+    }
+    auto request = std::make_unique<Request>();
+    request->op = Operation::Hash;
+    request->input.assign(data.begin(), data.end());
+    return submit(std::move(request));
+}
+
+std::future<std::vector<uint8_t>> TPMScheduler::sign(const std::string& digest) {
+    TPM2B_DIGEST probe;
+    if (digest.size() > sizeof(probe.buffer)) {
+        throw std::runtime_error("Digest too large to sign");
+    }
+    auto request = std::make_unique<Request>();
+    request->op = Operation::Sign;
+    request->input.assign(digest.begin(), digest.end());
+    return submit(std::move(request));
+}
+
+// Expects queueMutex to be held. Random requests anywhere in the queue are
+// pulled forward and merged with a random request at the front.
+std::vector<std::unique_ptr<TPMScheduler::Request>> TPMScheduler::takeNext() {
+    std::vector<std::unique_ptr<Request>> taken;
+    if (queue.empty()) {
+        return taken;
+    }
+    taken.push_back(std::move(queue.front()));
+    queue.pop_front();
+    if (taken.front()->op != Operation::Random) {
+        return taken;
+    }
+
+    size_t total = taken.front()->bytes;
+    for (auto it = queue.begin(); it != queue.end(); ) {
+        if ((*it)->op == Operation::Random && total + (*it)->bytes <= randomMergeBytes) {
+            total += (*it)->bytes;
+            taken.push_back(std::move(*it));
+            it = queue.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    randomMergedCount += taken.size() - 1;
+    return taken;
+}
+
+void TPMScheduler::run() {
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(queueMutex);
+            if (inFlight.empty()) {
+                queueChanged.wait(lock, [this] { return stopping || !queue.empty(); });
+                if (queue.empty()) {
+                    return;
+                }
+            }
+        }
+
+        // Fill every idle context; contexts leased by synchronous callers are skipped.
+        // Only this thread takes from the queue, so a request seen here is
+        // still there once a context is leased, and no lease is taken for
+        // nothing while in-flight commands are being polled.
+        bool starved = false;
+        while (inFlight.size() < config.maxInFlight) {
+            {
+                std::lock_guard<std::mutex> lock(queueMutex);
+                if (queue.empty()) {
+                    break;
+                }
+            }
+            std::vector<std::unique_ptr<Request>> requests;
+            try {
+                auto lease = pool.tryAcquire();
+                if (!lease) {
+                    starved = true;
+                    break;
+                }
+                {
+                    std::lock_guard<std::mutex> lock(queueMutex);
+                    requests = takeNext();
+                }
+                if (requests.empty()) {
+                    break;
+                }
+                Command& command = inFlight.emplace_back(std::move(*lease));
+                command.requests = std::move(requests);
+                launch(command);
+                if (command.requests.empty()) {
+                    inFlight.pop_back();
+                }
+            } catch (const std::exception &e) {
+                // Reconnecting a context failed; fail the next request instead of spinning on it.
+                logErrorMessage("TPM scheduler could not lease a context: " + std::string(e.what()), serverErrorLogFile);
+                {
+                    std::lock_guard<std::mutex> lock(queueMutex);
+                    requests = takeNext();
+                }
+                for (auto& request : requests) {
+                    reject(*request, e.what());
+                }
+                failedCount += requests.size();
+                break;
+            }
+        }
+        inFlightCount = inFlight.size();
+
+        if (inFlight.empty()) {
+            if (starved) {
+                std::unique_lock<std::mutex> lock(queueMutex);
+                queueChanged.wait_for(lock, config.pollInterval);
+            }
+            continue;
+        }
+
+        for (auto it = inFlight.begin(); it != inFlight.end(); ) {
+            if (poll(*it)) {
+                it = inFlight.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        inFlightCount = inFlight.size();
+    }
+}
+
+TSS2_RC TPMScheduler::startRandom(Command& command) {
+    size_t want = std::min(command.randomWanted - command.random.size(), config.maxRandomBytes);
+    ++randomCommandCount;
+    command.sentAt = std::chrono::steady_clock::now();
+    return Esys_GetRandom_Async(command.lease.get(), ESYS_TR_NONE, ESYS_TR_NONE, ESYS_TR_NONE, static_cast<UINT16>(want));
+}
+
+// Sends the command for command.requests; on failure the requests are failed and cleared.
+void TPMScheduler::launch(Command& command) {
+    ESYS_CONTEXT* esys_context = command.lease.get();
+    Request& request = *command.requests.front();
+    command.op = request.op;
+    command.startedAt = std::chrono::steady_clock::now();
+    command.sentAt = command.startedAt;
+    for (const auto& queued : command.requests) {
+        queueWaitUs += elapsedMicros(queued->queuedAt);
+    }
+
+    // _Finish returns TSS2_ESYS_RC_TRY_AGAIN after this long, letting the driver move on.
+    Esys_SetTimeout(esys_context, static_cast<INT32>(config.pollInterval.count()));
+
+    TSS2_RC rc = TSS2_RC_SUCCESS;
+    try {
+        switch (command.op) {
+        case Operation::Random: {
+            for (const auto& queued : command.requests) {
+                command.randomWanted += queued->bytes;
+            }
+            rc = startRandom(command);
+            break;
+        }
+        case Operation::Create: {
+            TPM2B_SENSITIVE_CREATE inSensitive = {};
+            inSensitive.size = sizeof(TPM2B_SENSITIVE_CREATE);
+            inSensitive.sensitive.userAuth.size = 0;
+            inSensitive.sensitive.data.size = static_cast<UINT16>(request.key.size());
+            std::memcpy(inSensitive.sensitive.data.buffer, request.key.data(), request.key.size());
+            request.key = KeyBuffer();
+
+            // Sealed data object: a keyed-hash object with no scheme that only holds the key bytes.
+            TPM2B_PUBLIC inPublic = {};
+            inPublic.size = sizeof(TPM2B_PUBLIC);
+            inPublic.publicArea.type = TPM2_ALG_KEYEDHASH;
+            inPublic.publicArea.nameAlg = TPM2_ALG_SHA256;
+            inPublic.publicArea.objectAttributes = (TPMA_OBJECT_USERWITHAUTH | TPMA_OBJECT_FIXEDTPM |
+                                                     TPMA_OBJECT_FIXEDPARENT);
+            inPublic.publicArea.parameters.keyedHashDetail.scheme.scheme = TPM2_ALG_NULL;
+            inPublic.publicArea.unique.keyedHash.size = 0;
+
+            TPM2B_DATA outsideInfo = {};
+            TPML_PCR_SELECTION creationPCR = {};
+            ESYS_TR parent = objectCache.storagePrimary(command.lease);
+            command.sentAt = std::chrono::steady_clock::now();
+            rc = Esys_Create_Async(esys_context, parent, ESYS_TR_PASSWORD,
+                                   ESYS_TR_NONE, ESYS_TR_NONE, &inSensitive, &inPublic, &outsideInfo, &creationPCR);
+            OPENSSL_cleanse(&inSensitive, sizeof(inSensitive));
+            break;
+        }
+        case Operation::Unseal: {
+            // Hot keys stay loaded in the pooled context, so this usually skips Esys_Load.
+            ESYS_TR objectHandle = objectCache.loadSealedObject(command.lease, request.keyId, request.version, request.input);
+            command.sentAt = std::chrono::steady_clock::now();
+            rc = Esys_Unseal_Async(esys_context, objectHandle, ESYS_TR_PASSWORD, ESYS_TR_NONE, ESYS_TR_NONE);
+            break;
+        }
+        case Operation::Hash: {
+            TPM2B_MAX_BUFFER buffer = {};
+            buffer.size = static_cast<UINT16>(request.input.size());
+            std::memcpy(buffer.buffer, request.input.data(), request.input.size());
+            rc = Esys_Hash_Async(esys_context, ESYS_TR_NONE, ESYS_TR_NONE, ESYS_TR_NONE, &buffer,
+                                 TPM2_ALG_SHA256, ESYS_TR_RH_NULL);
+            break;
+        }
+        case Operation::Sign: {
+            TPMT_SIG_SCHEME inScheme = {};
+            inScheme.scheme = TPM2_ALG_ECDSA;
+            inScheme.details.ecdsa.hashAlg = TPM2_ALG_SHA256;
+            TPM2B_DIGEST digest = {};
+            digest.size = static_cast<UINT16>(request.input.size());
+            std::memcpy(digest.buffer, request.input.data(), request.input.size());
+            // The signing key is unrestricted, so an empty ticket is enough.
+            TPMT_TK_HASHCHECK validation = {};
+            validation.tag = TPM2_ST_HASHCHECK;
+            validation.hierarchy = TPM2_RH_NULL;
+            ESYS_TR key = objectCache.signingKey(command.lease);
+            command.sentAt = std::chrono::steady_clock::now();
+            rc = Esys_Sign_Async(esys_context, key, ESYS_TR_PASSWORD, ESYS_TR_NONE, ESYS_TR_NONE,
+                                 &digest, &inScheme, &validation);
+            break;
+        }
+        }
+    } catch (const std::exception &e) {
+        Esys_SetTimeout(esys_context, TSS2_TCTI_TIMEOUT_BLOCK);
+        fail(command, e.what());
+        return;
+    }
+
+    if (rc != TSS2_RC_SUCCESS) {
+        Esys_SetTimeout(esys_context, TSS2_TCTI_TIMEOUT_BLOCK);
+        recordTPMCommand(commandName(command.op), std::chrono::steady_clock::now() - command.sentAt, rc);
+        command.lease.check(rc);
+        logErrorMessage("Error sending command to TPM: " + std::to_string(rc), serverErrorLogFile);
+        fail(command, "Error sending command to TPM");
+    }
+}
+
+bool TPMScheduler::poll(Command& command) {
+    ESYS_CONTEXT* esys_context = command.lease.get();
+    std::vector<uint8_t> output;
+    KeyBuffer unsealed;
+    std::string error;
+    TSS2_RC rc = TSS2_RC_SUCCESS;
+
+    try {
+        switch (command.op) {
+        case Operation::Random: {
+            TPM2B_DIGEST* randomBytes = NULL;
+            rc = Esys_GetRandom_Finish(esys_context, &randomBytes);
+            if (rc == TSS2_ESYS_RC_TRY_AGAIN) {
+                return false;
+            }
+            recordTPMCommand(commandName(command.op), std::chrono::steady_clock::now() - command.sentAt, rc);
+            if (rc != TSS2_RC_SUCCESS) {
+                error = "Error generating random bytes using TPM";
+                break;
+            }
+            command.random.insert(command.random.end(), randomBytes->buffer, randomBytes->buffer + randomBytes->size);
+            OPENSSL_cleanse(randomBytes->buffer, randomBytes->size);
+            bool empty = randomBytes->size == 0;
+            Esys_Free(randomBytes);
+            if (empty) {
+                rc = TSS2_ESYS_RC_GENERAL_FAILURE;
+                error = "TPM returned no random bytes";
+                break;
+            }
+            if (command.random.size() < command.randomWanted) {
+                // The TPM caps GetRandom at its digest size; keep the context and go again.
+                rc = startRandom(command);
+                if (rc == TSS2_RC_SUCCESS) {
+                    return false;
+                }
+                error = "Error generating random bytes using TPM";
+            }
+            break;
+        }
+        case Operation::Create: {
+            TPM2B_PRIVATE* outPrivate = NULL;
+            TPM2B_PUBLIC* outPublic = NULL;
+            TPM2B_CREATION_DATA* creationData = NULL;
+            TPM2B_DIGEST* creationHash = NULL;
+            TPMT_TK_CREATION* creationTicket = NULL;
+            rc = Esys_Create_Finish(esys_context, &outPrivate, &outPublic, &creationData, &creationHash, &creationTicket);
+            if (rc == TSS2_ESYS_RC_TRY_AGAIN) {
+                return false;
+            }
+            recordTPMCommand(commandName(command.op), std::chrono::steady_clock::now() - command.sentAt, rc);
+            if (rc != TSS2_RC_SUCCESS) {
+                error = "Error sealing key using TPM";
+                break;
+            }
+            try {
+                output = marshalSealedObject(*outPublic, *outPrivate);
+            } catch (const std::exception &e) {
+                error = e.what();
+            }
+            Esys_Free(outPrivate);
+            Esys_Free(outPublic);
+            Esys_Free(creationData);
+            Esys_Free(creationHash);
+            Esys_Free(creationTicket);
+            break;
+        }
+        case Operation::Unseal: {
+            TPM2B_SENSITIVE_DATA* outData = NULL;
+            rc = Esys_Unseal_Finish(esys_context, &outData);
+            if (rc == TSS2_ESYS_RC_TRY_AGAIN) {
+                return false;
+            }
+            recordTPMCommand(commandName(command.op), std::chrono::steady_clock::now() - command.sentAt, rc);
+            if (rc != TSS2_RC_SUCCESS) {
+                objectCache.discard(command.lease, command.requests.front()->keyId);
+                error = "Error unsealing key using TPM";
+                break;
+            }
+            try {
+                unsealed = KeyBuffer(outData->buffer, outData->size);
+            } catch (const std::exception &e) {
+                error = e.what();
+            }
+            OPENSSL_cleanse(outData->buffer, outData->size);
+            Esys_Free(outData);
+            break;
+        }
+        case Operation::Hash: {
+            TPM2B_DIGEST* digest = NULL;
+            TPMT_TK_HASHCHECK* validation = NULL;
+            rc = Esys_Hash_Finish(esys_context, &digest, &validation);
+            if (rc == TSS2_ESYS_RC_TRY_AGAIN) {
+                return false;
+            }
+            recordTPMCommand(commandName(command.op), std::chrono::steady_clock::now() - command.sentAt, rc);
+            if (rc != TSS2_RC_SUCCESS) {
+                error = "Error generating hash using TPM";
+                break;
+            }
+            output.assign(digest->buffer, digest->buffer + digest->size);
+            Esys_Free(digest);
+            Esys_Free(validation);
+            break;
+        }
+        case Operation::Sign: {
+            TPMT_SIGNATURE* signature = NULL;
+            rc = Esys_Sign_Finish(esys_context, &signature);
+            if (rc == TSS2_ESYS_RC_TRY_AGAIN) {
+                return false;
+            }
+            recordTPMCommand(commandName(command.op), std::chrono::steady_clock::now() - command.sentAt, rc);
+            if (rc != TSS2_RC_SUCCESS) {
+                error = "Error signing data using TPM";
+                break;
+            }
+            try {
+                output = derEcdsaSignature(signature->signature.ecdsa);
+            } catch (...) {
+                Esys_Free(signature);
+                throw;
+            }
+            Esys_Free(signature);
+            break;
+        }
+        }
+    } catch (const std::exception &e) {
+        error = e.what();
+    }
+
+    Esys_SetTimeout(esys_context, TSS2_TCTI_TIMEOUT_BLOCK);
+    serviceTimeUs += elapsedMicros(command.startedAt);
+
+    if (!error.empty()) {
+        command.lease.check(rc);
+        logErrorMessage(error + ": " + std::to_string(rc), serverErrorLogFile);
+        fail(command, error);
+        return true;
+    }
+
+    if (command.op == Operation::Random) {
+        size_t offset = 0;
+        for (auto& request : command.requests) {
+            request->result.set_value(std::vector<uint8_t>(command.random.begin() + offset,
+                                                           command.random.begin() + offset + request->bytes));
+            offset += request->bytes;
+        }
+        OPENSSL_cleanse(command.random.data(), command.random.size());
+    } else if (command.op == Operation::Unseal) {
+        command.requests.front()->unsealed.set_value(std::move(unsealed));
+    } else {
+        command.requests.front()->result.set_value(std::move(output));
+    }
+    completedCount += command.requests.size();
+    return true;
+}
+
+void TPMScheduler::fail(Command& command, const std::string& message) {
+    for (auto& request : command.requests) {
+        reject(*request, message);
+    }
+    failedCount += command.requests.size();
+    command.requests.clear();
+    OPENSSL_cleanse(command.random.data(), command.random.size());
+}
+
+const char* TPMScheduler::commandName(Operation op) {
+    switch (op) {
+    case Operation::Random: return "Esys_GetRandom";
+    case Operation::Create: return "Esys_Create";
+    case Operation::Unseal: return "Esys_Unseal";
+    case Operation::Hash: return "Esys_Hash";
+    case Operation::Sign: return "Esys_Sign";
+    }
+    return "Esys_Unknown";
+}
+
+TPMSchedulerStats TPMScheduler::stats() const {
+    TPMSchedulerStats result;
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        result.queueDepth = queue.size();
+        result.peakQueueDepth = peakQueueDepth;
+    }
+    result.inFlight = inFlightCount;
+    result.submitted = submittedCount;
+    result.completed = completedCount;
+    result.failed = failedCount;
+    result.randomCommands = randomCommandCount;
+    result.randomMerged = randomMergedCount;
+    result.queueWaitUs = queueWaitUs;
+    result.serviceTimeUs = serviceTimeUs;
+    return result;
+}
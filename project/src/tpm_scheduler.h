@@ -0,0 +1,131 @@
+// tpm_scheduler.h
+#ifndef TPM_SCHEDULER_H
+#define TPM_SCHEDULER_H
+
+#include "key_buffer.h"
+#include "tpm_context_pool.h"
+#include "tpm_object_cache.h"
+#include <tss2/tss2_esys.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct TPMSchedulerConfig {
+    size_t maxInFlight = 0;                    // commands outstanding at once, 0 = one per pooled context
+    size_t maxRandomBytes = 32;                // bytes per GetRandom, clamped to the TPM's max digest
+    std::chrono::milliseconds pollInterval{1}; // how long each _Finish waits before trying the next context
+};
+
+struct TPMSchedulerStats {
+    size_t queueDepth = 0;
+    size_t inFlight = 0;
+    size_t peakQueueDepth = 0;
+    uint64_t submitted = 0;
+    uint64_t completed = 0;
+    uint64_t failed = 0;
+    uint64_t randomCommands = 0;     // GetRandom commands actually sent
+    uint64_t randomMerged = 0;       // random requests served by another request's command
+    uint64_t queueWaitUs = 0;        // total time requests spent queued
+    uint64_t serviceTimeUs = 0;      // total time from _Async to _Finish
+};
+
+// Single driver thread that owns the conversation with the TPM. Callers submit
+// typed requests and get futures; the driver launches them with the ESAPI
+// _Async calls on whichever pooled contexts are idle and polls the matching
+// _Finish calls, so several commands are outstanding at once. Queued GetRandom
+// requests are pulled forward and merged into as few commands as possible.
+class TPMScheduler {
+public:
+    TPMScheduler(TPMContextPool& pool, TPMObjectCache& objectCache, const TPMSchedulerConfig& config = TPMSchedulerConfig());
+    ~TPMScheduler();
+
+    TPMScheduler(const TPMScheduler&) = delete;
+    TPMScheduler& operator=(const TPMScheduler&) = delete;
+
+    std::future<std::vector<uint8_t>> getRandom(size_t bytes);
+    // Creates a sealed data object under the storage primary; yields the marshalled blob.
+    // The key is wiped as soon as it has been copied into the command.
+    std::future<std::vector<uint8_t>> seal(KeyBuffer key);
+    // Loads the sealed object through the object cache and unseals it.
+    std::future<KeyBuffer> unseal(const std::string& key_id, uint64_t version, const std::vector<uint8_t>& sealedBlob);
+    std::future<std::vector<uint8_t>> hash(const std::string& data);
+    // ECDSA P-256 signature of a SHA-256 digest by the persistent signing key, DER-encoded.
+    std::future<std::vector<uint8_t>> sign(const std::string& digest);
+
+    TPMSchedulerStats stats() const;
+
+private:
+    enum class Operation { Random, Create, Unseal, Hash, Sign };
+
+    struct Request {
+        Operation op;
+        std::vector<uint8_t> input;
+        KeyBuffer key;                          // Create only
+        std::string keyId;
+        uint64_t version = 0;
+        size_t bytes = 0;
+        std::promise<std::vector<uint8_t>> result;
+        std::promise<KeyBuffer> unsealed;       // Unseal only, instead of result
+        std::chrono::steady_clock::time_point queuedAt;
+    };
+
+    struct Command {
+        explicit Command(TPMContextPool::Lease&& lease) : lease(std::move(lease)) {}
+
+        TPMContextPool::Lease lease;
+        Operation op;
+        // More than one only for merged GetRandom.
+        std::vector<std::unique_ptr<Request>> requests;
+        std::vector<uint8_t> random;
+        size_t randomWanted = 0;
+        std::chrono::steady_clock::time_point startedAt;
+        std::chrono::steady_clock::time_point sentAt;   // of the current _Async call
+    };
+
+    std::future<std::vector<uint8_t>> submit(std::unique_ptr<Request> request);
+    void enqueue(std::unique_ptr<Request> request);
+    static void reject(Request& request, const std::string& message);
+    std::vector<std::unique_ptr<Request>> takeNext();
+    void run();
+    void launch(Command& command);
+    TSS2_RC startRandom(Command& command);
+    // Returns false while the command is still running on the TPM.
+    bool poll(Command& command);
+    void fail(Command& command, const std::string& message);
+    static const char* commandName(Operation op);
+
+    TPMContextPool& pool;
+    TPMObjectCache& objectCache;
+    TPMSchedulerConfig config;
+
+    mutable std::mutex queueMutex;
+    std::condition_variable queueChanged;
+    std::deque<std::unique_ptr<Request>> queue;
+    size_t peakQueueDepth = 0;
+    bool stopping = false;
+
+    // Only touched by the driver thread.
+    std::list<Command> inFlight;
+    std::atomic<size_t> inFlightCount{0};
+
+    std::atomic<uint64_t> submittedCount{0};
+    std::atomic<uint64_t> completedCount{0};
+    std::atomic<uint64_t> failedCount{0};
+    std::atomic<uint64_t> randomCommandCount{0};
+    std::atomic<uint64_t> randomMergedCount{0};
+    std::atomic<uint64_t> queueWaitUs{0};
+    std::atomic<uint64_t> serviceTimeUs{0};
+
+    std::thread driver;
+};
+
+#endif // TPM_SCHEDULER_H
@@ -0,0 +1,135 @@
+// tpm_startup.cpp
+#include "tpm_startup.h"
+#include "logger.h"
+#include "metrics.h"
+#include <sstream>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+uint64_t micros(std::chrono::steady_clock::duration d) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+}
+
+uint32_t propertyOr(const TPMProperties& properties, TPM2_PT property, uint32_t fallback) {
+    auto it = properties.find(property);
+    return it == properties.end() ? fallback : it->second;
+}
+
+// Manufacturer ids are four ASCII characters packed into a word.
+std::string fourCharacterCode(uint32_t value) {
+    std::string code;
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        char c = static_cast<char>((value >> shift) & 0xFF);
+        if (c != '\0' && c != ' ') {
+            code += c;
+        }
+    }
+    return code;
+}
+
+} // namespace
+
+StartupTimer::StartupTimer() : start(std::chrono::steady_clock::now()), last(start) {}
+
+void StartupTimer::phase(const std::string& name) {
+    auto now = std::chrono::steady_clock::now();
+    completed.emplace_back(name, micros(now - last));
+    last = now;
+}
+
+uint64_t StartupTimer::totalMicros() const {
+    return micros(last - start);
+}
+
+std::string StartupTimer::report() const {
+    std::ostringstream out;
+    out << "Startup completed in " << totalMicros() << " us (";
+    for (size_t i = 0; i < completed.size(); ++i) {
+        out << (i == 0 ? "" : ", ") << completed[i].first << " " << completed[i].second << " us";
+    }
+    out << ")";
+    return out.str();
+}
+
+void checkTPMDeviceAccess() {
+    for (const char* device : {"/dev/tpmrm0", "/dev/tpm0"}) {
+        struct stat statbuf;
+        if (stat(device, &statbuf) == 0 && access(device, R_OK | W_OK) != 0) {
+            logErrorMessage(std::string("No read/write access to ") + device +
+                            "; grant it to the service user (e.g. the tss group) during setup", serverErrorLogFile);
+        }
+    }
+}
+
+TPMProperties readTPMProperties(TPMContextPool::Lease& lease, TPM2_PT group) {
+    TPMProperties properties;
+    TPM2_PT next = group;
+    TPMI_YES_NO moreData = TPM2_YES;
+
+    while (moreData == TPM2_YES) {
+        TPMS_CAPABILITY_DATA* capabilityData = NULL;
+        TSS2_RC rc = timedEsys("Esys_GetCapability", [&] {
+            return Esys_GetCapability(lease.get(), ESYS_TR_NONE, ESYS_TR_NONE, ESYS_TR_NONE,
+                                      TPM2_CAP_TPM_PROPERTIES, next, TPM2_MAX_TPM_PROPERTIES, &moreData, &capabilityData);
+        });
+        if (rc != TSS2_RC_SUCCESS) {
+            lease.check(rc);
+            logTpmError(rc, "Esys_GetCapability");
+            throw std::runtime_error("Error reading TPM properties");
+        }
+
+        const auto& list = capabilityData->data.tpmProperties;
+        bool inGroup = list.count > 0;
+        for (UINT32 i = 0; i < list.count; ++i) {
+            TPM2_PT property = list.tpmProperty[i].property;
+            // Groups are 256 properties wide; stop once the TPM moves on to the next one.
+            if ((property & ~0xFFu) != group) {
+                inGroup = false;
+                break;
+            }
+            properties[property] = list.tpmProperty[i].value;
+            next = property + 1;
+        }
+        Esys_Free(capabilityData);
+        if (!inGroup) {
+            break;
+        }
+    }
+    return properties;
+}
+
+void resetDALockoutIfNeeded(TPMContextPool::Lease& lease, const TPMProperties& variable) {
+    uint32_t failures = propertyOr(variable, TPM2_PT_LOCKOUT_COUNTER, 0);
+    bool inLockout = (propertyOr(variable, TPM2_PT_PERMANENT, 0) & TPMA_PERMANENT_INLOCKOUT) != 0;
+    if (failures == 0 && !inLockout) {
+        return;
+    }
+
+    TSS2_RC rc = timedEsys("Esys_DictionaryAttackLockReset", [&] {
+        return Esys_DictionaryAttackLockReset(lease.get(), ESYS_TR_RH_LOCKOUT, ESYS_TR_PASSWORD, ESYS_TR_NONE, ESYS_TR_NONE);
+    });
+    if (rc != TSS2_RC_SUCCESS) {
+        // Not fatal: a lockout hierarchy with its own password has to be reset by an operator.
+        lease.check(rc);
+        logTpmError(rc, "Esys_DictionaryAttackLockReset");
+        return;
+    }
+    logMessage("TPM DA Lockout cleared (" + std::to_string(failures) + " failed authorizations" +
+               (inLockout ? ", was in lockout)" : ")"), serverLogFile);
+}
+
+void logTPMSummary(const TPMProperties& fixed, const TPMProperties& variable) {
+    std::ostringstream out;
+    uint32_t firmware = propertyOr(fixed, TPM2_PT_FIRMWARE_VERSION_1, 0);
+    out << "TPM " << fourCharacterCode(propertyOr(fixed, TPM2_PT_MANUFACTURER, 0))
+        << " firmware " << (firmware >> 16) << "." << (firmware & 0xFFFF)
+        << ", max digest " << propertyOr(fixed, TPM2_PT_MAX_DIGEST, 0)
+        << ", input buffer " << propertyOr(fixed, TPM2_PT_INPUT_BUFFER, 0)
+        << ", lockout counter " << propertyOr(variable, TPM2_PT_LOCKOUT_COUNTER, 0)
+        << "/" << propertyOr(variable, TPM2_PT_MAX_AUTH_FAIL, 0)
+        << " (" << fixed.size() << " fixed, " << variable.size() << " variable properties)";
+    logMessage(out.str(), serverLogFile);
+}
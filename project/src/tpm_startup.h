@@ -0,0 +1,46 @@
+// tpm_startup.h
+#ifndef TPM_STARTUP_H
+#define TPM_STARTUP_H
+
+#include "tpm_context_pool.h"
+#include <tss2/tss2_esys.h>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+using TPMProperties = std::map<TPM2_PT, uint32_t>;
+
+// Wall-clock breakdown of server startup, logged once initialization is done.
+class StartupTimer {
+public:
+    StartupTimer();
+
+    // Ends the current phase under the given name and starts the next one.
+    void phase(const std::string& name);
+    uint64_t totalMicros() const;
+    const std::vector<std::pair<std::string, uint64_t>>& phases() const { return completed; }
+    std::string report() const;
+
+private:
+    std::chrono::steady_clock::time_point start;
+    std::chrono::steady_clock::time_point last;
+    std::vector<std::pair<std::string, uint64_t>> completed;
+};
+
+// Warns when the TPM device nodes exist but are not readable and writable by
+// this process. Permissions belong to the service setup, not the server.
+void checkTPMDeviceAccess();
+
+// Reads one property group (TPM2_PT_FIXED or TPM2_PT_VAR) with Esys_GetCapability.
+TPMProperties readTPMProperties(TPMContextPool::Lease& lease, TPM2_PT group);
+
+// Resets dictionary-attack state only when the TPM reports failed
+// authorizations or lockout, instead of clearing it on every start.
+void resetDALockoutIfNeeded(TPMContextPool::Lease& lease, const TPMProperties& variable);
+
+void logTPMSummary(const TPMProperties& fixed, const TPMProperties& variable);
+
+#endif // TPM_STARTUP_H
@@ -5,9 +5,13 @@
 #include <vector>
 #include <string>
 
-std::vector<uint8_t> tpm_hash(const std::string& data);
-std::vector<uint8_t> tpm_encrypt(const std::string& data);
-std::vector<uint8_t> tpm_sign(const std::string& data);
+class TPMContextPool;
+class TPMBackend;
+
+std::vector<uint8_t> tpm_hash(TPMBackend& backend, const std::string& data);
+// Talks to the device directly, so it has no software equivalent.
+std::vector<uint8_t> tpm_encrypt(TPMContextPool& pool, const std::string& data);
+std::vector<uint8_t> tpm_sign(TPMBackend& backend, const std::string& data);
 void secure_erase(std::vector<uint8_t>& data);
 
 #endif // UTILS_H
@@ -106,6 +106,10 @@ pause_between_operations() {
 
 # Main script execution starts here
 
+# Unit tests need no TPM, so run them first
+log_and_explain "Running unit tests of the components that need no TPM."
+exec_command "$BUILD_DIR/kms_tests" || { log_error "Unit tests failed. Exiting script."; exit 1; }
+
 # Initialize TPM
 initialize_tpm
 
@@ -127,6 +131,17 @@ log_and_explain "Testing key fetching (NIST SP 800-57, Section 5.1.3: Key Retrie
 exec_command "$BUILD_DIR/kms_client fetchKey test_key_id" || log_error "Key fetching failed."
 pause_between_operations
 
+# Test both wire formats against the same key
+log_and_explain "Testing JSON and CBOR content negotiation."
+json_fetch=$(KMS_CLIENT_WIRE_FORMAT=json "$BUILD_DIR/kms_client" fetchKey test_key_id 2>>$ERROR_LOG) || log_error "JSON key fetching failed."
+cbor_fetch=$(KMS_CLIENT_WIRE_FORMAT=cbor "$BUILD_DIR/kms_client" fetchKey test_key_id 2>>$ERROR_LOG) || log_error "CBOR key fetching failed."
+echo "JSON: $json_fetch" | tee -a $TPM_LOG
+echo "CBOR: $cbor_fetch" | tee -a $TPM_LOG
+if [ "$json_fetch" != "Fetched key: test_key_value" ] || [ "$cbor_fetch" != "$json_fetch" ]; then
+    log_error "JSON and CBOR fetches did not both return the stored key."
+fi
+pause_between_operations
+
 # Test key rotation
 log_and_explain "Testing key rotation (NIST SP 800-57, Section 5.3.5: Key Rotation)."
 exec_command "$BUILD_DIR/kms_client rotateKey test_key_id" || log_error "Key rotation failed."
@@ -137,5 +152,22 @@ log_and_explain "Testing key deletion (NIST SP 800-57, Section 5.3.9: Key Deleti
 exec_command "$BUILD_DIR/kms_client deleteKey test_key_id" || log_error "Key deletion failed."
 pause_between_operations
 
+# Test batch operations
+log_and_explain "Testing batch key generation."
+exec_command "$BUILD_DIR/kms_client generateKeys 10" || log_error "Batch key generation failed."
+pause_between_operations
+
+log_and_explain "Testing batch key storage."
+exec_command "$BUILD_DIR/kms_client storeKeys batch_key_1=value_1 batch_key_2=value_2 batch_key_3=value_3" || log_error "Batch key storage failed."
+pause_between_operations
+
+log_and_explain "Testing batch key fetching."
+exec_command "$BUILD_DIR/kms_client fetchKeys batch_key_1 batch_key_2 batch_key_3" || log_error "Batch key fetching failed."
+pause_between_operations
+
+log_and_explain "Testing batch key deletion."
+exec_command "$BUILD_DIR/kms_client deleteKeys batch_key_1 batch_key_2 batch_key_3" || log_error "Batch key deletion failed."
+pause_between_operations
+
 log_and_explain "All tests completed."
 
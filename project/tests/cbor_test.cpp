@@ -0,0 +1,172 @@
+// cbor_test.cpp
+#include "test_harness.h"
+#include "cbor.h"
+#include <cstdint>
+#include <limits>
+
+namespace {
+
+std::string hex(const std::string& data) {
+    static const char digits[] = "0123456789abcdef";
+    std::string out;
+    for (unsigned char c : data) {
+        out += digits[c >> 4];
+        out += digits[c & 0x0f];
+    }
+    return out;
+}
+
+std::string unhex(const std::string& text) {
+    std::string out;
+    for (size_t i = 0; i + 1 < text.size(); i += 2) {
+        out += static_cast<char>(std::stoi(text.substr(i, 2), nullptr, 16));
+    }
+    return out;
+}
+
+// n arrays, each holding the next, around a single 0.
+std::string nestedArrays(int n) {
+    CborWriter writer;
+    for (int i = 0; i < n; ++i) {
+        writer.array(1);
+    }
+    writer.unsignedInt(0);
+    return writer.release();
+}
+
+std::string sampleDocument() {
+    CborWriter writer;
+    writer.map(4);
+    writer.field("key_id", std::string("1700000000-ab12-7"));
+    writer.field("key", std::vector<uint8_t>(32, 0xa5));
+    writer.field("expires_at", uint64_t(1700086400));
+    writer.field("cached", true);
+    return writer.release();
+}
+
+} // namespace
+
+TEST_CASE(cborMatchesRfc8949Encodings) {
+    // RFC 8949 Appendix A.
+    const std::pair<uint64_t, const char*> integers[] = {
+        {0, "00"}, {23, "17"}, {24, "1818"}, {100, "1864"}, {1000, "1903e8"},
+        {1000000, "1a000f4240"}, {1000000000000ULL, "1b000000e8d4a51000"},
+        {std::numeric_limits<uint64_t>::max(), "1bffffffffffffffff"},
+    };
+    for (const auto& entry : integers) {
+        CborWriter writer;
+        writer.unsignedInt(entry.first);
+        CHECK(hex(writer.data()) == entry.second);
+    }
+    CborWriter writer;
+    writer.boolean(false);
+    writer.boolean(true);
+    writer.text("");
+    writer.text("a");
+    writer.bytes(std::vector<uint8_t>{});
+    writer.array(0);
+    writer.map(0);
+    CHECK(hex(writer.data()) == "f4f56061614080a0");
+}
+
+TEST_CASE(cborRoundTripsEveryHeaderWidth) {
+    const uint64_t values[] = {0, 23, 24, 255, 256, 65535, 65536, 0xffffffffULL, 0x100000000ULL,
+                               std::numeric_limits<uint64_t>::max()};
+    CborWriter writer;
+    writer.array(sizeof(values) / sizeof(values[0]));
+    for (uint64_t value : values) {
+        writer.unsignedInt(value);
+    }
+    std::string body = writer.release();
+    CborReader reader(body);
+    CHECK(reader.array() == sizeof(values) / sizeof(values[0]));
+    for (uint64_t value : values) {
+        CHECK(reader.unsignedInt() == value);
+    }
+    CHECK(reader.atEnd());
+
+    for (size_t length : {size_t(0), size_t(23), size_t(24), size_t(300), size_t(70000)}) {
+        std::string text(length, 't');
+        std::vector<uint8_t> bytes(length, 0x7f);
+        CborWriter strings;
+        strings.text(text);
+        strings.bytes(bytes);
+        std::string encoded = strings.release();
+        CborReader stringReader(encoded);
+        CHECK(stringReader.text() == text);
+        auto view = stringReader.bytesView();
+        CHECK(view.second == length);
+        CHECK(std::vector<uint8_t>(view.first, view.first + view.second) == bytes);
+        // The view points into the body rather than at a copy.
+        const char* viewStart = reinterpret_cast<const char*>(view.first);
+        CHECK(viewStart >= encoded.data() && viewStart + length <= encoded.data() + encoded.size());
+        CHECK(stringReader.atEnd());
+    }
+}
+
+TEST_CASE(cborReadsMapsAndSkipsUnknownFields) {
+    std::string key_id;
+    std::vector<uint8_t> key;
+    uint64_t expiresAt = 0;
+    readCborMap(sampleDocument(), [&](const std::string& name, CborReader& reader) {
+        if (name == "key_id") {
+            key_id = reader.text();
+        } else if (name == "key") {
+            key = reader.bytes();
+        } else if (name == "expires_at") {
+            expiresAt = reader.unsignedInt();
+        } else {
+            return false;
+        }
+        return true;
+    });
+    CHECK(key_id == "1700000000-ab12-7");
+    CHECK(key == std::vector<uint8_t>(32, 0xa5));
+    CHECK(expiresAt == 1700086400);
+
+    CHECK_THROWS(readCborMap(sampleDocument() + std::string(1, '\0'),
+                             [](const std::string&, CborReader&) { return false; }),
+                 std::invalid_argument);
+}
+
+TEST_CASE(cborRejectsEveryTruncation) {
+    std::string body = sampleDocument();
+    for (size_t length = 0; length < body.size(); ++length) {
+        CHECK_THROWS(readCborMap(body.substr(0, length), [](const std::string&, CborReader&) { return false; }),
+                     std::invalid_argument);
+    }
+}
+
+TEST_CASE(cborRejectsLengthsPastTheBody) {
+    // Text and byte strings claiming 2^63 and 2^64-1 bytes.
+    CHECK_THROWS(CborReader(unhex("7b8000000000000000")).text(), std::invalid_argument);
+    CHECK_THROWS(CborReader(unhex("5bffffffffffffffff")).bytes(), std::invalid_argument);
+    CHECK_THROWS(CborReader(unhex("5bffffffffffffffff")).skip(), std::invalid_argument);
+    // Counts larger than the remaining body could hold are refused before any element is read.
+    CHECK_THROWS(CborReader(unhex("9bffffffffffffffff00")).array(), std::invalid_argument);
+    CHECK_THROWS(CborReader(unhex("a20000")).map(), std::invalid_argument);
+    CHECK_THROWS(CborReader(unhex("1a0000")).unsignedInt(), std::invalid_argument);
+}
+
+TEST_CASE(cborRejectsUnsupportedEncodings) {
+    CHECK_THROWS(CborReader(unhex("9f00ff")).array(), std::invalid_argument);      // indefinite array
+    CHECK_THROWS(CborReader(unhex("1c")).unsignedInt(), std::invalid_argument);    // reserved length
+    CHECK_THROWS(CborReader(unhex("20")).skip(), std::invalid_argument);           // negative integer
+    CHECK_THROWS(CborReader(unhex("c000")).skip(), std::invalid_argument);         // tag
+    CHECK_THROWS(CborReader(unhex("f6")).boolean(), std::invalid_argument);        // null
+    CHECK_THROWS(CborReader(unhex("6161")).bytes(), std::invalid_argument);        // text read as bytes
+    CHECK_THROWS(readCborMap(unhex("80"), [](const std::string&, CborReader&) { return false; }),
+                 std::invalid_argument);
+}
+
+TEST_CASE(cborBoundsNestingDepth) {
+    std::string body = nestedArrays(16);
+    CborReader shallow(body);
+    shallow.skip();
+    CHECK(shallow.atEnd());
+    std::string deep = nestedArrays(17);
+    CHECK_THROWS(CborReader(deep).skip(), std::invalid_argument);
+    // A hostile body nested far deeper still fails cleanly instead of exhausting the stack.
+    std::string hostile(100000, '\x81');
+    CHECK_THROWS(CborReader(hostile).skip(), std::invalid_argument);
+}
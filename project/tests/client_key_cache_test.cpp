@@ -0,0 +1,109 @@
+// client_key_cache_test.cpp
+#include "test_harness.h"
+#include "client_key_cache.h"
+#include <thread>
+
+namespace {
+
+KeyBuffer keyOf(uint8_t fill, size_t size = 32) {
+    KeyBuffer key(size);
+    for (size_t i = 0; i < size; ++i) {
+        key.data()[i] = fill;
+    }
+    return key;
+}
+
+bool holds(ClientKeyCache& cache, const std::string& key_id, uint8_t fill) {
+    KeyBuffer key;
+    if (cache.find(key_id, key) != ClientKeyCache::Lookup::Hit || key.size() != 32) {
+        return false;
+    }
+    for (uint8_t byte : key) {
+        if (byte != fill) {
+            return false;
+        }
+    }
+    return true;
+}
+
+ClientKeyCacheConfig smallCache() {
+    ClientKeyCacheConfig config;
+    config.enabled = true;
+    config.maxEntries = 3;
+    return config;
+}
+
+} // namespace
+
+TEST_CASE(clientKeyCacheHandsOutCopies) {
+    ClientKeyCache cache(smallCache());
+    KeyBuffer missing;
+    CHECK(cache.find("a", missing) == ClientKeyCache::Lookup::Miss);
+
+    KeyBuffer original = keyOf(1);
+    cache.put("a", original);
+    original.data()[0] = 9;
+    CHECK(holds(cache, "a", 1));
+
+    // Changing a returned key does not change the cached one.
+    KeyBuffer hit;
+    CHECK(cache.find("a", hit) == ClientKeyCache::Lookup::Hit);
+    CHECK(hit.data() != original.data());
+    hit.data()[0] = 9;
+    CHECK(holds(cache, "a", 1));
+
+    cache.put("a", keyOf(2));
+    CHECK(holds(cache, "a", 2));
+    CHECK(cache.stats().entries == 1);
+    CHECK(cache.stats().misses == 1);
+}
+
+TEST_CASE(clientKeyCacheRemembersNotFound) {
+    ClientKeyCacheConfig config = smallCache();
+    config.notFoundTtl = std::chrono::milliseconds(20);
+    ClientKeyCache cache(config);
+    cache.putNotFound("gone");
+    KeyBuffer key;
+    CHECK(cache.find("gone", key) == ClientKeyCache::Lookup::NotFound);
+    CHECK(key.empty());
+    std::this_thread::sleep_for(std::chrono::milliseconds(30));
+    CHECK(cache.find("gone", key) == ClientKeyCache::Lookup::Miss);
+
+    // A stored key replaces the not-found answer.
+    cache.putNotFound("gone");
+    cache.put("gone", keyOf(3));
+    CHECK(holds(cache, "gone", 3));
+}
+
+TEST_CASE(clientKeyCacheExpiresEvictsAndInvalidates) {
+    ClientKeyCacheConfig config = smallCache();
+    config.ttl = std::chrono::milliseconds(20);
+    ClientKeyCache expiring(config);
+    expiring.put("a", keyOf(1));
+    std::this_thread::sleep_for(std::chrono::milliseconds(30));
+    KeyBuffer key;
+    CHECK(expiring.find("a", key) == ClientKeyCache::Lookup::Miss);
+    CHECK(expiring.stats().entries == 0);
+
+    ClientKeyCache cache(smallCache());
+    cache.put("a", keyOf(1));
+    cache.put("b", keyOf(2));
+    cache.put("c", keyOf(3));
+    CHECK(holds(cache, "a", 1));   // now the most recently used
+    cache.put("d", keyOf(4));      // evicts b
+    CHECK(cache.find("b", key) == ClientKeyCache::Lookup::Miss);
+    CHECK(holds(cache, "a", 1));
+    CHECK(holds(cache, "c", 3));
+    CHECK(holds(cache, "d", 4));
+    CHECK(cache.stats().evictions == 1);
+
+    cache.invalidate("c");
+    CHECK(cache.find("c", key) == ClientKeyCache::Lookup::Miss);
+    cache.clear();
+    CHECK(cache.stats().entries == 0);
+    CHECK(cache.find("a", key) == ClientKeyCache::Lookup::Miss);
+
+    // Keys longer than maxKeyBytes are not cached at all.
+    cache.put("long", keyOf(5, smallCache().maxKeyBytes + 1));
+    CHECK(cache.find("long", key) == ClientKeyCache::Lookup::Miss);
+}
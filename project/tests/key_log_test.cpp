@@ -0,0 +1,255 @@
+// key_log_test.cpp
+#include "test_harness.h"
+#include "key_log.h"
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <thread>
+
+namespace {
+
+constexpr uint64_t magicSize = 8;
+
+KeyLogRecord put(const std::string& key_id, uint8_t fill) {
+    return KeyLogRecord{KeyLogRecordType::Put, key_id, std::vector<uint8_t>(16, fill), 1700000000, 1700086400};
+}
+
+KeyLogConfig configFor(const std::string& directory) {
+    KeyLogConfig config;
+    config.directory = directory;
+    return config;
+}
+
+void writeAll(const std::string& directory, const std::vector<KeyLogRecord>& records) {
+    KeyLog log(configFor(directory));
+    log.recover([](const KeyLogRecord&) {});
+    for (const auto& record : records) {
+        log.write({record}, [] {});
+    }
+}
+
+std::vector<KeyLogRecord> recoverAll(const std::string& directory, KeyLogStats* stats = nullptr) {
+    std::vector<KeyLogRecord> records;
+    KeyLog log(configFor(directory));
+    log.recover([&](const KeyLogRecord& record) { records.push_back(record); });
+    if (stats != nullptr) {
+        *stats = log.stats();
+    }
+    return records;
+}
+
+bool sameRecord(const KeyLogRecord& a, const KeyLogRecord& b) {
+    return a.type == b.type && a.keyId == b.keyId && a.sealedBlob == b.sealedBlob &&
+           a.createdAt == b.createdAt && a.expiresAt == b.expiresAt;
+}
+
+std::string logPath(const std::string& directory) {
+    return (std::filesystem::path(directory) / "keys.log").string();
+}
+
+void flipByte(const std::string& path, uint64_t offset) {
+    std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+    file.seekg(static_cast<std::streamoff>(offset));
+    char byte = 0;
+    file.read(&byte, 1);
+    byte = static_cast<char>(byte ^ 0x5a);
+    file.seekp(static_cast<std::streamoff>(offset));
+    file.write(&byte, 1);
+}
+
+// Applies a replayed record to a key id -> record map, as KeyManager does.
+void applyTo(std::map<std::string, KeyLogRecord>& state, const KeyLogRecord& record) {
+    if (record.type == KeyLogRecordType::Erase) {
+        state.erase(record.keyId);
+    } else {
+        state[record.keyId] = record;
+    }
+}
+
+} // namespace
+
+TEST_CASE(keyLogReplaysEveryRecordType) {
+    std::string directory = testDirectory("keyLogReplaysEveryRecordType");
+    std::vector<KeyLogRecord> written = {
+        put("a", 1),
+        KeyLogRecord{KeyLogRecordType::Kek, "1", std::vector<uint8_t>(48, 2)},
+        KeyLogRecord{KeyLogRecordType::Erase, "a", {}},
+        KeyLogRecord{KeyLogRecordType::ReplicaPosition, "00000000000000ff-7", {}},
+    };
+    writeAll(directory, written);
+
+    KeyLogStats stats;
+    auto recovered = recoverAll(directory, &stats);
+    CHECK(recovered.size() == written.size());
+    for (size_t i = 0; i < written.size(); ++i) {
+        CHECK(sameRecord(recovered[i], written[i]));
+    }
+    CHECK(stats.recoveredRecords == written.size());
+    CHECK(stats.truncatedBytes == 0);
+}
+
+TEST_CASE(keyLogTruncatesTornTail) {
+    std::string directory = testDirectory("keyLogTruncatesTornTail");
+    writeAll(directory, {put("a", 1), put("b", 2)});
+    uint64_t intact = std::filesystem::file_size(logPath(directory));
+    writeAll(directory, {put("c", 3)});
+    uint64_t full = std::filesystem::file_size(logPath(directory));
+
+    // A crash partway through the last append.
+    std::filesystem::resize_file(logPath(directory), full - 5);
+    KeyLogStats stats;
+    auto recovered = recoverAll(directory, &stats);
+    CHECK(recovered.size() == 2);
+    CHECK(recovered[1].keyId == "b");
+    CHECK(stats.truncatedBytes == full - 5 - intact);
+    CHECK(std::filesystem::file_size(logPath(directory)) == intact);
+
+    // Appends after the truncation are not stranded behind the torn record.
+    writeAll(directory, {put("d", 4)});
+    recovered = recoverAll(directory);
+    CHECK(recovered.size() == 3);
+    CHECK(sameRecord(recovered[2], put("d", 4)));
+}
+
+TEST_CASE(keyLogStopsAtChecksumMismatch) {
+    std::string directory = testDirectory("keyLogStopsAtChecksumMismatch");
+    writeAll(directory, {put("a", 1), put("b", 2)});
+    uint64_t intact = std::filesystem::file_size(logPath(directory));
+    writeAll(directory, {put("c", 3)});
+    uint64_t full = std::filesystem::file_size(logPath(directory));
+
+    // Damage the last record's payload but not its length.
+    flipByte(logPath(directory), full - 1);
+    KeyLogStats stats;
+    auto recovered = recoverAll(directory, &stats);
+    CHECK(recovered.size() == 2);
+    CHECK(stats.truncatedBytes == full - intact);
+    CHECK(std::filesystem::file_size(logPath(directory)) == intact);
+}
+
+TEST_CASE(keyLogRejectsUnknownFormat) {
+    std::string directory = testDirectory("keyLogRejectsUnknownFormat");
+    writeAll(directory, {put("a", 1)});
+    flipByte(logPath(directory), 0);
+    CHECK_THROWS(recoverAll(directory), std::runtime_error);
+}
+
+TEST_CASE(keyLogIgnoresUnfinishedSnapshot) {
+    std::string directory = testDirectory("keyLogIgnoresUnfinishedSnapshot");
+    writeAll(directory, {put("a", 1), put("b", 2)});
+    // A crash while compacting, before the new snapshot was renamed into place.
+    std::ofstream(std::filesystem::path(directory) / "keys.snapshot.tmp", std::ios::binary) << "KMSSNP01 partial";
+
+    auto recovered = recoverAll(directory);
+    CHECK(recovered.size() == 2);
+    CHECK(recovered[0].keyId == "a");
+    CHECK(recovered[1].keyId == "b");
+}
+
+TEST_CASE(keyLogRecoversCompactionInterruptedBeforeTruncate) {
+    std::string directory = testDirectory("keyLogRecoversCompactionInterruptedBeforeTruncate");
+    std::string savedLog = (std::filesystem::path(directory) / "keys.log.saved").string();
+    std::map<std::string, KeyLogRecord> state;
+    {
+        KeyLogConfig config = configFor(directory);
+        config.compactAfterBytes = magicSize + 1;   // any record triggers a compaction
+        KeyLog log(config);
+        log.recover([](const KeyLogRecord&) {});
+        log.setSnapshotSource([&](const KeyLog::Visitor& visit) {
+            // The log as it stands just before this compaction truncates it.
+            std::filesystem::copy_file(logPath(directory), savedLog, std::filesystem::copy_options::overwrite_existing);
+            for (const auto& entry : state) {
+                visit(entry.second);
+            }
+        });
+        for (const auto& record : {put("a", 1), put("b", 2), KeyLogRecord{KeyLogRecordType::Erase, "a", {}}, put("b", 3), put("c", 4)}) {
+            log.write({record}, [&] { applyTo(state, record); });
+        }
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while ((log.stats().compactions == 0 || log.stats().logBytes != magicSize) &&
+               std::chrono::steady_clock::now() < deadline) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        CHECK(log.stats().compactions > 0);
+        CHECK(log.stats().logBytes == magicSize);
+    }
+    CHECK(std::filesystem::exists(std::filesystem::path(directory) / "keys.snapshot"));
+
+    // Put back the log the last compaction had already folded into the
+    // snapshot, as if the process died between the rename and the truncate.
+    std::filesystem::copy_file(savedLog, logPath(directory), std::filesystem::copy_options::overwrite_existing);
+    std::map<std::string, KeyLogRecord> recovered;
+    KeyLog log(configFor(directory));
+    log.recover([&](const KeyLogRecord& record) { applyTo(recovered, record); });
+    CHECK(recovered.size() == state.size());
+    for (const auto& entry : state) {
+        CHECK(recovered.count(entry.first) == 1);
+        CHECK(sameRecord(recovered[entry.first], entry.second));
+    }
+}
+
+TEST_CASE(keyLogRejectsCorruptSnapshot) {
+    std::string directory = testDirectory("keyLogRejectsCorruptSnapshot");
+    writeAll(directory, {});
+    std::ofstream(std::filesystem::path(directory) / "keys.snapshot", std::ios::binary) << "KMSSNP01 not a record";
+    CHECK_THROWS(recoverAll(directory), std::runtime_error);
+}
+
+TEST_CASE(keyLogAppliesConcurrentWritesInLogOrder) {
+    std::string directory = testDirectory("keyLogAppliesConcurrentWritesInLogOrder");
+    const size_t threads = 8;
+    const size_t writesPerThread = 40;
+    std::map<std::string, KeyLogRecord> state;
+    std::vector<KeyLogRecord> applied;
+    std::mutex appliedMutex;   // applies of successive groups may run on different threads
+    KeyLogStats stats;
+    {
+        KeyLogConfig config = configFor(directory);
+        config.groupCommitDelay = std::chrono::microseconds(200);   // so writers share commits
+        KeyLog log(config);
+        log.recover([](const KeyLogRecord&) {});
+        std::vector<std::thread> writers;
+        for (size_t t = 0; t < threads; ++t) {
+            writers.emplace_back([&, t] {
+                for (size_t i = 0; i < writesPerThread; ++i) {
+                    // Every writer overwrites the same key, and every third write
+                    // also touches a second one, so groups mix one- and two-record writes.
+                    std::vector<KeyLogRecord> records = {put("same", static_cast<uint8_t>(t))};
+                    records[0].sealedBlob[1] = static_cast<uint8_t>(i);
+                    if (i % 3 == 0) {
+                        records.push_back(put("other", static_cast<uint8_t>(t)));
+                    }
+                    log.write(records, [&, records] {
+                        std::lock_guard<std::mutex> lock(appliedMutex);
+                        for (const auto& record : records) {
+                            applyTo(state, record);
+                            applied.push_back(record);
+                        }
+                    });
+                }
+            });
+        }
+        for (auto& writer : writers) {
+            writer.join();
+        }
+        stats = log.stats();
+    }
+
+    auto replayed = recoverAll(directory);
+    CHECK(stats.records == replayed.size());
+    CHECK(applied.size() == replayed.size());
+    for (size_t i = 0; i < std::min(applied.size(), replayed.size()); ++i) {
+        CHECK(sameRecord(applied[i], replayed[i]));
+    }
+    std::map<std::string, KeyLogRecord> recovered;
+    for (const auto& record : replayed) {
+        applyTo(recovered, record);
+    }
+    CHECK(recovered.size() == state.size());
+    for (const auto& entry : state) {
+        CHECK(recovered.count(entry.first) == 1);
+        CHECK(sameRecord(recovered[entry.first], entry.second));
+    }
+}
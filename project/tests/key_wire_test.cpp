@@ -0,0 +1,61 @@
+// key_wire_test.cpp
+#include "test_harness.h"
+#include "key_wire.h"
+
+namespace {
+
+KeyBuffer keyOf(size_t size) {
+    KeyBuffer key(size);
+    for (size_t i = 0; i < size; ++i) {
+        key.data()[i] = static_cast<uint8_t>(i * 37 + 250);
+    }
+    return key;
+}
+
+bool sameKey(const KeyBuffer& a, const KeyBuffer& b) {
+    return std::vector<uint8_t>(a.begin(), a.end()) == std::vector<uint8_t>(b.begin(), b.end());
+}
+
+} // namespace
+
+TEST_CASE(keyRepliesRoundTripInBothFormats) {
+    // Empty, short, a full arena slot and one that needs locked pages of its own.
+    for (size_t size : {size_t(0), size_t(1), size_t(32), size_t(64), size_t(65), size_t(300)}) {
+        KeyBuffer key = keyOf(size);
+        for (bool cbor : {false, true}) {
+            CHECK(sameKey(decodeKeyReply(encodeKeyReply("1700000000-ab12-7", key, cbor), cbor), key));
+        }
+    }
+}
+
+TEST_CASE(jsonKeyRepliesMatchBatchItems) {
+    // A single-key reply carries the key as the same plain byte array as a
+    // batch item, not as a json binary value the other side cannot read.
+    KeyBuffer key = keyOf(32);
+    auto reply = nlohmann::json::parse(encodeKeyReply("k", key, false));
+    CHECK(reply.at("key_id") == "k");
+    CHECK(reply.at("key").is_array());
+    CHECK(reply.at("key") == keyToJson(key));
+    CHECK(sameKey(keyFromJson(nlohmann::json::parse(keyToJson(key).dump())), key));
+}
+
+TEST_CASE(keyRepliesRejectMalformedBodies) {
+    CHECK_THROWS(decodeKeyReply("not json", false), std::invalid_argument);
+    CHECK_THROWS(decodeKeyReply("[1,2,3]", false), std::invalid_argument);
+    CHECK_THROWS(decodeKeyReply(R"({"key_id":"k"})", false), std::invalid_argument);
+    CHECK_THROWS(decodeKeyReply(R"({"key":{"bytes":[1,2,3],"subtype":null}})", false), std::invalid_argument);
+    CHECK_THROWS(decodeKeyReply(R"({"key":[1,256]})", false), std::invalid_argument);
+    CHECK_THROWS(decodeKeyReply(R"({"key":[1,-1]})", false), std::invalid_argument);
+    CHECK_THROWS(decodeKeyReply(R"({"key":"AQID"})", false), std::invalid_argument);
+
+    std::string cbor = encodeKeyReply("k", keyOf(16), true);
+    CHECK_THROWS(decodeKeyReply(cbor.substr(0, cbor.size() - 1), true), std::invalid_argument);
+    CborWriter noKey;
+    noKey.map(1);
+    noKey.field("key_id", std::string("k"));
+    CHECK_THROWS(decodeKeyReply(noKey.release(), true), std::invalid_argument);
+    CborWriter textKey;
+    textKey.map(1);
+    textKey.field("key", std::string("AQID"));
+    CHECK_THROWS(decodeKeyReply(textKey.release(), true), std::invalid_argument);
+}
@@ -0,0 +1,135 @@
+// merkle_tree_test.cpp
+#include "test_harness.h"
+#include "batch_signer.h"
+#include "merkle_tree.h"
+#include "software_tpm_backend.h"
+#include <openssl/sha.h>
+#include <future>
+
+namespace {
+
+std::vector<uint8_t> digestOf(size_t i) {
+    std::string text = "document " + std::to_string(i);
+    std::vector<uint8_t> digest(SHA256_DIGEST_LENGTH);
+    SHA256(reinterpret_cast<const unsigned char*>(text.data()), text.size(), digest.data());
+    return digest;
+}
+
+std::vector<std::vector<uint8_t>> digests(size_t count) {
+    std::vector<std::vector<uint8_t>> out;
+    for (size_t i = 0; i < count; ++i) {
+        out.push_back(digestOf(i));
+    }
+    return out;
+}
+
+} // namespace
+
+TEST_CASE(merkleProofsRebuildTheRootForEveryLeaf) {
+    for (size_t size = 1; size <= 17; ++size) {
+        auto leaves = digests(size);
+        MerkleTree tree(leaves);
+        CHECK(tree.size() == size);
+        for (size_t i = 0; i < size; ++i) {
+            CHECK(merkleRootFromProof(leaves[i], i, size, tree.proof(i)) == tree.root());
+        }
+    }
+    // A tree of one is the leaf hash, never the caller's digest itself.
+    auto single = digests(1);
+    CHECK(MerkleTree(single).root() == merkleLeafHash(single[0]));
+    CHECK(MerkleTree(single).root() != single[0]);
+}
+
+TEST_CASE(merkleProofsRejectModifiedLeavesAndSiblings) {
+    const size_t size = 11;
+    auto leaves = digests(size);
+    MerkleTree tree(leaves);
+    for (size_t i = 0; i < size; ++i) {
+        auto proof = tree.proof(i);
+
+        auto leaf = leaves[i];
+        leaf[0] ^= 0x01;
+        CHECK(merkleRootFromProof(leaf, i, size, proof) != tree.root());
+
+        for (size_t level = 0; level < proof.size(); ++level) {
+            auto tampered = proof;
+            tampered[level][31] ^= 0x80;
+            CHECK(merkleRootFromProof(leaves[i], i, size, tampered) != tree.root());
+        }
+
+        // The same proof at another position does not fit.
+        size_t other = (i + 1) % size;
+        bool rejected = false;
+        try {
+            rejected = merkleRootFromProof(leaves[i], other, size, proof) != tree.root();
+        } catch (const std::invalid_argument&) {
+            rejected = true;
+        }
+        CHECK(rejected);
+    }
+
+    auto proof = tree.proof(3);
+    auto longer = proof;
+    longer.push_back(leaves[0]);
+    CHECK_THROWS(merkleRootFromProof(leaves[3], 3, size, longer), std::invalid_argument);
+    proof.pop_back();
+    CHECK_THROWS(merkleRootFromProof(leaves[3], 3, size, proof), std::invalid_argument);
+    CHECK_THROWS(merkleRootFromProof(leaves[3], size, size, tree.proof(3)), std::invalid_argument);
+    CHECK_THROWS(tree.proof(size), std::out_of_range);
+}
+
+TEST_CASE(batchSignaturesVerifyAgainstTheSignedRoot) {
+    SoftwareTPMBackend backend;
+    BatchSignerConfig config;
+    config.window = std::chrono::milliseconds(200);
+    config.maxBatchSize = 6;
+    BatchSigner signer(backend, config);
+    const std::string& publicKey = backend.signingPublicKeyPem();
+
+    // A full batch is signed at once, without waiting out the window.
+    std::vector<std::future<BatchSignature>> pending;
+    for (size_t i = 0; i < config.maxBatchSize; ++i) {
+        pending.push_back(signer.sign(digestOf(i)));
+    }
+    std::vector<BatchSignature> signatures;
+    for (auto& result : pending) {
+        signatures.push_back(result.get());
+    }
+    for (size_t i = 0; i < signatures.size(); ++i) {
+        CHECK(signatures[i].treeSize == config.maxBatchSize);
+        CHECK(signatures[i].root == signatures[0].root);
+        CHECK(verifyBatchSignature(digestOf(i), signatures[i], publicKey));
+        // Another leaf's proof does not carry this digest to the root.
+        CHECK(!verifyBatchSignature(digestOf(i), signatures[(i + 1) % signatures.size()], publicKey));
+    }
+    CHECK(signer.stats().batches == 1);
+
+    BatchSignature tampered = signatures[2];
+    tampered.proof[0][0] ^= 0x01;
+    CHECK(!verifyBatchSignature(digestOf(2), tampered, publicKey));
+
+    auto modifiedDigest = digestOf(2);
+    modifiedDigest[5] ^= 0x01;
+    CHECK(!verifyBatchSignature(modifiedDigest, signatures[2], publicKey));
+
+    BatchSignature forgedRoot = signatures[2];
+    forgedRoot.root[0] ^= 0x01;
+    CHECK(!verifyBatchSignature(digestOf(2), forgedRoot, publicKey));
+
+    BatchSignature badSignature = signatures[2];
+    badSignature.signature.back() ^= 0x01;
+    CHECK(!verifyBatchSignature(digestOf(2), badSignature, publicKey));
+
+    // A root signed for another batch does not vouch for this one.
+    BatchSignature unbatched = signer.signUnbatched(digestOf(100));
+    CHECK(verifyBatchSignature(digestOf(100), unbatched, publicKey));
+    BatchSignature swapped = signatures[2];
+    swapped.signature = unbatched.signature;
+    CHECK(!verifyBatchSignature(digestOf(2), swapped, publicKey));
+
+    // And a key other than the signer's does not verify anything.
+    SoftwareTPMBackend otherBackend;
+    CHECK(!verifyBatchSignature(digestOf(2), signatures[2], otherBackend.signingPublicKeyPem()));
+
+    CHECK_THROWS(signer.sign(std::vector<uint8_t>(31)), std::invalid_argument);
+}
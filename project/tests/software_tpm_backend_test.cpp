@@ -0,0 +1,37 @@
+// software_tpm_backend_test.cpp
+#include "test_harness.h"
+#include "software_tpm_backend.h"
+#include <filesystem>
+
+TEST_CASE(softwareBackendStateSurvivesRestart) {
+    std::string directory = testDirectory("softwareBackendStateSurvivesRestart");
+    SoftwareTPMConfig config;
+    // The parent directory does not exist yet, as with a fresh KMS_DATA_DIR.
+    config.stateFile = (std::filesystem::path(directory) / "data" / "software_tpm.pem").string();
+
+    const uint8_t bytes[] = {1, 2, 3, 4, 5, 6, 7, 8};
+    std::vector<uint8_t> blob;
+    std::string publicKey;
+    {
+        SoftwareTPMBackend backend(config);
+        blob = backend.seal("k", KeyBuffer(bytes, sizeof(bytes))).get();
+        publicKey = backend.signingPublicKeyPem();
+    }
+    CHECK(std::filesystem::exists(config.stateFile));
+
+    SoftwareTPMBackend restarted(config);
+    CHECK(restarted.signingPublicKeyPem() == publicKey);
+    KeyBuffer key = restarted.unseal("k", 1, blob).get();
+    CHECK(std::vector<uint8_t>(key.begin(), key.end()) == std::vector<uint8_t>(bytes, bytes + sizeof(bytes)));
+
+    // Without a state file every instance has a key of its own.
+    SoftwareTPMBackend ephemeral;
+    CHECK(ephemeral.signingPublicKeyPem() != publicKey);
+    bool rejected = false;
+    try {
+        ephemeral.unseal("k", 1, blob).get();
+    } catch (const std::exception&) {
+        rejected = true;
+    }
+    CHECK(rejected);
+}
@@ -0,0 +1,165 @@
+// stream_cipher_test.cpp
+#include "test_harness.h"
+#include "stream_cipher.h"
+#include <algorithm>
+#include <stdexcept>
+
+namespace {
+
+const std::vector<uint8_t> wrappedKey = {'w', 'r', 'a', 'p', 'p', 'e', 'd'};
+
+KeyBuffer dataKey() {
+    KeyBuffer key(32);
+    for (size_t i = 0; i < key.size(); ++i) {
+        key.data()[i] = static_cast<uint8_t>(i * 7 + 1);
+    }
+    return key;
+}
+
+// The header and then one entry per frame, exactly as the encryptor emitted them.
+struct EncryptedStream {
+    std::vector<uint8_t> header;
+    std::vector<std::vector<uint8_t>> frames;
+
+    std::vector<uint8_t> joined() const {
+        std::vector<uint8_t> out = header;
+        for (const auto& frame : frames) {
+            out.insert(out.end(), frame.begin(), frame.end());
+        }
+        return out;
+    }
+};
+
+std::vector<uint8_t> pattern(size_t size) {
+    std::vector<uint8_t> data(size);
+    for (size_t i = 0; i < size; ++i) {
+        data[i] = static_cast<uint8_t>(i * 31 + 3);
+    }
+    return data;
+}
+
+EncryptedStream encrypt(const std::vector<uint8_t>& plaintext, size_t chunkSize) {
+    EncryptedStream stream;
+    bool first = true;
+    StreamEncryptor encryptor(dataKey(), wrappedKey, chunkSize, [&](const uint8_t* data, size_t size) {
+        if (first) {
+            stream.header.assign(data, data + size);
+            first = false;
+        } else {
+            stream.frames.emplace_back(data, data + size);
+        }
+    });
+    encryptor.update(plaintext.data(), plaintext.size());
+    encryptor.finish();
+    return stream;
+}
+
+// Feeds ciphertext in pieces of at most step bytes and returns the plaintext.
+std::vector<uint8_t> decrypt(const std::vector<uint8_t>& ciphertext, size_t step) {
+    std::vector<uint8_t> plaintext;
+    StreamDecryptor decryptor(
+        [](const std::vector<uint8_t>& wrapped) {
+            if (wrapped != wrappedKey) {
+                throw std::runtime_error("unknown wrapped key");
+            }
+            return dataKey();
+        },
+        [&](const uint8_t* data, size_t size) { plaintext.insert(plaintext.end(), data, data + size); });
+    for (size_t offset = 0; offset < ciphertext.size(); offset += step) {
+        decryptor.update(ciphertext.data() + offset, std::min(step, ciphertext.size() - offset));
+    }
+    decryptor.finish();
+    CHECK(decryptor.plaintextSize() == plaintext.size());
+    return plaintext;
+}
+
+} // namespace
+
+TEST_CASE(streamCipherRoundTrips) {
+    const size_t chunkSize = 16;
+    for (size_t size : {size_t(0), size_t(1), chunkSize - 1, chunkSize, chunkSize + 1, 5 * chunkSize + 3}) {
+        std::vector<uint8_t> plaintext = pattern(size);
+        EncryptedStream stream = encrypt(plaintext, chunkSize);
+        // A full last chunk is still the flagged last frame, never followed by an empty one.
+        CHECK(stream.frames.size() == std::max<size_t>(1, (size + chunkSize - 1) / chunkSize));
+        std::vector<uint8_t> ciphertext = stream.joined();
+        CHECK(decrypt(ciphertext, 1) == plaintext);
+        CHECK(decrypt(ciphertext, 7) == plaintext);
+        CHECK(decrypt(ciphertext, ciphertext.size()) == plaintext);
+    }
+}
+
+TEST_CASE(streamCipherRejectsTruncation) {
+    std::vector<uint8_t> ciphertext = encrypt(pattern(50), 16).joined();
+    for (size_t length = 0; length < ciphertext.size(); ++length) {
+        std::vector<uint8_t> cut(ciphertext.begin(), ciphertext.begin() + length);
+        CHECK_THROWS(decrypt(cut, cut.size() + 1), std::invalid_argument);
+    }
+
+    // Dropping whole frames from the end leaves a stream that is well formed
+    // up to the cut, so it is the missing last-frame flag that gives it away.
+    EncryptedStream stream = encrypt(pattern(64), 16);
+    stream.frames.pop_back();
+    CHECK_THROWS(decrypt(stream.joined(), 16), std::invalid_argument);
+}
+
+TEST_CASE(streamCipherRejectsReorderedFrames) {
+    EncryptedStream stream = encrypt(pattern(64), 16);
+    CHECK(stream.frames.size() == 4);
+
+    EncryptedStream swapped = stream;
+    std::swap(swapped.frames[0], swapped.frames[1]);
+    CHECK_THROWS(decrypt(swapped.joined(), 64), std::invalid_argument);
+
+    EncryptedStream dropped = stream;
+    dropped.frames.erase(dropped.frames.begin() + 1);
+    CHECK_THROWS(decrypt(dropped.joined(), 64), std::invalid_argument);
+
+    EncryptedStream replayed = stream;
+    replayed.frames[2] = replayed.frames[1];
+    CHECK_THROWS(decrypt(replayed.joined(), 64), std::invalid_argument);
+
+    // Same key, but another stream's nonce prefix and header.
+    EncryptedStream other = encrypt(pattern(64), 16);
+    EncryptedStream spliced = stream;
+    spliced.frames[1] = other.frames[1];
+    CHECK_THROWS(decrypt(spliced.joined(), 64), std::invalid_argument);
+}
+
+TEST_CASE(streamCipherRejectsTampering) {
+    EncryptedStream stream = encrypt(pattern(40), 16);
+    std::vector<uint8_t> ciphertext = stream.joined();
+
+    // Every single-bit flip anywhere in the stream is caught: in the header it
+    // breaks the AAD or the key lookup, in a frame the tag or the length.
+    for (size_t offset = 0; offset < ciphertext.size(); ++offset) {
+        std::vector<uint8_t> tampered = ciphertext;
+        tampered[offset] ^= 0x01;
+        bool rejected = false;
+        try {
+            rejected = decrypt(tampered, tampered.size()) != pattern(40);
+        } catch (const std::invalid_argument&) {
+            rejected = true;
+        }
+        CHECK(rejected);
+    }
+
+    // Marking a middle frame as the last one changes its nonce.
+    EncryptedStream early = stream;
+    early.frames[0][0] |= 0x80;
+    early.frames.resize(1);
+    CHECK_THROWS(decrypt(early.joined(), 64), std::invalid_argument);
+
+    // Nothing may follow the last frame.
+    std::vector<uint8_t> trailing = ciphertext;
+    trailing.push_back(0);
+    CHECK_THROWS(decrypt(trailing, trailing.size()), std::invalid_argument);
+}
+
+TEST_CASE(streamCipherRejectsBadParameters) {
+    auto discard = [](const uint8_t*, size_t) {};
+    CHECK_THROWS(StreamEncryptor(KeyBuffer(16), wrappedKey, 16, discard), std::invalid_argument);
+    CHECK_THROWS(StreamEncryptor(dataKey(), wrappedKey, 0, discard), std::invalid_argument);
+    CHECK_THROWS(StreamEncryptor(dataKey(), wrappedKey, maxStreamChunkSize + 1, discard), std::invalid_argument);
+    CHECK_THROWS(StreamEncryptor(dataKey(), {}, 16, discard), std::invalid_argument);
+}
@@ -0,0 +1,58 @@
+// test_harness.h
+#ifndef TEST_HARNESS_H
+#define TEST_HARNESS_H
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Just enough of a test framework for the parts of the service that run
+// without a TPM: the on-disk and wire formats and the crypto built on
+// OpenSSL. Paths through the TPM are exercised by test_kms.sh.
+struct TestCase {
+    const char* name;
+    void (*run)();
+};
+
+std::vector<TestCase>& testRegistry();
+
+struct TestRegistrar {
+    TestRegistrar(const char* name, void (*run)()) { testRegistry().push_back({name, run}); }
+};
+
+struct TestFailure : std::runtime_error {
+    using std::runtime_error::runtime_error;
+};
+
+// Fresh, empty directory under the system temporary directory, named after the test.
+std::string testDirectory(const std::string& name);
+
+#define TEST_CASE(name)                                         \
+    static void name();                                         \
+    static const TestRegistrar name##Registrar(#name, name);    \
+    static void name()
+
+#define TEST_FAIL(message) \
+    throw TestFailure(std::string(__FILE__) + ":" + std::to_string(__LINE__) + ": " + (message))
+
+#define CHECK(condition)                              \
+    do {                                              \
+        if (!(condition)) {                           \
+            TEST_FAIL("CHECK(" #condition ") failed"); \
+        }                                             \
+    } while (0)
+
+#define CHECK_THROWS(expression, exceptionType)                           \
+    do {                                                                  \
+        bool thrown = false;                                              \
+        try {                                                             \
+            (void)(expression);                                           \
+        } catch (const exceptionType&) {                                  \
+            thrown = true;                                                \
+        }                                                                 \
+        if (!thrown) {                                                    \
+            TEST_FAIL(#expression " did not throw " #exceptionType);      \
+        }                                                                 \
+    } while (0)
+
+#endif // TEST_HARNESS_H
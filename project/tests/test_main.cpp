@@ -0,0 +1,46 @@
+// test_main.cpp
+#include "test_harness.h"
+#include "logger.h"
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <iostream>
+
+std::vector<TestCase>& testRegistry() {
+    static std::vector<TestCase> registry;
+    return registry;
+}
+
+std::string testDirectory(const std::string& name) {
+    auto directory = std::filesystem::temp_directory_path() / "kms_tests" / name;
+    std::filesystem::remove_all(directory);
+    std::filesystem::create_directories(directory);
+    return directory.string();
+}
+
+// Runs every registered test, or those whose name contains argv[1].
+int main(int argc, char* argv[]) {
+    LoggerConfig logConfig;
+    logConfig.level = LogLevel::Error;
+    logConfig.console = false;
+    logConfig.files = false;
+    configureLogger(logConfig);
+
+    const char* filter = argc > 1 ? argv[1] : "";
+    size_t run = 0, failed = 0;
+    for (const auto& test : testRegistry()) {
+        if (std::strstr(test.name, filter) == nullptr) {
+            continue;
+        }
+        ++run;
+        try {
+            test.run();
+            std::cout << "[ ok ] " << test.name << std::endl;
+        } catch (const std::exception& e) {
+            ++failed;
+            std::cout << "[FAIL] " << test.name << ": " << e.what() << std::endl;
+        }
+    }
+    std::cout << run - failed << "/" << run << " tests passed" << std::endl;
+    return failed == 0 ? 0 : 1;
+}